@@ -1,85 +0,0 @@
-#include <stdio.h>
-#include <stdlib.h>
-
-/**
- * Given a file path imagepath, read the data in that bitmapped image
- * and return the raw bytes of color in the data pointer.
- * The width and height of the image are returned in the weight and height pointers,
- * respectively.
- *
- * usage:
- *
- * unsigned char* imageData;
- * unsigned int width, height;
- * loadARGB_BMP("mytexture.bmp", &imageData, &width, &height);
- *
- * Modified from https://github.com/opengl-tutorials/ogl.
- */
-void loadARGB_BMP(const char* imagepath, unsigned char** data, unsigned int* width, unsigned int* height) {
-
-    printf("Reading image %s\n", imagepath);
-
-    // Data read from the header of the BMP file
-    unsigned char header[54];
-    unsigned int dataPos;
-    unsigned int imageSize;
-    // Actual RGBA data
-
-    // Open the file
-    FILE * file = fopen(imagepath,"rb");
-    if (!file){
-        printf("%s could not be opened. Are you in the right directory?\n", imagepath);
-        getchar();
-        return;
-    }
-
-    // Read the header, i.e. the 54 first bytes
-
-    // If less than 54 bytes are read, problem
-    if ( fread(header, 1, 54, file)!=54 ){
-        printf("Not a correct BMP file1\n");
-        fclose(file);
-        return;
-    }
-
-    // Read the information about the image
-    dataPos    = *(int*)&(header[0x0A]);
-    imageSize  = *(int*)&(header[0x22]);
-    *width      = *(int*)&(header[0x12]);
-    *height     = *(int*)&(header[0x16]);
-    // A BMP files always begins with "BM"
-    if ( header[0]!='B' || header[1]!='M' ){
-        printf("Not a correct BMP file2\n");
-        fclose(file);
-        return;
-    }
-    // Make sure this is a 32bpp file
-    if ( *(int*)&(header[0x1E])!=3  ) {
-        printf("Not a correct BMP file3\n");
-        fclose(file);
-        return;
-    }
-    // fprintf(stderr, "header[0x1c]: %d\n", *(int*)&(header[0x1c]));
-    // if ( *(int*)&(header[0x1C])!=32 ) {
-    //     printf("Not a correct BMP file4\n");
-    //     fclose(file);
-    //     return;
-    // }
-
-    // Some BMP files are misformatted, guess missing information
-    if (imageSize==0)    imageSize=(*width)* (*height)*4; // 4 : one byte for each Red, Green, Blue, Alpha component
-    if (dataPos==0)      dataPos=54; // The BMP header is done that way
-
-    // Create a buffer
-    *data = new unsigned char [imageSize];
-
-    if (dataPos != 54) {
-        fread(header, 1, dataPos - 54, file);
-    }
-
-    // Read the actual data from the file into the buffer
-    fread(*data,1,imageSize,file);
-
-    // Everything is in memory now, the file can be closed.
-    fclose (file);
-}
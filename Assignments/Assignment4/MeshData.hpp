@@ -0,0 +1,83 @@
+// MeshData.hpp the vertex record TexturedMesh parses PLYs into, and the sidecar tags
+// its cooked forms carry. Nothing here needs GL, so the tools and benchmarks share it.
+#ifndef MESHDATA_HPP
+#define MESHDATA_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+#include "../Common/PLYReader.hpp"
+#include "../Common/VertexPacking.hpp"
+#include "../Common/MeshChunks.hpp"
+
+struct VertexData
+{
+    float x, y, z;         // Position is mandatory
+    float nx, ny, nz;      // Normal vector (optional)
+    unsigned char r, g, b; // Color (optional)
+    float u, v;            // Texture coordinates (optional)
+
+    VertexData() : x(0), y(0), z(0), nx(0), ny(0), nz(0), r(255), g(255), b(255), u(0), v(0) {}
+};
+
+// Tags .meshbin caches holding packed position + UV vertices, change it whenever the packing changes.
+// The position format goes in bits 4-7 of the tag.
+const uint32_t PACKED_LAYOUT_TAG = 2;
+// Set in the cache tag when the cooked buffers went through optimizeMesh
+const uint32_t MESH_OPTIMIZED_TAG = 0x100;
+// Set in the cache tag when meshes too large for 16-bit indices are split
+const uint32_t MESH_SPLIT_TAG = 0x200;
+// Set in the cache tag when the index buffer holds a LOD chain
+const uint32_t MESH_LODS_TAG = 0x400;
+// Set in the cache tag when the mesh was cut into meshlets
+const uint32_t MESH_MESHLETS_TAG = 0x800;
+// Set in the cache tag when duplicate vertices were welded
+const uint32_t MESH_WELDED_TAG = 0x1000;
+// Tags spatial chunks, whose positions stay 32-bit floats as each chunk is loaded on its own
+const uint32_t CHUNK_LAYOUT_TAG = PACKED_LAYOUT_TAG | (POSITION_FLOAT32 << 4);
+
+// Maps the PLY properties onto the fields of VertexData
+inline PLYVertexLayout vertexDataLayout()
+{
+    PLYVertexLayout layout = makePLYVertexLayout(sizeof(VertexData));
+    setPLYAttrib(layout, PLY_X, offsetof(VertexData, x));
+    setPLYAttrib(layout, PLY_Y, offsetof(VertexData, y));
+    setPLYAttrib(layout, PLY_Z, offsetof(VertexData, z));
+    setPLYAttrib(layout, PLY_NX, offsetof(VertexData, nx));
+    setPLYAttrib(layout, PLY_NY, offsetof(VertexData, ny));
+    setPLYAttrib(layout, PLY_NZ, offsetof(VertexData, nz));
+    setPLYAttrib(layout, PLY_RED, offsetof(VertexData, r), PLY_UCHAR);
+    setPLYAttrib(layout, PLY_GREEN, offsetof(VertexData, g), PLY_UCHAR);
+    setPLYAttrib(layout, PLY_BLUE, offsetof(VertexData, b), PLY_UCHAR);
+    setPLYAttrib(layout, PLY_U, offsetof(VertexData, u));
+    setPLYAttrib(layout, PLY_V, offsetof(VertexData, v));
+    return layout;
+}
+
+// Reads the whole PLY. Triangles go into indices three at a time; quads and n-gons are fan triangulated
+inline void readPLYFile(PLYChunkedReader &reader, std::vector<VertexData> &vertices, std::vector<uint32_t> &indices)
+{
+    indices.clear();
+    reader.read(vertexDataLayout(), vertices, [&indices](const uint32_t *polygon, uint32_t count)
+    {
+        appendFanTriangles(indices, polygon, count);
+    });
+}
+
+// Packed layout of the spatial chunks: float position and UV
+inline PackedVertexLayout chunkVertexLayout()
+{
+    return makePackedVertexLayout(POSITION_FLOAT32, true, false);
+}
+
+// Partitions the PLY reader has open into the spatial chunks TexturedMesh pages in
+inline bool partitionVertexData(const std::string &plyPath, PLYChunkedReader &reader,
+                                size_t chunkTriangles = MESH_CHUNK_TRIANGLES)
+{
+    return partitionMesh<VertexData>(plyPath, reader, vertexDataLayout(), offsetof(VertexData, x), offsetof(VertexData, u),
+                                     chunkVertexLayout(), CHUNK_LAYOUT_TAG, chunkTriangles);
+}
+
+#endif
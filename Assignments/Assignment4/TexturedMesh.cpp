@@ -10,6 +10,23 @@
 #include <sstream>
 #include <cctype> 
 #include <algorithm>
+#include <stddef.h>
+#include <memory>
+
+#include "../Common/PLYReader.hpp"
+#include "../Common/MeshCache.hpp"
+#include "../Common/MeshPack.hpp"
+#include "../Common/MeshOptimize.hpp"
+#include "../Common/MeshWeld.hpp"
+#include "../Common/VertexPacking.hpp"
+#include "../Common/IndexBuffer.hpp"
+#include "../Common/Meshlets.hpp"
+#include "../Common/StreamingUpload.hpp"
+#include "../Common/MeshChunks.hpp"
+#include "../Common/ChunkPager.hpp"
+#include "../Common/AsyncIO.hpp"
+#include "../Common/TextureLoader.hpp"
+#include "MeshData.hpp"
 
 // Include GLM
 #include <glm/glm.hpp>
@@ -18,21 +35,31 @@
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
-struct VertexData
+// How a TexturedMesh is prepared for the GPU
+struct MeshLoadOptions
 {
-    float x, y, z;         // Position is mandatory
-    float nx, ny, nz;      // Normal vector (optional)
-    unsigned char r, g, b; // Color (optional)
-    float u, v;            // Texture coordinates (optional)
-
-    VertexData() : x(0), y(0), z(0), nx(0), ny(0), nz(0), r(255), g(255), b(255), u(0), v(0) {}
-};
-
-struct TriData
-{
-    int v1, v2, v3; // Indices for the triangle's vertices
-
-    TriData(int vertex1, int vertex2, int vertex3) : v1(vertex1), v2(vertex2), v3(vertex3) {}
+    bool optimize;                       // Run the vertex cache / overdraw / fetch pass after loading
+    PackedPositionFormat positionFormat; // Position encoding in the vertex buffer
+    bool splitLargeMeshes;               // Split meshes over 65536 vertices so they can use 16-bit indices too
+    bool buildLods;                      // Simplify into a LOD chain picked by screen-space error when drawing
+    bool buildMeshlets;                  // Cut into meshlets that are culled against the view frustum when drawing
+    bool cullBackFaces;                  // Also skip meshlets facing away from the camera. Only for closed meshes, or
+                                         // ones only ever seen from the front, as GL_CULL_FACE is not enabled
+    size_t streamAboveVertices;          // Uncooked meshes with more vertices are parsed and uploaded chunk by chunk
+                                         // instead, skipping the whole-mesh passes above; 0 never streams
+    size_t pageBudgetBytes;              // Meshes that would stream and have been partitioned by Tools/MeshCook are paged
+                                         // in around the camera within this many bytes instead; 0 never pages
+    float weldEpsilon;                   // Merge vertices whose position and UV agree to within this, before the passes
+                                         // above; 0 merges exact copies only, negative never welds
+    bool compressCache;                  // Cook into a compressed .meshz rather than a .meshbin: smaller on disk, and
+                                         // decoded as it uploads instead of mapped as is
+
+    MeshLoadOptions(bool optimize = false, PackedPositionFormat positionFormat = POSITION_UNORM16, bool splitLargeMeshes = false,
+                    bool buildLods = false, bool buildMeshlets = false, bool cullBackFaces = false, size_t streamAboveVertices = 0,
+                    size_t pageBudgetBytes = 0, float weldEpsilon = -1.0f, bool compressCache = false)
+        : optimize(optimize), positionFormat(positionFormat), splitLargeMeshes(splitLargeMeshes), buildLods(buildLods),
+          buildMeshlets(buildMeshlets), cullBackFaces(cullBackFaces), streamAboveVertices(streamAboveVertices),
+          pageBudgetBytes(pageBudgetBytes), weldEpsilon(weldEpsilon), compressCache(compressCache) {}
 };
 
 class Camera
@@ -80,244 +107,410 @@ public:
 class TexturedMesh
 {
 private:
-    GLuint vertexBufferID; // An integer ID for the VBO to store the vertex positions.
-    GLuint uvBufferID; // An integer ID for the VBO to store the texture coordinates.
+    GLuint vertexBufferID; // An integer ID for the VBO to store the packed vertex positions and texture coordinates.
     GLuint indexBufferID; // An integer ID for the VBO to store the face’s vertex indices
     GLuint textureID; // An integer ID for the Texture Object created to store the bitmap image.
     GLuint vaoID; // An integer ID for the VAO used to render the texture mesh.
     GLuint shaderProgramID; // An integer ID for the shader program created and linked to render the particular textured mesh.
-    std::vector<VertexData> vertices;
-    std::vector<TriData> faces;
-
-    void readPLYFile(const std::string &filename, std::vector<VertexData> &vertices, std::vector<TriData> &faces)
+    GLsizei indexCount; // Number of indices in the index buffer.
+    GLenum indexType; // GL_UNSIGNED_SHORT when every index fits in 16 bits, GL_UNSIGNED_INT otherwise.
+    std::vector<SubMesh> subMeshes; // Index ranges drawn with their own base vertex, empty if the mesh is drawn at once.
+    MeshLodChain lodChain; // Index ranges of each level of detail, empty if only the full mesh exists.
+    std::vector<Meshlet> meshlets; // Culling clusters of every level, in index buffer order; empty to draw without culling.
+    bool cullBackFaces; // Whether meshlets facing away from the camera are skipped.
+    std::vector<GLsizei> drawCounts; // Per-frame multi-draw arguments, kept to avoid reallocating them.
+    std::vector<const void *> drawOffsets;
+    std::vector<GLint> drawBaseVertices;
+    PackedVertexLayout packedLayout; // Layout of the vertices in vertexBufferID.
+    VertexDequantize dequantize; // Scale and offset the vertex shader applies to the packed attributes.
+    std::shared_ptr<MeshChunkPager> pager; // Spatial chunks paged around the camera, instead of the buffers above; may be null.
+
+    // Points attributes 0 (position) and 1 (uv) at the packed vertex buffer bound to GL_ARRAY_BUFFER
+    static void setVertexAttributes(const PackedVertexLayout &packedLayout)
     {
-        std::ifstream file(filename);
-        if (!file.is_open())
+        // Vertex Positions
+        glEnableVertexAttribArray(0);
+        if (packedLayout.positionFormat == POSITION_FLOAT32)
         {
-            throw std::runtime_error("Could not open file: " + filename);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, packedLayout.stride, (void *)(size_t)packedLayout.positionOffset);
         }
-
-        std::string line;
-        bool endHeader = false;
-        bool hasNormal = false;
-        bool hasColor = false;
-        bool hasTexture = false;
-
-        size_t numVertices = 0;
-        size_t numFaces = 0;
-
-        while (std::getline(file, line) && !endHeader)
+        else if (packedLayout.positionFormat == POSITION_HALF)
         {
-            std::istringstream iss(line);
-            std::string token;
-            iss >> token;
-            if (token == "element")
-            {
-                iss >> token;
-                if (token == "vertex")
-                {
-                    iss >> numVertices;
-                }
-                else if (token == "face")
-                {
-                    iss >> numFaces;
-                }
-            }
-            else if (token == "property")
-            {
-                iss >> token; // Skip the data type token
-                iss >> token;
-                if (token == "nx" || token == "ny" || token == "nz")
-                {
-                    hasNormal = true;
-                }
-                else if (token == "red" || token == "green" || token == "blue")
-                {
-                    hasColor = true;
-                }
-                else if (token == "u" || token == "v")
-                {
-                    hasTexture = true;
-                }
-            }
-            else if (token == "end_header")
-            {
-                endHeader = true;
-            }
+            glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, packedLayout.stride, (void *)(size_t)packedLayout.positionOffset);
+        }
+        else
+        {
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, packedLayout.stride, (void *)(size_t)packedLayout.positionOffset);
         }
 
-        vertices.reserve(numVertices);
-        for (size_t i = 0; i < numVertices; ++i)
+        // Texture Coordinates
+        glEnableVertexAttribArray(1);
+        if (packedLayout.positionFormat == POSITION_FLOAT32)
         {
-            std::getline(file, line);
-            std::istringstream vertexLine(line);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, packedLayout.stride, (void *)(size_t)packedLayout.uvOffset);
+        }
+        else
+        {
+            glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, packedLayout.stride, (void *)(size_t)packedLayout.uvOffset);
+        }
+    }
 
-            VertexData vertex;
-            vertexLine >> vertex.x >> vertex.y >> vertex.z;
+    // Takes the draw tables of mesh and creates its buffers at full size, still empty.
+    // Leaves the VAO bound.
+    void createBuffers(const MeshBuffers &mesh)
+    {
+        dequantize = mesh.dequantize;
+        subMeshes.assign(mesh.subMeshes, mesh.subMeshes + mesh.subMeshCount);
+        lodChain.lods.assign(mesh.lods, mesh.lods + mesh.lodCount);
+        meshlets.assign(mesh.meshlets, mesh.meshlets + mesh.meshletCount);
+        memcpy(lodChain.boundingSphere, mesh.boundingSphere, sizeof(lodChain.boundingSphere));
 
-            if (hasNormal)
-            {
-                vertexLine >> vertex.nx >> vertex.ny >> vertex.nz;
-            }
-            if (hasColor)
-            {
-                int r, g, b;
-                vertexLine >> r >> g >> b;
-                vertex.r = static_cast<unsigned char>(r);
-                vertex.g = static_cast<unsigned char>(g);
-                vertex.b = static_cast<unsigned char>(b);
-            }
-            if (hasTexture)
-            {
-                vertexLine >> vertex.u >> vertex.v;
-            }
+        // Generate and bind the VAO
+        glGenVertexArrays(1, &vaoID);
+        glBindVertexArray(vaoID);
 
-            vertices.push_back(vertex);
-        }
+        // Positions and texture coordinates share one interleaved buffer, uploaded once
+        glGenBuffers(1, &vertexBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+        glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * packedLayout.stride, NULL, GL_STATIC_DRAW);
+        std::cout << "Vertex buffer size: " << mesh.vertexCount * packedLayout.stride << " bytes" << std::endl;
 
-        faces.reserve(numFaces);
-        for (size_t i = 0; i < numFaces; ++i)
-        {
-            std::getline(file, line);
-            std::istringstream faceLine(line);
+        setVertexAttributes(packedLayout);
 
-            int verticesCount;
-            faceLine >> verticesCount;
-            if (verticesCount != 3)
-            {
-                std::cerr << "Non-triangular face detected." << std::endl;
-                continue;
-            }
+        // Indices for drawing triangles
+        glGenBuffers(1, &indexBufferID);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexCount * mesh.indexSize, NULL, GL_STATIC_DRAW);
+        std::cout << "Index buffer size: " << mesh.indexCount * mesh.indexSize << " bytes" << std::endl;
+        indexCount = (GLsizei)mesh.indexCount;
+        indexType = mesh.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
 
-            TriData tri(0, 0, 0);
-            faceLine >> tri.v1 >> tri.v2 >> tri.v3;
-            faces.push_back(tri);
-        }
+    // The vertex blob is laid out as packedLayout, i.e. what packVertices produced
+    void loadBuffers(const MeshBuffers &mesh)
+    {
+        createBuffers(mesh);
+
+        // Buffers larger than a staging chunk are filled a chunk at a time, so reading the next
+        // chunk (from the mapped cache on a warm start) overlaps with the GPU copying the one before
+        StagingRing &ring = StagingRing::shared();
+        uploadChunked(ring, vertexBufferID, mesh.vertexData, mesh.vertexCount * packedLayout.stride);
+        uploadChunked(ring, indexBufferID, mesh.indexData, mesh.indexCount * mesh.indexSize);
 
-        file.close();
+        // Unbind the VAO
+        glBindVertexArray(0);
     }
-    void loadARGB_BMP(const char *imagepath, unsigned char **data, unsigned int *width, unsigned int *height)
+
+    // Decodes the compressed streams of a .meshz on the staging worker straight into the
+    // staging ring, a whole number of codec blocks per chunk, while this thread copies
+    // the chunk before into the GPU buffers. The decoded mesh is never held whole. A pack
+    // whose buffers each fit in one chunk is decoded here and uploaded directly.
+    void loadPack(const MeshPack &pack, const std::string &plyPath)
     {
+        const int VERTEX_STREAM = 0, INDEX_STREAM = 1;
+        createBuffers(pack);
 
-        printf("Reading image %s\n", imagepath);
+        StagingRing &ring = StagingRing::shared();
+        size_t vertexBytes = pack.vertexCount * packedLayout.stride;
+        size_t indexBytes = pack.indexCount * pack.indexSize;
+        if (std::max(vertexBytes, indexBytes) <= ring.chunkSize())
+        {
+            std::vector<unsigned char> decoded(std::max<size_t>(std::max(vertexBytes, indexBytes), 1));
+            VertexStreamDecoder vertexDecoder(pack.vertexStream, pack.vertexStreamSize, pack.vertexCount, packedLayout.stride);
+            if (!vertexDecoder.decode(decoded.data(), pack.vertexCount))
+            {
+                throw std::runtime_error("Corrupt vertex stream in " + meshPackPath(plyPath));
+            }
+            glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes, decoded.data());
 
-        // Data read from the header of the BMP file
-        unsigned char header[54];
-        unsigned int dataPos;
-        unsigned int imageSize;
-        // Actual RGBA data
+            IndexStreamDecoder indexDecoder(pack.indexStream, pack.indexStreamSize, pack.indexCount);
+            if (!indexDecoder.decode(decoded.data(), pack.indexCount, pack.indexSize))
+            {
+                throw std::runtime_error("Corrupt index stream in " + meshPackPath(plyPath));
+            }
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indexBytes, decoded.data());
 
-        // Open the file
-        FILE *file = fopen(imagepath, "rb");
-        if (!file)
-        {
-            printf("%s could not be opened. Are you in the right directory?\n", imagepath);
-            getchar();
+            glBindVertexArray(0);
             return;
         }
 
-        // Read the header, i.e. the 54 first bytes
+        streamUpload(ring, [&](StagingRing &ring)
+        {
+            VertexStreamDecoder vertexDecoder(pack.vertexStream, pack.vertexStreamSize, pack.vertexCount, packedLayout.stride);
+            size_t chunkVertices = ring.chunkSize() / packedLayout.stride / MESH_CODEC_BLOCK * MESH_CODEC_BLOCK;
+            for (size_t first = 0; first < pack.vertexCount; first += chunkVertices)
+            {
+                size_t slot, count = std::min(chunkVertices, pack.vertexCount - first);
+                if (!vertexDecoder.decode(ring.acquire(slot), count))
+                {
+                    throw std::runtime_error("Corrupt vertex stream in " + meshPackPath(plyPath));
+                }
+                ring.publish(slot, VERTEX_STREAM, first * packedLayout.stride, count * packedLayout.stride);
+            }
 
-        // If less than 54 bytes are read, problem
-        if (fread(header, 1, 54, file) != 54)
+            IndexStreamDecoder indexDecoder(pack.indexStream, pack.indexStreamSize, pack.indexCount);
+            size_t chunkIndices = ring.chunkSize() / pack.indexSize / MESH_CODEC_BLOCK * MESH_CODEC_BLOCK;
+            for (size_t first = 0; first < pack.indexCount; first += chunkIndices)
+            {
+                size_t slot, count = std::min(chunkIndices, pack.indexCount - first);
+                if (!indexDecoder.decode(ring.acquire(slot), count, pack.indexSize))
+                {
+                    throw std::runtime_error("Corrupt index stream in " + meshPackPath(plyPath));
+                }
+                ring.publish(slot, INDEX_STREAM, first * pack.indexSize, count * pack.indexSize);
+            }
+        },
+            [&](int stream, size_t, size_t) -> GLuint
         {
-            printf("Not a correct BMP file1\n");
-            fclose(file);
-            return;
-        }
+            return stream == VERTEX_STREAM ? vertexBufferID : indexBufferID;
+        });
+
+        glBindVertexArray(0);
+    }
 
-        // Read the information about the image
-        dataPos = *(int *)&(header[0x0A]);
-        imageSize = *(int *)&(header[0x22]);
-        *width = *(int *)&(header[0x12]);
-        *height = *(int *)&(header[0x16]);
-        // A BMP files always begins with "BM"
-        if (header[0] != 'B' || header[1] != 'M')
+    // For float positions and UVs, which the shader takes as they are
+    void setIdentityDequantize()
+    {
+        for (int k = 0; k < 3; ++k)
         {
-            printf("Not a correct BMP file2\n");
-            fclose(file);
-            return;
+            dequantize.positionScale[k] = 1.0f;
+            dequantize.positionOffset[k] = 0.0f;
         }
-        // Make sure this is a 32bpp file
-        if (*(int *)&(header[0x1E]) != 3)
+        for (int k = 0; k < 2; ++k)
         {
-            printf("Not a correct BMP file3\n");
-            fclose(file);
-            return;
+            dequantize.uvScale[k] = 1.0f;
+            dequantize.uvOffset[k] = 0.0f;
         }
+    }
 
-        // Some BMP files are misformatted, guess missing information
-        if (imageSize == 0)
-            imageSize = (*width) * (*height) * 4; // 4 : one byte for each Red, Green, Blue, Alpha component
-        if (dataPos == 0)
-            dataPos = 54; // The BMP header is done that way
-
-        // Create a buffer
-        *data = new unsigned char[imageSize];
-
-        if (dataPos != 54)
+    // Pages the spatial chunks Tools/MeshCook partitioned a mesh too large to keep whole
+    // into. Chunk positions stay 32-bit floats, as each chunk is loaded on its own.
+    // Returns false if there are no chunks for the current contents of the PLY.
+    bool loadChunks(const std::string &plyPath, size_t budgetBytes)
+    {
+        PackedVertexLayout layout = chunkVertexLayout();
+        std::vector<MeshChunkInfo> chunks;
+        float boundingSphere[4];
+        if (!loadMeshChunks(plyPath, CHUNK_LAYOUT_TAG, layout.stride, chunks, boundingSphere))
         {
-            fread(header, 1, dataPos - 54, file);
+            return false;
         }
-
-        // Read the actual data from the file into the buffer
-        fread(*data, 1, imageSize, file);
-
-        // Everything is in memory now, the file can be closed.
-        fclose(file);
+        packedLayout = layout;
+        setIdentityDequantize();
+        memcpy(lodChain.boundingSphere, boundingSphere, sizeof(boundingSphere));
+        std::cout << plyPath << ": " << chunks.size() << " chunks paged within " << budgetBytes << " bytes" << std::endl;
+        // The pager is shared by copies of this mesh, so it keeps its own copy of the layout
+        pager.reset(new MeshChunkPager(meshChunksDirectory(plyPath), chunks, packedLayout.stride, budgetBytes,
+                                       [layout]() { setVertexAttributes(layout); }));
+        return true;
     }
 
-    
-    void loadBuffers()
+    // Parses the PLY a staging chunk at a time on a worker thread and packs each chunk straight
+    // into the mapped staging ring, while this thread copies the chunk before it into the GPU
+    // buffers. Neither the parsed mesh nor the packed buffers are ever held whole on the CPU.
+    // Quantizing needs the bounds of the whole mesh, so streamed positions stay 32-bit floats.
+    void streamBuffers(PLYChunkedReader &reader)
     {
-        // Generate and bind the VAO
+        const int VERTEX_STREAM = 0, INDEX_STREAM = 1;
+        packedLayout = makePackedVertexLayout(POSITION_FLOAT32, true, false);
+        size_t vertexCount = reader.elementCount("vertex");
+        size_t indexSize = chooseIndexSize(vertexCount);
+
         glGenVertexArrays(1, &vaoID);
         glBindVertexArray(vaoID);
 
-        // Load data into vertex buffers
         glGenBuffers(1, &vertexBufferID);
         glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexData), &vertices[0], GL_STATIC_DRAW);
-        std::cout << "Vertex buffer size: " << vertices.size() * sizeof(VertexData) << " bytes" << std::endl;
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * packedLayout.stride, NULL, GL_STATIC_DRAW);
+        setVertexAttributes(packedLayout);
 
-        // Set the vertex attribute pointers
-        // Vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void *)0);
+        // Sized for a triangle mesh; polygons fan out into more triangles and grow it
+        size_t indexCapacity = std::max<size_t>(reader.elementCount("face") * 3 * indexSize, 4);
+        glGenBuffers(1, &indexBufferID);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, indexBufferID);
+        glBufferData(GL_COPY_WRITE_BUFFER, indexCapacity, NULL, GL_STATIC_DRAW);
 
-        // Texture Coordinates
-        glGenBuffers(1, &uvBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexData), &vertices[0].u, GL_STATIC_DRAW);
-        std::cout << "Texture coordinate buffer size: " << vertices.size() * sizeof(VertexData) << " bytes" << std::endl;
+        setIdentityDequantize();
 
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void *)offsetof(VertexData, u));
+        StagingRing &ring = StagingRing::shared();
+        size_t indexBytes = 0;
+        streamUpload(ring, [&](StagingRing &ring)
+        {
+            std::vector<unsigned char> packed;
+            unsigned char *indexChunk = NULL;
+            size_t indexSlot = 0, indexChunkBytes = 0;
+            reader.decode<VertexData>(vertexDataLayout(), ring.chunkSize() / packedLayout.stride,
+                [&](const VertexData *vertices, size_t first, size_t count)
+            {
+                packVertices(packedLayout, count, sizeof(VertexData), &vertices[0].x, &vertices[0].u, NULL, packed, dequantize);
+                size_t slot;
+                memcpy(ring.acquire(slot), packed.data(), packed.size());
+                ring.publish(slot, VERTEX_STREAM, first * packedLayout.stride, packed.size());
+            },
+                [&](const uint32_t *polygon, uint32_t count)
+            {
+                // Quads and n-gons are fan triangulated (v0 v1 v2, v0 v2 v3, ...)
+                for (uint32_t j = 2; j < count; ++j)
+                {
+                    if (!indexChunk)
+                    {
+                        indexChunk = ring.acquire(indexSlot);
+                    }
+                    uint32_t triangle[3] = {polygon[0], polygon[j - 1], polygon[j]};
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        uint16_t shortIndex = (uint16_t)triangle[k];
+                        memcpy(indexChunk + indexChunkBytes, indexSize == 2 ? (void *)&shortIndex : (void *)&triangle[k], indexSize);
+                        indexChunkBytes += indexSize;
+                    }
+                    if (indexChunkBytes + 3 * indexSize > ring.chunkSize())
+                    {
+                        ring.publish(indexSlot, INDEX_STREAM, indexBytes, indexChunkBytes);
+                        indexBytes += indexChunkBytes;
+                        indexChunk = NULL;
+                        indexChunkBytes = 0;
+                    }
+                }
+            });
+            if (indexChunk)
+            {
+                ring.publish(indexSlot, INDEX_STREAM, indexBytes, indexChunkBytes);
+                indexBytes += indexChunkBytes;
+            }
+        },
+            [&](int stream, size_t offset, size_t size) -> GLuint
+        {
+            if (stream == VERTEX_STREAM)
+            {
+                return vertexBufferID;
+            }
+            if (offset + size > indexCapacity)
+            {
+                // Move what has been copied so far into a buffer twice the size
+                GLuint grown;
+                size_t capacity = std::max(indexCapacity * 2, offset + size);
+                glGenBuffers(1, &grown);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+                glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+                glBindBuffer(GL_COPY_READ_BUFFER, indexBufferID);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, offset);
+                glDeleteBuffers(1, &indexBufferID);
+                indexBufferID = grown;
+                indexCapacity = capacity;
+            }
+            return indexBufferID;
+        });
 
-        // Indices for drawing triangles
-        glGenBuffers(1, &indexBufferID);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, faces.size() * sizeof(TriData), &faces[0], GL_STATIC_DRAW);
-        std::cout << "Index buffer size: " << faces.size() * sizeof(TriData) << " bytes" << std::endl;
+        std::cout << "Vertex buffer size: " << vertexCount * packedLayout.stride << " bytes" << std::endl;
+        std::cout << "Index buffer size: " << indexBytes << " bytes" << std::endl;
+        indexCount = (GLsizei)(indexBytes / indexSize);
+        indexType = indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        memset(lodChain.boundingSphere, 0, sizeof(lodChain.boundingSphere));
 
-        // Unbind the VAO
         glBindVertexArray(0);
     }
 
-    void loadTexture(const std::string &texturePath)
+    // Parses the whole PLY, runs the passes options ask for and cooks the result into
+    // the .meshbin or, with options.compressCache, the .meshz sidecar for next time before
+    // uploading it
+    void cookBuffers(PLYChunkedReader &reader, const std::string &plyPath, const MeshLoadOptions &options, uint32_t cacheTag)
     {
-        // Generate texture ID and load texture data
-        unsigned char *imageData;
-        unsigned int width, height;
-        loadARGB_BMP(texturePath.c_str(), &imageData, &width, &height);
+        std::vector<VertexData> vertices;
+        std::vector<uint32_t> faces;
+        readPLYFile(reader, vertices, faces);
+        if (options.weldEpsilon >= 0.0f)
+        {
+            // Only position and UV reach the GPU, so corners that differ in nothing else become one vertex
+            std::vector<WeldAttribute> attributes = {{offsetof(VertexData, x), 3}, {offsetof(VertexData, u), 2}};
+            weldMesh(vertices, faces.data(), faces.size(), attributes, options.weldEpsilon, plyPath.c_str());
+        }
+        if (options.optimize)
+        {
+            // Reorder for the post-transform cache, overdraw and vertex fetch
+            optimizeMesh(vertices, faces.data(), faces.size(), offsetof(VertexData, x), plyPath.c_str());
+        }
+        MeshBuffers mesh;
+        const uint32_t *indices = faces.data();
+        mesh.indexCount = faces.size();
+        mesh.indexSize = chooseIndexSize(vertices.size());
+        bool split = mesh.indexSize == 4 && options.splitLargeMeshes;
+
+        // Coarser levels go after the full mesh in the same index buffer. A split mesh
+        // is drawn in pieces and keeps only the full level.
+        std::vector<uint32_t> lodIndices;
+        if (options.buildLods && !split && !vertices.empty())
+        {
+            buildLodChain(&vertices[0].x, &vertices[0].u, sizeof(VertexData), vertices.size(), indices, mesh.indexCount,
+                          lodIndices, lodChain, options.optimize);
+            indices = lodIndices.data();
+            mesh.indexCount = lodIndices.size();
+            mesh.lods = lodChain.lods.data();
+            mesh.lodCount = lodChain.lods.size();
+            memcpy(mesh.boundingSphere, lodChain.boundingSphere, sizeof(mesh.boundingSphere));
+        }
 
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, imageData);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        // Meshlets never cross from one level of detail into the next
+        if (options.buildMeshlets && !vertices.empty())
+        {
+            if (lodChain.lods.empty())
+            {
+                buildMeshlets(&vertices[0].x, sizeof(VertexData), vertices.size(), indices, 0, mesh.indexCount, meshlets);
+            }
+            for (const MeshLod &lod : lodChain.lods)
+            {
+                buildMeshlets(&vertices[0].x, sizeof(VertexData), vertices.size(), indices, lod.firstIndex, lod.indexCount, meshlets);
+            }
+        }
 
-        glBindTexture(GL_TEXTURE_2D, 0);
-        delete[] imageData;
+        std::vector<unsigned char> packed;
+        packVertices(packedLayout, vertices.size(), sizeof(VertexData),
+                     vertices.empty() ? NULL : &vertices[0].x, vertices.empty() ? NULL : &vertices[0].u, NULL,
+                     packed, mesh.dequantize);
+        // Everything from here on reads the packed copy
+        size_t vertexCount = vertices.size();
+        std::vector<VertexData>().swap(vertices);
+
+        // Use 16-bit indices whenever the mesh allows it, splitting it first if asked to
+        std::vector<uint32_t> splitIndices;
+        if (split)
+        {
+            std::vector<unsigned char> splitVertices;
+            splitMesh(packed.data(), vertexCount, packedLayout.stride, indices, mesh.indexCount, SHORT_INDEX_LIMIT,
+                      splitVertices, splitIndices, subMeshes);
+            packed.swap(splitVertices);
+            indices = splitIndices.data();
+            mesh.indexSize = 2;
+            mesh.subMeshes = subMeshes.data();
+            mesh.subMeshCount = subMeshes.size();
+            assignMeshletSubMeshes(meshlets, subMeshes.data(), subMeshes.size());
+        }
+        mesh.meshlets = meshlets.data();
+        mesh.meshletCount = meshlets.size();
+        std::vector<unsigned char> indexData;
+        packIndices(indices, mesh.indexCount, mesh.indexSize, indexData);
+        std::vector<uint32_t>().swap(faces);
+        std::vector<uint32_t>().swap(lodIndices);
+        std::vector<uint32_t>().swap(splitIndices);
+        mesh.vertexData = packed.data();
+        mesh.vertexCount = packed.size() / packedLayout.stride;
+        mesh.vertexStride = packedLayout.stride;
+        mesh.indexData = indexData.data();
+
+        // Stamped with the hash of the bytes just parsed, so the PLY is not read again
+        if (options.compressCache ? !writeMeshPack(plyPath, cacheTag, mesh, &reader.getFile())
+                                  : !writeMeshCache(plyPath, cacheTag, mesh, &reader.getFile()))
+        {
+            std::cerr << "Could not write mesh cache for " << plyPath << std::endl;
+        }
+        loadBuffers(mesh);
+        // The packed buffers go when this scope ends; only the GPU copy is kept
+    }
+
+    void loadTexture(const std::string &texturePath)
+    {
+        // Decoded and mipmapped in the background; a placeholder is drawn until it is uploaded
+        textureID = TextureLoader::instance().request(texturePath);
     }
 
     void loadShaders()
@@ -335,11 +528,16 @@ private:
 		out vec2 uv_out;\n\
 		// Values that stay constant for the whole mesh.\n\
 		uniform mat4 MVP;\n\
+		// Undo the vertex quantization.\n\
+		uniform vec3 positionScale;\n\
+		uniform vec3 positionOffset;\n\
+		uniform vec2 uvScale;\n\
+		uniform vec2 uvOffset;\n\
 		void main(){ \n\
 			// Output position of the vertex, in clip space : MVP * position\n\
-			gl_Position =  MVP * vec4(vertexPosition,1);\n\
+			gl_Position =  MVP * vec4(vertexPosition * positionScale + positionOffset,1);\n\
 			// The color will be interpolated to produce the color of each fragment\n\
-			uv_out = uv;\n\
+			uv_out = uv * uvScale + uvOffset;\n\
 		}\n";
 
         // Read the Fragment Shader code from the file
@@ -372,10 +570,54 @@ private:
     }
 
 public:
-    TexturedMesh(const std::string &plyPath, const std::string &texturePath)
+    TexturedMesh(const std::string &plyPath, const std::string &texturePath, const MeshLoadOptions &options = MeshLoadOptions())
     {
-        readPLYFile(plyPath, vertices, faces);
-        loadBuffers();
+        // The shader only reads position and UV, so only those go to the GPU
+        packedLayout = makePackedVertexLayout(options.positionFormat, true, false);
+        uint32_t cacheTag = PACKED_LAYOUT_TAG | (options.positionFormat << 4) | (options.optimize ? MESH_OPTIMIZED_TAG : 0) |
+                            (options.splitLargeMeshes ? MESH_SPLIT_TAG : 0) | (options.buildLods ? MESH_LODS_TAG : 0) |
+                            (options.buildMeshlets ? MESH_MESHLETS_TAG : 0) | (options.weldEpsilon >= 0.0f ? MESH_WELDED_TAG : 0);
+        cullBackFaces = options.cullBackFaces;
+
+        // Warm start: the cooked sidecar is mapped and uploaded as is, no parsing
+        CookedMesh cooked;
+        MeshPack pack;
+        if (loadMeshCache(plyPath, cacheTag, packedLayout.stride, cooked))
+        {
+            loadBuffers(cooked);
+        }
+        else if (openMeshPack(plyPath, cacheTag, packedLayout.stride, pack))
+        {
+            // A compressed .meshz, shipped without the PLY or cooked by an earlier cold start,
+            // is decoded as it uploads
+            loadPack(pack, plyPath);
+        }
+        else if (options.streamAboveVertices > 0 && options.pageBudgetBytes > 0 &&
+                 loadChunks(plyPath, options.pageBudgetBytes))
+        {
+            // Partitioned by Tools/MeshCook: only the chunks around the camera are loaded
+        }
+        else
+        {
+            // Cold start: the PLY is opened once, its header decides how it is loaded, and
+            // whichever path that is decodes from the same mapping
+            PLYChunkedReader reader(plyPath);
+            bool tooLarge = options.streamAboveVertices > 0 && reader.elementCount("vertex") > options.streamAboveVertices;
+            if (tooLarge)
+            {
+                // Too large to hold whole: parse and upload in chunks, and parse again next time
+                if (options.pageBudgetBytes > 0)
+                {
+                    std::cout << plyPath << " has no current spatial chunks; run Tools/MeshCook on it to page it in" << std::endl;
+                }
+                streamBuffers(reader);
+            }
+            else
+            {
+                // Parse the PLY once and cook it for next time
+                cookBuffers(reader, plyPath, options, cacheTag);
+            }
+        }
         loadTexture(texturePath);
         loadShaders();
     }
@@ -384,14 +626,14 @@ public:
     {
         // Properly delete all the buffers and the texture
         glDeleteBuffers(1, &vertexBufferID);
-        glDeleteBuffers(1, &uvBufferID);
         glDeleteBuffers(1, &indexBufferID);
         glDeleteTextures(1, &textureID);
         glDeleteVertexArrays(1, &vaoID);
         glDeleteProgram(shaderProgramID);
     }
 
-    void draw(const glm::mat4 &MVP)
+    // lodPixelScale is projection[1][1] * viewport height / 2; zero always draws the full mesh
+    void draw(const glm::mat4 &MVP, float lodPixelScale = 0.0f)
     {
         // Use shader program
         glUseProgram(shaderProgramID);
@@ -405,9 +647,81 @@ public:
 
         // Set the MVP matrix for the shader
         glUniformMatrix4fv(glGetUniformLocation(shaderProgramID, "MVP"), 1, GL_FALSE, &MVP[0][0]);
+        glUniform3fv(glGetUniformLocation(shaderProgramID, "positionScale"), 1, dequantize.positionScale);
+        glUniform3fv(glGetUniformLocation(shaderProgramID, "positionOffset"), 1, dequantize.positionOffset);
+        glUniform2fv(glGetUniformLocation(shaderProgramID, "uvScale"), 1, dequantize.uvScale);
+        glUniform2fv(glGetUniformLocation(shaderProgramID, "uvOffset"), 1, dequantize.uvOffset);
 
-        // Draw the mesh
-        glDrawElements(GL_TRIANGLES, faces.size() * 3, GL_UNSIGNED_INT, 0);
+        if (pager)
+        {
+            // Bring in what the camera has moved towards, then draw what is resident and in view
+            pager->update(&MVP[0][0]);
+            pager->draw();
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glUseProgram(0);
+            return;
+        }
+
+        // Index range to draw: the level of detail picked for this distance, or the whole buffer
+        uint32_t first = 0, count = (uint32_t)indexCount;
+        if (!lodChain.lods.empty())
+        {
+            // Clip space w is the distance along the view axis for a perspective projection
+            const float *sphere = lodChain.boundingSphere;
+            glm::vec4 centre = MVP * glm::vec4(sphere[0], sphere[1], sphere[2], 1.0f);
+            const MeshLod &lod = lodChain.lods[selectLod(lodChain.lods.data(), lodChain.lods.size(), centre.w - sphere[3], lodPixelScale)];
+            first = lod.firstIndex;
+            count = lod.indexCount;
+        }
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+
+        if (!meshlets.empty())
+        {
+            // Submit only the meshlets of that range that can be seen, merging neighbours into one draw
+            MeshletCuller culler(&MVP[0][0]);
+            drawCounts.clear();
+            drawOffsets.clear();
+            drawBaseVertices.clear();
+            uint32_t previousEnd = 0;
+            std::vector<Meshlet>::const_iterator meshlet = std::lower_bound(meshlets.begin(), meshlets.end(), first,
+                [](const Meshlet &m, uint32_t index) { return m.firstIndex < index; });
+            for (; meshlet != meshlets.end() && meshlet->firstIndex < first + count; ++meshlet)
+            {
+                if (!culler.inFrustum(*meshlet) || (cullBackFaces && culler.backFacing(*meshlet)))
+                {
+                    continue;
+                }
+                if (!drawCounts.empty() && previousEnd == meshlet->firstIndex && drawBaseVertices.back() == (GLint)meshlet->baseVertex)
+                {
+                    drawCounts.back() += meshlet->indexCount;
+                }
+                else
+                {
+                    drawCounts.push_back(meshlet->indexCount);
+                    drawOffsets.push_back((const void *)(meshlet->firstIndex * indexSize));
+                    drawBaseVertices.push_back(meshlet->baseVertex);
+                }
+                previousEnd = meshlet->firstIndex + meshlet->indexCount;
+            }
+            if (!drawCounts.empty())
+            {
+                glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), indexType, (const void *const *)drawOffsets.data(),
+                                              (GLsizei)drawCounts.size(), drawBaseVertices.data());
+            }
+        }
+        else if (!subMeshes.empty())
+        {
+            // One call per sub-mesh if it had to be split for 16-bit indices
+            for (const SubMesh &subMesh : subMeshes)
+            {
+                glDrawElementsBaseVertex(GL_TRIANGLES, subMesh.indexCount, indexType,
+                                         (void *)(subMesh.firstIndex * indexSize), subMesh.baseVertex);
+            }
+        }
+        else
+        {
+            glDrawElements(GL_TRIANGLES, count, indexType, (void *)(first * indexSize));
+        }
 
         // Unbind everything
         glBindVertexArray(0);
@@ -416,36 +730,75 @@ public:
     }
 };
 
+// Whether the uncooked PLY at plyPath is parsed whole rather than streamed. Archive entries are
+// inflated whole whichever way they are parsed. A header that can't be read is left to the load.
+bool loadsWhole(const std::string &plyPath, size_t streamAboveVertices)
+{
+    std::string archive, entry;
+    if (streamAboveVertices == 0 || splitArchivePath(plyPath, archive, entry))
+    {
+        return true;
+    }
+    try
+    {
+        return readPLYFileHeader(plyPath).vertexCount() <= streamAboveVertices;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
 int main()
 {
     std::vector<TexturedMesh> opaqueMeshes;
     std::vector<TexturedMesh> transparentMeshes;
+    // Run the vertex cache / overdraw / fetch pass after loading, store positions as 16-bit fixed point,
+    // split any mesh too large for 16-bit indices, build LOD chains and cull meshlets against the view.
+    // Back-facing meshlets are still drawn: the scene renders without GL_CULL_FACE, and its walls and
+    // props are single-sided surfaces that can be seen from behind.
+    // Meshes over 4M vertices are streamed, or if Tools/MeshCook has cut them into spatial chunks, 512 MB of
+    // chunks around the camera are kept loaded.
+    // Face-corner duplicates are welded first; 1e-6 is far below what 16-bit positions can resolve.
+    // Cooked meshes are kept as compressed .meshz files, a fraction of the size of a .meshbin.
+    const size_t streamAboveVertices = 1 << 22;
+    const size_t pageBudgetBytes = (size_t)512 << 20;
+    const float weldEpsilon = 1e-6f;
+    MeshLoadOptions options(true, POSITION_UNORM16, true, true, true, false, streamAboveVertices, pageBudgetBytes, weldEpsilon, true);
 
     // File names without extension
     std::vector<std::string> fileNames = {
         "Bottles", "Curtains", "DoorBG", "Floor", "MetalObjects",
         "Patio", "Table", "Walls", "WindowBG", "WoodObjects"};
 
-    // Iterate over each file name, create TexturedMesh objects and add to the vector
+    // Read the assets straight out of LinksHouse.zip when it is there, rather than an unpacked copy.
+    // Everything about to be parsed whole is read in one batch, in the background while the window
+    // opens; each mesh starts as soon as its own file is in. A PLY that has been cooked (meshbin, meshz
+    // or chunks) is left out since the sidecar is read instead, and so is one over streamAboveVertices,
+    // which is streamed from its mapping and never held whole. A texture with a cooked .ktx2 container
+    // has that read in place of its BMP.
+    enableArchivePaths();
+    struct stat archiveInfo;
+    std::string assetDirectory = stat("LinksHouse.zip", &archiveInfo) == 0 ? "LinksHouse.zip/" : "LinksHouse/";
+    std::vector<std::string> assetPaths, prefetchPaths;
     for (const std::string &name : fileNames)
-    {   
-        // Convert the name to lowercase for file paths
+    {
         std::string lowerCaseName = name;
         std::transform(lowerCaseName.begin(), lowerCaseName.end(), lowerCaseName.begin(),
                [](unsigned char c){ return std::tolower(c); });
-
-        std::string plyFilePath = "LinksHouse/" + name + ".ply";
-        std::string bmpFilePath = "LinksHouse/" + lowerCaseName + ".bmp";
-        
-        if (name == "DoorBG" || name == "MetalObjects" || name == "Curtains")
-        {
-            transparentMeshes.emplace_back(plyFilePath, bmpFilePath);
-        }
-        else
+        assetPaths.push_back(assetDirectory + name + ".ply");
+        assetPaths.push_back(assetDirectory + lowerCaseName + ".bmp");
+        const std::string &plyPath = assetPaths[assetPaths.size() - 2];
+        struct stat cookedInfo;
+        if (stat(meshCachePath(plyPath).c_str(), &cookedInfo) != 0 && stat(meshPackPath(plyPath).c_str(), &cookedInfo) != 0 &&
+            stat(meshChunksDirectory(plyPath).c_str(), &cookedInfo) != 0 && loadsWhole(plyPath, streamAboveVertices))
         {
-            opaqueMeshes.emplace_back(plyFilePath, bmpFilePath);
+            prefetchPaths.push_back(plyPath);
         }
+        std::string cookedPath = cookedTexturePath(assetPaths.back());
+        prefetchPaths.push_back(stat(cookedPath.c_str(), &cookedInfo) == 0 ? cookedPath : assetPaths.back());
     }
+    prefetchFiles(prefetchPaths);
 
     // Initialise GLFW
     if (!glfwInit())
@@ -483,6 +836,32 @@ int main()
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
 
+    // Textures are loaded in whatever formats this driver takes, so the loader starts once GLEW knows them
+    TextureLoader::instance().start();
+
+    // Meshes create their buffers, staging ring and texture as they load, so they are built once the
+    // context exists. Each frees its GL objects when destroyed, so the vectors are sized up front and
+    // never reallocate, which would destroy the copies they were moved from.
+    opaqueMeshes.reserve(fileNames.size());
+    transparentMeshes.reserve(fileNames.size());
+
+    // Iterate over each file name, create TexturedMesh objects and add to the vector
+    for (size_t i = 0; i < fileNames.size(); ++i)
+    {   
+        const std::string &name = fileNames[i];
+        std::string plyFilePath = assetPaths[i * 2];
+        std::string bmpFilePath = assetPaths[i * 2 + 1];
+        
+        if (name == "DoorBG" || name == "MetalObjects" || name == "Curtains")
+        {
+            transparentMeshes.emplace_back(plyFilePath, bmpFilePath, options);
+        }
+        else
+        {
+            opaqueMeshes.emplace_back(plyFilePath, bmpFilePath, options);
+        }
+    }
+
     // Create camera
     Camera camera;
 
@@ -491,6 +870,8 @@ int main()
 
     // Projection matrix : 45° Field of View, 4:3 ratio, display range : 0.1 unit <-> 100 units
     glm::mat4 Projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+    // Converts lengths at unit distance to pixels, for picking each mesh's level of detail
+    float lodPixelScale = Projection[1][1] * screenH * 0.5f;
 
     // Camera matrix
     glm::mat4 View = glm::lookAt(
@@ -522,11 +903,14 @@ int main()
         // Update camera view matrix
         View = camera.getViewMatrix();
 
+        // Upload the textures that finished loading since the last frame
+        TextureLoader::instance().update();
+
         // Render opaque meshes
         for (auto &mesh : opaqueMeshes)
         {
             glm::mat4 MVP = Projection * View * Model; // Compute the MVP matrix
-            mesh.draw(MVP);
+            mesh.draw(MVP, lodPixelScale);
         }
 
          // Enable blending
@@ -537,7 +921,7 @@ int main()
         for (auto &mesh : transparentMeshes)
         {
             glm::mat4 MVP = Projection * View * Model; // Compute the MVP matrix
-            mesh.draw(MVP);
+            mesh.draw(MVP, lodPixelScale);
         }
 
         // Disable blending after rendering transparent meshes
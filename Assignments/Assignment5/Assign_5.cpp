@@ -22,8 +22,11 @@ using namespace glm;
 #include <iostream>
 #include <fstream>
 #include <functional>
+#include <algorithm>
 #include <cmath>
 #include "TriTable.hpp"
+#include "../Common/PLYWriter.hpp"
+#include "../Common/MeshNormals.hpp"
 
 #define FRONT_TOP_LEFT 128
 #define FRONT_TOP_RIGHT 64
@@ -241,7 +244,10 @@ class MarchingCubes {
     float maxCoor = 1;
     float stepSize = 0.1;
     float curIteration = 0;
-    std::vector<float> vertices;
+    std::vector<float> vertices; // The slab finished last step, then the newest slab; older slabs are released
+    std::vector<float> normals;
+    size_t newestSlab = 0;       // Where the newest slab starts in vertices
+    PLYStreamWriter *output = nullptr;
 
     void addTriangles(int *verts, float x, float y, float z) {
         for (int i = 0; verts[i] >= 0; i += 3) {
@@ -254,6 +260,7 @@ class MarchingCubes {
     }
 
     void iterativeGeneration() {
+        size_t slabStart = vertices.size();
         for (float a = minCoor; a < maxCoor; a += stepSize) {
             for (float b = minCoor; b < maxCoor; b += stepSize) {
                 int cornerVal = 0;
@@ -277,10 +284,29 @@ class MarchingCubes {
                 addTriangles(marching_cubes_lut[cornerVal], a, b, curIteration);
             }
         }
+
+        // A slab shares its borders only with the slabs either side, so the one before this step's
+        // is final now that this one exists. The slab before that is still held for its border faces.
+        normals.clear();
+        computeNormals(vertices.data(), vertices.size(), normals);
+
+        // Append the slab whose normals just became final to the output file while generation carries on
+        if (output && slabStart > newestSlab) {
+            output->appendVertices(&vertices[newestSlab], &normals[newestSlab], (slabStart - newestSlab) / 3);
+        }
+
         curIteration += stepSize;
         if (curIteration > maxCoor) {
             finished = true;
+            if (output && vertices.size() > slabStart) {
+                output->appendVertices(&vertices[slabStart], &normals[slabStart], (vertices.size() - slabStart) / 3);
+            }
         }
+
+        // Release the slab that was only kept as context, so memory stays at three slabs however fine the step
+        vertices.erase(vertices.begin(), vertices.begin() + newestSlab);
+        normals.erase(normals.begin(), normals.begin() + newestSlab);
+        newestSlab = slabStart - newestSlab;
     }
 
 public:
@@ -293,72 +319,97 @@ public:
         iterativeGeneration();
     }
 
-    std::vector<float> getVertices() {
+    // Stream every slab to writer as it is generated, one slab behind so its normals are final
+    void streamTo(PLYStreamWriter *writer) {
+        output = writer;
+    }
+
+    // After each generate(): the slab that has just become final, then the newest slab. Earlier slabs
+    // were returned by earlier steps and are no longer held.
+    const std::vector<float> &getVertices() const {
         return vertices;
     }
 
-    std::vector<float> computeNormals(const std::vector<float> &vertices) {
-        std::vector<float> normals;
-        for (int i = 0; i < vertices.size(); i += 9) {
-            glm::vec3 p1(vertices[i], vertices[i + 1], vertices[i + 2]);
-            glm::vec3 p2(vertices[i + 3], vertices[i + 4], vertices[i + 5]);
-            glm::vec3 p3(vertices[i + 6], vertices[i + 7], vertices[i + 8]);
-            glm::vec3 normal = glm::normalize(glm::cross(p2 - p1, p3 - p1));
-            for (int j = 0; j < 3; ++j) {
-                normals.insert(normals.end(), {normal.x, normal.y, normal.z});
-            }
-        }
+    const std::vector<float> &getNormals() const {
         return normals;
     }
+
+    // How many floats at the start of getVertices() and getNormals() are final; all of them once finished
+    size_t finalFloats() const {
+        return finished ? vertices.size() : newestSlab;
+    }
+
+    // Appends smooth normals for count floats of triangle soup starting at verts to out, averaged
+    // over the faces that share a corner position unless they meet at a crease. Each step passes
+    // every slab still held, so borders are smoothed across the slabs either side of them; only
+    // the newest slab's far border waits on the next step, which is why output runs a slab behind.
+    void computeNormals(const float *verts, size_t count, std::vector<float> &out) {
+        size_t first = out.size();
+        size_t vertexCount = count / 9 * 3;
+        out.resize(first + vertexCount * 3);
+        if (vertexCount > 0) {
+            computeSoupNormals(verts, vertexCount, DEFAULT_CREASE_ANGLE, NORMAL_WEIGHT_ANGLE, &out[first]);
+        }
+    }
 };
 
 
 // This function will create the file named fileName and,
 // write to it a valid PLY file encoding the vertices and normals in vertices and normals.
-void writePLY(const std::vector<float> &vertices, const std::vector<float> &normals, const std::string &fileName) {
-    std::ofstream plyFile(fileName);
-    if (!plyFile) {
-        std::cerr << "Failed to open file: " << fileName << std::endl;
+void writePLY(const std::vector<float> &vertices, const std::vector<float> &normals, const std::string &fileName,
+              PLYFormat format = PLY_ASCII) {
+    PLYStreamWriter plyFile;
+    if (!plyFile.open(fileName, format)) {
         return;
     }
-
-    int vertexCount = vertices.size() / 3;
-    int faceCount = vertexCount / 3;
-
-    plyFile << "ply\n";
-    plyFile << "format ascii 1.0\n";
-    plyFile << "element vertex " << vertexCount << "\n";
-    plyFile << "property float x\n";
-    plyFile << "property float y\n";
-    plyFile << "property float z\n";
-    plyFile << "property float nx\n";
-    plyFile << "property float ny\n";
-    plyFile << "property float nz\n";
-    plyFile << "element face " << faceCount << "\n";
-    plyFile << "property list uchar int vertex_indices\n";
-    plyFile << "end_header\n";
-
-    for (size_t i = 0; i < vertices.size(); i += 3) {
-        plyFile << vertices[i] << " " << vertices[i + 1] << " " << vertices[i + 2] << " "
-                << normals[i] << " " << normals[i + 1] << " " << normals[i + 2] << "\n";
+    if (!vertices.empty()) {
+        plyFile.appendVertices(&vertices[0], &normals[0], vertices.size() / 3);
     }
+    plyFile.close();
+}
 
-    for (int i = 0; i < faceCount; ++i) {
-        plyFile << "3 " << i * 3 << " " << i * 3 + 1 << " " << i * 3 + 2 << "\n";
-    }
 
-    plyFile.close();
+// Writes data into buffer from float offset on, and points vertex attribute index of the bound VAO at it.
+// A buffer too small is replaced by one twice the size, keeping its first offset floats.
+void writeAttributeBuffer(GLuint index, GLuint &buffer, size_t &capacity, size_t offset, const std::vector<float> &data) {
+    size_t needed = (offset + data.size()) * sizeof(float);
+    if (needed > capacity) {
+        GLuint grown;
+        size_t grownCapacity = std::max(capacity * 2, needed);
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, grownCapacity, NULL, GL_DYNAMIC_DRAW);
+        if (offset > 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, offset * sizeof(float));
+        }
+        glDeleteBuffers(1, &buffer);
+        buffer = grown;
+        capacity = grownCapacity;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (!data.empty()) {
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(float), data.size() * sizeof(float), &data[0]);
+    }
+    glVertexAttribPointer(index, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
 }
 
 
 int main(int argc, char *argv[]){
-    std::vector<float> normals;
     float step = 0.05;
     float min = -5.0f;
     float max = 5.0f;
     float isoval = -1.5;
     std::string filename = "TriangleMesh.ply";
     bool generateFile = true;
+    PLYFormat fileFormat = PLY_ASCII;
+
+    // Pass --binary to write meshes.ply as binary little endian, which is smaller and faster to write
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--binary") {
+            fileFormat = PLY_BINARY_LITTLE_ENDIAN;
+        }
+    }
 
     // Initialize window
     if (!glfwInit())
@@ -402,13 +453,19 @@ int main(int argc, char *argv[]){
     MarchingCubes cubes(function1, isoval, min, max, step);
     Cube drawCube(min, max);
 
+    // The mesh is written slab by slab while it is generated
+    PLYStreamWriter plyStream;
+    if (generateFile && plyStream.open("meshes.ply", fileFormat)) {
+        cubes.streamTo(&plyStream);
+    }
+
     // Set up VAO and VBO
     GLuint vao, vertex_VBO, normal_VBO, program_ID; 
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
     glGenBuffers(1, &vertex_VBO);
     glBindBuffer(GL_ARRAY_BUFFER, vertex_VBO);
-    glBufferData(GL_ARRAY_BUFFER, 0, &cubes.getVertices()[0], GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(
         0,
@@ -419,7 +476,7 @@ int main(int argc, char *argv[]){
         (void *)0);
     glGenBuffers(1, &normal_VBO);
     glBindBuffer(GL_ARRAY_BUFFER, normal_VBO);
-    glBufferData(GL_ARRAY_BUFFER, 0, &normals, GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(
         1,
@@ -454,6 +511,9 @@ int main(int argc, char *argv[]){
     GLfloat LIGHT_DIRECTION[3] = {5.0f, 5.0f, 5.0f};   // light direction
     double prevTime = glfwGetTime();
     bool wroteFile = false;
+    size_t vertexCapacity = 0, normalCapacity = 0; // Bytes allocated in vertex_VBO and normal_VBO
+    size_t finalFloats = 0; // Floats at the start of the buffers whose normals are final
+    size_t drawFloats = 0;  // Floats at the start of the buffers that are drawn
 
     while (!glfwWindowShouldClose(window))
     {
@@ -470,21 +530,19 @@ int main(int argc, char *argv[]){
         if (!cubes.finished)
         { // if not finished, generate mesh
             cubes.generate();
-            std::vector<float> vertices = cubes.getVertices();
-            normals = cubes.computeNormals(vertices);
 
+            // Only the slabs the generator still holds are written: the one that just became final goes over
+            // its provisional copy, and the newest slab after it, to be written again next time
             glBindVertexArray(vao); // update buffers
-            glBindBuffer(GL_ARRAY_BUFFER, normal_VBO);
-            glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GL_FLOAT), &normals[0], GL_DYNAMIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, vertex_VBO);
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GL_FLOAT), &vertices[0], GL_DYNAMIC_DRAW);
+            writeAttributeBuffer(0, vertex_VBO, vertexCapacity, finalFloats, cubes.getVertices());
+            writeAttributeBuffer(1, normal_VBO, normalCapacity, finalFloats, cubes.getNormals());
             glBindVertexArray(0);
+            drawFloats = finalFloats + cubes.getVertices().size();
+            finalFloats += cubes.finalFloats();
         }
         else if (!wroteFile && generateFile)
-        { // if finished, write file
-            std::vector<float> vertices = cubes.getVertices();
-            normals = cubes.computeNormals(vertices);
-            writePLY(vertices, normals, "meshes.ply");
+        { // if finished, write the face list and patch the header
+            plyStream.close();
             wroteFile = true;
         }
 
@@ -511,7 +569,7 @@ int main(int argc, char *argv[]){
         glUniform3fv(lightDirID, 1, LIGHT_DIRECTION);
 
         glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLES, 0, normals.size());
+        glDrawArrays(GL_TRIANGLES, 0, drawFloats / 3);
         glBindVertexArray(0);
         glUseProgram(0);
 
@@ -24,7 +24,6 @@ using namespace glm;
 #include <iostream>
 #include <vector>
 
-#include "LoadBMP.hpp"
 #include "PlaneMesh.hpp"
 #include "CamControls.hpp"
 #include "LoadPLY.hpp"
@@ -65,6 +64,9 @@ int main( int argc, char* argv[])
 
 	///////////////////////////////////////////////////////
 
+	// Assets are read out of A6.zip when it is there (PlaneMesh.hpp)
+	enableArchivePaths();
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -98,6 +100,8 @@ int main( int argc, char* argv[])
 		return -1;
 	}
 
+	// Textures are loaded in whatever formats this driver takes, so the loader starts once GLEW knows them
+	TextureLoader::instance().start();
 
 	PlaneMesh plane(xmin, xmax, stepsize);
 	
@@ -143,6 +147,9 @@ int main( int argc, char* argv[])
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		cameraControlsGlobe(V, 5);
+
+		// Upload the textures that finished loading since the last frame
+		TextureLoader::instance().update();
 		
 		plane.draw(lightpos, V, Projection);
 
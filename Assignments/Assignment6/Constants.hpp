@@ -21,6 +21,15 @@ const float CLOSENESS_DISPLACEMENT = 0.05;
 // Graphical constants
 const float SHININESS = 64.0;
 
+// Reorder loaded meshes for the vertex cache, overdraw and vertex fetch
+const bool OPTIMIZE_MESHES = true;
+
+// Merge vertices whose position, normal and UV agree to within this; negative never welds
+const float WELD_EPSILON = 1e-6f;
+
+// Simplify loaded meshes into LOD chains picked by screen-space error
+const bool BUILD_MESH_LODS = true;
+
 
 // parameters
 const float BOAT_WAVE_FREQUENCY = 4.0;
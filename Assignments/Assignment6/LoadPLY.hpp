@@ -1,10 +1,15 @@
 #ifndef LOADPLY_HPP
 #define LOADPLY_HPP
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <vector>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <stdexcept>
+
+#include "../Common/PLYReader.hpp"
+#include "../Common/MeshNormals.hpp"
 
 struct Vertex {
     float x, y, z;    // Position
@@ -12,75 +17,46 @@ struct Vertex {
     float u, v;       // Texture coordinates
 };
 
-struct Face {
-    std::vector<int> indices;
-};
-
-void loadPLY(const char* filename, std::vector<Vertex>& vertices, std::vector<Face>& faces) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        printf("%s could not be opened.\n", filename);
-        return;
-    }
+// All faces of a mesh as one triangle list. Quads and n-gons are fan triangulated
+// at load time, so indices can be uploaded as an index buffer as is.
+struct FaceList {
+    std::vector<uint32_t> indices; // Three per triangle
+    std::vector<uint32_t> offsets; // Optional: where each source face's triangles start in indices
 
-    std::string line;
-    bool headerEnded = false;
-    int vertexCount = 0;
-    int faceCount = 0;
-
-    // Read header
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        std::string token;
-        iss >> token;
+    size_t triangleCount() const { return indices.size() / 3; }
+};
 
-        if (token == "end_header") {
-            headerEnded = true;
-            break;
-        } else if (token == "element") {
-            iss >> token;
-            if (token == "vertex") {
-                iss >> vertexCount;
-            } else if (token == "face") {
-                iss >> faceCount;
+// Pass keepFaceOffsets to also record which triangles came from which PLY face.
+// Files without normals get smooth ones generated, which may add vertices along creases.
+void loadPLY(const char* filename, std::vector<Vertex>& vertices, FaceList& faces, bool keepFaceOffsets = false) {
+    // Map the PLY properties onto the fields of Vertex
+    PLYVertexLayout layout = makePLYVertexLayout(sizeof(Vertex));
+    setPLYAttrib(layout, PLY_X, offsetof(Vertex, x));
+    setPLYAttrib(layout, PLY_Y, offsetof(Vertex, y));
+    setPLYAttrib(layout, PLY_Z, offsetof(Vertex, z));
+    setPLYAttrib(layout, PLY_NX, offsetof(Vertex, nx));
+    setPLYAttrib(layout, PLY_NY, offsetof(Vertex, ny));
+    setPLYAttrib(layout, PLY_NZ, offsetof(Vertex, nz));
+    setPLYAttrib(layout, PLY_U, offsetof(Vertex, u));
+    setPLYAttrib(layout, PLY_V, offsetof(Vertex, v));
+
+    try {
+        PLYHeader header = readPLY(filename, layout, vertices, [&faces, keepFaceOffsets](const uint32_t* indices, uint32_t count) {
+            if (keepFaceOffsets) {
+                faces.offsets.push_back((uint32_t)faces.indices.size());
             }
+            appendFanTriangles(faces.indices, indices, count);
+        });
+        if (keepFaceOffsets) {
+            faces.offsets.push_back((uint32_t)faces.indices.size());
         }
-    }
-
-    if (!headerEnded) {
-        printf("PLY header not properly terminated.\n");
-        return;
-    }
-
-    // Read vertices
-    vertices.reserve(vertexCount);
-    for (int i = 0; i < vertexCount; ++i) {
-        std::getline(file, line);
-        std::istringstream iss(line);
-        Vertex vertex;
-        iss >> vertex.x >> vertex.y >> vertex.z;
-        iss >> vertex.nx >> vertex.ny >> vertex.nz;
-        iss >> vertex.u >> vertex.v;
-        vertices.push_back(vertex);
-    }
-
-    // Read faces
-    faces.reserve(faceCount);
-    for (int i = 0; i < faceCount; ++i) {
-        std::getline(file, line);
-        std::istringstream iss(line);
-        int vertexCount;
-        iss >> vertexCount;
-        Face face;
-        for (int j = 0; j < vertexCount; ++j) {
-            int index;
-            iss >> index;
-            face.indices.push_back(index);
+        if (!header.hasVertexAttrib(PLY_NX) || !header.hasVertexAttrib(PLY_NY) || !header.hasVertexAttrib(PLY_NZ)) {
+            generateNormals(vertices, faces.indices.data(), faces.indices.size(), offsetof(Vertex, x), offsetof(Vertex, nx),
+                            DEFAULT_CREASE_ANGLE);
         }
-        faces.push_back(face);
+    } catch (const std::exception& e) {
+        printf("%s\n", e.what());
     }
-
-    file.close();
 }
 
 #endif // LOADPLY_HPP
@@ -5,6 +5,19 @@
 #include "Shader.hpp"
 #include "LoadPLY.hpp"
 #include "Constants.hpp"
+#include "../Common/MeshOptimize.hpp"
+#include "../Common/IndexBuffer.hpp"
+#include "../Common/MeshSimplify.hpp"
+#include "../Common/MeshWeld.hpp"
+#include "../Common/AsyncIO.hpp"
+#include "../Common/TextureLoader.hpp"
+
+// Assets are read straight out of A6.zip when it is there, otherwise from the unpacked Assets directory
+inline std::string assetPath(const std::string& name) {
+	struct stat info;
+	static const std::string root = stat("A6.zip", &info) == 0 ? "A6.zip/A6-OWL/Assets/" : "Assets/";
+	return root + name;
+}
 
 class PlaneMesh {
 	
@@ -22,12 +35,18 @@ class PlaneMesh {
     GLuint EyesVAO, EyesVBO, EyesEBO;
     GLuint HeadVAO, HeadVBO, HeadEBO;
 
+    // GL_UNSIGNED_SHORT when the mesh has few enough vertices, GL_UNSIGNED_INT otherwise
+    GLenum planeIndexType, boatIndexType, eyesIndexType, headIndexType;
+
+    // Levels of detail of each loaded mesh; the full mesh alone when BUILD_MESH_LODS is off
+    MeshLodChain boatLods, eyesLods, headLods;
+
     std::vector<Vertex> boat_vertices;
-    std::vector<Face> boat_faces;
+    FaceList boat_faces;
     std::vector<Vertex> eyes_vertices;
-    std::vector<Face> eyes_faces;
+    FaceList eyes_faces;
     std::vector<Vertex> head_vertices;
-    std::vector<Face> head_faces;
+    FaceList head_faces;
 
 	GLuint vertexbuffer, elementbuffer;
 	GLuint TextureID, DispID, BoatID, EyesID, HeadID;
@@ -65,7 +84,37 @@ class PlaneMesh {
         }
     }
 
-	void setupMesh(GLuint& VAO, GLuint& VBO, GLuint& EBO, std::vector<Vertex>& vertices, std::vector<Face>& faces) {
+	// Uploads indices at the narrowest width that addresses vertexCount vertices
+	GLenum uploadIndices(const uint32_t* indices, size_t indexCount, size_t vertexCount) {
+		size_t indexSize = chooseIndexSize(vertexCount);
+		std::vector<unsigned char> indexData;
+		packIndices(indices, indexCount, indexSize, indexData);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), indexData.data(), GL_STATIC_DRAW);
+		return indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	}
+
+	void setupMesh(GLuint& VAO, GLuint& VBO, GLuint& EBO, GLenum& indexType, MeshLodChain& lodChain,
+	               std::vector<Vertex>& vertices, FaceList& faces, const char* name) {
+        if (WELD_EPSILON >= 0.0f) {
+            std::vector<WeldAttribute> attributes = {{offsetof(Vertex, x), 3}, {offsetof(Vertex, nx), 3}, {offsetof(Vertex, u), 2}};
+            weldMesh(vertices, faces.indices.data(), faces.indices.size(), attributes, WELD_EPSILON, name);
+        }
+        if (OPTIMIZE_MESHES) {
+            optimizeMesh(vertices, faces.indices.data(), faces.indices.size(), offsetof(Vertex, x), name);
+        }
+
+        // The index buffer holds the full mesh followed by its coarser levels
+        std::vector<uint32_t> lodIndices;
+        if (BUILD_MESH_LODS && !vertices.empty()) {
+            buildLodChain(&vertices[0].x, &vertices[0].u, sizeof(Vertex), vertices.size(),
+                          faces.indices.data(), faces.indices.size(), lodIndices, lodChain, OPTIMIZE_MESHES);
+        } else {
+            lodIndices = faces.indices;
+            MeshLod full = {0, (uint32_t)faces.indices.size(), 0.0f};
+            lodChain.lods.assign(1, full);
+            computeBoundingSphere((const float*)vertices.data(), sizeof(Vertex), vertices.size(), lodChain.boundingSphere);
+        }
+
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
@@ -76,7 +125,7 @@ class PlaneMesh {
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, faces.size() * sizeof(Face), &faces[0], GL_STATIC_DRAW);
+        indexType = uploadIndices(lodIndices.data(), lodIndices.size(), vertices.size());
 
         // Set vertex attribute pointers
         // Position attribute
@@ -92,6 +141,17 @@ class PlaneMesh {
         glBindVertexArray(0);
     }
 
+	// Draws the level of detail whose error covers at most a pixel at the mesh's distance
+	void drawLod(const MeshLodChain& lodChain, GLenum indexType, const glm::mat4& MVP, float pixelScale) {
+		// Clip space w is the distance along the view axis for a perspective projection
+		const float* sphere = lodChain.boundingSphere;
+		glm::vec4 centre = MVP * glm::vec4(sphere[0], sphere[1], sphere[2], 1.0f);
+		size_t level = selectLod(lodChain.lods.data(), lodChain.lods.size(), centre.w - sphere[3], pixelScale);
+		const MeshLod& lod = lodChain.lods[level];
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+		glDrawElements(GL_TRIANGLES, lod.indexCount, indexType, (void*)(lod.firstIndex * indexSize));
+	}
+
 public:
 
 	PlaneMesh(float min, float max, float stepsize) {
@@ -108,90 +168,52 @@ public:
 			"Shader.geoshader", 
 			"Shader.fragmentshader");
 
-		// Load texture
-		unsigned char* texture_data;
-		unsigned int texture_width, texture_height;
-		loadBMP24("Assets/water.bmp", &texture_data, &texture_width, &texture_height);
-
-		// Create texture
-		glGenTextures(1, &TextureID);
-		glActiveTexture(GL_TEXTURE0);
+		// Read every asset in one batch, or inflate them all at once if they come from the archive.
+		// Textures that have been cooked are read from their .ktx2 container instead.
+		std::vector<std::string> assets;
+		for (const char* name : {"water.bmp", "displacement-map1.bmp", "boat.bmp", "eyes.bmp", "head.bmp"}) {
+			struct stat info;
+			std::string cookedPath = cookedTexturePath(assetPath(name));
+			assets.push_back(stat(cookedPath.c_str(), &info) == 0 ? cookedPath : assetPath(name));
+		}
+		for (const char* name : {"boat.ply", "eyes.ply", "head.ply"}) {
+			assets.push_back(assetPath(name));
+		}
+		prefetchFiles(assets);
+
+		// Textures are loaded or cooked in the background, showing a placeholder until then
+		TextureID = TextureLoader::instance().request(assetPath("water.bmp"));
 		glBindTexture(GL_TEXTURE_2D, TextureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture_width, texture_height, 0, GL_BGR, GL_UNSIGNED_BYTE, texture_data);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glGenerateMipmap(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, 0);
 
-		// Load displacement map
-		unsigned char* disp_data;
-		unsigned int disp_width, disp_height;
-		loadBMP24("Assets/displacement-map1.bmp", &disp_data, &disp_width, &disp_height);
-
-		// Create displacement map
-		glGenTextures(1, &DispID);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, DispID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, disp_width, disp_height, 0, GL_BGR, GL_UNSIGNED_BYTE, disp_data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		// Load displacement map; the shader only reads its red channel
+		DispID = TextureLoader::instance().request(assetPath("displacement-map1.bmp"), TEXTURE_STORE_RED_GREEN);
 		
 		// // Boat
 		// loadPLY("Assets/boat.ply", boat_vertices, boat_faces);
 
 		// Load boat
-		unsigned char* boat_data;
-		unsigned int boat_width, boat_height;
-		loadBMP32("Assets/boat.bmp", &boat_data, &boat_width, &boat_height);
-
-		// Create boat
-    	glGenTextures(1, &BoatID);
-   	    glActiveTexture(GL_TEXTURE2);
-    	glBindTexture(GL_TEXTURE_2D, BoatID);
-    	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, boat_width, boat_height, 0, GL_BGR, GL_UNSIGNED_BYTE, boat_data);
-    	glGenerateMipmap(GL_TEXTURE_2D);
-   		glBindTexture(GL_TEXTURE_2D, 0);
-
+		BoatID = TextureLoader::instance().request(assetPath("boat.bmp"));
 
 		// Load eyes
-		unsigned char* eyes_data;
-		unsigned int eyes_width, eyes_height;
-		loadBMP32("Assets/eyes.bmp", &eyes_data, &eyes_width, &eyes_height);
-
-		// Create eyes
-		glGenTextures(1, &EyesID);
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, EyesID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, eyes_width, eyes_height, 0, GL_BGR, GL_UNSIGNED_BYTE, eyes_data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
+		EyesID = TextureLoader::instance().request(assetPath("eyes.bmp"));
 
 		// Load head
-		unsigned char* head_data;
-		unsigned int head_width, head_height;
-		loadBMP32("Assets/head.bmp", &head_data, &head_width, &head_height);
-
-		// Create head
-		glGenTextures(1, &HeadID);
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, HeadID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, head_width, head_height, 0, GL_BGR, GL_UNSIGNED_BYTE, head_data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, 0);
-	
+		HeadID = TextureLoader::instance().request(assetPath("head.bmp"));
 
 		 // Setup the mesh for boat
-        loadPLY("Assets/boat.ply", boat_vertices, boat_faces);
-        setupMesh(BoatVAO, BoatVBO, BoatEBO, boat_vertices, boat_faces);
+        loadPLY(assetPath("boat.ply").c_str(), boat_vertices, boat_faces);
+        setupMesh(BoatVAO, BoatVBO, BoatEBO, boatIndexType, boatLods, boat_vertices, boat_faces, assetPath("boat.ply").c_str());
 
         // Setup the mesh for eyes
-        loadPLY("Assets/eyes.ply", eyes_vertices, eyes_faces);
-        setupMesh(EyesVAO, EyesVBO, EyesEBO, eyes_vertices, eyes_faces);
+        loadPLY(assetPath("eyes.ply").c_str(), eyes_vertices, eyes_faces);
+        setupMesh(EyesVAO, EyesVBO, EyesEBO, eyesIndexType, eyesLods, eyes_vertices, eyes_faces, assetPath("eyes.ply").c_str());
 
         // Setup the mesh for head
-        loadPLY("Assets/head.ply", head_vertices, head_faces);
-        setupMesh(HeadVAO, HeadVBO, HeadEBO, head_vertices, head_faces);
+        loadPLY(assetPath("head.ply").c_str(), head_vertices, head_faces);
+        setupMesh(HeadVAO, HeadVBO, HeadEBO, headIndexType, headLods, head_vertices, head_faces, assetPath("head.ply").c_str());
 
 		// Set constant uniforms
 		glUseProgram(ProgramID);
@@ -245,7 +267,7 @@ public:
 
 		// Index buffer
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(int), &indices[0], GL_STATIC_DRAW);
+		planeIndexType = uploadIndices((const uint32_t*)indices.data(), indices.size(), verts.size() / 3);
 
 		// Set up vertex attribute pointers
 		glEnableVertexAttribArray(0);
@@ -280,6 +302,11 @@ public:
 		glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
 		glUniform1f(timeID, glfwGetTime());
 
+		// Converts lengths at unit distance to pixels, for picking each mesh's level of detail
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		float lodPixelScale = P[1][1] * viewport[3] * 0.5f;
+
 		// Activate textures
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, TextureID);
@@ -291,7 +318,7 @@ public:
 
 		// Set patch size to 4 and draw the vertices
 		glPatchParameteri(GL_PATCH_VERTICES, 4);
-		glDrawElements(GL_PATCHES, indices.size(), GL_UNSIGNED_INT, (void*)0);
+		glDrawElements(GL_PATCHES, indices.size(), planeIndexType, (void*)0);
 
 	
     	// Bind the boat mesh VAO and draw
@@ -299,21 +326,21 @@ public:
     	glActiveTexture(GL_TEXTURE2);
     	glBindTexture(GL_TEXTURE_2D, BoatID);
     	glPatchParameteri(GL_PATCH_VERTICES, 4);
-    	glDrawElements(GL_TRIANGLES, boat_faces.size() * 3, GL_UNSIGNED_INT, 0);
+    	drawLod(boatLods, boatIndexType, MVP, lodPixelScale);
 
     	// Bind the eyes mesh VAO and draw
    	 	glBindVertexArray(EyesVAO);
     	glActiveTexture(GL_TEXTURE3);
     	glBindTexture(GL_TEXTURE_2D, EyesID);
     	glPatchParameteri(GL_PATCH_VERTICES, 4);
-    	glDrawElements(GL_TRIANGLES, eyes_faces.size() * 3, GL_UNSIGNED_INT, 0);
+    	drawLod(eyesLods, eyesIndexType, MVP, lodPixelScale);
 
     	// Bind the head mesh VAO and draw
     	glBindVertexArray(HeadVAO);
     	glActiveTexture(GL_TEXTURE4);
     	glBindTexture(GL_TEXTURE_2D, HeadID);
     	glPatchParameteri(GL_PATCH_VERTICES, 4);
-    	glDrawElements(GL_TRIANGLES, head_faces.size() * 3, GL_UNSIGNED_INT, 0);
+    	drawLod(headLods, headIndexType, MVP, lodPixelScale);
 
 		glBindVertexArray(0);
 
@@ -0,0 +1,473 @@
+// PLYBench.cpp times the PLY loaders on a generated corpus of synthetic meshes
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "../Common/PLYReader.hpp"
+#include "../Common/MeshCache.hpp"
+#include "../Common/MeshPack.hpp"
+#include "../Common/MeshChunks.hpp"
+#include "../Common/IndexBuffer.hpp"
+#include "../Assignment4/MeshData.hpp"
+#include "../Assignment6/LoadPLY.hpp"
+
+// Vertex attributes a corpus file can carry, on top of the position
+enum CorpusAttribs {
+    CORPUS_NORMALS = 1,
+    CORPUS_UVS = 2,
+    CORPUS_COLORS = 4
+};
+
+struct CorpusLayout {
+    const char* name;
+    int attribs;
+};
+
+static const CorpusLayout CORPUS_LAYOUTS[] = {
+    {"xyz", 0},
+    {"xyz_n", CORPUS_NORMALS},
+    {"xyz_n_uv", CORPUS_NORMALS | CORPUS_UVS},
+    {"xyz_rgb", CORPUS_COLORS},
+    {"xyz_n_rgb_uv", CORPUS_NORMALS | CORPUS_COLORS | CORPUS_UVS},
+};
+
+// Writes a rolling height field of vertexCount vertices, one row of `width` at a
+// time, and two triangles per grid cell. Binary files are written in host order.
+static bool writeCorpusFile(const std::string& path, size_t vertexCount, int attribs, bool binary) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open file: %s\n", path.c_str());
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    size_t width = std::max<size_t>((size_t)std::ceil(std::sqrt((double)vertexCount)), 2);
+    size_t rows = vertexCount / width;
+    size_t faceCount = rows > 1 ? (rows - 1) * (width - 1) * 2 : 0;
+
+    const char* formatName = !binary ? "ascii" : plyHostIsLittleEndian() ? "binary_little_endian" : "binary_big_endian";
+    fprintf(file, "ply\nformat %s 1.0\nelement vertex %zu\n", formatName, vertexCount);
+    fprintf(file, "property float x\nproperty float y\nproperty float z\n");
+    if (attribs & CORPUS_NORMALS) {
+        fprintf(file, "property float nx\nproperty float ny\nproperty float nz\n");
+    }
+    if (attribs & CORPUS_COLORS) {
+        fprintf(file, "property uchar red\nproperty uchar green\nproperty uchar blue\n");
+    }
+    if (attribs & CORPUS_UVS) {
+        fprintf(file, "property float u\nproperty float v\n");
+    }
+    fprintf(file, "element face %zu\nproperty list uchar int vertex_indices\nend_header\n", faceCount);
+
+    std::vector<char> line(256);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        float column = (float)(i % width), row = (float)(i / width);
+        float position[3] = {column * 0.01f, 0.05f * std::sin(column * 0.1f) * std::cos(row * 0.1f), row * 0.01f};
+        float normal[3] = {0.0f, 1.0f, 0.0f};
+        unsigned char color[3] = {(unsigned char)(i * 7), (unsigned char)(i * 13), (unsigned char)(i * 29)};
+        float uv[2] = {column / (float)width, row / (float)(rows ? rows : 1)};
+
+        if (binary) {
+            fwrite(position, sizeof(float), 3, file);
+            if (attribs & CORPUS_NORMALS) {
+                fwrite(normal, sizeof(float), 3, file);
+            }
+            if (attribs & CORPUS_COLORS) {
+                fwrite(color, 1, 3, file);
+            }
+            if (attribs & CORPUS_UVS) {
+                fwrite(uv, sizeof(float), 2, file);
+            }
+            continue;
+        }
+        int length = snprintf(line.data(), line.size(), "%g %g %g", position[0], position[1], position[2]);
+        if (attribs & CORPUS_NORMALS) {
+            length += snprintf(line.data() + length, line.size() - length, " %g %g %g", normal[0], normal[1], normal[2]);
+        }
+        if (attribs & CORPUS_COLORS) {
+            length += snprintf(line.data() + length, line.size() - length, " %d %d %d", color[0], color[1], color[2]);
+        }
+        if (attribs & CORPUS_UVS) {
+            length += snprintf(line.data() + length, line.size() - length, " %g %g", uv[0], uv[1]);
+        }
+        line[length++] = '\n';
+        fwrite(line.data(), 1, length, file);
+    }
+
+    for (size_t row = 0; row + 1 < rows; ++row) {
+        for (size_t column = 0; column + 1 < width; ++column) {
+            int32_t corner = (int32_t)(row * width + column);
+            int32_t triangles[2][3] = {{corner, corner + (int32_t)width, corner + 1},
+                                       {corner + 1, corner + (int32_t)width, corner + (int32_t)width + 1}};
+            for (int t = 0; t < 2; ++t) {
+                if (binary) {
+                    unsigned char count = 3;
+                    fwrite(&count, 1, 1, file);
+                    fwrite(triangles[t], sizeof(int32_t), 3, file);
+                } else {
+                    fprintf(file, "3 %d %d %d\n", triangles[t][0], triangles[t][1], triangles[t][2]);
+                }
+            }
+        }
+    }
+    return fclose(file) == 0;
+}
+
+// What a loader reports back from the child process it runs in
+struct LoadResult {
+    double seconds;
+    uint64_t vertices;
+    uint64_t triangles;
+    int ok;
+};
+
+// Assignment 4 readPLYFile: whole mesh into VertexData and a triangle index array
+static void loadReadPLYFile(const std::string& path, LoadResult& result) {
+    PLYChunkedReader reader(path);
+    std::vector<VertexData> vertices;
+    std::vector<uint32_t> triangles;
+    readPLYFile(reader, vertices, triangles);
+    result.vertices = vertices.size();
+    result.triangles = triangles.size() / 3;
+}
+
+// Assignment 6 loadPLY, which prints and swallows its errors
+static void loadLoadPLY(const std::string& path, LoadResult& result) {
+    std::vector<Vertex> vertices;
+    FaceList faces;
+    loadPLY(path.c_str(), vertices, faces);
+    result.vertices = vertices.size();
+    result.triangles = faces.triangleCount();
+}
+
+// PLYChunkedReader as TexturedMesh streams with it: vertices 64K at a time, never held whole
+static void loadChunked(const std::string& path, LoadResult& result) {
+    PLYChunkedReader reader(path);
+    uint64_t vertices = 0, triangles = 0;
+    reader.decode<VertexData>(vertexDataLayout(), 1 << 16,
+        [&vertices](const VertexData*, size_t, size_t count) { vertices += count; },
+        [&triangles](const uint32_t*, uint32_t count) { triangles += count - 2; });
+    result.vertices = vertices;
+    result.triangles = triangles;
+}
+
+// The sidecar rows time warm starts: readPLYFile output packed as TexturedMesh packs it
+// (16-bit positions, UVs) without the optimize, LOD and meshlet passes, cooked once per
+// corpus file and reused while the file is unchanged
+const uint32_t BENCH_CACHE_TAG = PACKED_LAYOUT_TAG | (POSITION_UNORM16 << 4);
+
+static void cookSidecar(const std::string& path, bool compressed) {
+    PLYChunkedReader reader(path);
+    std::vector<VertexData> vertices;
+    std::vector<uint32_t> triangles;
+    readPLYFile(reader, vertices, triangles);
+    PackedVertexLayout layout = makePackedVertexLayout(POSITION_UNORM16, true, false);
+    std::vector<unsigned char> packed, indexData;
+    MeshBuffers mesh;
+    packVertices(layout, vertices.size(), sizeof(VertexData), vertices.empty() ? NULL : &vertices[0].x,
+                 vertices.empty() ? NULL : &vertices[0].u, NULL, packed, mesh.dequantize);
+    mesh.indexSize = chooseIndexSize(vertices.size());
+    packIndices(triangles.data(), triangles.size(), mesh.indexSize, indexData);
+    mesh.vertexData = packed.data();
+    mesh.vertexCount = vertices.size();
+    mesh.vertexStride = layout.stride;
+    mesh.indexData = indexData.data();
+    mesh.indexCount = triangles.size();
+    if (compressed ? !writeMeshPack(path, BENCH_CACHE_TAG, mesh, &reader.getFile())
+                   : !writeMeshCache(path, BENCH_CACHE_TAG, mesh, &reader.getFile())) {
+        throw std::runtime_error("Could not cook " + path);
+    }
+}
+
+// Reads every byte, as the upload would, so the time covers paging the file in
+static uint64_t touchBytes(const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i += 64) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+static void prepareMeshBin(const std::string& path) {
+    CookedMesh cooked;
+    size_t stride = makePackedVertexLayout(POSITION_UNORM16, true, false).stride;
+    if (!loadMeshCache(path, BENCH_CACHE_TAG, stride, cooked)) {
+        cookSidecar(path, false);
+    }
+}
+
+// Warm start from a .meshbin: map it and read both blobs
+static void loadMeshBin(const std::string& path, LoadResult& result) {
+    CookedMesh cooked;
+    size_t stride = makePackedVertexLayout(POSITION_UNORM16, true, false).stride;
+    if (!loadMeshCache(path, BENCH_CACHE_TAG, stride, cooked)) {
+        throw std::runtime_error("No current .meshbin for " + path);
+    }
+    volatile uint64_t sum = touchBytes(cooked.vertexData, cooked.vertexCount * cooked.vertexStride) +
+                            touchBytes(cooked.indexData, cooked.indexCount * cooked.indexSize);
+    (void)sum;
+    result.vertices = cooked.vertexCount;
+    result.triangles = cooked.indexCount / 3;
+}
+
+static void prepareMeshZ(const std::string& path) {
+    MeshPack pack;
+    size_t stride = makePackedVertexLayout(POSITION_UNORM16, true, false).stride;
+    if (!openMeshPack(path, BENCH_CACHE_TAG, stride, pack)) {
+        cookSidecar(path, true);
+    }
+}
+
+// Warm start from a .meshz: decode both streams a staging chunk's worth of blocks at a time
+static void loadMeshZ(const std::string& path, LoadResult& result) {
+    MeshPack pack;
+    size_t stride = makePackedVertexLayout(POSITION_UNORM16, true, false).stride;
+    if (!openMeshPack(path, BENCH_CACHE_TAG, stride, pack)) {
+        throw std::runtime_error("No current .meshz for " + path);
+    }
+    const size_t chunkBlocks = 1024;
+    std::vector<unsigned char> chunk(chunkBlocks * MESH_CODEC_BLOCK * std::max<size_t>(stride, 4));
+    VertexStreamDecoder vertexDecoder(pack.vertexStream, pack.vertexStreamSize, pack.vertexCount, stride);
+    for (size_t first = 0; first < pack.vertexCount; first += chunkBlocks * MESH_CODEC_BLOCK) {
+        if (!vertexDecoder.decode(chunk.data(), std::min(chunkBlocks * MESH_CODEC_BLOCK, pack.vertexCount - first))) {
+            throw std::runtime_error("Corrupt vertex stream in " + meshPackPath(path));
+        }
+    }
+    IndexStreamDecoder indexDecoder(pack.indexStream, pack.indexStreamSize, pack.indexCount);
+    for (size_t first = 0; first < pack.indexCount; first += chunkBlocks * MESH_CODEC_BLOCK) {
+        if (!indexDecoder.decode(chunk.data(), std::min(chunkBlocks * MESH_CODEC_BLOCK, pack.indexCount - first), pack.indexSize)) {
+            throw std::runtime_error("Corrupt index stream in " + meshPackPath(path));
+        }
+    }
+    result.vertices = pack.vertexCount;
+    result.triangles = pack.indexCount / 3;
+}
+
+static void prepareChunks(const std::string& path) {
+    std::vector<MeshChunkInfo> chunks;
+    float boundingSphere[4];
+    if (!loadMeshChunks(path, CHUNK_LAYOUT_TAG, chunkVertexLayout().stride, chunks, boundingSphere)) {
+        PLYChunkedReader reader(path);
+        if (!partitionVertexData(path, reader)) {
+            throw std::runtime_error("Could not partition " + path);
+        }
+    }
+}
+
+// Partitioned mesh: read the manifest and every chunk file, as the pager would with the
+// whole mesh in view. Vertices on chunk borders are stored in each chunk they touch.
+static void loadChunkFiles(const std::string& path, LoadResult& result) {
+    std::vector<MeshChunkInfo> chunks;
+    float boundingSphere[4];
+    size_t stride = chunkVertexLayout().stride;
+    if (!loadMeshChunks(path, CHUNK_LAYOUT_TAG, stride, chunks, boundingSphere)) {
+        throw std::runtime_error("No current chunks for " + path);
+    }
+    std::string directory = meshChunksDirectory(path);
+    std::vector<unsigned char> buffer;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        size_t size = chunks[c].vertexCount * stride + chunks[c].indexCount * chunks[c].indexSize;
+        buffer.resize(size);
+        FILE* file = fopen(meshChunkPath(directory, c).c_str(), "rb");
+        bool ok = file && fread(buffer.data(), 1, size, file) == size;
+        if (file) {
+            fclose(file);
+        }
+        if (!ok) {
+            throw std::runtime_error("Could not read chunk " + std::to_string(c) + " of " + path);
+        }
+        result.vertices += chunks[c].vertexCount;
+        result.triangles += chunks[c].indexCount / 3;
+    }
+}
+
+struct Loader {
+    const char* name;
+    void (*load)(const std::string& path, LoadResult& result);
+    void (*prepare)(const std::string& path); // Cooks what load reads, untimed; may be NULL
+    bool copiesVertices;                      // Reports more vertices than the PLY holds
+};
+
+// Add new loaders here
+static const Loader LOADERS[] = {
+    {"readPLYFile", loadReadPLYFile, NULL, false},
+    {"loadPLY", loadLoadPLY, NULL, false},
+    {"PLYChunkedReader", loadChunked, NULL, false},
+    {".meshbin", loadMeshBin, prepareMeshBin, false},
+    {".meshz", loadMeshZ, prepareMeshZ, false},
+    {"chunks", loadChunkFiles, prepareChunks, true},
+};
+
+// Cooks what every loader reads, as one more load so it runs in a child process
+static void prepareLoaders(const std::string& path, LoadResult&) {
+    for (const Loader& loader : LOADERS) {
+        if (loader.prepare) {
+            loader.prepare(path);
+        }
+    }
+}
+
+// Runs one load in a child process, so the peak RSS it reports belongs to that load alone
+static bool runLoader(const Loader& loader, const std::string& path, LoadResult& result, long& peakKilobytes) {
+    int channel[2];
+    if (pipe(channel) != 0) {
+        return false;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+        close(channel[0]);
+        close(channel[1]);
+        return false;
+    }
+    if (child == 0) {
+        close(channel[0]);
+        LoadResult measured = {0, 0, 0, 1};
+        auto start = std::chrono::steady_clock::now();
+        try {
+            loader.load(path, measured);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s: %s\n", loader.name, e.what());
+            measured.ok = 0;
+        }
+        measured.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ssize_t written = write(channel[1], &measured, sizeof(measured));
+        _exit(written == (ssize_t)sizeof(measured) ? 0 : 1);
+    }
+
+    close(channel[1]);
+    ssize_t received = read(channel[0], &result, sizeof(result));
+    close(channel[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(child, &status, 0, &usage) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        received != (ssize_t)sizeof(result)) {
+        return false;
+    }
+    peakKilobytes = usage.ru_maxrss;
+    return true;
+}
+
+// Parses a comma separated list of counts with optional K or M suffixes
+static std::vector<size_t> parseSizes(const char* list) {
+    std::vector<size_t> sizes;
+    const char* cursor = list;
+    while (*cursor) {
+        char* end;
+        double value = strtod(cursor, &end);
+        if (*end == 'K' || *end == 'k') {
+            value *= 1e3;
+            ++end;
+        } else if (*end == 'M' || *end == 'm') {
+            value *= 1e6;
+            ++end;
+        }
+        if (end == cursor || value < 1) {
+            fprintf(stderr, "Bad size list: %s\n", list);
+            exit(2);
+        }
+        sizes.push_back((size_t)value);
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    return sizes;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--dir DIR] [--sizes 10K,100K,1M,10M,50M] [--layouts xyz,xyz_n,...] [--repeat N]\n"
+            "Generates any missing corpus files and sidecars under DIR, then times every loader on each.\n"
+            "Layouts: xyz xyz_n xyz_n_uv xyz_rgb xyz_n_rgb_uv, each in ascii and binary.\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    std::string directory = "ply_corpus";
+    std::vector<size_t> sizes = parseSizes("10K,100K,1M,10M,50M");
+    std::string layoutFilter;
+    int repeat = 3;
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (i + 1 < argc && option == "--dir") {
+            directory = argv[++i];
+        } else if (i + 1 < argc && option == "--sizes") {
+            sizes = parseSizes(argv[++i]);
+        } else if (i + 1 < argc && option == "--layouts") {
+            layoutFilter = "," + std::string(argv[++i]) + ",";
+        } else if (i + 1 < argc && option == "--repeat") {
+            repeat = std::max(atoi(argv[++i]), 1);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    makeDirectory(directory);
+
+    printf("%-36s %-17s %9s %9s %9s %10s %9s\n", "file", "loader", "MB", "ms", "MB/s", "Mverts/s", "peak MB");
+    int failures = 0;
+    for (size_t size : sizes) {
+        for (const CorpusLayout& layout : CORPUS_LAYOUTS) {
+            if (!layoutFilter.empty() && layoutFilter.find("," + std::string(layout.name) + ",") == std::string::npos) {
+                continue;
+            }
+            for (int binary = 0; binary < 2; ++binary) {
+                std::string name = "grid_" + std::to_string(size) + "_" + layout.name + (binary ? "_binary.ply" : "_ascii.ply");
+                std::string path = directory + "/" + name;
+                struct stat info;
+                if (stat(path.c_str(), &info) != 0) {
+                    // Write under a temporary name so an interrupted run never leaves a short file
+                    if (!writeCorpusFile(path + ".tmp", size, layout.attribs, binary != 0) ||
+                        rename((path + ".tmp").c_str(), path.c_str()) != 0 || stat(path.c_str(), &info) != 0) {
+                        fprintf(stderr, "Could not generate %s\n", path.c_str());
+                        return 1;
+                    }
+                }
+                double megabytes = info.st_size / 1e6;
+
+                // Sidecars are cooked in a child too, so the parent never grows to a whole mesh
+                Loader cook = {"cook", prepareLoaders, NULL, false};
+                LoadResult cooked;
+                long cookKilobytes;
+                if (!runLoader(cook, path, cooked, cookKilobytes) || !cooked.ok) {
+                    fprintf(stderr, "Could not cook sidecars for %s\n", path.c_str());
+                    return 1;
+                }
+
+                for (const Loader& loader : LOADERS) {
+                    // Best time over the repeats; the first run also warms the page cache
+                    double best = 0;
+                    long peak = 0;
+                    bool ok = true;
+                    for (int r = 0; r < repeat && ok; ++r) {
+                        LoadResult result;
+                        long peakKilobytes = 0;
+                        ok = runLoader(loader, path, result, peakKilobytes) && result.ok &&
+                             (loader.copiesVertices ? result.vertices >= size : result.vertices == size);
+                        best = r == 0 ? result.seconds : std::min(best, result.seconds);
+                        peak = std::max(peak, peakKilobytes);
+                    }
+                    if (!ok) {
+                        printf("%-36s %-17s FAILED\n", name.c_str(), loader.name);
+                        ++failures;
+                        continue;
+                    }
+                    printf("%-36s %-17s %9.1f %9.1f %9.1f %10.2f %9.1f\n", name.c_str(), loader.name, megabytes, best * 1e3,
+                           megabytes / best, size / best / 1e6, peak / 1024.0);
+                }
+            }
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,433 @@
+// AsyncIO.hpp batched file reads through io_uring, with a thread pool fallback
+#ifndef ASYNCIO_HPP
+#define ASYNCIO_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define ASYNCIO_HAS_IO_URING 1
+#endif
+#endif
+
+#include "MappedFile.hpp"
+#include "ZipArchive.hpp"
+
+// Largest single read; bigger files are read in several pieces in flight at once
+const size_t ASYNC_READ_PIECE = 8 << 20;
+// Reads in flight at once, in the ring or across the fallback threads
+const unsigned ASYNC_READ_DEPTH = 32;
+
+// Called on the thread that started the batch as each file completes, in completion
+// order. error is empty on success; data may be swapped out and kept.
+typedef std::function<void(size_t index, std::vector<char>& data, const std::string& error)> ReadCallback;
+
+// Opens path for reading and reports its size; -1 if it can't be opened
+inline int openForRead(const std::string& path, size_t& size) {
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+    struct _stat64 info;
+    if (fd >= 0 && _fstat64(fd, &info) != 0) {
+        _close(fd);
+        fd = -1;
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd >= 0 && fstat(fd, &info) != 0) {
+        close(fd);
+        fd = -1;
+    }
+#endif
+    size = fd >= 0 ? (size_t)info.st_size : 0;
+    return fd;
+}
+
+// Reads up to length bytes at offset. Without pread, a seek and a read do the same,
+// as each file of a batch is read by one thread.
+inline long long readAt(int fd, char* buffer, size_t length, size_t offset) {
+#ifdef _WIN32
+    if (_lseeki64(fd, (long long)offset, SEEK_SET) < 0) {
+        return -1;
+    }
+    return _read(fd, buffer, (unsigned)std::min<size_t>(length, 1u << 30));
+#else
+    return pread(fd, buffer, length, (off_t)offset);
+#endif
+}
+
+inline void closeForRead(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+// One file of a batch: its descriptor, its buffer and how much is still outstanding
+struct BatchFile {
+    int fd;
+    std::vector<char> data;
+    size_t piecesLeft;
+    std::string error;
+};
+
+// Opens every file of the batch and sizes its buffer. Files that can't be opened get
+// their error set and no pieces.
+inline void openBatchFiles(const std::vector<std::string>& paths, std::vector<BatchFile>& files) {
+    files.resize(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        BatchFile& file = files[i];
+        size_t size;
+        file.fd = openForRead(paths[i], size);
+        if (file.fd < 0) {
+            file.error = "Could not open file: " + paths[i];
+            file.piecesLeft = 0;
+            continue;
+        }
+        file.data.resize(size);
+        file.piecesLeft = (file.data.size() + ASYNC_READ_PIECE - 1) / ASYNC_READ_PIECE;
+    }
+}
+
+inline void finishBatchFile(std::vector<BatchFile>& files, size_t index, const ReadCallback& onComplete) {
+    BatchFile& file = files[index];
+    if (file.fd >= 0) {
+        closeForRead(file.fd);
+        file.fd = -1;
+    }
+    if (!file.error.empty()) {
+        file.data.clear();
+    }
+    onComplete(index, file.data, file.error);
+    std::vector<char>().swap(file.data);
+}
+
+#ifdef ASYNCIO_HAS_IO_URING
+// The submission and completion rings of one io_uring instance, set up with the raw
+// system calls so there is no liburing dependency
+class IoUring {
+    int ringFd;
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    io_uring_sqe* sqes;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_cqe* cqes;
+
+    IoUring(const IoUring&);
+    IoUring& operator=(const IoUring&);
+
+public:
+    IoUring() : ringFd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqRingSize(0), cqRingSize(0), sqesSize(0), sqes(NULL) {}
+
+    ~IoUring() {
+        if (sqes) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0) {
+            close(ringFd);
+        }
+    }
+
+    // False if the kernel has no io_uring or it is disabled
+    bool init(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ringFd < 0) {
+            return false;
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            return false;
+        }
+        cqRing = single ? sqRing : mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            return false;
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* mapped = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        sqes = (io_uring_sqe*)mapped;
+
+        char* sq = (char*)sqRing;
+        sqHead = (unsigned*)(sq + params.sq_off.head);
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        char* cq = (char*)cqRing;
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // Queues a read; it goes to the kernel with the next submitAndWait
+    void queueRead(int fd, void* buffer, unsigned length, uint64_t offset, uint64_t userData) {
+        unsigned tail = *sqTail;
+        unsigned slot = tail & *sqMask;
+        io_uring_sqe& sqe = sqes[slot];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)(uintptr_t)buffer;
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.user_data = userData;
+        sqArray[slot] = slot;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Hands the queued reads to the kernel and waits for at least one completion
+    bool submitAndWait(unsigned toSubmit) {
+        for (;;) {
+            int result = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (result >= 0) {
+                return true;
+            }
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    // Takes the next completion, if there is one
+    bool popCompletion(uint64_t& userData, int& result) {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        const io_uring_cqe& cqe = cqes[head & *cqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+// Reads every piece of every file with up to ASYNC_READ_DEPTH reads in the ring at
+// once. A piece that comes back short is queued again for the rest. False if the
+// ring could not be set up, in which case nothing has been read.
+inline bool readBatchIoUring(std::vector<BatchFile>& files, const ReadCallback& onComplete) {
+    std::unique_ptr<IoUring> ring(new IoUring());
+    if (!ring->init(ASYNC_READ_DEPTH)) {
+        return false;
+    }
+
+    // A piece is (file, offset, length); its index is the read's user data
+    struct Piece {
+        size_t file;
+        size_t offset;
+        size_t length;
+    };
+    std::vector<Piece> pieces;
+    std::deque<size_t> waiting;
+    for (size_t i = 0; i < files.size(); ++i) {
+        for (size_t offset = 0; offset < files[i].data.size(); offset += ASYNC_READ_PIECE) {
+            Piece piece = {i, offset, std::min(ASYNC_READ_PIECE, files[i].data.size() - offset)};
+            waiting.push_back(pieces.size());
+            pieces.push_back(piece);
+        }
+        if (files[i].piecesLeft == 0) {
+            finishBatchFile(files, i, onComplete);
+        }
+    }
+
+    unsigned inFlight = 0;
+    while (!waiting.empty() || inFlight > 0) {
+        unsigned queued = 0;
+        while (!waiting.empty() && inFlight < ASYNC_READ_DEPTH) {
+            const Piece& piece = pieces[waiting.front()];
+            ring->queueRead(files[piece.file].fd, &files[piece.file].data[piece.offset], (unsigned)piece.length, piece.offset,
+                           waiting.front());
+            waiting.pop_front();
+            ++inFlight;
+            ++queued;
+        }
+        if (!ring->submitAndWait(queued)) {
+            // Closing the ring waits out the reads still in flight before their buffers go
+            std::string error = strerror(errno);
+            ring.reset();
+            for (size_t i = 0; i < files.size(); ++i) {
+                if (files[i].piecesLeft > 0) {
+                    files[i].error = error;
+                    files[i].piecesLeft = 0;
+                    finishBatchFile(files, i, onComplete);
+                }
+            }
+            return true;
+        }
+
+        uint64_t userData;
+        int result;
+        while (ring->popCompletion(userData, result)) {
+            --inFlight;
+            Piece& piece = pieces[(size_t)userData];
+            BatchFile& file = files[piece.file];
+            if (result < 0 || (result == 0 && piece.length > 0)) {
+                if (file.error.empty()) {
+                    file.error = result < 0 ? strerror(-result) : "File shrank while being read";
+                }
+            } else if ((size_t)result < piece.length) {
+                piece.offset += result;
+                piece.length -= result;
+                waiting.push_back((size_t)userData);
+                continue;
+            }
+            if (--file.piecesLeft == 0) {
+                finishBatchFile(files, piece.file, onComplete);
+            }
+        }
+    }
+    return true;
+}
+#endif
+
+// The same with blocking reads on a pool of threads. Completed files are queued back
+// to the calling thread, which runs the callbacks.
+inline void readBatchThreads(std::vector<BatchFile>& files, const ReadCallback& onComplete) {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<size_t> completed;
+    std::atomic<size_t> next(0);
+
+    size_t remaining = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i].piecesLeft == 0) {
+            finishBatchFile(files, i, onComplete);
+        } else {
+            ++remaining;
+        }
+    }
+
+    unsigned threadCount = (unsigned)std::min<size_t>(ASYNC_READ_DEPTH, remaining);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; ++t) {
+        threads.push_back(std::thread([&]() {
+            for (size_t i = next++; i < files.size(); i = next++) {
+                BatchFile& file = files[i];
+                if (file.piecesLeft == 0) {
+                    continue;
+                }
+                for (size_t offset = 0; offset < file.data.size();) {
+                    long long result = readAt(file.fd, &file.data[offset], file.data.size() - offset, offset);
+                    if (result < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (result <= 0) {
+                        file.error = result < 0 ? strerror(errno) : "File shrank while being read";
+                        break;
+                    }
+                    offset += result;
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                completed.push_back(i);
+                changed.notify_all();
+            }
+        }));
+    }
+
+    while (remaining > 0) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !completed.empty(); });
+            index = completed.front();
+            completed.pop_front();
+        }
+        finishBatchFile(files, index, onComplete);
+        --remaining;
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Reads all of paths at once, calling onComplete for each file as it arrives. Uses
+// io_uring where the kernel has it and a thread pool otherwise.
+inline void readFilesBatched(const std::vector<std::string>& paths, const ReadCallback& onComplete) {
+    std::vector<BatchFile> files;
+    openBatchFiles(paths, files);
+#ifdef ASYNCIO_HAS_IO_URING
+    if (readBatchIoUring(files, onComplete)) {
+        return;
+    }
+#endif
+    readBatchThreads(files, onComplete);
+}
+
+// Starts reading every asset the program is about to load in one batch, into the
+// prefetched files (MappedFile.hpp) the loaders take them from, and returns at once.
+// Paths into zip archives are inflated in parallel instead. Each file is handed over
+// as it completes, so a loader starts on its file while the rest are still in flight;
+// one that asks for a file not yet read waits for it. Files that fail are left for the
+// loader to report. Only pass files that are loaded whole: a prefetched file is held
+// in memory rather than mapped.
+inline void prefetchFiles(const std::vector<std::string>& paths) {
+    std::vector<std::string> plain;
+    for (const std::string& path : paths) {
+        std::string archive, entry;
+        if (!splitArchivePath(path, archive, entry)) {
+            plain.push_back(path);
+        }
+    }
+    prefetchArchivePaths(paths);
+    if (plain.empty()) {
+        return;
+    }
+
+    // The thread only touches the prefetched files, which outlive it, so it can be
+    // left to finish on its own
+    expectPrefetchedFiles(plain);
+    std::thread([plain]() {
+        readFilesBatched(plain, [&plain](size_t index, std::vector<char>& data, const std::string& error) {
+            if (error.empty()) {
+                storePrefetchedFile(plain[index], data);
+            } else {
+                dropPrefetchedFile(plain[index]);
+            }
+        });
+    }).detach();
+}
+
+#endif
@@ -0,0 +1,173 @@
+// BMPImage.hpp memory-mapped BMP decoding, shared by every texture loader
+#ifndef BMPIMAGE_HPP
+#define BMPIMAGE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "MappedFile.hpp"
+
+// Compression values of the BITMAPINFOHEADER that carry uncompressed pixels
+const uint32_t BMP_RGB = 0;
+const uint32_t BMP_BITFIELDS = 3;
+const uint32_t BMP_ALPHABITFIELDS = 6;
+
+// A decoded BMP. Pixels stay in the mapped file wherever their layout is one GL can
+// read as is (24-bit BGR, 32-bit BGRA or RGBA with or without alpha); other 32-bit
+// channel masks are converted to RGBA once into converted. Rows are rowStride bytes
+// apart, padded to 4 bytes as in the file.
+struct BMPImage {
+    std::unique_ptr<MappedFile> file;
+    std::vector<unsigned char> converted;
+    const unsigned char* pixels; // First row in memory order
+    unsigned int width, height;
+    unsigned int channels;       // Bytes per pixel: 3 or 4
+    bool bgr;                    // Blue comes first in each pixel
+    bool hasAlpha;               // The fourth byte is alpha rather than padding
+    bool topDown;                // The first row in memory is the top of the image
+    size_t rowStride;
+
+    BMPImage() : pixels(NULL), width(0), height(0), channels(0), bgr(true), hasAlpha(false), topDown(false), rowStride(0) {}
+
+    // Row y counted from the bottom, the order OpenGL expects
+    const unsigned char* row(unsigned int y) const {
+        return pixels + (size_t)(topDown ? height - 1 - y : y) * rowStride;
+    }
+};
+
+inline uint32_t readBMP32(const char* at) {
+    uint32_t value;
+    memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+inline uint16_t readBMP16(const char* at) {
+    uint16_t value;
+    memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+// Position and width of the set bits of a channel mask
+inline void bmpMaskShift(uint32_t mask, unsigned& shift, unsigned& bits) {
+    shift = bits = 0;
+    if (mask == 0) {
+        return;
+    }
+    while (!(mask & 1)) {
+        mask >>= 1;
+        ++shift;
+    }
+    while (mask & 1) {
+        mask >>= 1;
+        ++bits;
+    }
+}
+
+// Expands 32-bit pixels with arbitrary channel masks to RGBA8
+inline void convertBMPMasks(BMPImage& image, const uint32_t* masks) {
+    unsigned shift[4], bits[4];
+    for (int c = 0; c < 4; ++c) {
+        bmpMaskShift(masks[c], shift[c], bits[c]);
+    }
+    image.converted.resize((size_t)image.width * image.height * 4);
+    for (unsigned int y = 0; y < image.height; ++y) {
+        const char* source = (const char*)image.pixels + (size_t)y * image.rowStride;
+        unsigned char* target = &image.converted[(size_t)y * image.width * 4];
+        for (unsigned int x = 0; x < image.width; ++x) {
+            uint32_t pixel = readBMP32(source + x * 4);
+            for (int c = 0; c < 4; ++c) {
+                if (bits[c] == 0) {
+                    target[x * 4 + c] = 255;
+                    continue;
+                }
+                uint32_t value = (pixel & masks[c]) >> shift[c];
+                uint32_t maximum = bits[c] >= 32 ? 0xFFFFFFFFu : (1u << bits[c]) - 1;
+                target[x * 4 + c] = (unsigned char)(((uint64_t)value * 255 + maximum / 2) / maximum);
+            }
+        }
+    }
+    image.pixels = image.converted.data();
+    image.rowStride = (size_t)image.width * 4;
+    image.bgr = false;
+    image.hasAlpha = masks[3] != 0;
+}
+
+// Maps a 24 or 32-bit uncompressed BMP (BI_RGB or BI_BITFIELDS), top-down or
+// bottom-up, from disk or through a zip archive. Prints why and returns false if
+// the file can't be used.
+inline bool loadBMP(const std::string& path, BMPImage& image) {
+    try {
+        image.file.reset(new MappedFile(path));
+    } catch (const std::exception&) {
+        printf("%s could not be opened. Are you in the right directory?\n", path.c_str());
+        return false;
+    }
+    const char* data = image.file->data();
+    size_t size = image.file->size();
+    if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+        printf("%s is not a BMP file\n", path.c_str());
+        return false;
+    }
+
+    uint32_t dataOffset = readBMP32(data + 0x0A);
+    uint32_t headerSize = readBMP32(data + 0x0E);
+    int32_t width = (int32_t)readBMP32(data + 0x12);
+    int32_t height = (int32_t)readBMP32(data + 0x16);
+    uint16_t bitsPerPixel = readBMP16(data + 0x1C);
+    uint32_t compression = readBMP32(data + 0x1E);
+    if (headerSize < 40 || width <= 0 || height == 0 || height == INT32_MIN) {
+        printf("%s has an unsupported BMP header\n", path.c_str());
+        return false;
+    }
+    if (bitsPerPixel != 24 && bitsPerPixel != 32) {
+        printf("%s is %u bits per pixel; only 24 and 32 are supported\n", path.c_str(), bitsPerPixel);
+        return false;
+    }
+    if (compression != BMP_RGB && !(bitsPerPixel == 32 && (compression == BMP_BITFIELDS || compression == BMP_ALPHABITFIELDS))) {
+        printf("%s uses an unsupported BMP compression (%u)\n", path.c_str(), compression);
+        return false;
+    }
+
+    image.width = (unsigned int)width;
+    image.height = (unsigned int)(height < 0 ? -height : height);
+    image.topDown = height < 0;
+    image.channels = bitsPerPixel / 8;
+    image.rowStride = ((size_t)image.width * bitsPerPixel + 31) / 32 * 4;
+    if (dataOffset == 0) {
+        dataOffset = 14 + headerSize + (compression == BMP_RGB ? 0 : 12);
+    }
+    // The last row may end without its padding
+    if (dataOffset > size ||
+        (size - dataOffset) < image.rowStride * (image.height - 1) + (size_t)image.width * image.channels) {
+        printf("%s is truncated\n", path.c_str());
+        return false;
+    }
+    image.pixels = (const unsigned char*)data + dataOffset;
+    image.bgr = true;
+    image.hasAlpha = false;
+    if (compression == BMP_RGB) {
+        return true;
+    }
+
+    // The masks follow a 40 byte header and are part of any longer one; alpha only from V3 on
+    uint32_t masks[4] = {readBMP32(data + 0x36), readBMP32(data + 0x3A), readBMP32(data + 0x3E), 0};
+    if (headerSize >= 56 || compression == BMP_ALPHABITFIELDS) {
+        masks[3] = readBMP32(data + 0x42);
+    }
+    bool alphaOnTop = masks[3] == 0 || masks[3] == 0xFF000000u;
+    if (alphaOnTop && masks[0] == 0x00FF0000u && masks[1] == 0x0000FF00u && masks[2] == 0x000000FFu) {
+        image.hasAlpha = masks[3] != 0;
+    } else if (alphaOnTop && masks[0] == 0x000000FFu && masks[1] == 0x0000FF00u && masks[2] == 0x00FF0000u) {
+        image.bgr = false;
+        image.hasAlpha = masks[3] != 0;
+    } else {
+        convertBMPMasks(image, masks);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,570 @@
+// BlockCompress.hpp BC1, BC3, BC5 and BC7 texture compression on the CPU
+#ifndef BLOCKCOMPRESS_HPP
+#define BLOCKCOMPRESS_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "BMPImage.hpp"
+#include "MipBaker.hpp"
+#include "Parallel.hpp"
+
+// Block rows of a level handed to one parallelFor item
+const unsigned int BLOCK_ROW_BATCH = 4;
+
+enum BlockFormat {
+    BLOCK_BC1, // RGB, 4 bits per pixel
+    BLOCK_BC3, // RGB as BC1 plus interpolated alpha, 8 bits per pixel
+    BLOCK_BC5, // Red and green as two independent channels, 8 bits per pixel
+    BLOCK_BC7  // RGBA, 8 bits per pixel; mode 6 only
+};
+
+// Trades encoding time for accuracy
+enum BlockQuality {
+    BLOCK_QUALITY_FAST,   // Principal axis endpoints, no refinement
+    BLOCK_QUALITY_NORMAL, // One least squares refinement; BC7 tries every p-bit pair
+    BLOCK_QUALITY_HIGH    // Refines until the error stops dropping; BC4 tries both modes
+};
+
+inline size_t blockBytes(BlockFormat format) {
+    return format == BLOCK_BC1 ? 8 : 16;
+}
+
+inline size_t compressedLevelSize(BlockFormat format, unsigned int width, unsigned int height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+// Squared RGBA distance from each of the 16 pixels of a block to its nearest palette
+// entry. Pixels and palette are RGBA8 packed as uint32 with red in the low byte;
+// channelMask clears the bytes that don't count. Ties go to the lower index.
+inline uint32_t matchPalette(const uint32_t* pixels, const uint32_t* palette, int count, uint32_t channelMask,
+                             uint8_t* indices) {
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi32((int)channelMask);
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t total = 0;
+    for (int group = 0; group < 16; group += 4) {
+        __m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pixels + group)), mask);
+        __m128i best = _mm_set1_epi32(0x7FFFFFFF);
+        __m128i bestIndex = zero;
+        for (int k = 0; k < count; ++k) {
+            __m128i entry = _mm_and_si128(_mm_set1_epi32((int)palette[k]), mask);
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(px, entry), _mm_subs_epu8(entry, px));
+            __m128i lo = _mm_unpacklo_epi8(diff, zero);
+            __m128i hi = _mm_unpackhi_epi8(diff, zero);
+            __m128 squaresLo = _mm_castsi128_ps(_mm_madd_epi16(lo, lo));
+            __m128 squaresHi = _mm_castsi128_ps(_mm_madd_epi16(hi, hi));
+            // Each pixel left two partial sums, red+green and blue+alpha
+            __m128i distance = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(squaresLo, squaresHi, _MM_SHUFFLE(2, 0, 2, 0))),
+                                             _mm_castps_si128(_mm_shuffle_ps(squaresLo, squaresHi, _MM_SHUFFLE(3, 1, 3, 1))));
+            __m128i closer = _mm_cmplt_epi32(distance, best);
+            best = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best));
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, bestIndex));
+        }
+        uint32_t distances[4], found[4];
+        _mm_storeu_si128((__m128i*)distances, best);
+        _mm_storeu_si128((__m128i*)found, bestIndex);
+        for (int i = 0; i < 4; ++i) {
+            indices[group + i] = (uint8_t)found[i];
+            total += distances[i];
+        }
+    }
+    return total;
+#else
+    uint32_t total = 0;
+    for (int i = 0; i < 16; ++i) {
+        uint32_t best = 0xFFFFFFFFu;
+        for (int k = 0; k < count; ++k) {
+            uint32_t distance = 0;
+            for (int c = 0; c < 4; ++c) {
+                if (channelMask >> (c * 8) & 0xFF) {
+                    int d = (int)(pixels[i] >> (c * 8) & 0xFF) - (int)(palette[k] >> (c * 8) & 0xFF);
+                    distance += (uint32_t)(d * d);
+                }
+            }
+            if (distance < best) {
+                best = distance;
+                indices[i] = (uint8_t)k;
+            }
+        }
+        total += best;
+    }
+    return total;
+#endif
+}
+
+inline uint32_t packRGBA(int r, int g, int b, int a) {
+    return (uint32_t)r | (uint32_t)g << 8 | (uint32_t)b << 16 | (uint32_t)a << 24;
+}
+
+inline int channelOf(uint32_t pixel, int c) {
+    return (int)(pixel >> (c * 8) & 0xFF);
+}
+
+// The line through the block's colours along their principal axis, as the two
+// extreme projections. Only the first channels channels take part.
+inline void principalEndpoints(const uint32_t* pixels, int channels, float* e0, float* e1) {
+    float mean[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < channels; ++c) {
+            mean[c] += channelOf(pixels[i], c);
+        }
+    }
+    for (int c = 0; c < channels; ++c) {
+        mean[c] /= 16.0f;
+    }
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; ++i) {
+        float d[4];
+        for (int c = 0; c < channels; ++c) {
+            d[c] = channelOf(pixels[i], c) - mean[c];
+        }
+        for (int a = 0; a < channels; ++a) {
+            for (int b = 0; b < channels; ++b) {
+                covariance[a][b] += d[a] * d[b];
+            }
+        }
+    }
+
+    // Power iteration from the channel with the largest spread
+    float axis[4] = {0, 0, 0, 0};
+    int widest = 0;
+    for (int c = 1; c < channels; ++c) {
+        if (covariance[c][c] > covariance[widest][widest]) {
+            widest = c;
+        }
+    }
+    axis[widest] = 1.0f;
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float next[4] = {0, 0, 0, 0};
+        float length = 0.0f;
+        for (int a = 0; a < channels; ++a) {
+            for (int b = 0; b < channels; ++b) {
+                next[a] += covariance[a][b] * axis[b];
+            }
+            length += next[a] * next[a];
+        }
+        if (length < 1e-12f) {
+            break;
+        }
+        length = 1.0f / sqrtf(length);
+        for (int c = 0; c < channels; ++c) {
+            axis[c] = next[c] * length;
+        }
+    }
+
+    float low = 0.0f, high = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; ++c) {
+            t += (channelOf(pixels[i], c) - mean[c]) * axis[c];
+        }
+        low = std::min(low, t);
+        high = std::max(high, t);
+    }
+    for (int c = 0; c < channels; ++c) {
+        e0[c] = std::min(std::max(mean[c] + low * axis[c], 0.0f), 255.0f);
+        e1[c] = std::min(std::max(mean[c] + high * axis[c], 0.0f), 255.0f);
+    }
+}
+
+// Least squares endpoints for the given indices, where index i sits weights[i] of
+// the way from e0 to e1. Returns false when the indices don't pin both ends down.
+inline bool refineEndpoints(const uint32_t* pixels, const uint8_t* indices, const float* weights, int channels,
+                            float* e0, float* e1) {
+    float a = 0, b = 0, c = 0, x[4] = {0, 0, 0, 0}, y[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 16; ++i) {
+        float t = weights[indices[i]];
+        a += (1 - t) * (1 - t);
+        b += t * (1 - t);
+        c += t * t;
+        for (int k = 0; k < channels; ++k) {
+            x[k] += (1 - t) * channelOf(pixels[i], k);
+            y[k] += t * channelOf(pixels[i], k);
+        }
+    }
+    float determinant = a * c - b * b;
+    if (fabsf(determinant) < 1e-6f) {
+        return false;
+    }
+    for (int k = 0; k < channels; ++k) {
+        e0[k] = std::min(std::max((c * x[k] - b * y[k]) / determinant, 0.0f), 255.0f);
+        e1[k] = std::min(std::max((a * y[k] - b * x[k]) / determinant, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+inline uint16_t packRGB565(const float* color) {
+    int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+inline uint32_t unpackRGB565(uint16_t color) {
+    int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+    return packRGBA(r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2, 0);
+}
+
+// The four colours of a BC1 block in four colour mode
+inline void bc1Palette(uint16_t c0, uint16_t c1, uint32_t* palette) {
+    palette[0] = unpackRGB565(c0);
+    palette[1] = unpackRGB565(c1);
+    int mixed[2][3];
+    for (int c = 0; c < 3; ++c) {
+        int a = channelOf(palette[0], c), b = channelOf(palette[1], c);
+        mixed[0][c] = (2 * a + b + 1) / 3;
+        mixed[1][c] = (a + 2 * b + 1) / 3;
+    }
+    palette[2] = packRGBA(mixed[0][0], mixed[0][1], mixed[0][2], 0);
+    palette[3] = packRGBA(mixed[1][0], mixed[1][1], mixed[1][2], 0);
+}
+
+// Encodes the colours of a block as BC1 in four colour mode, which is also the
+// colour half of BC3
+inline void encodeBC1(const uint32_t* pixels, BlockQuality quality, uint8_t* out) {
+    static const float weights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+    float e0[4], e1[4];
+    principalEndpoints(pixels, 3, e0, e1);
+
+    // e1 is the high end of the axis; it goes first so that c0 > c1 usually holds as is
+    uint16_t c0 = packRGB565(e1), c1 = packRGB565(e0);
+    uint32_t palette[4];
+    uint8_t indices[16];
+    bc1Palette(c0, c1, palette);
+    uint32_t error = matchPalette(pixels, palette, 4, 0x00FFFFFFu, indices);
+
+    int passes = quality == BLOCK_QUALITY_FAST ? 0 : quality == BLOCK_QUALITY_NORMAL ? 1 : 4;
+    for (int pass = 0; pass < passes && error > 0; ++pass) {
+        if (!refineEndpoints(pixels, indices, weights, 3, e1, e0)) {
+            break;
+        }
+        uint16_t n0 = packRGB565(e1), n1 = packRGB565(e0);
+        uint32_t candidate[4];
+        uint8_t candidateIndices[16];
+        bc1Palette(n0, n1, candidate);
+        uint32_t candidateError = matchPalette(pixels, candidate, 4, 0x00FFFFFFu, candidateIndices);
+        if (candidateError >= error) {
+            break;
+        }
+        c0 = n0;
+        c1 = n1;
+        error = candidateError;
+        memcpy(indices, candidateIndices, sizeof(indices));
+    }
+
+    // Four colour mode needs c0 > c1; swapping the ends swaps 0 with 1 and 2 with 3
+    if (c0 < c1) {
+        std::swap(c0, c1);
+        for (int i = 0; i < 16; ++i) {
+            indices[i] ^= 1;
+        }
+    } else if (c0 == c1) {
+        memset(indices, 0, sizeof(indices));
+    }
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; ++i) {
+        bits |= (uint32_t)indices[i] << (i * 2);
+    }
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &bits, 4);
+}
+
+// The eight values of a BC4 block; six plus 0 and 255 when a0 <= a1
+inline void bc4Palette(int a0, int a1, int* palette) {
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (int i = 2; i < 8; ++i) {
+            palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+        }
+    } else {
+        for (int i = 2; i < 6; ++i) {
+            palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+inline uint32_t matchBC4(const uint8_t* values, const int* palette, uint8_t* indices) {
+    uint32_t total = 0;
+    for (int i = 0; i < 16; ++i) {
+        int best = 1 << 30;
+        for (int k = 0; k < 8; ++k) {
+            int d = (values[i] - palette[k]) * (values[i] - palette[k]);
+            if (d < best) {
+                best = d;
+                indices[i] = (uint8_t)k;
+            }
+        }
+        total += (uint32_t)best;
+    }
+    return total;
+}
+
+// Encodes one channel of a block as BC4, the alpha half of BC3 and each half of BC5
+inline void encodeBC4(const uint8_t* values, BlockQuality quality, uint8_t* out) {
+    int low = 255, high = 0;
+    for (int i = 0; i < 16; ++i) {
+        low = std::min(low, (int)values[i]);
+        high = std::max(high, (int)values[i]);
+    }
+    int a0 = high, a1 = low;
+    int palette[8];
+    uint8_t indices[16];
+    bc4Palette(a0, a1, palette);
+    uint32_t error = matchBC4(values, palette, indices);
+
+    // Six value mode spends two entries on 0 and 255, which pays off when those
+    // appear next to a narrow range of other values
+    if (quality == BLOCK_QUALITY_HIGH && error > 0) {
+        int innerLow = 255, innerHigh = 0;
+        for (int i = 0; i < 16; ++i) {
+            if (values[i] != 0 && values[i] != 255) {
+                innerLow = std::min(innerLow, (int)values[i]);
+                innerHigh = std::max(innerHigh, (int)values[i]);
+            }
+        }
+        if (innerLow <= innerHigh) {
+            int candidate[8];
+            uint8_t candidateIndices[16];
+            bc4Palette(innerLow, innerHigh, candidate);
+            uint32_t candidateError = matchBC4(values, candidate, candidateIndices);
+            if (candidateError < error) {
+                a0 = innerLow;
+                a1 = innerHigh;
+                error = candidateError;
+                memcpy(indices, candidateIndices, sizeof(indices));
+            }
+        }
+    }
+
+    out[0] = (uint8_t)a0;
+    out[1] = (uint8_t)a1;
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; ++i) {
+        bits |= (uint64_t)indices[i] << (i * 3);
+    }
+    for (int i = 0; i < 6; ++i) {
+        out[2 + i] = (uint8_t)(bits >> (i * 8));
+    }
+}
+
+// Interpolation weights of BC7's 4-bit indices, in 64ths
+const int BC7_WEIGHTS4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Quantizes an endpoint to 7 bits per channel that decode, with p-bit bit, as the
+// nearest 8-bit value
+inline void quantizeBC7Mode6(const float* endpoint, int bit, int* quantized) {
+    for (int c = 0; c < 4; ++c) {
+        int q = (int)floorf((endpoint[c] - bit) / 2.0f + 0.5f);
+        quantized[c] = std::min(std::max(q, 0), 127);
+    }
+}
+
+inline void bc7Mode6Palette(const int* q0, int p0, const int* q1, int p1, uint32_t* palette) {
+    int e0[4], e1[4];
+    for (int c = 0; c < 4; ++c) {
+        e0[c] = q0[c] << 1 | p0;
+        e1[c] = q1[c] << 1 | p1;
+    }
+    for (int i = 0; i < 16; ++i) {
+        int w = BC7_WEIGHTS4[i];
+        int v[4];
+        for (int c = 0; c < 4; ++c) {
+            v[c] = ((64 - w) * e0[c] + w * e1[c] + 32) >> 6;
+        }
+        palette[i] = packRGBA(v[0], v[1], v[2], v[3]);
+    }
+}
+
+// Appends count bits of value to a 128-bit block, lowest bit first
+inline void putBits(uint8_t* block, int& position, uint32_t value, int count) {
+    for (int i = 0; i < count; ++i, ++position) {
+        if (value >> i & 1) {
+            block[position >> 3] |= (uint8_t)(1 << (position & 7));
+        }
+    }
+}
+
+// Encodes a block as BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a p-bit
+// each, and a 4-bit index per pixel
+inline void encodeBC7(const uint32_t* pixels, BlockQuality quality, uint8_t* out) {
+    static const float weights[16] = {0 / 64.0f,  4 / 64.0f,  9 / 64.0f,  13 / 64.0f, 17 / 64.0f, 21 / 64.0f,
+                                      26 / 64.0f, 30 / 64.0f, 34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f,
+                                      51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f};
+
+    float e0[4], e1[4];
+    principalEndpoints(pixels, 4, e0, e1);
+
+    int q0[4], q1[4], p0 = 0, p1 = 0;
+    uint8_t indices[16];
+    uint32_t error = 0xFFFFFFFFu;
+    auto tryEndpoints = [&](const float* f0, const float* f1) {
+        for (int bits = 0; bits < 4; ++bits) {
+            int b0 = bits & 1, b1 = bits >> 1;
+            // The fast setting only tries matching p-bits
+            if (quality == BLOCK_QUALITY_FAST && b0 != b1) {
+                continue;
+            }
+            int c0[4], c1[4];
+            quantizeBC7Mode6(f0, b0, c0);
+            quantizeBC7Mode6(f1, b1, c1);
+            uint32_t palette[16];
+            uint8_t candidateIndices[16];
+            bc7Mode6Palette(c0, b0, c1, b1, palette);
+            uint32_t candidateError = matchPalette(pixels, palette, 16, 0xFFFFFFFFu, candidateIndices);
+            if (candidateError < error) {
+                error = candidateError;
+                memcpy(q0, c0, sizeof(q0));
+                memcpy(q1, c1, sizeof(q1));
+                p0 = b0;
+                p1 = b1;
+                memcpy(indices, candidateIndices, sizeof(indices));
+            }
+        }
+    };
+    tryEndpoints(e0, e1);
+
+    int passes = quality == BLOCK_QUALITY_FAST ? 0 : quality == BLOCK_QUALITY_NORMAL ? 1 : 4;
+    for (int pass = 0; pass < passes && error > 0; ++pass) {
+        uint32_t before = error;
+        if (!refineEndpoints(pixels, indices, weights, 4, e0, e1)) {
+            break;
+        }
+        tryEndpoints(e0, e1);
+        if (error >= before) {
+            break;
+        }
+    }
+
+    // The first index is stored with its top bit implied zero
+    if (indices[0] & 8) {
+        std::swap(q0, q1);
+        std::swap(p0, p1);
+        for (int i = 0; i < 16; ++i) {
+            indices[i] = (uint8_t)(15 - indices[i]);
+        }
+    }
+    memset(out, 0, 16);
+    int position = 0;
+    putBits(out, position, 1 << 6, 7);
+    for (int c = 0; c < 4; ++c) {
+        putBits(out, position, (uint32_t)q0[c], 7);
+        putBits(out, position, (uint32_t)q1[c], 7);
+    }
+    putBits(out, position, (uint32_t)p0, 1);
+    putBits(out, position, (uint32_t)p1, 1);
+    putBits(out, position, indices[0], 3);
+    for (int i = 1; i < 16; ++i) {
+        putBits(out, position, indices[i], 4);
+    }
+}
+
+// Compresses one level. row(y) returns row y counted from the bottom, pixels of
+// channels bytes in the order the flags describe; blocks past the edge repeat the
+// last row and column.
+template <typename RowAccess>
+void compressLevel(const RowAccess& row, unsigned int width, unsigned int height, unsigned int channels, bool bgr,
+                   bool hasAlpha, BlockFormat format, BlockQuality quality, uint8_t* out) {
+    unsigned int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    size_t bytes = blockBytes(format);
+    size_t batches = (blocksHigh + BLOCK_ROW_BATCH - 1) / BLOCK_ROW_BATCH;
+    parallelFor(batches, [&](size_t batch) {
+        unsigned int end = std::min(blocksHigh, (unsigned int)(batch + 1) * BLOCK_ROW_BATCH);
+        for (unsigned int by = (unsigned int)batch * BLOCK_ROW_BATCH; by < end; ++by) {
+            for (unsigned int bx = 0; bx < blocksWide; ++bx) {
+                uint32_t pixels[16];
+                for (unsigned int j = 0; j < 4; ++j) {
+                    const unsigned char* source = row(std::min(by * 4 + j, height - 1));
+                    for (unsigned int i = 0; i < 4; ++i) {
+                        const unsigned char* p = source + std::min(bx * 4 + i, width - 1) * channels;
+                        int alpha = hasAlpha ? p[3] : 255;
+                        pixels[j * 4 + i] = bgr ? packRGBA(p[2], p[1], p[0], alpha) : packRGBA(p[0], p[1], p[2], alpha);
+                    }
+                }
+
+                uint8_t* block = out + ((size_t)by * blocksWide + bx) * bytes;
+                if (format == BLOCK_BC1) {
+                    encodeBC1(pixels, quality, block);
+                } else if (format == BLOCK_BC3) {
+                    uint8_t alpha[16];
+                    for (int i = 0; i < 16; ++i) {
+                        alpha[i] = (uint8_t)channelOf(pixels[i], 3);
+                    }
+                    encodeBC4(alpha, quality, block);
+                    encodeBC1(pixels, quality, block + 8);
+                } else if (format == BLOCK_BC5) {
+                    uint8_t red[16], green[16];
+                    for (int i = 0; i < 16; ++i) {
+                        red[i] = (uint8_t)channelOf(pixels[i], 0);
+                        green[i] = (uint8_t)channelOf(pixels[i], 1);
+                    }
+                    encodeBC4(red, quality, block);
+                    encodeBC4(green, quality, block + 8);
+                } else {
+                    encodeBC7(pixels, quality, block);
+                }
+            }
+        }
+    });
+}
+
+// Every level of a compressed texture, level 0 first, the blocks held in storage
+struct CompressedLevel {
+    unsigned int width, height;
+    const unsigned char* data;
+    size_t size;
+};
+
+struct CompressedTexture {
+    BlockFormat format;
+    std::vector<CompressedLevel> levels;
+    std::vector<unsigned char> storage;
+
+    CompressedTexture() : format(BLOCK_BC1) {}
+};
+
+// Compresses image and its mip chain
+inline void compressTexture(const BMPImage& image, const MipChain& mips, BlockFormat format, BlockQuality quality,
+                            CompressedTexture& texture) {
+    texture.format = format;
+    texture.levels.clear();
+    size_t total = compressedLevelSize(format, image.width, image.height);
+    for (const MipLevel& level : mips.levels) {
+        total += compressedLevelSize(format, level.width, level.height);
+    }
+    texture.storage.assign(total, 0);
+
+    size_t offset = 0;
+    auto add = [&](unsigned int width, unsigned int height) {
+        CompressedLevel level;
+        level.width = width;
+        level.height = height;
+        level.data = &texture.storage[offset];
+        level.size = compressedLevelSize(format, width, height);
+        texture.levels.push_back(level);
+        offset += level.size;
+        return &texture.storage[offset - level.size];
+    };
+    uint8_t* out = add(image.width, image.height);
+    compressLevel([&image](unsigned int y) { return image.row(y); }, image.width, image.height, image.channels, image.bgr,
+                  image.hasAlpha, format, quality, out);
+    for (const MipLevel& level : mips.levels) {
+        out = add(level.width, level.height);
+        size_t stride = (size_t)level.width * image.channels;
+        compressLevel([&level, stride](unsigned int y) { return level.pixels + y * stride; }, level.width, level.height,
+                      image.channels, image.bgr, image.hasAlpha, format, quality, out);
+    }
+}
+
+#endif
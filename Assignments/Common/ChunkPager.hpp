@@ -0,0 +1,232 @@
+// ChunkPager.hpp pages the chunks of a partitioned mesh in and out of GPU memory
+#ifndef CHUNKPAGER_HPP
+#define CHUNKPAGER_HPP
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+#include "MeshChunks.hpp"
+#include "Meshlets.hpp"
+
+// Chunk files being read at once, and read chunks turned into GPU buffers per frame,
+// so a fast camera move costs a few small uploads per frame instead of a long stall
+const size_t CHUNK_PAGER_READS_IN_FLIGHT = 4;
+const size_t CHUNK_PAGER_UPLOADS_PER_FRAME = 4;
+
+// Keeps the chunks nearest the camera resident within a byte budget. update() ranks
+// every chunk by distance from the eye, chunks in the view frustum first, and takes
+// them in that order until the budget is spent; the rest are evicted, farthest first,
+// to make room. Chunk files are read on a worker thread and uploaded on the GL thread.
+class MeshChunkPager {
+    struct Slot {
+        GLuint vaoID, vertexBufferID, indexBufferID;
+        bool resident, pending, visible;
+        float distance;
+    };
+
+    struct ReadRequest {
+        size_t chunk;
+        std::vector<unsigned char> data; // Empty if the read failed
+    };
+
+    std::string directory;
+    std::vector<MeshChunkInfo> chunks;
+    std::vector<Slot> slots;
+    size_t vertexStride;
+    size_t budgetBytes;
+    size_t residentBytes;  // Resident and pending chunks
+    std::function<void()> setVertexAttributes;
+    std::vector<size_t> order;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<size_t> requested;
+    std::deque<ReadRequest> completed;
+    bool stopping;
+
+    MeshChunkPager(const MeshChunkPager&);
+    MeshChunkPager& operator=(const MeshChunkPager&);
+
+    size_t chunkBytes(size_t chunk) const {
+        return (size_t)(chunks[chunk].vertexCount * vertexStride + chunks[chunk].indexCount * chunks[chunk].indexSize);
+    }
+
+    void readChunks() {
+        for (;;) {
+            ReadRequest request;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]() { return stopping || !requested.empty(); });
+                if (stopping) {
+                    return;
+                }
+                request.chunk = requested.front();
+                requested.pop_front();
+            }
+            request.data.resize(chunkBytes(request.chunk));
+            FILE* file = fopen(meshChunkPath(directory, request.chunk).c_str(), "rb");
+            if (!file || fread(request.data.data(), 1, request.data.size(), file) != request.data.size()) {
+                request.data.clear();
+            }
+            if (file) {
+                fclose(file);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.push_back(std::move(request));
+        }
+    }
+
+    void upload(size_t chunk, const std::vector<unsigned char>& data) {
+        Slot& slot = slots[chunk];
+        size_t vertexBytes = (size_t)chunks[chunk].vertexCount * vertexStride;
+        glGenVertexArrays(1, &slot.vaoID);
+        glBindVertexArray(slot.vaoID);
+        glGenBuffers(1, &slot.vertexBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, slot.vertexBufferID);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, data.data(), GL_STATIC_DRAW);
+        setVertexAttributes();
+        glGenBuffers(1, &slot.indexBufferID);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, slot.indexBufferID);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.size() - vertexBytes, data.data() + vertexBytes, GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        slot.resident = true;
+    }
+
+    void evict(size_t chunk) {
+        Slot& slot = slots[chunk];
+        glDeleteBuffers(1, &slot.vertexBufferID);
+        glDeleteBuffers(1, &slot.indexBufferID);
+        glDeleteVertexArrays(1, &slot.vaoID);
+        slot.vaoID = slot.vertexBufferID = slot.indexBufferID = 0;
+        slot.resident = false;
+        residentBytes -= chunkBytes(chunk);
+    }
+
+public:
+    // setAttributes points the vertex attributes at the vertex buffer bound to
+    // GL_ARRAY_BUFFER; it is called once per chunk as it is uploaded.
+    MeshChunkPager(const std::string& directory, const std::vector<MeshChunkInfo>& chunks, size_t vertexStride,
+                   size_t budgetBytes, std::function<void()> setAttributes)
+        : directory(directory), chunks(chunks), vertexStride(vertexStride), budgetBytes(budgetBytes), residentBytes(0),
+          setVertexAttributes(setAttributes), stopping(false) {
+        Slot empty = {0, 0, 0, false, false, false, 0.0f};
+        slots.assign(chunks.size(), empty);
+        worker = std::thread(&MeshChunkPager::readChunks, this);
+    }
+
+    ~MeshChunkPager() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            changed.notify_all();
+        }
+        worker.join();
+        for (size_t chunk = 0; chunk < slots.size(); ++chunk) {
+            if (slots[chunk].resident) {
+                evict(chunk);
+            }
+        }
+    }
+
+    size_t getResidentBytes() const { return residentBytes; }
+
+    // Call once per frame on the GL thread, before draw, with the model-view-projection matrix
+    void update(const float* mvp) {
+        // Turn the chunks read since the last frame into buffers
+        std::deque<ReadRequest> arrived;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t count = std::min(completed.size(), CHUNK_PAGER_UPLOADS_PER_FRAME);
+            for (size_t i = 0; i < count; ++i) {
+                arrived.push_back(std::move(completed.front()));
+                completed.pop_front();
+            }
+        }
+        for (ReadRequest& request : arrived) {
+            slots[request.chunk].pending = false;
+            if (request.data.empty()) {
+                fprintf(stderr, "Failed to read %s\n", meshChunkPath(directory, request.chunk).c_str());
+                residentBytes -= chunkBytes(request.chunk);
+            } else {
+                upload(request.chunk, request.data);
+            }
+        }
+
+        // Rank: what can be seen, nearest first, then what is nearby but out of view
+        MeshletCuller culler(mvp);
+        order.resize(chunks.size());
+        for (size_t chunk = 0; chunk < chunks.size(); ++chunk) {
+            const float* sphere = chunks[chunk].boundingSphere;
+            float dx = sphere[0] - culler.camera[0], dy = sphere[1] - culler.camera[1], dz = sphere[2] - culler.camera[2];
+            slots[chunk].visible = culler.sphereInFrustum(sphere);
+            slots[chunk].distance = std::max(sqrtf(dx * dx + dy * dy + dz * dz) - sphere[3], 0.0f);
+            order[chunk] = chunk;
+        }
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            if (slots[a].visible != slots[b].visible) {
+                return slots[a].visible;
+            }
+            return slots[a].distance < slots[b].distance;
+        });
+
+        // The chunks that fit in the budget in that order are wanted
+        size_t wantedEnd = 0, wantedBytes = 0;
+        while (wantedEnd < order.size() && wantedBytes + chunkBytes(order[wantedEnd]) <= budgetBytes) {
+            wantedBytes += chunkBytes(order[wantedEnd++]);
+        }
+
+        // Request missing wanted chunks nearest first, evicting unwanted ones from the far end to make room
+        size_t inFlight = 0;
+        for (const Slot& slot : slots) {
+            inFlight += slot.pending ? 1 : 0;
+        }
+        size_t victim = order.size();
+        for (size_t rank = 0; rank < wantedEnd && inFlight < CHUNK_PAGER_READS_IN_FLIGHT; ++rank) {
+            size_t chunk = order[rank];
+            if (slots[chunk].resident || slots[chunk].pending) {
+                continue;
+            }
+            while (residentBytes + chunkBytes(chunk) > budgetBytes && victim > wantedEnd) {
+                --victim;
+                if (slots[order[victim]].resident) {
+                    evict(order[victim]);
+                }
+            }
+            if (residentBytes + chunkBytes(chunk) > budgetBytes) {
+                break;
+            }
+            slots[chunk].pending = true;
+            residentBytes += chunkBytes(chunk);
+            ++inFlight;
+            std::lock_guard<std::mutex> lock(mutex);
+            requested.push_back(chunk);
+            changed.notify_all();
+        }
+    }
+
+    // Draws the resident chunks that were in view at the last update, with whatever
+    // program and uniforms are bound
+    void draw() const {
+        for (size_t chunk = 0; chunk < slots.size(); ++chunk) {
+            const Slot& slot = slots[chunk];
+            if (slot.resident && slot.visible) {
+                glBindVertexArray(slot.vaoID);
+                glDrawElements(GL_TRIANGLES, (GLsizei)chunks[chunk].indexCount,
+                               chunks[chunk].indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (void*)0);
+            }
+        }
+        glBindVertexArray(0);
+    }
+};
+
+#endif
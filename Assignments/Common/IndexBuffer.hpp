@@ -0,0 +1,96 @@
+// IndexBuffer.hpp index width selection and splitting for 16-bit index buffers
+#ifndef INDEXBUFFER_HPP
+#define INDEXBUFFER_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Number of vertices a 16-bit index can address
+const size_t SHORT_INDEX_LIMIT = 65536;
+
+// A range of the index buffer drawn with its own base vertex. Indices inside a
+// sub-mesh are relative to baseVertex, so each one fits in 16 bits.
+struct SubMesh {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t baseVertex;
+    uint32_t vertexCount;
+};
+
+// Bytes per index needed to address vertexCount vertices
+inline size_t chooseIndexSize(size_t vertexCount) {
+    return vertexCount <= SHORT_INDEX_LIMIT ? 2 : 4;
+}
+
+// Copies 32-bit indices into out at the given width (2 or 4 bytes)
+inline void packIndices(const uint32_t* indices, size_t indexCount, size_t indexSize, std::vector<unsigned char>& out) {
+    out.resize(indexCount * indexSize);
+    if (indexSize == 4) {
+        if (indexCount > 0) {
+            memcpy(&out[0], indices, indexCount * 4);
+        }
+        return;
+    }
+    for (size_t i = 0; i < indexCount; ++i) {
+        uint16_t index = (uint16_t)indices[i];
+        memcpy(&out[i * 2], &index, 2);
+    }
+}
+
+// Splits a mesh into sub-meshes of at most maxVertices vertices each, walking the
+// triangles in order so an optimized index order is kept. Vertices used by more
+// than one sub-mesh are duplicated. outIndices are relative to each sub-mesh's
+// baseVertex and outVertices is the concatenation of the sub-meshes' vertices.
+inline void splitMesh(const void* vertices, size_t vertexCount, size_t stride,
+                      const uint32_t* indices, size_t indexCount, size_t maxVertices,
+                      std::vector<unsigned char>& outVertices, std::vector<uint32_t>& outIndices,
+                      std::vector<SubMesh>& subMeshes) {
+    const uint32_t unassigned = 0xFFFFFFFFu;
+    const unsigned char* source = (const unsigned char*)vertices;
+    std::vector<uint32_t> remap(vertexCount, unassigned);
+    std::vector<uint32_t> used; // Source vertices of the current sub-mesh, in local order
+
+    outVertices.clear();
+    outIndices.clear();
+    outIndices.reserve(indexCount);
+    subMeshes.clear();
+
+    SubMesh current = {0, 0, 0, 0};
+    for (size_t t = 0; t + 2 < indexCount; t += 3) {
+        size_t added = 0;
+        for (int k = 0; k < 3; ++k) {
+            if (remap[indices[t + k]] == unassigned) {
+                ++added;
+            }
+        }
+        if (used.size() + added > maxVertices) {
+            // Close the current sub-mesh and start the next one after its vertices
+            current.vertexCount = (uint32_t)used.size();
+            subMeshes.push_back(current);
+            for (size_t v = 0; v < used.size(); ++v) {
+                remap[used[v]] = unassigned;
+            }
+            current.firstIndex = (uint32_t)outIndices.size();
+            current.indexCount = 0;
+            current.baseVertex += (uint32_t)used.size();
+            used.clear();
+        }
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = indices[t + k];
+            if (remap[v] == unassigned) {
+                remap[v] = (uint32_t)used.size();
+                used.push_back(v);
+                outVertices.insert(outVertices.end(), source + v * stride, source + (v + 1) * stride);
+            }
+            outIndices.push_back(remap[v]);
+        }
+        current.indexCount += 3;
+    }
+    if (current.indexCount > 0) {
+        current.vertexCount = (uint32_t)used.size();
+        subMeshes.push_back(current);
+    }
+}
+
+#endif
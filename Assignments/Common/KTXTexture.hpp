@@ -0,0 +1,444 @@
+// KTXTexture.hpp cooked textures in KTX2 containers, every mip level ready for upload
+#ifndef KTXTEXTURE_HPP
+#define KTXTEXTURE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "BMPImage.hpp"
+#include "MipBaker.hpp"
+#include "BlockCompress.hpp"
+#include "MeshCache.hpp"
+
+// Bump when cooking changes so older containers are cooked again
+const uint32_t KTX_COOK_VERSION = 1;
+
+const unsigned char KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+// Vulkan format numbers, which KTX2 names its formats by, of the formats cooked here
+const uint32_t KTX_R8G8B8_UNORM = 23;
+const uint32_t KTX_R8G8B8_SRGB = 29;
+const uint32_t KTX_B8G8R8_UNORM = 30;
+const uint32_t KTX_B8G8R8_SRGB = 36;
+const uint32_t KTX_R8G8B8A8_UNORM = 37;
+const uint32_t KTX_R8G8B8A8_SRGB = 43;
+const uint32_t KTX_B8G8R8A8_UNORM = 44;
+const uint32_t KTX_B8G8R8A8_SRGB = 50;
+const uint32_t KTX_BC1_RGB_UNORM = 131;
+const uint32_t KTX_BC1_RGB_SRGB = 132;
+const uint32_t KTX_BC3_UNORM = 137;
+const uint32_t KTX_BC3_SRGB = 138;
+const uint32_t KTX_BC5_UNORM = 141;
+const uint32_t KTX_BC7_UNORM = 145;
+const uint32_t KTX_BC7_SRGB = 146;
+
+struct KTXFormatInfo {
+    uint32_t vkFormat;
+    bool srgb;             // Colour stored with the sRGB transfer function; otherwise linear data
+    bool compressed;
+    BlockFormat block;     // When compressed
+    unsigned int channels; // Bytes per pixel when not
+    bool bgr;
+};
+
+inline const KTXFormatInfo* ktxFormatInfo(uint32_t vkFormat) {
+    static const KTXFormatInfo formats[] = {
+        {KTX_R8G8B8_UNORM, false, false, BLOCK_BC1, 3, false},   {KTX_R8G8B8_SRGB, true, false, BLOCK_BC1, 3, false},
+        {KTX_B8G8R8_UNORM, false, false, BLOCK_BC1, 3, true},    {KTX_B8G8R8_SRGB, true, false, BLOCK_BC1, 3, true},
+        {KTX_R8G8B8A8_UNORM, false, false, BLOCK_BC1, 4, false}, {KTX_R8G8B8A8_SRGB, true, false, BLOCK_BC1, 4, false},
+        {KTX_B8G8R8A8_UNORM, false, false, BLOCK_BC1, 4, true},  {KTX_B8G8R8A8_SRGB, true, false, BLOCK_BC1, 4, true},
+        {KTX_BC1_RGB_UNORM, false, true, BLOCK_BC1, 0, false},   {KTX_BC1_RGB_SRGB, true, true, BLOCK_BC1, 0, false},
+        {KTX_BC3_UNORM, false, true, BLOCK_BC3, 0, false},       {KTX_BC3_SRGB, true, true, BLOCK_BC3, 0, false},
+        {KTX_BC5_UNORM, false, true, BLOCK_BC5, 0, false},
+        {KTX_BC7_UNORM, false, true, BLOCK_BC7, 0, false},       {KTX_BC7_SRGB, true, true, BLOCK_BC7, 0, false},
+    };
+    for (const KTXFormatInfo& format : formats) {
+        if (format.vkFormat == vkFormat) {
+            return &format;
+        }
+    }
+    return NULL;
+}
+
+// The format holding blocks of block, or if not compressed, pixels laid out as
+// channels and bgr say. BC5 has no sRGB form and is always linear.
+inline uint32_t ktxFindFormat(bool compressed, BlockFormat block, unsigned int channels, bool bgr, bool srgb) {
+    static const uint32_t candidates[] = {KTX_R8G8B8_UNORM,   KTX_R8G8B8_SRGB,   KTX_B8G8R8_UNORM,   KTX_B8G8R8_SRGB,
+                                          KTX_R8G8B8A8_UNORM, KTX_R8G8B8A8_SRGB, KTX_B8G8R8A8_UNORM, KTX_B8G8R8A8_SRGB,
+                                          KTX_BC1_RGB_UNORM,  KTX_BC1_RGB_SRGB,  KTX_BC3_UNORM,      KTX_BC3_SRGB,
+                                          KTX_BC5_UNORM,      KTX_BC7_UNORM,     KTX_BC7_SRGB};
+    for (uint32_t vkFormat : candidates) {
+        const KTXFormatInfo* info = ktxFormatInfo(vkFormat);
+        if (info->compressed != compressed || (info->srgb != srgb && !(compressed && block == BLOCK_BC5))) {
+            continue;
+        }
+        if (compressed ? info->block == block : info->channels == channels && info->bgr == bgr) {
+            return vkFormat;
+        }
+    }
+    return 0;
+}
+
+// Bytes of one texel block: a 4x4 block when compressed, a pixel otherwise
+inline size_t ktxTexelBlockBytes(const KTXFormatInfo& info) {
+    return info.compressed ? blockBytes(info.block) : info.channels;
+}
+
+inline size_t ktxLevelSize(const KTXFormatInfo& info, unsigned int width, unsigned int height) {
+    return info.compressed ? compressedLevelSize(info.block, width, height) : (size_t)width * height * info.channels;
+}
+
+// The file header, followed by one KTX2LevelIndex per level, largest first
+struct KTX2Header {
+    unsigned char identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;             // 0 for a 2D texture
+    uint32_t layerCount;             // 0 when not an array
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme; // Always 0 here: levels are stored as uploaded
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct KTX2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// Where a container was cooked from, kept under the "CookSource" key so the
+// loader can tell when the source image has changed
+struct KTXCookStamp {
+    uint64_t sourceSize; // Size, mtime and content hash of the source image
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint32_t version;    // KTX_COOK_VERSION
+    uint32_t quality;    // BlockQuality of compressed levels
+    uint32_t filter;     // MipFilter of levels 1 and up
+    uint32_t reserved;
+};
+
+// One level of a texture, rows tightly packed and bottom row first
+struct KTXLevel {
+    unsigned int width, height;
+    const unsigned char* data;
+    size_t size;
+};
+
+// A cooked texture. The levels live in storage when it was just cooked, or in file
+// when it was mapped from disk.
+struct KTXTexture {
+    uint32_t vkFormat;
+    unsigned int width, height;
+    std::vector<KTXLevel> levels; // Level 0 first
+    KTXCookStamp stamp;
+    bool stamped;                 // The file carried a stamp, or cookTexture made one
+    size_t stampOffset;           // Where the stamp sits in the file
+    std::vector<unsigned char> storage;
+    std::unique_ptr<MappedFile> file;
+
+    KTXTexture() : vkFormat(0), width(0), height(0), stamped(false), stampOffset(0) {
+        memset(&stamp, 0, sizeof(stamp));
+    }
+};
+
+inline std::string cookedTexturePath(const std::string& sourcePath) {
+    return sidecarPath(sourcePath, ".ktx2");
+}
+
+// The basic data format descriptor block every KTX2 file carries: the colour model,
+// transfer function, and which bits of a texel block belong to which channel
+inline std::vector<uint32_t> ktxDataFormatDescriptor(const KTXFormatInfo& info) {
+    struct Sample {
+        uint32_t bitOffset, bitLength, channel;
+        bool alpha;
+    };
+    std::vector<Sample> samples;
+    uint32_t model;
+    if (!info.compressed) {
+        model = 1; // RGBSDA, where alpha is channel 15
+        static const uint32_t rgb[4] = {0, 1, 2, 15}, bgr[4] = {2, 1, 0, 15};
+        for (unsigned int c = 0; c < info.channels; ++c) {
+            samples.push_back({c * 8, 8, (info.bgr ? bgr : rgb)[c], c == 3});
+        }
+    } else if (info.block == BLOCK_BC1) {
+        model = 128;
+        samples.push_back({0, 64, 0, false});
+    } else if (info.block == BLOCK_BC3) {
+        model = 130;
+        samples.push_back({0, 64, 15, true});
+        samples.push_back({64, 64, 0, false});
+    } else if (info.block == BLOCK_BC5) {
+        model = 132;
+        samples.push_back({0, 64, 0, false});
+        samples.push_back({64, 64, 1, false});
+    } else {
+        model = 134;
+        samples.push_back({0, 128, 0, false});
+    }
+
+    uint32_t blockSize = 24 + 16 * (uint32_t)samples.size();
+    std::vector<uint32_t> words;
+    words.push_back(4 + blockSize);                     // dfdTotalSize
+    words.push_back(0);                                 // Khronos vendor, basic descriptor type
+    words.push_back(2 | blockSize << 16);               // Version 1.3 and the block size
+    words.push_back(model | 1 << 8 | (info.srgb ? 2 : 1) << 16); // BT.709 primaries, sRGB or linear, straight alpha
+    words.push_back(info.compressed ? (3 | 3 << 8) : 0); // Texel block dimensions minus one
+    words.push_back((uint32_t)ktxTexelBlockBytes(info)); // Bytes in plane 0
+    words.push_back(0);
+    for (const Sample& sample : samples) {
+        // Alpha next to sRGB colour is marked linear
+        uint32_t channelType = sample.channel | (sample.alpha && info.srgb ? 0x10 : 0);
+        words.push_back(sample.bitOffset | (sample.bitLength - 1) << 16 | channelType << 24);
+        words.push_back(0);
+        words.push_back(0);
+        words.push_back(info.compressed ? 0xFFFFFFFFu : 255);
+    }
+    return words;
+}
+
+inline void appendKeyValue(std::vector<unsigned char>& kvd, const char* key, const void* value, size_t size) {
+    uint32_t length = (uint32_t)(strlen(key) + 1 + size);
+    const unsigned char* lengthBytes = (const unsigned char*)&length;
+    kvd.insert(kvd.end(), lengthBytes, lengthBytes + 4);
+    kvd.insert(kvd.end(), key, key + strlen(key) + 1);
+    kvd.insert(kvd.end(), (const unsigned char*)value, (const unsigned char*)value + size);
+    kvd.resize((kvd.size() + 3) & ~(size_t)3, 0);
+}
+
+// Maps a KTX2 file holding a 2D texture in one of the formats above. A missing file
+// returns false quietly; one that can't be used also says why.
+inline bool loadKTX(const std::string& path, KTXTexture& texture) {
+    std::unique_ptr<MappedFile> file;
+    try {
+        file.reset(new MappedFile(path));
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    KTX2Header header;
+    const KTXFormatInfo* info = NULL;
+    if (file->size() >= sizeof(header)) {
+        memcpy(&header, file->data(), sizeof(header));
+        info = ktxFormatInfo(header.vkFormat);
+    }
+    if (!info || memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 || header.pixelWidth == 0 ||
+        header.pixelHeight == 0 || header.pixelDepth != 0 || header.layerCount > 1 || header.faceCount != 1 ||
+        header.supercompressionScheme != 0 || header.levelCount == 0 || header.levelCount > 32 ||
+        sizeof(header) + header.levelCount * sizeof(KTX2LevelIndex) > file->size() ||
+        (uint64_t)header.kvdByteOffset + header.kvdByteLength > file->size()) {
+        printf("%s is not a KTX2 2D texture in a supported format\n", path.c_str());
+        return false;
+    }
+
+    std::vector<KTXLevel> levels(header.levelCount);
+    for (uint32_t i = 0; i < header.levelCount; ++i) {
+        KTX2LevelIndex entry;
+        memcpy(&entry, file->data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+        KTXLevel& level = levels[i];
+        level.width = std::max(1u, header.pixelWidth >> i);
+        level.height = std::max(1u, header.pixelHeight >> i);
+        level.size = ktxLevelSize(*info, level.width, level.height);
+        if (entry.byteLength != level.size || entry.byteOffset + entry.byteLength > file->size()) {
+            printf("%s has a damaged level %u\n", path.c_str(), i);
+            return false;
+        }
+        level.data = (const unsigned char*)file->data() + entry.byteOffset;
+    }
+
+    texture.stamped = false;
+    size_t offset = header.kvdByteOffset, end = offset + header.kvdByteLength;
+    while (offset + 4 <= end) {
+        uint32_t length;
+        memcpy(&length, file->data() + offset, 4);
+        if (length > end - offset - 4) {
+            break;
+        }
+        const char* key = file->data() + offset + 4;
+        size_t keyLength = strnlen(key, length);
+        if (keyLength == 10 && memcmp(key, "CookSource", 10) == 0 && length == 11 + sizeof(KTXCookStamp)) {
+            texture.stampOffset = offset + 4 + 11;
+            memcpy(&texture.stamp, file->data() + texture.stampOffset, sizeof(KTXCookStamp));
+            texture.stamped = true;
+        }
+        offset += (4 + length + 3) & ~(size_t)3;
+    }
+
+    texture.vkFormat = header.vkFormat;
+    texture.width = header.pixelWidth;
+    texture.height = header.pixelHeight;
+    texture.levels.swap(levels);
+    texture.storage.clear();
+    texture.file = std::move(file);
+    return true;
+}
+
+// Writes texture as a KTX2 file: header, level index, format descriptor and key/value
+// data, then the levels from the smallest up, as the format asks. The file is
+// written under a temporary name and renamed into place.
+inline bool writeKTX(const std::string& path, const KTXTexture& texture) {
+    const KTXFormatInfo* info = ktxFormatInfo(texture.vkFormat);
+    if (!info || texture.levels.empty()) {
+        return false;
+    }
+    KTX2Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    header.vkFormat = texture.vkFormat;
+    header.typeSize = 1;
+    header.pixelWidth = texture.width;
+    header.pixelHeight = texture.height;
+    header.faceCount = 1;
+    header.levelCount = (uint32_t)texture.levels.size();
+
+    std::vector<uint32_t> dfd = ktxDataFormatDescriptor(*info);
+    std::vector<unsigned char> kvd;
+    if (texture.stamped) {
+        appendKeyValue(kvd, "CookSource", &texture.stamp, sizeof(texture.stamp));
+    }
+    appendKeyValue(kvd, "KTXorientation", "ru", 3); // First row is the bottom one, as GL has it
+    appendKeyValue(kvd, "KTXwriter", "TextureCook", 12);
+
+    std::vector<KTX2LevelIndex> index(texture.levels.size());
+    header.dfdByteOffset = (uint32_t)(sizeof(header) + index.size() * sizeof(KTX2LevelIndex));
+    header.dfdByteLength = (uint32_t)(dfd.size() * 4);
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = (uint32_t)kvd.size();
+
+    // Each level starts on a multiple of both the texel block size and 4
+    size_t blockSize = ktxTexelBlockBytes(*info);
+    size_t alignment = blockSize % 4 == 0 ? blockSize : blockSize % 2 == 0 ? blockSize * 2 : blockSize * 4;
+    uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+    for (size_t i = index.size(); i-- > 0;) {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[i].byteOffset = offset;
+        index[i].byteLength = index[i].uncompressedByteLength = texture.levels[i].size;
+        offset += texture.levels[i].size;
+    }
+
+    std::string tempPath = path + ".tmp";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(index.data(), sizeof(KTX2LevelIndex), index.size(), out) == index.size() &&
+              fwrite(dfd.data(), 4, dfd.size(), out) == dfd.size() && (kvd.empty() || fwrite(kvd.data(), 1, kvd.size(), out) == kvd.size());
+    static const char padding[16] = {0};
+    uint64_t written = header.kvdByteOffset + header.kvdByteLength;
+    for (size_t i = index.size(); ok && i-- > 0;) {
+        size_t gap = (size_t)(index[i].byteOffset - written);
+        ok = fwrite(padding, 1, gap, out) == gap &&
+             fwrite(texture.levels[i].data, 1, texture.levels[i].size, out) == texture.levels[i].size;
+        written = index[i].byteOffset + index[i].byteLength;
+    }
+    ok = fclose(out) == 0 && ok;
+
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Cooks image, read from sourcePath, into texture: the mip chain is baked with
+// filter, in linear light unless vkFormat holds linear data, and every level is
+// block compressed at quality or repacked without row padding. A raw format must
+// match the image's own channel layout.
+inline bool cookTexture(const std::string& sourcePath, const BMPImage& image, uint32_t vkFormat, BlockQuality quality,
+                        MipFilter filter, KTXTexture& texture) {
+    const KTXFormatInfo* info = ktxFormatInfo(vkFormat);
+    if (!info || (!info->compressed && (info->channels != image.channels || info->bgr != image.bgr))) {
+        return false;
+    }
+    MipChain mips;
+    bakeMipChain(image, filter, mips, info->srgb);
+
+    texture.vkFormat = vkFormat;
+    texture.width = image.width;
+    texture.height = image.height;
+    texture.levels.clear();
+    texture.file.reset();
+    if (info->compressed) {
+        CompressedTexture blocks;
+        compressTexture(image, mips, info->block, quality, blocks);
+        texture.storage.swap(blocks.storage);
+        for (const CompressedLevel& level : blocks.levels) {
+            texture.levels.push_back({level.width, level.height, level.data, level.size});
+        }
+    } else {
+        size_t rowBytes = (size_t)image.width * image.channels;
+        texture.storage.resize(rowBytes * image.height + mips.storage.size());
+        for (unsigned int y = 0; y < image.height; ++y) {
+            unsigned char* row = &texture.storage[y * rowBytes];
+            memcpy(row, image.row(y), rowBytes);
+            // Padding bytes become opaque alpha, as in the baked levels
+            if (image.channels == 4 && !image.hasAlpha) {
+                for (size_t x = 3; x < rowBytes; x += 4) {
+                    row[x] = 255;
+                }
+            }
+        }
+        if (!mips.storage.empty()) {
+            memcpy(&texture.storage[rowBytes * image.height], mips.storage.data(), mips.storage.size());
+        }
+        size_t offset = 0;
+        texture.levels.push_back({image.width, image.height, texture.storage.data(), rowBytes * image.height});
+        offset += rowBytes * image.height;
+        for (const MipLevel& level : mips.levels) {
+            texture.levels.push_back({level.width, level.height, &texture.storage[offset], level.size});
+            offset += level.size;
+        }
+    }
+
+    memset(&texture.stamp, 0, sizeof(texture.stamp));
+    texture.stamped = statSource(sourcePath, texture.stamp.sourceSize, texture.stamp.sourceMtime);
+    if (texture.stamped) {
+        texture.stamp.sourceHash = image.file ? hashSourceBytes(sourcePath, image.file->data(), image.file->size())
+                                              : hashSourceFile(sourcePath);
+    }
+    texture.stamp.version = KTX_COOK_VERSION;
+    texture.stamp.quality = (uint32_t)quality;
+    texture.stamp.filter = (uint32_t)filter;
+    return true;
+}
+
+// Whether texture, mapped from the container of sourcePath, was cooked from the
+// source as it is now. Size and mtime are checked first; if only the mtime differs
+// the source is hashed, and a matching hash keeps the container and refreshes its stamp.
+inline bool cookedTextureCurrent(const std::string& sourcePath, KTXTexture& texture) {
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    if (!texture.stamped || texture.stamp.version != KTX_COOK_VERSION ||
+        !statSource(sourcePath, sourceSize, sourceMtime) || texture.stamp.sourceSize != sourceSize) {
+        return false;
+    }
+    if (texture.stamp.sourceMtime == sourceMtime) {
+        return true;
+    }
+    if (texture.stamp.sourceHash != hashSourceFile(sourcePath)) {
+        return false;
+    }
+    texture.stamp.sourceMtime = sourceMtime;
+    if (FILE* out = fopen(cookedTexturePath(sourcePath).c_str(), "r+b")) {
+        if (fseek(out, (long)texture.stampOffset, SEEK_SET) == 0) {
+            fwrite(&texture.stamp, sizeof(texture.stamp), 1, out);
+        }
+        fclose(out);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,156 @@
+// MappedFile.hpp read-only memory mapping of a whole file
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Reads a path that is not a plain file into out, or returns false to map it as one.
+// Unset unless the program opts in, e.g. to archive paths with enableArchivePaths()
+// (ZipArchive.hpp), so programs that only map plain files need not link zlib.
+typedef bool (*PathReader)(const std::string& path, std::vector<char>& out);
+
+inline PathReader& pathReader() {
+    static PathReader reader = NULL;
+    return reader;
+}
+
+// Files read ahead of time (batched reads, archive entries inflated in parallel) wait
+// here until the first MappedFile of their path takes them. A path still being read
+// is pending, and a MappedFile of it waits for that read rather than starting its own.
+struct PrefetchedFiles {
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::map<std::string, std::vector<char> > files;
+    std::set<std::string> pending;
+
+    // Never destroyed: background reads may still be storing files at exit
+    static PrefetchedFiles& instance() {
+        static PrefetchedFiles* prefetched = new PrefetchedFiles();
+        return *prefetched;
+    }
+};
+
+// Marks paths as being read ahead, before the reads start
+inline void expectPrefetchedFiles(const std::vector<std::string>& paths) {
+    PrefetchedFiles& prefetched = PrefetchedFiles::instance();
+    std::lock_guard<std::mutex> lock(prefetched.mutex);
+    prefetched.pending.insert(paths.begin(), paths.end());
+}
+
+inline void storePrefetchedFile(const std::string& path, std::vector<char>& data) {
+    PrefetchedFiles& prefetched = PrefetchedFiles::instance();
+    std::lock_guard<std::mutex> lock(prefetched.mutex);
+    prefetched.files[path].swap(data);
+    prefetched.pending.erase(path);
+    prefetched.arrived.notify_all();
+}
+
+// Ends the read ahead of a path that failed; its MappedFile reads it, and reports why
+inline void dropPrefetchedFile(const std::string& path) {
+    PrefetchedFiles& prefetched = PrefetchedFiles::instance();
+    std::lock_guard<std::mutex> lock(prefetched.mutex);
+    prefetched.pending.erase(path);
+    prefetched.arrived.notify_all();
+}
+
+// Moves the prefetched contents of path into out, waiting for them if path is still
+// being read; false if there are none
+inline bool takePrefetchedFile(const std::string& path, std::vector<char>& out) {
+    PrefetchedFiles& prefetched = PrefetchedFiles::instance();
+    std::unique_lock<std::mutex> lock(prefetched.mutex);
+    prefetched.arrived.wait(lock, [&]() { return prefetched.pending.count(path) == 0; });
+    std::map<std::string, std::vector<char> >::iterator found = prefetched.files.find(path);
+    if (found == prefetched.files.end()) {
+        return false;
+    }
+    out.swap(found->second);
+    prefetched.files.erase(found);
+    return true;
+}
+
+// Maps a file read-only for the lifetime of the object. On platforms without
+// mmap the file is read into memory instead, so callers only see data()/size().
+// A file that was prefetched is taken from memory as it is, and a path the pathReader
+// handles (an archive entry such as "Assets.zip/dir/file.ply") is read into memory.
+class MappedFile {
+    const char* bytes;
+    size_t length;
+    std::vector<char> buffer; // Holds the file when it is not mapped
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    explicit MappedFile(const std::string& filename) : bytes(NULL), length(0) {
+        if (takePrefetchedFile(filename, buffer) || (pathReader() && pathReader()(filename, buffer))) {
+            length = buffer.size();
+            bytes = length ? &buffer[0] : NULL;
+            return;
+        }
+#ifndef _WIN32
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Could not stat file: " + filename);
+        }
+        length = (size_t)info.st_size;
+        if (length > 0) {
+            void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Could not map file: " + filename);
+            }
+            // The whole file is consumed front to back
+            madvise(mapping, length, MADV_SEQUENTIAL);
+            bytes = (const char*)mapping;
+        }
+        // The mapping keeps its own reference to the file
+        close(fd);
+#else
+        std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+        file.seekg(0, std::ios::end);
+        length = (size_t)file.tellg();
+        file.seekg(0, std::ios::beg);
+        buffer.resize(length);
+        if (length > 0 && !file.read(&buffer[0], length)) {
+            throw std::runtime_error("Could not read file: " + filename);
+        }
+        bytes = length ? &buffer[0] : NULL;
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (bytes && buffer.empty()) {
+            munmap((void*)bytes, length);
+        }
+#endif
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+#endif
@@ -0,0 +1,292 @@
+// MeshCache.hpp cooked .meshbin sidecar files holding GPU-ready mesh buffers
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <sys/stat.h>
+
+#include "MappedFile.hpp"
+#include "ZipArchive.hpp"
+#include "VertexPacking.hpp"
+#include "IndexBuffer.hpp"
+#include "MeshSimplify.hpp"
+#include "Meshlets.hpp"
+
+// Bump when the file layout changes so stale caches are re-cooked
+const uint32_t MESHBIN_VERSION = 6;
+
+// A .meshbin file is this header followed by the vertex blob, the index blob, the
+// sub-mesh, LOD and meshlet tables, each starting on a 16 byte boundary. Both blobs
+// are exactly what gets handed to glBufferData, so a warm load is a map and a few
+// pointer offsets.
+struct MeshBinHeader {
+    char magic[8];          // "MESHBIN"
+    uint32_t version;
+    uint32_t layoutTag;     // Identifies the vertex struct the blob was cooked for
+    uint32_t vertexStride;
+    uint32_t indexSize;     // Bytes per index
+    uint64_t sourceSize;    // Size, mtime and content hash of the PLY it was cooked from
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t subMeshCount;  // Zero when the whole index buffer is drawn at once
+    uint64_t subMeshOffset;
+    uint64_t lodCount;      // Zero when only the full index buffer exists
+    uint64_t lodOffset;
+    uint64_t meshletCount;  // Zero when the mesh is drawn without culling
+    uint64_t meshletOffset;
+    VertexDequantize dequantize; // Undoes the vertex quantization; all zero if none was given
+    float boundingSphere[4];
+};
+
+// What a .meshbin holds: the GPU buffers of a mesh and the tables that say how to
+// draw them. Only the vertex and index blobs are required.
+struct MeshBuffers {
+    const void* vertexData;
+    const void* indexData;
+    size_t vertexCount;
+    size_t indexCount;
+    size_t vertexStride;
+    size_t indexSize;
+    const SubMesh* subMeshes;    // From splitMesh
+    size_t subMeshCount;
+    const MeshLod* lods;         // From buildLodChain
+    size_t lodCount;
+    const Meshlet* meshlets;     // From buildMeshlets
+    size_t meshletCount;
+    VertexDequantize dequantize; // From packVertices
+    float boundingSphere[4];
+
+    MeshBuffers() : vertexData(NULL), indexData(NULL), vertexCount(0), indexCount(0), vertexStride(0), indexSize(0),
+                    subMeshes(NULL), subMeshCount(0), lods(NULL), lodCount(0),
+                    meshlets(NULL), meshletCount(0) {
+        memset(&dequantize, 0, sizeof(dequantize));
+        memset(boundingSphere, 0, sizeof(boundingSphere));
+    }
+};
+
+// A cooked mesh mapped from disk. The pointers stay valid for the lifetime of the object.
+struct CookedMesh : MeshBuffers {
+    std::unique_ptr<MappedFile> file;
+};
+
+// sourcePath with its extension replaced by extension (which includes the dot). Files
+// inside a zip archive get theirs next to the archive, named after the archive and
+// the entry ("Assets.zip/dir/a.ply" -> "Assets_dir_a.meshbin").
+inline std::string sidecarPath(const std::string& sourcePath, const char* extension) {
+    std::string archive, entry;
+    if (splitArchivePath(sourcePath, archive, entry)) {
+        std::replace(entry.begin(), entry.end(), '/', '_');
+        return sidecarPath(archive.substr(0, archive.size() - 4) + "_" + entry, extension);
+    }
+    size_t dot = sourcePath.find_last_of('.');
+    size_t slash = sourcePath.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return sourcePath + extension;
+    }
+    return sourcePath.substr(0, dot) + extension;
+}
+
+inline std::string meshCachePath(const std::string& sourcePath) {
+    return sidecarPath(sourcePath, ".meshbin");
+}
+
+// 64-bit content hash, eight bytes per step
+inline uint64_t hashBytes64(const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ (size * 0xFF51AFD7ED558CCDull);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        h = (h ^ word) * 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < size; ++i, shift += 8) {
+        tail |= (uint64_t)p[i] << shift;
+    }
+    h = (h ^ tail) * 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 32;
+    return h;
+}
+
+inline bool statSource(const std::string& path, uint64_t& size, int64_t& mtime) {
+    if (statArchivePath(path, size, mtime)) {
+        return true;
+    }
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    size = (uint64_t)info.st_size;
+    mtime = (int64_t)info.st_mtime;
+    return true;
+}
+
+// A file inside a zip archive is hashed from the CRC-32 and size in the archive's
+// central directory, so it is never inflated for this
+inline bool hashArchiveSource(const std::string& path, uint64_t& hash) {
+    uint32_t crc;
+    uint64_t size;
+    if (!checksumArchivePath(path, crc, size)) {
+        return false;
+    }
+    uint64_t checksum[2] = {crc, size};
+    hash = hashBytes64(checksum, sizeof(checksum));
+    return true;
+}
+
+// Content hash of the source file at path, whose bytes the caller already holds
+inline uint64_t hashSourceBytes(const std::string& path, const void* data, size_t size) {
+    uint64_t hash;
+    return hashArchiveSource(path, hash) ? hash : hashBytes64(data, size);
+}
+
+// Content hash of the source file at path, reading it if it is not in an archive
+inline uint64_t hashSourceFile(const std::string& path) {
+    uint64_t hash;
+    if (hashArchiveSource(path, hash)) {
+        return hash;
+    }
+    MappedFile source(path);
+    return hashBytes64(source.data(), source.size());
+}
+
+inline uint64_t alignMeshBin(uint64_t offset) {
+    return (offset + 15) & ~(uint64_t)15;
+}
+
+// Maps the cooked sidecar of sourcePath if it was built for this vertex layout from
+// the current source. Size and mtime are checked first; if only those differ the
+// source is hashed, and a matching hash reuses the cache and refreshes its stamp.
+inline bool loadMeshCache(const std::string& sourcePath, uint32_t layoutTag, size_t vertexStride, CookedMesh& cooked) {
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    if (!statSource(sourcePath, sourceSize, sourceMtime)) {
+        return false;
+    }
+
+    std::string cachePath = meshCachePath(sourcePath);
+    std::unique_ptr<MappedFile> file;
+    try {
+        file.reset(new MappedFile(cachePath));
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    MeshBinHeader header;
+    if (file->size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, "MESHBIN", 8) != 0 || header.version != MESHBIN_VERSION ||
+        header.layoutTag != layoutTag || header.vertexStride != vertexStride ||
+        header.vertexOffset + header.vertexCount * header.vertexStride > file->size() ||
+        header.indexOffset + header.indexCount * header.indexSize > file->size() ||
+        header.subMeshOffset + header.subMeshCount * sizeof(SubMesh) > file->size() ||
+        header.lodOffset + header.lodCount * sizeof(MeshLod) > file->size() ||
+        header.meshletOffset + header.meshletCount * sizeof(Meshlet) > file->size()) {
+        return false;
+    }
+
+    if (header.sourceSize != sourceSize || header.sourceMtime != sourceMtime) {
+        if (header.sourceSize != sourceSize || header.sourceHash != hashSourceFile(sourcePath)) {
+            return false;
+        }
+        // Same content with a new timestamp (fresh checkout, copy, touch)
+        header.sourceMtime = sourceMtime;
+        if (FILE* out = fopen(cachePath.c_str(), "r+b")) {
+            fwrite(&header, sizeof(header), 1, out);
+            fclose(out);
+        }
+    }
+
+    cooked.vertexData = file->data() + header.vertexOffset;
+    cooked.indexData = file->data() + header.indexOffset;
+    cooked.vertexCount = (size_t)header.vertexCount;
+    cooked.indexCount = (size_t)header.indexCount;
+    cooked.vertexStride = header.vertexStride;
+    cooked.indexSize = header.indexSize;
+    cooked.subMeshes = (const SubMesh*)(file->data() + header.subMeshOffset);
+    cooked.subMeshCount = (size_t)header.subMeshCount;
+    cooked.lods = (const MeshLod*)(file->data() + header.lodOffset);
+    cooked.lodCount = (size_t)header.lodCount;
+    cooked.meshlets = (const Meshlet*)(file->data() + header.meshletOffset);
+    cooked.meshletCount = (size_t)header.meshletCount;
+    cooked.dequantize = header.dequantize;
+    memcpy(cooked.boundingSphere, header.boundingSphere, sizeof(header.boundingSphere));
+    cooked.file = std::move(file);
+    return true;
+}
+
+// Writes the sidecar for sourcePath. The file is written under a temporary name
+// and renamed into place, so a crash never leaves a half written cache behind.
+// source, if the caller still has the source open, is hashed instead of reading it again.
+inline bool writeMeshCache(const std::string& sourcePath, uint32_t layoutTag, const MeshBuffers& mesh,
+                           const MappedFile* source = NULL) {
+    MeshBinHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MESHBIN", 8);
+    header.version = MESHBIN_VERSION;
+    header.layoutTag = layoutTag;
+    header.vertexStride = (uint32_t)mesh.vertexStride;
+    header.indexSize = (uint32_t)mesh.indexSize;
+    if (!statSource(sourcePath, header.sourceSize, header.sourceMtime)) {
+        return false;
+    }
+    header.sourceHash = source ? hashSourceBytes(sourcePath, source->data(), source->size()) : hashSourceFile(sourcePath);
+    header.vertexCount = mesh.vertexCount;
+    header.indexCount = mesh.indexCount;
+    header.subMeshCount = mesh.subMeshCount;
+    header.lodCount = mesh.lodCount;
+    header.meshletCount = mesh.meshletCount;
+    header.vertexOffset = alignMeshBin(sizeof(header));
+    header.indexOffset = alignMeshBin(header.vertexOffset + mesh.vertexCount * mesh.vertexStride);
+    header.subMeshOffset = alignMeshBin(header.indexOffset + mesh.indexCount * mesh.indexSize);
+    header.lodOffset = alignMeshBin(header.subMeshOffset + mesh.subMeshCount * sizeof(SubMesh));
+    header.meshletOffset = alignMeshBin(header.lodOffset + mesh.lodCount * sizeof(MeshLod));
+    header.dequantize = mesh.dequantize;
+    memcpy(header.boundingSphere, mesh.boundingSphere, sizeof(header.boundingSphere));
+
+    std::string cachePath = meshCachePath(sourcePath);
+    std::string tempPath = cachePath + ".tmp";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+
+    // Each section is padded up to its offset from the end of the previous one
+    static const char padding[16] = {0};
+    uint64_t written = 0;
+    auto section = [&](uint64_t offset, const void* data, size_t size) {
+        size_t gap = (size_t)(offset - written);
+        bool sectionOk = fwrite(padding, 1, gap, out) == gap && (size == 0 || fwrite(data, 1, size, out) == size);
+        written = offset + size;
+        return sectionOk;
+    };
+    bool ok = section(0, &header, sizeof(header));
+    ok = ok && section(header.vertexOffset, mesh.vertexData, mesh.vertexCount * mesh.vertexStride);
+    ok = ok && section(header.indexOffset, mesh.indexData, mesh.indexCount * mesh.indexSize);
+    ok = ok && section(header.subMeshOffset, mesh.subMeshes, mesh.subMeshCount * sizeof(SubMesh));
+    ok = ok && section(header.lodOffset, mesh.lods, mesh.lodCount * sizeof(MeshLod));
+    ok = ok && section(header.meshletOffset, mesh.meshlets, mesh.meshletCount * sizeof(Meshlet));
+    ok = fclose(out) == 0 && ok;
+
+    if (!ok || rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,407 @@
+// MeshChunks.hpp offline spatial partitioning of meshes too large to hold in memory
+#ifndef MESHCHUNKS_HPP
+#define MESHCHUNKS_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "MappedFile.hpp"
+#include "MeshCache.hpp"
+#include "PLYReader.hpp"
+#include "VertexPacking.hpp"
+#include "IndexBuffer.hpp"
+#include "MeshSimplify.hpp"
+
+// Bump when the manifest or chunk file layout changes
+const uint32_t MESHCHUNKS_VERSION = 1;
+// Triangles per chunk the grid is sized for
+const size_t MESH_CHUNK_TRIANGLES = 1 << 16;
+// Vertices parsed and packed at a time while spilling the source
+const size_t MESH_CHUNK_PARSE_VERTICES = 1 << 16;
+// Most triangles gathered in memory at once while writing the chunks
+const size_t MESH_CHUNK_BATCH_TRIANGLES = 1 << 24;
+// Finest grid the partitioner will try, per axis
+const uint32_t MESH_CHUNK_MAX_CELLS = 128;
+
+// A partitioned mesh is a directory next to the source ("Scan.ply" -> "Scan.chunks/")
+// holding manifest.bin and one chunk_NNNNNN.bin per non-empty grid cell. A chunk file
+// is its packed vertices followed by its indices, both ready for glBufferData. The
+// manifest is this header and a MeshChunkInfo per chunk.
+struct MeshChunksHeader {
+    char magic[8];          // "MCHUNKS"
+    uint32_t version;
+    uint32_t layoutTag;     // Identifies the packed vertex layout of the chunks
+    uint32_t vertexStride;
+    uint32_t reserved;
+    uint64_t sourceSize;    // Size and mtime of the PLY it was partitioned from
+    int64_t sourceMtime;
+    uint64_t chunkCount;
+    float boundingSphere[4];
+};
+
+struct MeshChunkInfo {
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint32_t indexSize;     // 2 or 4, whichever the chunk's vertex count allows
+    uint32_t reserved;
+    float boundingSphere[4];
+};
+
+inline std::string meshChunksDirectory(const std::string& sourcePath) {
+    return sidecarPath(sourcePath, ".chunks");
+}
+
+// Creates the directory at path unless it is already there
+inline bool makeDirectory(const std::string& path) {
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+inline std::string meshChunkPath(const std::string& directory, size_t chunk) {
+    char name[32];
+    snprintf(name, sizeof(name), "/chunk_%06zu.bin", chunk);
+    return directory + name;
+}
+
+// Reads the manifest of the partitioned sourcePath if it was built for this vertex
+// layout from the current source.
+inline bool loadMeshChunks(const std::string& sourcePath, uint32_t layoutTag, size_t vertexStride,
+                           std::vector<MeshChunkInfo>& chunks, float boundingSphere[4]) {
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    if (!statSource(sourcePath, sourceSize, sourceMtime)) {
+        return false;
+    }
+    FILE* file = fopen((meshChunksDirectory(sourcePath) + "/manifest.bin").c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    MeshChunksHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "MCHUNKS", 8) == 0 &&
+              header.version == MESHCHUNKS_VERSION && header.layoutTag == layoutTag &&
+              header.vertexStride == vertexStride && header.sourceSize == sourceSize && header.sourceMtime == sourceMtime;
+    if (ok) {
+        chunks.resize((size_t)header.chunkCount);
+        ok = chunks.empty() || fread(chunks.data(), sizeof(MeshChunkInfo), chunks.size(), file) == chunks.size();
+        memcpy(boundingSphere, header.boundingSphere, sizeof(header.boundingSphere));
+    }
+    fclose(file);
+    return ok;
+}
+
+// Appends to a scratch file through a fixed-size buffer
+class ScratchWriter {
+    FILE* file;
+    std::vector<unsigned char> buffer;
+    size_t used;
+    bool failed;
+
+    ScratchWriter(const ScratchWriter&);
+    ScratchWriter& operator=(const ScratchWriter&);
+
+public:
+    explicit ScratchWriter(const std::string& path) : file(fopen(path.c_str(), "wb")), buffer(1 << 20), used(0), failed(file == NULL) {}
+
+    ~ScratchWriter() {
+        close();
+    }
+
+    void write(const void* data, size_t size) {
+        if (used + size > buffer.size()) {
+            flush();
+        }
+        if (size > buffer.size()) {
+            failed = failed || !file || fwrite(data, 1, size, file) != size;
+            return;
+        }
+        memcpy(&buffer[used], data, size);
+        used += size;
+    }
+
+    void flush() {
+        failed = failed || !file || (used > 0 && fwrite(buffer.data(), 1, used, file) != used);
+        used = 0;
+    }
+
+    // False if anything failed to reach the disk
+    bool close() {
+        if (file) {
+            flush();
+            failed = fclose(file) != 0 || failed;
+            file = NULL;
+        }
+        return !failed;
+    }
+};
+
+// Uniform grid over the mesh bounds that triangles are bucketed into by centroid
+struct ChunkGrid {
+    float lower[3];
+    float cellSize[3];
+    uint32_t cells[3];
+
+    uint32_t cellOf(const float* a, const float* b, const float* c) const {
+        uint32_t cell = 0;
+        for (int k = 2; k >= 0; --k) {
+            float centroid = (a[k] + b[k] + c[k]) * (1.0f / 3.0f);
+            int64_t i = cellSize[k] > 0 ? (int64_t)((centroid - lower[k]) / cellSize[k]) : 0;
+            i = std::min<int64_t>(std::max<int64_t>(i, 0), cells[k] - 1);
+            cell = cell * cells[k] + (uint32_t)i;
+        }
+        return cell;
+    }
+
+    size_t cellCount() const { return (size_t)cells[0] * cells[1] * cells[2]; }
+};
+
+// Buckets the triangles of the scratch files written by partitionMesh into grid cells
+// and writes each non-empty cell out as a chunk, followed by the manifest.
+inline bool writeMeshChunks(const std::string& directory, const std::string& vertexScratch, const std::string& triangleScratch,
+                            size_t vertexCount, const float lower[3], const float upper[3],
+                            const PackedVertexLayout& packedLayout, size_t chunkTriangles, MeshChunksHeader& header) {
+    MappedFile vertexFile(vertexScratch), triangleFile(triangleScratch);
+    const size_t stride = packedLayout.stride;
+    const unsigned char* vertexData = (const unsigned char*)vertexFile.data();
+    const uint32_t* triangles = (const uint32_t*)triangleFile.data();
+    size_t triangleCount = triangleFile.size() / (3 * sizeof(uint32_t));
+    if (vertexFile.size() != vertexCount * stride) {
+        return false;
+    }
+    for (size_t t = 0; t < triangleCount * 3; ++t) {
+        if (triangles[t] >= vertexCount) {
+            return false;
+        }
+    }
+    auto position = [&](uint32_t vertex) {
+        return (const float*)(vertexData + (size_t)vertex * stride + packedLayout.positionOffset);
+    };
+
+    // Size the cells for chunkTriangles each as if the triangles filled the bounds
+    // evenly, then halve them while some cell is still far over that
+    ChunkGrid grid;
+    float largest = std::max(std::max(upper[0] - lower[0], upper[1] - lower[1]), upper[2] - lower[2]);
+    float extent[3];
+    for (int k = 0; k < 3; ++k) {
+        grid.lower[k] = lower[k];
+        extent[k] = std::max(upper[k] - lower[k], largest > 0 ? largest * 1e-6f : 1.0f);
+    }
+    double cellsWanted = std::max<double>((double)triangleCount / std::max<size_t>(chunkTriangles, 1), 1.0);
+    // Axes the mesh is flat along (a terrain, a facade) get a single cell
+    double volume = 1.0;
+    int axes = 0;
+    for (int k = 0; k < 3; ++k) {
+        if (extent[k] > largest * 1e-3f) {
+            volume *= extent[k];
+            ++axes;
+        }
+    }
+    double side = axes > 0 ? pow(volume / cellsWanted, 1.0 / axes) : 1.0;
+    for (int k = 0; k < 3; ++k) {
+        bool flat = extent[k] <= largest * 1e-3f;
+        grid.cells[k] = flat ? 1 : (uint32_t)std::min<double>(std::max(ceil(extent[k] / side), 1.0), MESH_CHUNK_MAX_CELLS);
+    }
+    std::vector<uint32_t> counts;
+    for (;;) {
+        for (int k = 0; k < 3; ++k) {
+            grid.cellSize[k] = extent[k] / grid.cells[k];
+        }
+        counts.assign(grid.cellCount(), 0);
+        uint32_t fullest = 0;
+        for (size_t t = 0; t < triangleCount; ++t) {
+            const uint32_t* triangle = triangles + t * 3;
+            uint32_t& count = counts[grid.cellOf(position(triangle[0]), position(triangle[1]), position(triangle[2]))];
+            fullest = std::max(fullest, ++count);
+        }
+        bool refinable = false;
+        for (int k = 0; k < 3; ++k) {
+            refinable = refinable || (grid.cells[k] < MESH_CHUNK_MAX_CELLS && extent[k] > largest * 1e-3f);
+        }
+        if (fullest <= 4 * chunkTriangles || !refinable) {
+            break;
+        }
+        for (int k = 0; k < 3; ++k) {
+            if (extent[k] > largest * 1e-3f) {
+                grid.cells[k] = std::min(grid.cells[k] * 2, MESH_CHUNK_MAX_CELLS);
+            }
+        }
+    }
+
+    // Gather the triangles of a run of cells at a time, one scan of the triangle file
+    // per run, and write each cell of the run as a chunk with only the vertices it uses
+    std::vector<MeshChunkInfo> chunks;
+    std::vector<uint32_t> gathered, globals, locals;
+    std::vector<size_t> starts;
+    std::vector<unsigned char> chunkVertices, chunkIndices;
+    size_t firstCell = 0;
+    while (firstCell < counts.size()) {
+        size_t lastCell = firstCell, batchTriangles = 0;
+        starts.clear();
+        while (lastCell < counts.size() && (batchTriangles == 0 || batchTriangles + counts[lastCell] <= MESH_CHUNK_BATCH_TRIANGLES)) {
+            starts.push_back(batchTriangles);
+            batchTriangles += counts[lastCell++];
+        }
+        starts.push_back(batchTriangles);
+        if (batchTriangles == 0) {
+            firstCell = lastCell;
+            continue;
+        }
+
+        gathered.resize(batchTriangles);
+        std::vector<size_t> fill(starts.begin(), starts.end() - 1);
+        for (size_t t = 0; t < triangleCount; ++t) {
+            const uint32_t* triangle = triangles + t * 3;
+            size_t cell = grid.cellOf(position(triangle[0]), position(triangle[1]), position(triangle[2]));
+            if (cell >= firstCell && cell < lastCell) {
+                gathered[fill[cell - firstCell]++] = (uint32_t)t;
+            }
+        }
+
+        for (size_t cell = firstCell; cell < lastCell; ++cell) {
+            size_t begin = starts[cell - firstCell], end = starts[cell - firstCell + 1];
+            if (begin == end) {
+                continue;
+            }
+            globals.clear();
+            for (size_t i = begin; i < end; ++i) {
+                globals.insert(globals.end(), triangles + (size_t)gathered[i] * 3, triangles + (size_t)gathered[i] * 3 + 3);
+            }
+            locals.resize(globals.size());
+            std::vector<uint32_t> corners(globals);
+            std::sort(globals.begin(), globals.end());
+            globals.erase(std::unique(globals.begin(), globals.end()), globals.end());
+            for (size_t i = 0; i < corners.size(); ++i) {
+                locals[i] = (uint32_t)(std::lower_bound(globals.begin(), globals.end(), corners[i]) - globals.begin());
+            }
+            chunkVertices.resize(globals.size() * stride);
+            for (size_t v = 0; v < globals.size(); ++v) {
+                memcpy(&chunkVertices[v * stride], vertexData + (size_t)globals[v] * stride, stride);
+            }
+
+            MeshChunkInfo info;
+            memset(&info, 0, sizeof(info));
+            info.vertexCount = globals.size();
+            info.indexCount = locals.size();
+            info.indexSize = (uint32_t)chooseIndexSize(globals.size());
+            computeBoundingSphere((const float*)(chunkVertices.data() + packedLayout.positionOffset), stride, globals.size(),
+                                  info.boundingSphere);
+            packIndices(locals.data(), locals.size(), info.indexSize, chunkIndices);
+
+            FILE* out = fopen(meshChunkPath(directory, chunks.size()).c_str(), "wb");
+            bool written = out && fwrite(chunkVertices.data(), 1, chunkVertices.size(), out) == chunkVertices.size() &&
+                           fwrite(chunkIndices.data(), 1, chunkIndices.size(), out) == chunkIndices.size();
+            if (out) {
+                written = fclose(out) == 0 && written;
+            }
+            if (!written) {
+                return false;
+            }
+            chunks.push_back(info);
+        }
+        firstCell = lastCell;
+    }
+
+    // Chunk files past the new count are left over from an earlier partition
+    for (size_t chunk = chunks.size(); remove(meshChunkPath(directory, chunk).c_str()) == 0; ++chunk) {
+    }
+
+    computeBoundingSphere((const float*)(vertexData + packedLayout.positionOffset), stride, vertexCount, header.boundingSphere);
+    header.chunkCount = chunks.size();
+    std::string manifestPath = directory + "/manifest.bin", tempPath = manifestPath + ".tmp";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              (chunks.empty() || fwrite(chunks.data(), sizeof(MeshChunkInfo), chunks.size(), out) == chunks.size());
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tempPath.c_str(), manifestPath.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Splits the PLY at sourcePath, opened as reader, into spatial chunks next to it (see
+// MeshChunksHeader) without ever holding it whole: vertices are packed into a scratch file as they are
+// parsed and faces fan triangulated into another, then both are mapped and the
+// triangles bucketed by grid cell, a batch of cells at a time. The grid starts at
+// about chunkTriangles per cell and is refined while cells stay far over that, since
+// a scanned surface only fills a fraction of its bounding box.
+//
+// VertexT is what the PLY is decoded into, with float positions at positionOffset
+// and float UVs at uvOffset. packedLayout must use POSITION_FLOAT32: chunks are
+// loaded independently, so there is no common range to quantize them to.
+template <typename VertexT>
+bool partitionMesh(const std::string& sourcePath, PLYChunkedReader& reader, const PLYVertexLayout& plyLayout,
+                   size_t positionOffset, size_t uvOffset, const PackedVertexLayout& packedLayout, uint32_t layoutTag,
+                   size_t chunkTriangles = MESH_CHUNK_TRIANGLES) {
+    MeshChunksHeader header;
+    memset(&header, 0, sizeof(header));
+    if (packedLayout.positionFormat != POSITION_FLOAT32 || !statSource(sourcePath, header.sourceSize, header.sourceMtime)) {
+        return false;
+    }
+    memcpy(header.magic, "MCHUNKS", 8);
+    header.version = MESHCHUNKS_VERSION;
+    header.layoutTag = layoutTag;
+    header.vertexStride = packedLayout.stride;
+
+    std::string directory = meshChunksDirectory(sourcePath);
+    if (!makeDirectory(directory)) {
+        return false;
+    }
+    std::string vertexScratch = directory + "/vertices.tmp", triangleScratch = directory + "/triangles.tmp";
+
+    float lower[3] = {0, 0, 0}, upper[3] = {0, 0, 0};
+    size_t vertexCount = 0;
+    bool ok;
+    try {
+        ScratchWriter vertexOut(vertexScratch), triangleOut(triangleScratch);
+        std::vector<unsigned char> packed;
+        VertexDequantize identity;
+        reader.decode<VertexT>(plyLayout, MESH_CHUNK_PARSE_VERTICES,
+            [&](const VertexT* vertices, size_t, size_t count) {
+                const char* base = (const char*)vertices;
+                packVertices(packedLayout, count, sizeof(VertexT), (const float*)(base + positionOffset),
+                             (const float*)(base + uvOffset), NULL, packed, identity);
+                for (size_t v = 0; v < count; ++v) {
+                    const float* p = (const float*)(base + v * sizeof(VertexT) + positionOffset);
+                    for (int k = 0; k < 3; ++k) {
+                        lower[k] = vertexCount + v == 0 ? p[k] : std::min(lower[k], p[k]);
+                        upper[k] = vertexCount + v == 0 ? p[k] : std::max(upper[k], p[k]);
+                    }
+                }
+                vertexOut.write(packed.data(), packed.size());
+                vertexCount += count;
+            },
+            [&](const uint32_t* polygon, uint32_t count) {
+                for (uint32_t j = 2; j < count; ++j) {
+                    uint32_t triangle[3] = {polygon[0], polygon[j - 1], polygon[j]};
+                    triangleOut.write(triangle, sizeof(triangle));
+                }
+            });
+        ok = vertexOut.close();
+        ok = triangleOut.close() && ok;
+        ok = ok && writeMeshChunks(directory, vertexScratch, triangleScratch, vertexCount, lower, upper,
+                                   packedLayout, chunkTriangles, header);
+    } catch (const std::exception&) {
+        ok = false;
+    }
+    remove(vertexScratch.c_str());
+    remove(triangleScratch.c_str());
+    return ok;
+}
+
+#endif
@@ -0,0 +1,341 @@
+// MeshCodec.hpp compression of packed vertex and index buffers
+#ifndef MESHCODEC_HPP
+#define MESHCODEC_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Vertices or indices per block; a stream is decoded a whole number of blocks at a time
+const size_t MESH_CODEC_BLOCK = 256;
+// Largest vertex the vertex codec handles
+const size_t MESH_CODEC_MAX_STRIDE = 64;
+
+// The bit packing stage. This is fixed-width packing per group, not entropy coding:
+// bytes are taken sixteen at a time and each group is stored at 0, 2, 4 or 8 bits per
+// byte, whichever is the smallest that holds its largest value.
+// The 2-bit widths of all groups come first, four to a byte, then the group data.
+// Small values (delta and zigzag coded residuals) so cost a fraction of a byte each.
+// At 2 bits, byte j holds values j, j + 4, j + 8 and j + 12 from the low bits up; at 4
+// bits it holds j and j + 8. That way a group unpacks with a few word-wide masks.
+inline void encodeByteGroups(const unsigned char* values, size_t count, std::vector<unsigned char>& out) {
+    size_t groups = (count + 15) / 16;
+    size_t selectors = out.size();
+    out.resize(out.size() + (groups + 3) / 4, 0);
+
+    for (size_t g = 0; g < groups; ++g) {
+        unsigned char group[16] = {0};
+        memcpy(group, values + g * 16, std::min<size_t>(16, count - g * 16));
+        unsigned char largest = *std::max_element(group, group + 16);
+        int selector = largest == 0 ? 0 : (largest < 4 ? 1 : (largest < 16 ? 2 : 3));
+        out[selectors + g / 4] |= (unsigned char)(selector << ((g % 4) * 2));
+
+        if (selector == 1) {
+            for (int j = 0; j < 4; ++j) {
+                out.push_back((unsigned char)(group[j] | group[j + 4] << 2 | group[j + 8] << 4 | group[j + 12] << 6));
+            }
+        } else if (selector == 2) {
+            for (int j = 0; j < 8; ++j) {
+                out.push_back((unsigned char)(group[j] | group[j + 8] << 4));
+            }
+        } else if (selector == 3) {
+            out.insert(out.end(), group, group + 16);
+        }
+    }
+}
+
+// Decodes count bytes into out, which must have room for count rounded up to 16.
+// Returns the end of the encoded data, or NULL if it runs past end.
+inline const unsigned char* decodeByteGroups(const unsigned char* data, const unsigned char* end,
+                                             size_t count, unsigned char* out) {
+    size_t groups = (count + 15) / 16;
+    const unsigned char* selectors = data;
+    data += (groups + 3) / 4;
+    if (data > end) {
+        return NULL;
+    }
+
+    for (size_t g = 0; g < groups; ++g, out += 16) {
+        int selector = (selectors[g / 4] >> ((g % 4) * 2)) & 3;
+        static const size_t groupBytes[4] = {0, 4, 8, 16};
+        if ((size_t)(end - data) < groupBytes[selector]) {
+            return NULL;
+        }
+        switch (selector) {
+            case 0:
+                memset(out, 0, 16);
+                break;
+            case 1: {
+                uint32_t packed;
+                memcpy(&packed, data, 4);
+                for (int q = 0; q < 4; ++q) {
+                    uint32_t values = (packed >> (q * 2)) & 0x03030303u;
+                    memcpy(out + q * 4, &values, 4);
+                }
+                break;
+            }
+            case 2: {
+                uint64_t packed;
+                memcpy(&packed, data, 8);
+                uint64_t low = packed & 0x0F0F0F0F0F0F0F0Full, high = (packed >> 4) & 0x0F0F0F0F0F0F0F0Full;
+                memcpy(out, &low, 8);
+                memcpy(out + 8, &high, 8);
+                break;
+            }
+            default:
+                memcpy(out, data, 16);
+                break;
+        }
+        data += groupBytes[selector];
+    }
+    return data;
+}
+
+inline unsigned char zigzag8(unsigned char delta) {
+    return (unsigned char)((delta << 1) ^ (unsigned char)((signed char)delta >> 7));
+}
+
+inline unsigned char unzigzag8(unsigned char value) {
+    return (unsigned char)((value >> 1) ^ (unsigned char)-(value & 1));
+}
+
+inline uint32_t zigzag32(uint32_t delta) {
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+inline uint32_t unzigzag32(uint32_t value) {
+    return (value >> 1) ^ (uint32_t)-(int32_t)(value & 1);
+}
+
+// Vertices are coded byte plane by byte plane: byte k of each vertex becomes its
+// difference from byte k of the vertex before, zigzag coded so small steps either way
+// are small values. Neighbouring vertices of an optimized mesh are close in space and
+// quantized positions and UVs change slowly, so most planes pack to 2 or 4 bits.
+inline bool encodeVertexBuffer(const void* vertices, size_t count, size_t stride, std::vector<unsigned char>& out) {
+    if (stride == 0 || stride > MESH_CODEC_MAX_STRIDE) {
+        return false;
+    }
+    const unsigned char* source = (const unsigned char*)vertices;
+    unsigned char last[MESH_CODEC_MAX_STRIDE] = {0};
+    unsigned char deltas[MESH_CODEC_BLOCK];
+
+    for (size_t first = 0; first < count; first += MESH_CODEC_BLOCK) {
+        size_t n = std::min(MESH_CODEC_BLOCK, count - first);
+        for (size_t k = 0; k < stride; ++k) {
+            unsigned char previous = last[k];
+            for (size_t i = 0; i < n; ++i) {
+                unsigned char value = source[(first + i) * stride + k];
+                deltas[i] = zigzag8((unsigned char)(value - previous));
+                previous = value;
+            }
+            last[k] = previous;
+            encodeByteGroups(deltas, n, out);
+        }
+    }
+    return true;
+}
+
+// Decodes a vertex stream a chunk at a time, so it can be written straight into
+// staging memory. Every chunk but the last must be a whole number of blocks.
+class VertexStreamDecoder {
+    const unsigned char* cur;
+    const unsigned char* end;
+    size_t stride;
+    size_t remaining;
+    unsigned char last[MESH_CODEC_MAX_STRIDE];
+
+#ifdef __SSE2__
+    // Transposes sixteen rows of sixteen bytes. The unpack network leaves column c in
+    // rows[(c % 4) * 4 + c / 4], which the caller reads through.
+    static void transpose16(__m128i* rows) {
+        __m128i t[16];
+        for (int i = 0; i < 8; ++i) {
+            t[i] = _mm_unpacklo_epi8(rows[2 * i], rows[2 * i + 1]);
+            t[i + 8] = _mm_unpackhi_epi8(rows[2 * i], rows[2 * i + 1]);
+        }
+        for (int i = 0; i < 4; ++i) {
+            rows[i] = _mm_unpacklo_epi16(t[2 * i], t[2 * i + 1]);
+            rows[i + 4] = _mm_unpackhi_epi16(t[2 * i], t[2 * i + 1]);
+            rows[i + 8] = _mm_unpacklo_epi16(t[8 + 2 * i], t[9 + 2 * i]);
+            rows[i + 12] = _mm_unpackhi_epi16(t[8 + 2 * i], t[9 + 2 * i]);
+        }
+        for (int i = 0; i < 8; ++i) {
+            t[i] = _mm_unpacklo_epi32(rows[2 * i], rows[2 * i + 1]);
+            t[i + 8] = _mm_unpackhi_epi32(rows[2 * i], rows[2 * i + 1]);
+        }
+        for (int i = 0; i < 4; ++i) {
+            rows[i] = _mm_unpacklo_epi64(t[2 * i], t[2 * i + 1]);
+            rows[i + 4] = _mm_unpackhi_epi64(t[2 * i], t[2 * i + 1]);
+            rows[i + 8] = _mm_unpacklo_epi64(t[8 + 2 * i], t[9 + 2 * i]);
+            rows[i + 12] = _mm_unpackhi_epi64(t[8 + 2 * i], t[9 + 2 * i]);
+        }
+    }
+
+    // Sixteen vertices at a time: unzigzag sixteen planes, transpose them into vertex
+    // rows and add each row to the running vertex, sixteen bytes of it per instruction.
+    // Row stores are full width and may spill into the next row, which is written after.
+    void undoVertexDeltas(unsigned char (*planes)[MESH_CODEC_BLOCK], size_t n, unsigned char* block, unsigned char* targetEnd) {
+        const size_t slices = (stride + 15) / 16;
+        const __m128i one = _mm_set1_epi8(1), low7 = _mm_set1_epi8(0x7F), zero = _mm_setzero_si128();
+        __m128i running[MESH_CODEC_MAX_STRIDE / 16], rows[MESH_CODEC_MAX_STRIDE / 16][16];
+        for (size_t c = 0; c < slices; ++c) {
+            unsigned char start[16] = {0};
+            memcpy(start, last + c * 16, std::min<size_t>(16, stride - c * 16));
+            running[c] = _mm_loadu_si128((const __m128i*)start);
+        }
+
+        for (size_t i0 = 0; i0 < n; i0 += 16) {
+            for (size_t c = 0; c < slices; ++c) {
+                for (size_t k = 0; k < 16; ++k) {
+                    if (c * 16 + k >= stride) {
+                        rows[c][k] = zero;
+                        continue;
+                    }
+                    __m128i z = _mm_loadu_si128((const __m128i*)(planes[c * 16 + k] + i0));
+                    __m128i half = _mm_and_si128(_mm_srli_epi16(z, 1), low7);
+                    rows[c][k] = _mm_xor_si128(half, _mm_sub_epi8(zero, _mm_and_si128(z, one)));
+                }
+                transpose16(rows[c]);
+            }
+            size_t m = std::min<size_t>(16, n - i0);
+            for (size_t j = 0; j < m; ++j) {
+                unsigned char* row = block + (i0 + j) * stride;
+                for (size_t c = 0; c < slices; ++c) {
+                    running[c] = _mm_add_epi8(running[c], rows[c][(j % 4) * 4 + j / 4]);
+                    if (row + c * 16 + 16 <= targetEnd) {
+                        _mm_storeu_si128((__m128i*)(row + c * 16), running[c]);
+                    } else {
+                        unsigned char tail[16];
+                        _mm_storeu_si128((__m128i*)tail, running[c]);
+                        memcpy(row + c * 16, tail, std::min<size_t>(16, stride - c * 16));
+                    }
+                }
+            }
+        }
+
+        for (size_t c = 0; c < slices; ++c) {
+            unsigned char end[16];
+            _mm_storeu_si128((__m128i*)end, running[c]);
+            memcpy(last + c * 16, end, std::min<size_t>(16, stride - c * 16));
+        }
+    }
+#else
+    void undoVertexDeltas(unsigned char (*planes)[MESH_CODEC_BLOCK], size_t n, unsigned char* block, unsigned char*) {
+        for (size_t k = 0; k < stride; ++k) {
+            unsigned char value = last[k];
+            for (size_t i = 0; i < n; ++i) {
+                value = (unsigned char)(value + unzigzag8(planes[k][i]));
+                block[i * stride + k] = value;
+            }
+            last[k] = value;
+        }
+    }
+#endif
+
+public:
+    VertexStreamDecoder(const void* data, size_t size, size_t vertexCount, size_t stride)
+        : cur((const unsigned char*)data), end((const unsigned char*)data + size), stride(stride), remaining(vertexCount) {
+        memset(last, 0, sizeof(last));
+    }
+
+    // Decodes the next count vertices into out; false if the stream is corrupt or too short
+    bool decode(void* out, size_t count) {
+        if (count > remaining || stride == 0 || stride > MESH_CODEC_MAX_STRIDE ||
+            (count < remaining && count % MESH_CODEC_BLOCK != 0)) {
+            return false;
+        }
+        unsigned char* target = (unsigned char*)out;
+        unsigned char* targetEnd = target + count * stride;
+        unsigned char planes[MESH_CODEC_MAX_STRIDE][MESH_CODEC_BLOCK];
+
+        for (size_t first = 0; first < count; first += MESH_CODEC_BLOCK) {
+            size_t n = std::min(MESH_CODEC_BLOCK, count - first);
+            for (size_t k = 0; k < stride; ++k) {
+                cur = decodeByteGroups(cur, end, n, planes[k]);
+                if (!cur) {
+                    return false;
+                }
+            }
+            undoVertexDeltas(planes, n, target + first * stride, targetEnd);
+        }
+        remaining -= count;
+        return true;
+    }
+};
+
+// Indices are coded as the zigzag difference from the index before. After the
+// vertex cache and fetch passes most differences are a few vertices either way, so
+// the high bytes of the 32-bit residuals are nearly all zero; the four byte planes
+// of each block go through the bit packing stage separately.
+inline void encodeIndexBuffer(const uint32_t* indices, size_t count, std::vector<unsigned char>& out) {
+    unsigned char planes[4][MESH_CODEC_BLOCK];
+    uint32_t previous = 0;
+
+    for (size_t first = 0; first < count; first += MESH_CODEC_BLOCK) {
+        size_t n = std::min(MESH_CODEC_BLOCK, count - first);
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t residual = zigzag32(indices[first + i] - previous);
+            previous = indices[first + i];
+            for (int b = 0; b < 4; ++b) {
+                planes[b][i] = (unsigned char)(residual >> (b * 8));
+            }
+        }
+        for (int b = 0; b < 4; ++b) {
+            encodeByteGroups(planes[b], n, out);
+        }
+    }
+}
+
+// Decodes an index stream a chunk at a time into 2 or 4 byte indices. Every chunk
+// but the last must be a whole number of blocks.
+class IndexStreamDecoder {
+    const unsigned char* cur;
+    const unsigned char* end;
+    size_t remaining;
+    uint32_t previous;
+
+public:
+    IndexStreamDecoder(const void* data, size_t size, size_t indexCount)
+        : cur((const unsigned char*)data), end((const unsigned char*)data + size), remaining(indexCount), previous(0) {}
+
+    bool decode(void* out, size_t count, size_t indexSize) {
+        if (count > remaining || (indexSize != 2 && indexSize != 4) ||
+            (count < remaining && count % MESH_CODEC_BLOCK != 0)) {
+            return false;
+        }
+        unsigned char planes[4][MESH_CODEC_BLOCK];
+
+        for (size_t first = 0; first < count; first += MESH_CODEC_BLOCK) {
+            size_t n = std::min(MESH_CODEC_BLOCK, count - first);
+            for (int b = 0; b < 4; ++b) {
+                cur = decodeByteGroups(cur, end, n, planes[b]);
+                if (!cur) {
+                    return false;
+                }
+            }
+            if (indexSize == 2) {
+                uint16_t* target = (uint16_t*)out + first;
+                for (size_t i = 0; i < n; ++i) {
+                    uint32_t residual = planes[0][i] | planes[1][i] << 8 | planes[2][i] << 16 | (uint32_t)planes[3][i] << 24;
+                    previous += unzigzag32(residual);
+                    target[i] = (uint16_t)previous;
+                }
+            } else {
+                uint32_t* target = (uint32_t*)out + first;
+                for (size_t i = 0; i < n; ++i) {
+                    uint32_t residual = planes[0][i] | planes[1][i] << 8 | planes[2][i] << 16 | (uint32_t)planes[3][i] << 24;
+                    previous += unzigzag32(residual);
+                    target[i] = previous;
+                }
+            }
+        }
+        remaining -= count;
+        return true;
+    }
+};
+
+#endif
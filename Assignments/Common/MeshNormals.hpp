@@ -0,0 +1,200 @@
+// MeshNormals.hpp smooth vertex normals with crease angle splitting
+#ifndef MESHNORMALS_HPP
+#define MESHNORMALS_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "MeshOptimize.hpp"
+#include "MeshWeld.hpp"
+#include "Parallel.hpp"
+
+// How much each face around a vertex counts towards its normal
+enum NormalWeighting {
+    NORMAL_WEIGHT_AREA,  // By face area: cheap, but long thin triangles dominate
+    NORMAL_WEIGHT_ANGLE  // By the face's angle at the vertex (Thurmer and Wuthrich): independent of tessellation
+};
+
+// Vertices and triangles handed to one task of the parallel passes
+const size_t NORMAL_BLOCK = 4096;
+
+// Faces meeting at more than this many degrees keep a hard edge in generated normals
+const float DEFAULT_CREASE_ANGLE = 60.0f;
+
+// Computes a normal for every corner of the triangle list. Faces around a position
+// are averaged into a corner's normal only if they are within creaseAngle degrees of
+// the corner's own face, so hard edges stay hard. Vertices are matched by position,
+// not index, so UV seams don't show up as shading seams. Faces are found through a
+// CSR vertex -> triangle adjacency; every pass runs across all cores.
+inline void computeCornerNormals(const float* positions, size_t stride, size_t vertexCount, const uint32_t* indices,
+                                 size_t indexCount, float creaseAngle, NormalWeighting weighting, float* cornerNormals) {
+    size_t triangleCount = indexCount / 3;
+    if (vertexCount == 0 || triangleCount == 0) {
+        return;
+    }
+
+    // Give corners at the same position the same index
+    std::vector<float> welded(vertexCount * 3);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        memcpy(&welded[v * 3], (const char*)positions + v * stride, 3 * sizeof(float));
+    }
+    std::vector<uint32_t> corners(indices, indices + triangleCount * 3);
+    std::vector<WeldAttribute> position = {{0, 3}};
+    size_t positionCount = weldVertices(&welded[0], vertexCount, 3 * sizeof(float), position, 0.0f, &corners[0], corners.size());
+
+    // Unit face normals and the weight of each corner
+    std::vector<float> faceNormals(triangleCount * 3);
+    std::vector<float> cornerWeights(triangleCount * 3);
+    size_t triangleBlocks = (triangleCount + NORMAL_BLOCK - 1) / NORMAL_BLOCK;
+    parallelFor(triangleBlocks, [&](size_t block) {
+        size_t end = std::min(triangleCount, (block + 1) * NORMAL_BLOCK);
+        for (size_t t = block * NORMAL_BLOCK; t < end; ++t) {
+            const float* p[3];
+            for (int k = 0; k < 3; ++k) {
+                p[k] = &welded[corners[t * 3 + k] * 3];
+            }
+            float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+            float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+            float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            float scale = length > 0.0f ? 1.0f / length : 0.0f;
+            for (int c = 0; c < 3; ++c) {
+                faceNormals[t * 3 + c] = n[c] * scale;
+            }
+            for (int k = 0; k < 3; ++k) {
+                if (weighting == NORMAL_WEIGHT_AREA) {
+                    cornerWeights[t * 3 + k] = length;
+                    continue;
+                }
+                const float* a = p[k];
+                const float* b = p[(k + 1) % 3];
+                const float* c = p[(k + 2) % 3];
+                float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                float w[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                float lengths = sqrtf((u[0] * u[0] + u[1] * u[1] + u[2] * u[2]) * (w[0] * w[0] + w[1] * w[1] + w[2] * w[2]));
+                float cosine = lengths > 0.0f ? (u[0] * w[0] + u[1] * w[1] + u[2] * w[2]) / lengths : 1.0f;
+                cornerWeights[t * 3 + k] = acosf(std::max(-1.0f, std::min(1.0f, cosine)));
+            }
+        }
+    });
+
+    TriangleAdjacency adjacency;
+    adjacency.build(&corners[0], corners.size(), positionCount);
+
+    // Every corner belongs to exactly one position, so positions can be worked on in parallel
+    float creaseCosine = cosf(creaseAngle * 3.14159265f / 180.0f);
+    size_t positionBlocks = (positionCount + NORMAL_BLOCK - 1) / NORMAL_BLOCK;
+    parallelFor(positionBlocks, [&](size_t block) {
+        size_t end = std::min(positionCount, (block + 1) * NORMAL_BLOCK);
+        for (size_t v = block * NORMAL_BLOCK; v < end; ++v) {
+            const uint32_t* first = &adjacency.triangles[0] + adjacency.offsets[v];
+            const uint32_t* last = &adjacency.triangles[0] + adjacency.offsets[v + 1];
+            for (const uint32_t* own = first; own != last; ++own) {
+                // A degenerate triangle can touch the same position twice; each corner is done once
+                if (own != first && own[-1] == *own) {
+                    continue;
+                }
+                const float* ownNormal = &faceNormals[*own * 3];
+                float sum[3] = {0.0f, 0.0f, 0.0f};
+                for (const uint32_t* other = first; other != last; ++other) {
+                    if (other != first && other[-1] == *other) {
+                        continue;
+                    }
+                    const float* otherNormal = &faceNormals[*other * 3];
+                    if (ownNormal[0] * otherNormal[0] + ownNormal[1] * otherNormal[1] + ownNormal[2] * otherNormal[2] < creaseCosine) {
+                        continue;
+                    }
+                    float weight = 0.0f;
+                    for (int k = 0; k < 3; ++k) {
+                        if (corners[*other * 3 + k] == v) {
+                            weight = cornerWeights[*other * 3 + k];
+                            break;
+                        }
+                    }
+                    for (int c = 0; c < 3; ++c) {
+                        sum[c] += otherNormal[c] * weight;
+                    }
+                }
+                float length = sqrtf(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                float normal[3] = {0.0f, 0.0f, 1.0f};
+                if (length > 0.0f) {
+                    for (int c = 0; c < 3; ++c) {
+                        normal[c] = sum[c] / length;
+                    }
+                } else if (ownNormal[0] != 0.0f || ownNormal[1] != 0.0f || ownNormal[2] != 0.0f) {
+                    memcpy(normal, ownNormal, sizeof(normal));
+                }
+                for (int k = 0; k < 3; ++k) {
+                    if (corners[*own * 3 + k] == v) {
+                        memcpy(cornerNormals + (*own * 3 + k) * 3, normal, sizeof(normal));
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Normals for triangle soup, three vertices per triangle as marching cubes emits them
+// (positions packed x, y, z). normals receives three floats per vertex.
+inline void computeSoupNormals(const float* positions, size_t vertexCount, float creaseAngle, NormalWeighting weighting,
+                               float* normals) {
+    std::vector<uint32_t> indices(vertexCount - vertexCount % 3);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        indices[i] = (uint32_t)i;
+    }
+    computeCornerNormals(positions, 3 * sizeof(float), vertexCount, indices.data(), indices.size(), creaseAngle, weighting,
+                         normals);
+}
+
+// Writes smooth normals into an indexed mesh. A vertex whose corners end up with
+// different normals across a crease is duplicated, one copy per normal, and the
+// indices of the corners are pointed at their copy. Indices must be below the vertex
+// count, as the PLY readers guarantee.
+template <typename VertexT>
+void generateNormals(std::vector<VertexT>& vertices, uint32_t* indices, size_t indexCount, size_t positionOffset,
+                     size_t normalOffset, float creaseAngle, NormalWeighting weighting = NORMAL_WEIGHT_ANGLE) {
+    size_t cornerCount = indexCount - indexCount % 3;
+    if (vertices.empty() || cornerCount == 0) {
+        return;
+    }
+    std::vector<float> cornerNormals(cornerCount * 3);
+    computeCornerNormals((const float*)((const char*)&vertices[0] + positionOffset), sizeof(VertexT), vertices.size(),
+                         indices, cornerCount, creaseAngle, weighting, &cornerNormals[0]);
+
+    // nextCopy chains each vertex to its duplicates
+    const uint32_t unassigned = 0xFFFFFFFFu;
+    std::vector<bool> assigned(vertices.size(), false);
+    std::vector<uint32_t> nextCopy(vertices.size(), unassigned);
+    for (size_t i = 0; i < cornerCount; ++i) {
+        const float* normal = &cornerNormals[i * 3];
+        uint32_t v = indices[i];
+        if (!assigned[v]) {
+            memcpy((char*)&vertices[v] + normalOffset, normal, 3 * sizeof(float));
+            assigned[v] = true;
+            continue;
+        }
+        uint32_t copy = v, last = v;
+        for (; copy != unassigned; last = copy, copy = nextCopy[copy]) {
+            float existing[3];
+            memcpy(existing, (const char*)&vertices[copy] + normalOffset, sizeof(existing));
+            if (fabsf(existing[0] - normal[0]) <= 1e-5f && fabsf(existing[1] - normal[1]) <= 1e-5f &&
+                fabsf(existing[2] - normal[2]) <= 1e-5f) {
+                break;
+            }
+        }
+        if (copy == unassigned) {
+            VertexT duplicate = vertices[v];
+            copy = (uint32_t)vertices.size();
+            vertices.push_back(duplicate);
+            memcpy((char*)&vertices[copy] + normalOffset, normal, 3 * sizeof(float));
+            nextCopy.push_back(unassigned);
+            nextCopy[last] = copy;
+        }
+        indices[i] = copy;
+    }
+}
+
+#endif
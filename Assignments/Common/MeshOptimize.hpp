@@ -0,0 +1,298 @@
+// MeshOptimize.hpp post-load reordering of triangles and vertices for the GPU
+#ifndef MESHOPTIMIZE_HPP
+#define MESHOPTIMIZE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// Post-transform cache size the passes and statistics model
+const unsigned VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+    float acmr; // Average cache miss ratio: vertex shader runs per triangle (0.5 ideal, 3 worst)
+    float atvr; // Average transformed vertex ratio: vertex shader runs per vertex (1 ideal)
+};
+
+// Simulates a FIFO post-transform cache over the index stream.
+inline VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                           unsigned cacheSize = VERTEX_CACHE_SIZE) {
+    std::vector<uint32_t> cachedAt(vertexCount, 0);
+    std::vector<char> used(vertexCount, 0);
+    size_t misses = 0, usedVertices = 0;
+    uint32_t time = cacheSize + 1;
+
+    for (size_t i = 0; i < indexCount; ++i) {
+        uint32_t v = indices[i];
+        if (time - cachedAt[v] > cacheSize) {
+            cachedAt[v] = time++;
+            ++misses;
+        }
+        if (!used[v]) {
+            used[v] = 1;
+            ++usedVertices;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = indexCount ? (float)misses / (float)(indexCount / 3) : 0.0f;
+    stats.atvr = usedVertices ? (float)misses / (float)usedVertices : 0.0f;
+    return stats;
+}
+
+// Vertex -> triangle adjacency in compressed row form. Indices must be below
+// vertexCount; the PLY readers reject files where they are not.
+struct TriangleAdjacency {
+    std::vector<uint32_t> offsets;   // vertexCount + 1 entries
+    std::vector<uint32_t> triangles; // Triangles of vertex v are triangles[offsets[v] .. offsets[v + 1])
+
+    void build(const uint32_t* indices, size_t indexCount, size_t vertexCount) {
+        offsets.assign(vertexCount + 1, 0);
+        for (size_t i = 0; i < indexCount; ++i) {
+            offsets[indices[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; ++v) {
+            offsets[v + 1] += offsets[v];
+        }
+        triangles.resize(indexCount);
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indexCount; ++i) {
+            triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+        }
+    }
+};
+
+// Reorders triangles for the post-transform cache with Tipsify (Sander, Nehab and
+// Barczak 2007): fan around the current vertex, then continue from the cached
+// neighbour that will stay in the cache longest, falling back to recently touched
+// vertices at a dead end. If clusterStarts is given it receives the first triangle
+// of every run that begins with such a jump; those runs are what the overdraw pass sorts.
+inline void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount,
+                                std::vector<uint32_t>* clusterStarts = NULL, unsigned cacheSize = VERTEX_CACHE_SIZE) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    TriangleAdjacency adjacency;
+    adjacency.build(indices, indexCount, vertexCount);
+
+    std::vector<uint32_t> live(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    }
+    std::vector<uint32_t> cachedAt(vertexCount, 0);
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    result.reserve(indexCount);
+
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0;
+    bool jumped = true;
+    long fan = -1;
+    for (size_t v = 0; v < vertexCount && fan < 0; ++v) {
+        if (live[v] > 0) {
+            fan = (long)v;
+        }
+    }
+
+    while (fan >= 0) {
+        if (jumped && clusterStarts) {
+            clusterStarts->push_back((uint32_t)(result.size() / 3));
+        }
+
+        candidates.clear();
+        for (uint32_t a = adjacency.offsets[fan]; a < adjacency.offsets[fan + 1]; ++a) {
+            uint32_t t = adjacency.triangles[a];
+            if (emitted[t]) {
+                continue;
+            }
+            emitted[t] = 1;
+            for (int k = 0; k < 3; ++k) {
+                uint32_t v = indices[t * 3 + k];
+                result.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cachedAt[v] > cacheSize) {
+                    cachedAt[v] = time++;
+                }
+            }
+        }
+
+        // Best candidate: still has work and will still be cached after fanning it
+        long next = -1;
+        uint32_t best = 0;
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            uint32_t v = candidates[c];
+            if (live[v] == 0) {
+                continue;
+            }
+            uint32_t priority = 0;
+            if (time - cachedAt[v] + 2 * live[v] <= cacheSize) {
+                priority = time - cachedAt[v];
+            }
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+
+        jumped = next < 0;
+        while (next < 0 && !deadEnds.empty()) {
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[v] > 0) {
+                next = v;
+            }
+        }
+        while (next < 0 && cursor < vertexCount) {
+            if (live[cursor] > 0) {
+                next = (long)cursor;
+            }
+            ++cursor;
+        }
+        fan = next;
+    }
+
+    memcpy(indices, &result[0], result.size() * sizeof(uint32_t));
+}
+
+// Sorts the clusters found by optimizeVertexCache so that those facing out from the
+// centre of the mesh come first. Such triangles tend to occlude the rest from most
+// view directions, which cuts overdraw without knowing the camera (Sander et al.).
+// The new order is only kept if it raises ACMR by less than the given factor.
+inline void optimizeOverdraw(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& clusterStarts,
+                             const float* positions, size_t positionStride, size_t vertexCount,
+                             float threshold = 1.05f) {
+    size_t triangleCount = indexCount / 3;
+    size_t clusterCount = clusterStarts.size();
+    if (clusterCount < 2) {
+        return;
+    }
+
+    const size_t floatStride = positionStride / sizeof(float);
+    struct Cluster {
+        float sortKey;
+        uint32_t begin, end;
+    };
+    std::vector<Cluster> clusters(clusterCount);
+    float meshCentroid[3] = {0, 0, 0};
+    float meshArea = 0;
+    std::vector<float> centroids(clusterCount * 3), normals(clusterCount * 3);
+
+    for (size_t c = 0; c < clusterCount; ++c) {
+        clusters[c].begin = clusterStarts[c];
+        clusters[c].end = c + 1 < clusterCount ? clusterStarts[c + 1] : (uint32_t)triangleCount;
+        float centroid[3] = {0, 0, 0}, normal[3] = {0, 0, 0}, area = 0;
+        for (uint32_t t = clusters[c].begin; t < clusters[c].end; ++t) {
+            const float* p0 = positions + indices[t * 3] * floatStride;
+            const float* p1 = positions + indices[t * 3 + 1] * floatStride;
+            const float* p2 = positions + indices[t * 3 + 2] * floatStride;
+            float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; ++k) {
+                centroid[k] += (p0[k] + p1[k] + p2[k]) / 3.0f * a;
+                normal[k] += n[k];
+            }
+            area += a;
+        }
+        for (int k = 0; k < 3; ++k) {
+            meshCentroid[k] += centroid[k];
+            centroids[c * 3 + k] = area > 0 ? centroid[k] / area : 0;
+            normals[c * 3 + k] = normal[k];
+        }
+        meshArea += area;
+    }
+    for (int k = 0; k < 3; ++k) {
+        meshCentroid[k] = meshArea > 0 ? meshCentroid[k] / meshArea : 0;
+    }
+
+    for (size_t c = 0; c < clusterCount; ++c) {
+        const float* n = &normals[c * 3];
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        float key = 0;
+        if (length > 0) {
+            for (int k = 0; k < 3; ++k) {
+                key += (centroids[c * 3 + k] - meshCentroid[k]) * n[k] / length;
+            }
+        }
+        clusters[c].sortKey = key;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(),
+                     [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(indexCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        sorted.insert(sorted.end(), indices + clusters[c].begin * 3, indices + clusters[c].end * 3);
+    }
+
+    float before = analyzeVertexCache(indices, indexCount, vertexCount).acmr;
+    float after = analyzeVertexCache(&sorted[0], indexCount, vertexCount).acmr;
+    if (after <= before * threshold) {
+        memcpy(indices, &sorted[0], indexCount * sizeof(uint32_t));
+    }
+}
+
+// Reorders vertices into the order the index stream first touches them, so vertex
+// fetch walks memory forwards. Unreferenced vertices are dropped. Returns the new
+// vertex count; vertex data is rewritten in place.
+inline size_t optimizeVertexFetch(void* vertices, size_t vertexCount, size_t stride, uint32_t* indices, size_t indexCount) {
+    const uint32_t unassigned = 0xFFFFFFFFu;
+    std::vector<uint32_t> remap(vertexCount, unassigned);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i) {
+        uint32_t& slot = remap[indices[i]];
+        if (slot == unassigned) {
+            slot = next++;
+        }
+        indices[i] = slot;
+    }
+
+    std::vector<char> reordered((size_t)next * stride);
+    const char* source = (const char*)vertices;
+    for (size_t v = 0; v < vertexCount; ++v) {
+        if (remap[v] != unassigned) {
+            memcpy(&reordered[remap[v] * stride], source + v * stride, stride);
+        }
+    }
+    if (next > 0) {
+        memcpy(vertices, &reordered[0], reordered.size());
+    }
+    return next;
+}
+
+// Runs the cache, overdraw and fetch passes over a loaded mesh and prints ACMR/ATVR
+// before and after. positionOffset is the byte offset of float x, y, z in VertexT.
+template <typename VertexT>
+void optimizeMesh(std::vector<VertexT>& vertices, uint32_t* indices, size_t indexCount,
+                  size_t positionOffset, const char* label) {
+    if (vertices.empty() || indexCount < 3) {
+        return;
+    }
+    VertexCacheStats before = analyzeVertexCache(indices, indexCount, vertices.size());
+
+    // Exporters sometimes already emit a good order; never make it worse
+    std::vector<uint32_t> original(indices, indices + indexCount);
+    std::vector<uint32_t> clusterStarts;
+    optimizeVertexCache(indices, indexCount, vertices.size(), &clusterStarts);
+    optimizeOverdraw(indices, indexCount, clusterStarts,
+                     (const float*)((const char*)&vertices[0] + positionOffset), sizeof(VertexT), vertices.size());
+    if (analyzeVertexCache(indices, indexCount, vertices.size()).acmr > before.acmr) {
+        memcpy(indices, &original[0], indexCount * sizeof(uint32_t));
+    }
+    vertices.resize(optimizeVertexFetch(&vertices[0], vertices.size(), sizeof(VertexT), indices, indexCount));
+
+    VertexCacheStats after = analyzeVertexCache(indices, indexCount, vertices.size());
+    printf("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", label, before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+#endif
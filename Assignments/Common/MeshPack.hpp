@@ -0,0 +1,193 @@
+// MeshPack.hpp compressed .meshz mesh files that can ship in place of the PLY
+#ifndef MESHPACK_HPP
+#define MESHPACK_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "MeshCache.hpp"
+#include "MeshCodec.hpp"
+
+// Bump when the file layout or the codec changes
+const uint32_t MESHZ_VERSION = 2;
+
+// A .meshz file is this header, the sub-mesh, LOD and meshlet tables as they are in
+// memory, then the compressed vertex and index streams (MeshCodec.hpp). Unlike a
+// .meshbin it does not need the PLY it was made from, so it can ship alone; the PLY is
+// only checked against the stamp when it is there.
+struct MeshPackHeader {
+    char magic[8];          // "MESHZ"
+    uint32_t version;
+    uint32_t layoutTag;     // Identifies the vertex layout the streams decode to
+    uint32_t vertexStride;
+    uint32_t indexSize;     // Bytes per decoded index
+    uint64_t sourceSize;    // Size, mtime and content hash of the PLY it was made from
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t subMeshCount;
+    uint64_t lodCount;
+    uint64_t meshletCount;
+    uint64_t vertexStreamSize;
+    uint64_t indexStreamSize;
+    VertexDequantize dequantize;
+    float boundingSphere[4];
+};
+
+// A mapped .meshz. The tables point into the file; vertexData and indexData stay NULL,
+// the streams are decoded with VertexStreamDecoder and IndexStreamDecoder instead.
+struct MeshPack : MeshBuffers {
+    const unsigned char* vertexStream;
+    size_t vertexStreamSize;
+    const unsigned char* indexStream;
+    size_t indexStreamSize;
+    std::unique_ptr<MappedFile> file;
+
+    MeshPack() : vertexStream(NULL), vertexStreamSize(0), indexStream(NULL), indexStreamSize(0) {}
+};
+
+inline std::string meshPackPath(const std::string& sourcePath) {
+    return sidecarPath(sourcePath, ".meshz");
+}
+
+// Maps the .meshz next to sourcePath if it holds this vertex layout. The source need
+// not exist; if it does, the pack is checked against it like a .meshbin: size and mtime
+// first, and if only those differ the source is hashed, and a matching hash keeps the
+// pack and refreshes its stamp.
+inline bool openMeshPack(const std::string& sourcePath, uint32_t layoutTag, size_t vertexStride, MeshPack& pack) {
+    std::string packPath = meshPackPath(sourcePath);
+    std::unique_ptr<MappedFile> file;
+    try {
+        file.reset(new MappedFile(packPath));
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    MeshPackHeader header;
+    if (file->size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, file->data(), sizeof(header));
+    uint64_t tableBytes = header.subMeshCount * sizeof(SubMesh) + header.lodCount * sizeof(MeshLod) +
+                          header.meshletCount * sizeof(Meshlet);
+    if (memcmp(header.magic, "MESHZ", 6) != 0 || header.version != MESHZ_VERSION ||
+        header.layoutTag != layoutTag || header.vertexStride != vertexStride ||
+        (header.indexSize != 2 && header.indexSize != 4) ||
+        sizeof(header) + tableBytes + header.vertexStreamSize + header.indexStreamSize > file->size()) {
+        return false;
+    }
+
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    if (statSource(sourcePath, sourceSize, sourceMtime) &&
+        (header.sourceSize != sourceSize || header.sourceMtime != sourceMtime)) {
+        if (header.sourceSize != sourceSize || header.sourceHash != hashSourceFile(sourcePath)) {
+            return false;
+        }
+        // Same content with a new timestamp (fresh checkout, copy, touch)
+        header.sourceMtime = sourceMtime;
+        if (FILE* out = fopen(packPath.c_str(), "r+b")) {
+            fwrite(&header, sizeof(header), 1, out);
+            fclose(out);
+        }
+    }
+
+    const char* cursor = file->data() + sizeof(header);
+    pack.subMeshes = (const SubMesh*)cursor;
+    cursor += header.subMeshCount * sizeof(SubMesh);
+    pack.lods = (const MeshLod*)cursor;
+    cursor += header.lodCount * sizeof(MeshLod);
+    pack.meshlets = (const Meshlet*)cursor;
+    cursor += header.meshletCount * sizeof(Meshlet);
+    pack.vertexStream = (const unsigned char*)cursor;
+    pack.indexStream = pack.vertexStream + header.vertexStreamSize;
+
+    pack.vertexData = NULL;
+    pack.indexData = NULL;
+    pack.vertexCount = (size_t)header.vertexCount;
+    pack.indexCount = (size_t)header.indexCount;
+    pack.vertexStride = header.vertexStride;
+    pack.indexSize = header.indexSize;
+    pack.subMeshCount = (size_t)header.subMeshCount;
+    pack.lodCount = (size_t)header.lodCount;
+    pack.meshletCount = (size_t)header.meshletCount;
+    pack.vertexStreamSize = (size_t)header.vertexStreamSize;
+    pack.indexStreamSize = (size_t)header.indexStreamSize;
+    pack.dequantize = header.dequantize;
+    memcpy(pack.boundingSphere, header.boundingSphere, sizeof(header.boundingSphere));
+    pack.file = std::move(file);
+    return true;
+}
+
+// Compresses mesh into the .meshz next to sourcePath, written under a temporary name
+// and renamed into place like the .meshbin. Index data must be 2 or 4 bytes per index.
+// source, if the caller still has the source open, is hashed instead of reading it again.
+inline bool writeMeshPack(const std::string& sourcePath, uint32_t layoutTag, const MeshBuffers& mesh,
+                          const MappedFile* source = NULL) {
+    std::vector<unsigned char> vertexStream, indexStream;
+    if (!encodeVertexBuffer(mesh.vertexData, mesh.vertexCount, mesh.vertexStride, vertexStream)) {
+        return false;
+    }
+    std::vector<uint32_t> indices(mesh.indexCount);
+    for (size_t i = 0; i < mesh.indexCount; ++i) {
+        if (mesh.indexSize == 2) {
+            uint16_t index;
+            memcpy(&index, (const unsigned char*)mesh.indexData + i * 2, 2);
+            indices[i] = index;
+        } else {
+            memcpy(&indices[i], (const unsigned char*)mesh.indexData + i * 4, 4);
+        }
+    }
+    encodeIndexBuffer(indices.data(), indices.size(), indexStream);
+
+    MeshPackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MESHZ", 6);
+    header.version = MESHZ_VERSION;
+    header.layoutTag = layoutTag;
+    header.vertexStride = (uint32_t)mesh.vertexStride;
+    header.indexSize = (uint32_t)mesh.indexSize;
+    if (!statSource(sourcePath, header.sourceSize, header.sourceMtime)) {
+        return false;
+    }
+    header.sourceHash = source ? hashSourceBytes(sourcePath, source->data(), source->size()) : hashSourceFile(sourcePath);
+    header.vertexCount = mesh.vertexCount;
+    header.indexCount = mesh.indexCount;
+    header.subMeshCount = mesh.subMeshCount;
+    header.lodCount = mesh.lodCount;
+    header.meshletCount = mesh.meshletCount;
+    header.vertexStreamSize = vertexStream.size();
+    header.indexStreamSize = indexStream.size();
+    header.dequantize = mesh.dequantize;
+    memcpy(header.boundingSphere, mesh.boundingSphere, sizeof(header.boundingSphere));
+
+    std::string packPath = meshPackPath(sourcePath);
+    std::string tempPath = packPath + ".tmp";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    auto section = [out](const void* data, size_t size) {
+        return size == 0 || fwrite(data, 1, size, out) == size;
+    };
+    bool ok = section(&header, sizeof(header));
+    ok = ok && section(mesh.subMeshes, mesh.subMeshCount * sizeof(SubMesh));
+    ok = ok && section(mesh.lods, mesh.lodCount * sizeof(MeshLod));
+    ok = ok && section(mesh.meshlets, mesh.meshletCount * sizeof(Meshlet));
+    ok = ok && section(vertexStream.data(), vertexStream.size());
+    ok = ok && section(indexStream.data(), indexStream.size());
+    ok = fclose(out) == 0 && ok;
+
+    if (!ok || rename(tempPath.c_str(), packPath.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif
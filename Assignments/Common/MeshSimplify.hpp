@@ -0,0 +1,455 @@
+// MeshSimplify.hpp quadric error edge collapse simplification and LOD chains
+#ifndef MESHSIMPLIFY_HPP
+#define MESHSIMPLIFY_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "MeshOptimize.hpp"
+#include "Parallel.hpp"
+
+// One level of detail: a range of a shared index buffer, all levels index the same vertices
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error; // Largest deviation from the full mesh, in model units
+};
+
+// All levels of a mesh, finest first, and the sphere used to measure distance to it
+struct MeshLodChain {
+    std::vector<MeshLod> lods;
+    float boundingSphere[4]; // Centre x, y, z and radius
+};
+
+// Triangle share each level keeps relative to the full mesh, and the error any
+// level may reach as a fraction of the bounding radius
+const float LOD_TRIANGLE_RATIOS[] = {0.5f, 0.25f, 0.125f};
+const float LOD_MAX_RELATIVE_ERROR = 0.05f;
+
+// Weight of the planes that hold open borders in place, relative to face planes
+const double SIMPLIFY_BORDER_WEIGHT = 10.0;
+
+// Symmetric 4x4 error quadric (Garland and Heckbert 1997): the sum of squared
+// distances to a set of weighted planes.
+struct Quadric {
+    double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+    double weight;
+
+    void clear() {
+        memset(this, 0, sizeof(*this));
+    }
+
+    void addPlane(double nx, double ny, double nz, double d, double w) {
+        a00 += w * nx * nx; a01 += w * nx * ny; a02 += w * nx * nz; a03 += w * nx * d;
+        a11 += w * ny * ny; a12 += w * ny * nz; a13 += w * ny * d;
+        a22 += w * nz * nz; a23 += w * nz * d;
+        a33 += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric& q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+    }
+
+    // Weighted mean squared distance of p from the planes
+    double evaluate(const float* p) const {
+        double x = p[0], y = p[1], z = p[2];
+        double error = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                     + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                     + a22 * z * z + 2 * a23 * z
+                     + a33;
+        return weight > 0 ? fabs(error) / weight : 0;
+    }
+};
+
+// Centre of the bounding box and the radius around it that holds every vertex
+inline void computeBoundingSphere(const float* positions, size_t positionStride, size_t vertexCount, float sphere[4]) {
+    const size_t step = positionStride / sizeof(float);
+    float lower[3] = {0, 0, 0}, upper[3] = {0, 0, 0};
+    for (size_t v = 0; v < vertexCount; ++v) {
+        for (int k = 0; k < 3; ++k) {
+            float value = positions[v * step + k];
+            if (v == 0 || value < lower[k]) lower[k] = value;
+            if (v == 0 || value > upper[k]) upper[k] = value;
+        }
+    }
+    float radius = 0;
+    for (int k = 0; k < 3; ++k) {
+        sphere[k] = 0.5f * (lower[k] + upper[k]);
+    }
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const float* p = positions + v * step;
+        float dx = p[0] - sphere[0], dy = p[1] - sphere[1], dz = p[2] - sphere[2];
+        radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+    }
+    sphere[3] = sqrtf(radius);
+}
+
+// Simplifies a triangle list until it has at most targetIndexCount indices or the
+// next collapse would move the surface by more than maxError (model units).
+// Collapses are vertex to vertex, so the result indexes the original vertices and
+// can share their buffer. uvs (same stride, may be NULL) define the texture charts:
+// vertices with the same position collapse together, and only along an edge that
+// exists in every chart they belong to, so UV seams stay put. Vertices that only
+// differ in normal (flat shading) count as one chart. Open borders only collapse
+// along the border. Returns the new index list; error receives the largest error
+// of the collapses that were made.
+inline std::vector<uint32_t> simplifyMesh(const float* positions, const float* uvs, size_t vertexStride, size_t vertexCount,
+                                          const uint32_t* indices, size_t indexCount, size_t targetIndexCount,
+                                          float maxError, float* error = NULL) {
+    const size_t step = vertexStride / sizeof(float);
+    std::vector<uint32_t> result(indices, indices + indexCount);
+    if (error) {
+        *error = 0;
+    }
+    if (indexCount <= targetIndexCount || vertexCount == 0) {
+        return result;
+    }
+
+    // Group vertices sharing a position; the group's first vertex stands for it
+    std::vector<uint32_t> byPosition(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        byPosition[v] = (uint32_t)v;
+    }
+    std::sort(byPosition.begin(), byPosition.end(), [&](uint32_t a, uint32_t b) {
+        return memcmp(positions + a * step, positions + b * step, 3 * sizeof(float)) < 0;
+    });
+    std::vector<uint32_t> positionOf(vertexCount);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        uint32_t v = byPosition[i];
+        bool same = i > 0 && memcmp(positions + v * step, positions + byPosition[i - 1] * step, 3 * sizeof(float)) == 0;
+        positionOf[v] = same ? positionOf[byPosition[i - 1]] : v;
+    }
+    // Vertices at the same position with the same UV are in the same chart
+    std::vector<uint32_t> chartOf(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        chartOf[v] = (uint32_t)v;
+    }
+    if (uvs) {
+        std::vector<uint32_t> byChart(byPosition);
+        std::stable_sort(byChart.begin(), byChart.end(), [&](uint32_t a, uint32_t b) {
+            return positionOf[a] != positionOf[b] ? positionOf[a] < positionOf[b]
+                                                  : memcmp(uvs + a * step, uvs + b * step, 2 * sizeof(float)) < 0;
+        });
+        for (size_t i = 1; i < vertexCount; ++i) {
+            uint32_t v = byChart[i], previous = byChart[i - 1];
+            if (positionOf[v] == positionOf[previous] && memcmp(uvs + v * step, uvs + previous * step, 2 * sizeof(float)) == 0) {
+                chartOf[v] = chartOf[previous];
+            }
+        }
+    }
+
+    // Vertices of each position group, in compressed row form
+    std::vector<uint32_t> groupStart(vertexCount + 1, 0), groupVertices(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        groupStart[positionOf[v] + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; ++v) {
+        groupStart[v + 1] += groupStart[v];
+    }
+    {
+        std::vector<uint32_t> fill(groupStart.begin(), groupStart.end() - 1);
+        for (size_t v = 0; v < vertexCount; ++v) {
+            groupVertices[fill[positionOf[v]]++] = (uint32_t)v;
+        }
+    }
+
+    auto position = [&](uint32_t v) { return positions + (size_t)v * step; };
+    auto directedEdge = [](uint32_t a, uint32_t b) { return ((uint64_t)a << 32) | b; };
+
+    std::vector<uint32_t> corners;          // Triangles in position space
+    std::vector<uint64_t> edges;            // Directed position space edges, sorted
+    std::vector<char> onBorder(vertexCount, 0);
+    auto rebuild = [&]() {
+        corners.resize(result.size());
+        edges.resize(result.size());
+        for (size_t i = 0; i < result.size(); ++i) {
+            corners[i] = positionOf[result[i]];
+        }
+        for (size_t t = 0; t < result.size(); t += 3) {
+            for (int k = 0; k < 3; ++k) {
+                edges[t + k] = directedEdge(corners[t + k], corners[t + (k + 1) % 3]);
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+    };
+    auto isBorderEdge = [&](uint32_t a, uint32_t b) {
+        return !std::binary_search(edges.begin(), edges.end(), directedEdge(b, a)) ||
+               !std::binary_search(edges.begin(), edges.end(), directedEdge(a, b));
+    };
+
+    // Face quadrics weighted by area, plus planes through open borders at right
+    // angles to the surface so borders keep their shape
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        quadrics[v].clear();
+    }
+    rebuild();
+    for (size_t t = 0; t < result.size(); t += 3) {
+        const float* p[3] = {position(corners[t]), position(corners[t + 1]), position(corners[t + 2])};
+        double e1[3], e2[3], n[3];
+        for (int k = 0; k < 3; ++k) {
+            e1[k] = p[1][k] - p[0][k];
+            e2[k] = p[2][k] - p[0][k];
+        }
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0) {
+            continue;
+        }
+        for (int k = 0; k < 3; ++k) {
+            n[k] /= length;
+        }
+        double area = 0.5 * length;
+        double d = -(n[0] * p[0][0] + n[1] * p[0][1] + n[2] * p[0][2]);
+        for (int k = 0; k < 3; ++k) {
+            quadrics[corners[t + k]].addPlane(n[0], n[1], n[2], d, area);
+        }
+
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = corners[t + k], b = corners[t + (k + 1) % 3];
+            if (!isBorderEdge(a, b)) {
+                continue;
+            }
+            onBorder[a] = onBorder[b] = 1;
+            const float* pa = position(a);
+            const float* pb = position(b);
+            double edge[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+            double m[3] = {edge[1] * n[2] - edge[2] * n[1], edge[2] * n[0] - edge[0] * n[2], edge[0] * n[1] - edge[1] * n[0]};
+            double mLength = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+            if (mLength == 0) {
+                continue;
+            }
+            double w = SIMPLIFY_BORDER_WEIGHT * mLength * mLength; // |edge x n| is the edge length
+            for (int j = 0; j < 3; ++j) {
+                m[j] /= mLength;
+            }
+            double md = -(m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2]);
+            quadrics[a].addPlane(m[0], m[1], m[2], md, w);
+            quadrics[b].addPlane(m[0], m[1], m[2], md, w);
+        }
+    }
+
+    const double maxCost = (double)maxError * maxError;
+    double appliedCost = 0;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<char> locked(vertexCount);
+    std::vector<uint32_t> target(vertexCount);
+    std::vector<double> cost(vertexCount);
+    std::vector<uint32_t> order;
+    TriangleAdjacency adjacency;
+
+    while (result.size() > targetIndexCount) {
+        adjacency.build(&corners[0], corners.size(), vertexCount);
+
+        // Cheapest valid direction to collapse each position
+        std::fill(target.begin(), target.end(), 0xFFFFFFFFu);
+        order.clear();
+        for (size_t t = 0; t < corners.size(); t += 3) {
+            for (int k = 0; k < 3; ++k) {
+                for (int j = 1; j < 3; ++j) {
+                    uint32_t u = corners[t + k], v = corners[t + (k + j) % 3];
+                    if (u == v || (onBorder[u] && !(onBorder[v] && isBorderEdge(u, v)))) {
+                        continue;
+                    }
+                    Quadric q = quadrics[u];
+                    q.add(quadrics[v]);
+                    double c = q.evaluate(position(v));
+                    if (target[u] == 0xFFFFFFFFu) {
+                        order.push_back(u);
+                    } else if (c >= cost[u]) {
+                        continue;
+                    }
+                    target[u] = v;
+                    cost[u] = c;
+                }
+            }
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return cost[a] < cost[b]; });
+
+        for (size_t v = 0; v < vertexCount; ++v) {
+            remap[v] = (uint32_t)v;
+        }
+        std::fill(locked.begin(), locked.end(), 0);
+        size_t remaining = result.size();
+        size_t collapses = 0;
+
+        for (size_t i = 0; i < order.size() && remaining > targetIndexCount; ++i) {
+            uint32_t u = order[i], v = target[u];
+            if (cost[u] > maxCost) {
+                break;
+            }
+            if (locked[u] || locked[v]) {
+                continue;
+            }
+
+            // Triangles around u must not flip or degenerate once u moves onto v
+            bool valid = true;
+            size_t removed = 0;
+            for (uint32_t a = adjacency.offsets[u]; a < adjacency.offsets[u + 1] && valid; ++a) {
+                const uint32_t* c = &corners[adjacency.triangles[a] * 3];
+                if (c[0] == v || c[1] == v || c[2] == v) {
+                    removed += 3;
+                    continue;
+                }
+                const float* before[3];
+                const float* after[3];
+                for (int k = 0; k < 3; ++k) {
+                    before[k] = position(c[k]);
+                    after[k] = c[k] == u ? position(v) : before[k];
+                }
+                double nb[3], na[3];
+                for (int pass = 0; pass < 2; ++pass) {
+                    const float** p = pass == 0 ? before : after;
+                    double* n = pass == 0 ? nb : na;
+                    double e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+                    double e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+                    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+                    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+                    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+                }
+                double dot = nb[0] * na[0] + nb[1] * na[1] + nb[2] * na[2];
+                double lengths = sqrt((nb[0] * nb[0] + nb[1] * nb[1] + nb[2] * nb[2]) *
+                                      (na[0] * na[0] + na[1] * na[1] + na[2] * na[2]));
+                valid = lengths > 0 && dot > 0.25 * lengths;
+            }
+
+            // Every vertex at u must have a neighbour at v in its own chart to move onto
+            for (uint32_t g = groupStart[u]; g < groupStart[u + 1] && valid; ++g) {
+                uint32_t wedge = groupVertices[g];
+                uint32_t moveTo = 0xFFFFFFFFu;
+                bool used = false;
+                for (uint32_t a = adjacency.offsets[u]; a < adjacency.offsets[u + 1]; ++a) {
+                    const uint32_t* r = &result[adjacency.triangles[a] * 3];
+                    const uint32_t* c = &corners[adjacency.triangles[a] * 3];
+                    int atU = -1, atV = -1;
+                    for (int k = 0; k < 3; ++k) {
+                        if (r[k] == wedge) {
+                            used = true;
+                        }
+                        if (c[k] == u && chartOf[r[k]] == chartOf[wedge]) {
+                            atU = k;
+                        }
+                        if (c[k] == v) {
+                            atV = k;
+                        }
+                    }
+                    if (atU >= 0 && atV >= 0 && moveTo == 0xFFFFFFFFu) {
+                        moveTo = r[atV];
+                    }
+                }
+                if (used && moveTo == 0xFFFFFFFFu) {
+                    valid = false;
+                }
+                remap[wedge] = used ? moveTo : wedge;
+            }
+            if (!valid) {
+                for (uint32_t g = groupStart[u]; g < groupStart[u + 1]; ++g) {
+                    remap[groupVertices[g]] = groupVertices[g];
+                }
+                continue;
+            }
+
+            // Neither u's neighbours nor v may move in this pass; the checks above
+            // assumed their current positions
+            for (uint32_t a = adjacency.offsets[u]; a < adjacency.offsets[u + 1]; ++a) {
+                const uint32_t* c = &corners[adjacency.triangles[a] * 3];
+                locked[c[0]] = locked[c[1]] = locked[c[2]] = 1;
+            }
+            quadrics[v].add(quadrics[u]);
+            appliedCost = std::max(appliedCost, cost[u]);
+            remaining -= removed;
+            ++collapses;
+        }
+
+        if (collapses == 0) {
+            break;
+        }
+
+        // Apply the collapses and drop triangles that lost an edge
+        size_t write = 0;
+        for (size_t t = 0; t < result.size(); t += 3) {
+            uint32_t a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+            uint32_t pa = positionOf[a], pb = positionOf[b], pc = positionOf[c];
+            if (pa == pb || pb == pc || pa == pc) {
+                continue;
+            }
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+        rebuild();
+    }
+
+    if (error) {
+        *error = (float)sqrt(appliedCost);
+    }
+    return result;
+}
+
+// Builds the LOD chain of a mesh: the full index list followed by coarser levels
+// that keep LOD_TRIANGLE_RATIOS of its triangles. Each level is simplified from
+// the full mesh so its error is measured against it, which also lets the levels
+// run in parallel. The chain stops early once a level cannot get meaningfully
+// smaller within the error bound.
+inline void buildLodChain(const float* positions, const float* uvs, size_t vertexStride, size_t vertexCount,
+                          const uint32_t* indices, size_t indexCount,
+                          std::vector<uint32_t>& lodIndices, MeshLodChain& chain, bool optimize = true) {
+    computeBoundingSphere(positions, vertexStride, vertexCount, chain.boundingSphere);
+    float maxError = chain.boundingSphere[3] * LOD_MAX_RELATIVE_ERROR;
+
+    lodIndices.assign(indices, indices + indexCount);
+    chain.lods.clear();
+    MeshLod full = {0, (uint32_t)indexCount, 0.0f};
+    chain.lods.push_back(full);
+
+    const size_t levelCount = sizeof(LOD_TRIANGLE_RATIOS) / sizeof(LOD_TRIANGLE_RATIOS[0]);
+    std::vector<std::vector<uint32_t> > levels(levelCount);
+    float errors[levelCount];
+    parallelFor(levelCount, [&](size_t level) {
+        size_t target = (size_t)(indexCount / 3 * LOD_TRIANGLE_RATIOS[level]) * 3;
+        levels[level] = simplifyMesh(positions, uvs, vertexStride, vertexCount, indices, indexCount,
+                                     target, maxError, &errors[level]);
+        if (optimize && !levels[level].empty()) {
+            optimizeVertexCache(&levels[level][0], levels[level].size(), vertexCount);
+        }
+    });
+
+    for (size_t level = 0; level < levelCount; ++level) {
+        const std::vector<uint32_t>& simplified = levels[level];
+        if (simplified.empty() || simplified.size() * 10 > chain.lods.back().indexCount * 9) {
+            break;
+        }
+        MeshLod lod = {(uint32_t)lodIndices.size(), (uint32_t)simplified.size(), errors[level]};
+        lodIndices.insert(lodIndices.end(), simplified.begin(), simplified.end());
+        chain.lods.push_back(lod);
+    }
+}
+
+// Picks the coarsest level whose error covers at most maxPixels on screen.
+// distance is from the eye to the bounding sphere; pixelScale converts a length at
+// distance 1 to pixels (projection[1][1] * viewport height / 2).
+inline size_t selectLod(const MeshLod* lods, size_t lodCount, float distance, float pixelScale, float maxPixels = 1.0f) {
+    if (lodCount == 0 || pixelScale <= 0) {
+        return 0;
+    }
+    distance = std::max(distance, 1e-4f);
+    for (size_t level = lodCount - 1; level > 0; --level) {
+        if (lods[level].error * pixelScale / distance <= maxPixels) {
+            return level;
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,162 @@
+// MeshWeld.hpp merges duplicate vertices left by per-corner exporters
+#ifndef MESHWELD_HPP
+#define MESHWELD_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+// A run of float components that must agree for two vertices to be welded
+struct WeldAttribute {
+    size_t offset; // Byte offset of the first float in the vertex
+    size_t count;  // Number of floats
+};
+
+// Open addressing table from a position cell to the newest welded vertex in it;
+// older ones in the same cell are chained through WeldGrid::nextInCell.
+struct WeldGrid {
+    struct Entry {
+        int64_t cell[3];
+        uint32_t head;
+    };
+    std::vector<Entry> entries;
+    std::vector<uint32_t> nextInCell;
+    size_t mask;
+
+    static const uint32_t EMPTY = 0xFFFFFFFFu;
+
+    explicit WeldGrid(size_t vertexCount) {
+        size_t capacity = 16;
+        while (capacity < vertexCount * 2) {
+            capacity <<= 1;
+        }
+        Entry empty = {{0, 0, 0}, EMPTY};
+        entries.assign(capacity, empty);
+        mask = capacity - 1;
+    }
+
+    Entry& find(const int64_t* cell) {
+        uint64_t h = (uint64_t)cell[0] * 0x9E3779B97F4A7C15ull ^ (uint64_t)cell[1] * 0xC2B2AE3D27D4EB4Full ^
+                     (uint64_t)cell[2] * 0x165667B19E3779F9ull;
+        h ^= h >> 29;
+        for (size_t slot = (size_t)h & mask;; slot = (slot + 1) & mask) {
+            Entry& entry = entries[slot];
+            if (entry.head == EMPTY || (entry.cell[0] == cell[0] && entry.cell[1] == cell[1] && entry.cell[2] == cell[2])) {
+                return entry;
+            }
+        }
+    }
+};
+
+// Collapses vertices whose attributes agree to within epsilon into the first of them
+// and remaps indices to match. The first attribute must be the x, y, z position: it
+// picks the grid cells searched for candidates, so only vertices whose positions are
+// within epsilon on every axis are ever compared. An epsilon of 0 welds only exact
+// copies (with -0 equal to 0). Fields not named by an attribute are taken from the
+// vertex kept. Vertices are compacted in place in first-seen order; returns the new
+// vertex count. Triangles that collapse are left in the index buffer. Indices must be
+// below vertexCount, as the PLY readers guarantee. Throws if a position is not finite,
+// or so large that its grid cell does not fit in 64 bits.
+inline size_t weldVertices(void* vertices, size_t vertexCount, size_t stride, const std::vector<WeldAttribute>& attributes,
+                           float epsilon, uint32_t* indices, size_t indexCount) {
+    if (vertexCount == 0 || attributes.empty()) {
+        return vertexCount;
+    }
+    char* data = (char*)vertices;
+    WeldGrid grid(vertexCount);
+    grid.nextInCell.reserve(vertexCount);
+    std::vector<uint32_t> remap(vertexCount);
+    // Cells are twice epsilon wide, so everything within epsilon is in at most two per axis
+    float cellSize = 2.0f * epsilon;
+    float positionLimit = epsilon > 0.0f ? cellSize * 0x1p62f : INFINITY;
+    uint32_t next = 0;
+
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const char* vertex = data + v * stride;
+        float position[3];
+        memcpy(position, vertex + attributes[0].offset, sizeof(position));
+        int64_t cell[3], first[3], last[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            // Also false for NaN, whose cast to a cell index would be undefined
+            if (!(fabsf(position[axis]) < positionLimit)) {
+                throw std::runtime_error("Cannot weld vertex " + std::to_string(v) + ": its position is not finite or out of range");
+            }
+            if (epsilon > 0.0f) {
+                cell[axis] = (int64_t)floorf(position[axis] / cellSize);
+                first[axis] = (int64_t)floorf((position[axis] - epsilon) / cellSize);
+                last[axis] = (int64_t)floorf((position[axis] + epsilon) / cellSize);
+            } else {
+                float value = position[axis] + 0.0f;
+                int32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                cell[axis] = first[axis] = last[axis] = bits;
+            }
+        }
+
+        // Vertices within epsilon of this one are in the cells that its epsilon box touches
+        uint32_t match = WeldGrid::EMPTY;
+        for (int64_t x = first[0]; x <= last[0] && match == WeldGrid::EMPTY; ++x) {
+            for (int64_t y = first[1]; y <= last[1] && match == WeldGrid::EMPTY; ++y) {
+                for (int64_t z = first[2]; z <= last[2] && match == WeldGrid::EMPTY; ++z) {
+                    int64_t neighbour[3] = {x, y, z};
+                    for (uint32_t candidate = grid.find(neighbour).head; candidate != WeldGrid::EMPTY;
+                         candidate = grid.nextInCell[candidate]) {
+                        const char* kept = data + (size_t)candidate * stride;
+                        bool same = true;
+                        for (size_t a = 0; a < attributes.size() && same; ++a) {
+                            for (size_t c = 0; c < attributes[a].count && same; ++c) {
+                                float mine, theirs;
+                                memcpy(&mine, vertex + attributes[a].offset + c * sizeof(float), sizeof(float));
+                                memcpy(&theirs, kept + attributes[a].offset + c * sizeof(float), sizeof(float));
+                                same = fabsf(mine - theirs) <= epsilon;
+                            }
+                        }
+                        if (same) {
+                            match = candidate;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        if (match != WeldGrid::EMPTY) {
+            remap[v] = match;
+            continue;
+        }
+
+        // A new vertex; every slot up to v has been read already, so it moves down in place
+        WeldGrid::Entry& entry = grid.find(cell);
+        if (entry.head == WeldGrid::EMPTY) {
+            memcpy(entry.cell, cell, sizeof(cell));
+        }
+        grid.nextInCell.push_back(entry.head);
+        entry.head = next;
+        if (next != v) {
+            memcpy(data + (size_t)next * stride, vertex, stride);
+        }
+        remap[v] = next++;
+    }
+
+    for (size_t i = 0; i < indexCount; ++i) {
+        indices[i] = remap[indices[i]];
+    }
+    return next;
+}
+
+// Welds a loaded mesh and prints how far the vertex count dropped
+template <typename VertexT>
+void weldMesh(std::vector<VertexT>& vertices, uint32_t* indices, size_t indexCount,
+              const std::vector<WeldAttribute>& attributes, float epsilon, const char* label) {
+    if (vertices.empty()) {
+        return;
+    }
+    size_t before = vertices.size();
+    vertices.resize(weldVertices(&vertices[0], vertices.size(), sizeof(VertexT), attributes, epsilon, indices, indexCount));
+    printf("%s: welded %zu -> %zu vertices (%.2fx)\n", label, before, vertices.size(), (double)before / vertices.size());
+}
+
+#endif
@@ -0,0 +1,241 @@
+// Meshlets.hpp small triangle clusters with bounds for per-cluster culling
+#ifndef MESHLETS_HPP
+#define MESHLETS_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "IndexBuffer.hpp"
+
+// Cluster size limits, the usual choice for mesh shader hardware
+const size_t MESHLET_MAX_VERTICES = 64;
+const size_t MESHLET_MAX_TRIANGLES = 124;
+
+// A contiguous range of the index buffer with the bounds needed to cull it.
+// A cluster whose triangles all face away from the camera is skipped when
+// dot(normalize(coneApex - camera), coneAxis) >= coneCutoff.
+struct Meshlet {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t baseVertex;  // Added to every index, for meshes split into sub-meshes
+    float boundingSphere[4];
+    float coneApex[3];
+    float coneAxis[3];
+    float coneCutoff;     // Above 1 when the cone is too wide to ever cull
+};
+
+// Bounding sphere and normal cone of the triangles in indices[first, first + count)
+inline void computeMeshletBounds(const float* positions, size_t positionStride,
+                                 const uint32_t* indices, size_t first, size_t count, Meshlet& meshlet) {
+    const size_t step = positionStride / sizeof(float);
+    size_t triangleCount = count / 3;
+    std::vector<float> normals(triangleCount * 3);
+
+    float lower[3] = {0, 0, 0}, upper[3] = {0, 0, 0};
+    float axis[3] = {0, 0, 0};
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const float* p[3];
+        for (int k = 0; k < 3; ++k) {
+            p[k] = positions + indices[first + t * 3 + k] * step;
+            for (int j = 0; j < 3; ++j) {
+                if ((t == 0 && k == 0) || p[k][j] < lower[j]) lower[j] = p[k][j];
+                if ((t == 0 && k == 0) || p[k][j] > upper[j]) upper[j] = p[k][j];
+            }
+        }
+        float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+        float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+        float* n = &normals[t * 3];
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int j = 0; j < 3; ++j) {
+            n[j] = length > 0 ? n[j] / length : 0;
+            axis[j] += n[j];
+        }
+    }
+
+    float* sphere = meshlet.boundingSphere;
+    float radius = 0;
+    for (int j = 0; j < 3; ++j) {
+        sphere[j] = 0.5f * (lower[j] + upper[j]);
+    }
+    for (size_t i = first; i < first + count; ++i) {
+        const float* p = positions + indices[i] * step;
+        float dx = p[0] - sphere[0], dy = p[1] - sphere[1], dz = p[2] - sphere[2];
+        radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+    }
+    sphere[3] = sqrtf(radius);
+
+    // Cone around the average normal that holds every triangle normal; the apex is
+    // pulled back until every triangle plane lies in front of it
+    float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float minDot = 1;
+    for (int j = 0; j < 3; ++j) {
+        axis[j] = axisLength > 0 ? axis[j] / axisLength : 0;
+    }
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const float* n = &normals[t * 3];
+        minDot = std::min(minDot, n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]);
+    }
+    memcpy(meshlet.coneAxis, axis, sizeof(axis));
+    memcpy(meshlet.coneApex, sphere, sizeof(meshlet.coneApex));
+    if (axisLength == 0 || minDot <= 0.1f) {
+        meshlet.coneCutoff = 2.0f;
+        return;
+    }
+    float maxT = 0;
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const float* n = &normals[t * 3];
+        const float* p0 = positions + indices[first + t * 3] * step;
+        float toCentre[3] = {sphere[0] - p0[0], sphere[1] - p0[1], sphere[2] - p0[2]};
+        float along = n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2];
+        maxT = std::max(maxT, (toCentre[0] * n[0] + toCentre[1] * n[1] + toCentre[2] * n[2]) / along);
+    }
+    for (int j = 0; j < 3; ++j) {
+        meshlet.coneApex[j] = sphere[j] - axis[j] * maxT;
+    }
+    meshlet.coneCutoff = sqrtf(1 - minDot * minDot);
+}
+
+// Cuts indices[first, first + count) into meshlets in triangle order, starting a new one
+// whenever the next triangle would exceed the vertex or triangle limit. The triangle
+// order is kept, so run this after the vertex cache pass, which already keeps
+// neighbouring triangles together.
+inline void buildMeshlets(const float* positions, size_t positionStride, size_t vertexCount,
+                          const uint32_t* indices, size_t first, size_t count, std::vector<Meshlet>& meshlets,
+                          size_t maxVertices = MESHLET_MAX_VERTICES, size_t maxTriangles = MESHLET_MAX_TRIANGLES) {
+    std::vector<uint32_t> seen(vertexCount, 0xFFFFFFFFu);
+    size_t start = first, vertices = 0;
+    uint32_t id = 0;
+
+    for (size_t t = first; t + 2 < first + count; t += 3) {
+        size_t added = 0;
+        for (int k = 0; k < 3; ++k) {
+            if (seen[indices[t + k]] != id) {
+                ++added;
+            }
+        }
+        if (vertices + added > maxVertices || (t - start) / 3 + 1 > maxTriangles) {
+            Meshlet meshlet = {(uint32_t)start, (uint32_t)(t - start), 0, {0, 0, 0, 0}, {0, 0, 0}, {0, 0, 0}, 0};
+            computeMeshletBounds(positions, positionStride, indices, start, t - start, meshlet);
+            meshlets.push_back(meshlet);
+            start = t;
+            vertices = 0;
+            ++id;
+        }
+        for (int k = 0; k < 3; ++k) {
+            if (seen[indices[t + k]] != id) {
+                seen[indices[t + k]] = id;
+                ++vertices;
+            }
+        }
+    }
+    size_t end = first + count / 3 * 3;
+    if (end > start) {
+        Meshlet meshlet = {(uint32_t)start, (uint32_t)(end - start), 0, {0, 0, 0, 0}, {0, 0, 0}, {0, 0, 0}, 0};
+        computeMeshletBounds(positions, positionStride, indices, start, end - start, meshlet);
+        meshlets.push_back(meshlet);
+    }
+}
+
+// Gives each meshlet the base vertex of the sub-mesh it lies in, cutting meshlets that
+// straddle two sub-meshes. Both halves keep the bounds of the whole, which still hold.
+inline void assignMeshletSubMeshes(std::vector<Meshlet>& meshlets, const SubMesh* subMeshes, size_t subMeshCount) {
+    if (subMeshCount == 0) {
+        return;
+    }
+    std::vector<Meshlet> result;
+    result.reserve(meshlets.size() + subMeshCount);
+    size_t s = 0;
+    for (size_t m = 0; m < meshlets.size(); ++m) {
+        Meshlet meshlet = meshlets[m];
+        uint32_t end = meshlet.firstIndex + meshlet.indexCount;
+        while (meshlet.firstIndex < end) {
+            while (s + 1 < subMeshCount && subMeshes[s].firstIndex + subMeshes[s].indexCount <= meshlet.firstIndex) {
+                ++s;
+            }
+            Meshlet piece = meshlet;
+            piece.indexCount = std::min(end, subMeshes[s].firstIndex + subMeshes[s].indexCount) - meshlet.firstIndex;
+            piece.baseVertex = subMeshes[s].baseVertex;
+            result.push_back(piece);
+            meshlet.firstIndex += piece.indexCount;
+        }
+    }
+    meshlets.swap(result);
+}
+
+// The model space view frustum and eye of a perspective model-view-projection matrix
+// (column major, as OpenGL and GLM store it)
+struct MeshletCuller {
+    float planes[6][4];
+    float camera[3];
+
+    explicit MeshletCuller(const float* mvp) {
+        // Gribb and Hartmann: each plane is row 3 plus or minus row 0, 1 or 2
+        for (int i = 0; i < 6; ++i) {
+            int row = i / 2;
+            float sign = i % 2 == 0 ? 1.0f : -1.0f;
+            float length = 0;
+            for (int c = 0; c < 4; ++c) {
+                planes[i][c] = mvp[c * 4 + 3] + sign * mvp[c * 4 + row];
+                length += c < 3 ? planes[i][c] * planes[i][c] : 0;
+            }
+            length = sqrtf(length);
+            for (int c = 0; c < 4; ++c) {
+                planes[i][c] = length > 0 ? planes[i][c] / length : planes[i][c];
+            }
+        }
+
+        // The eye is the point with clip x = y = w = 0; solve rows 0, 1 and 3 by Cramer's rule
+        const int rows[3] = {0, 1, 3};
+        float a[3][3], b[3];
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                a[r][c] = mvp[c * 4 + rows[r]];
+            }
+            b[r] = -mvp[12 + rows[r]];
+        }
+        float det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+                  - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+                  + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+        for (int c = 0; c < 3; ++c) {
+            float m[3][3];
+            memcpy(m, a, sizeof(m));
+            for (int r = 0; r < 3; ++r) {
+                m[r][c] = b[r];
+            }
+            float detC = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                       - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                       + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+            camera[c] = det != 0 ? detC / det : 0;
+        }
+    }
+
+    bool inFrustum(const Meshlet& meshlet) const {
+        return sphereInFrustum(meshlet.boundingSphere);
+    }
+
+    // sphere is centre x, y, z and radius
+    bool sphereInFrustum(const float* sphere) const {
+        for (int i = 0; i < 6; ++i) {
+            if (planes[i][0] * sphere[0] + planes[i][1] * sphere[1] + planes[i][2] * sphere[2] + planes[i][3] < -sphere[3]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Only meaningful when back faces are not meant to be seen
+    bool backFacing(const Meshlet& meshlet) const {
+        float view[3] = {meshlet.coneApex[0] - camera[0], meshlet.coneApex[1] - camera[1], meshlet.coneApex[2] - camera[2]};
+        float length = sqrtf(view[0] * view[0] + view[1] * view[1] + view[2] * view[2]);
+        const float* axis = meshlet.coneAxis;
+        return view[0] * axis[0] + view[1] * axis[1] + view[2] * axis[2] >= meshlet.coneCutoff * length;
+    }
+};
+
+#endif
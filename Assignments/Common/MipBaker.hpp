@@ -0,0 +1,326 @@
+// MipBaker.hpp gamma-correct mip chains baked on the CPU
+#ifndef MIPBAKER_HPP
+#define MIPBAKER_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#include "BMPImage.hpp"
+#include "Parallel.hpp"
+
+// Rows of a level handed to one parallelFor item
+const unsigned int MIP_ROW_BLOCK = 16;
+
+// Size of the linear to sRGB table; fine enough that every byte survives a round
+// trip and no value lands more than one step from the exact conversion
+const unsigned int MIP_SRGB_TABLE_SIZE = 4096;
+
+enum MipFilter {
+    MIP_FILTER_BOX,   // 2x2 average: cheap, slightly blurry, aliases on fine detail
+    MIP_FILTER_KAISER // 6x6 Kaiser-windowed sinc: sharper levels with less aliasing
+};
+
+// One level of a mip chain, rows tightly packed and bottom row first, in the
+// channel layout of the image it was baked from
+struct MipLevel {
+    unsigned int width, height;
+    const unsigned char* pixels;
+    size_t size;
+};
+
+// Levels 1 and up of a texture, their pixels held in storage
+struct MipChain {
+    std::vector<MipLevel> levels;
+    std::vector<unsigned char> storage;
+};
+
+// A level during baking: four linear floats per pixel, bottom row first
+struct LinearLevel {
+    unsigned int width, height;
+    std::vector<float> pixels;
+};
+
+inline const float* srgbToLinearTable() {
+    static const std::vector<float> table = []() {
+        std::vector<float> values(256);
+        for (int i = 0; i < 256; ++i) {
+            float c = i / 255.0f;
+            values[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+inline const unsigned char* linearToSrgbTable() {
+    static const std::vector<unsigned char> table = []() {
+        std::vector<unsigned char> values(MIP_SRGB_TABLE_SIZE);
+        for (unsigned int i = 0; i < MIP_SRGB_TABLE_SIZE; ++i) {
+            float c = (float)i / (MIP_SRGB_TABLE_SIZE - 1);
+            float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+            values[i] = (unsigned char)(s * 255.0f + 0.5f);
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+// Converts image's colour channels from sRGB to linear light, or just to floats
+// when srgb is false and the bytes are data. Alpha is already linear; padding
+// bytes of a 32-bit image without alpha become opaque.
+inline void decodeLinear(const BMPImage& image, bool srgb, LinearLevel& level) {
+    float identity[256];
+    for (int i = 0; i < 256; ++i) {
+        identity[i] = i / 255.0f;
+    }
+    const float* toLinear = srgb ? srgbToLinearTable() : identity;
+    level.width = image.width;
+    level.height = image.height;
+    level.pixels.resize((size_t)image.width * image.height * 4);
+    size_t blocks = (image.height + MIP_ROW_BLOCK - 1) / MIP_ROW_BLOCK;
+    parallelFor(blocks, [&](size_t block) {
+        unsigned int end = std::min(image.height, (unsigned int)(block + 1) * MIP_ROW_BLOCK);
+        for (unsigned int y = (unsigned int)block * MIP_ROW_BLOCK; y < end; ++y) {
+            const unsigned char* in = image.row(y);
+            float* out = &level.pixels[(size_t)y * image.width * 4];
+            for (unsigned int x = 0; x < image.width; ++x, in += image.channels, out += 4) {
+                out[0] = toLinear[in[0]];
+                out[1] = toLinear[in[1]];
+                out[2] = toLinear[in[2]];
+                out[3] = image.hasAlpha ? in[3] / 255.0f : 1.0f;
+            }
+        }
+    });
+}
+
+// Converts a linear level back to bytes in the layout of the source image
+inline void encodeLevel(const LinearLevel& level, unsigned int channels, bool srgb, unsigned char* out) {
+    const unsigned char* toSrgb = linearToSrgbTable();
+    const float scale = (float)(MIP_SRGB_TABLE_SIZE - 1);
+    size_t count = (size_t)level.width * level.height;
+    for (size_t i = 0; i < count; ++i, out += channels) {
+        const float* in = &level.pixels[i * 4];
+        for (unsigned int c = 0; c < 3; ++c) {
+            float v = std::min(std::max(in[c], 0.0f), 1.0f);
+            out[c] = srgb ? toSrgb[(unsigned int)(v * scale + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f);
+        }
+        if (channels == 4) {
+            out[3] = (unsigned char)(std::min(std::max(in[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+}
+
+// One row of a 2x2 box reduction. row0 and row1 are source rows; an odd last
+// column is averaged with itself.
+inline void boxRow(const float* row0, const float* row1, unsigned int sourceWidth, float* out, unsigned int width) {
+    unsigned int x = 0;
+#ifdef __AVX__
+    // Two target pixels at a time: sum the rows, then pair up neighbouring pixels
+    const __m256 quarter8 = _mm256_set1_ps(0.25f);
+    for (; x + 1 < width && x * 2 + 3 < sourceWidth; x += 2) {
+        __m256 s01 = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8), _mm256_loadu_ps(row1 + x * 8));
+        __m256 s23 = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8 + 8), _mm256_loadu_ps(row1 + x * 8 + 8));
+        __m256 even = _mm256_permute2f128_ps(s01, s23, 0x20);
+        __m256 odd = _mm256_permute2f128_ps(s01, s23, 0x31);
+        _mm256_storeu_ps(out + x * 4, _mm256_mul_ps(_mm256_add_ps(even, odd), quarter8));
+    }
+#endif
+    for (; x < width; ++x) {
+        const float* a0 = row0 + std::min(x * 2, sourceWidth - 1) * 4;
+        const float* a1 = row0 + std::min(x * 2 + 1, sourceWidth - 1) * 4;
+        const float* b0 = row1 + std::min(x * 2, sourceWidth - 1) * 4;
+        const float* b1 = row1 + std::min(x * 2 + 1, sourceWidth - 1) * 4;
+#ifdef __SSE2__
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a0), _mm_loadu_ps(a1)), _mm_add_ps(_mm_loadu_ps(b0), _mm_loadu_ps(b1)));
+        _mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+        for (int c = 0; c < 4; ++c) {
+            out[x * 4 + c] = (a0[c] + a1[c] + b0[c] + b1[c]) * 0.25f;
+        }
+#endif
+    }
+}
+
+// Weights of the Kaiser-windowed sinc for a 2x reduction. Tap i reads source pixel
+// 2x - 2 + i, at distance i - 2.5 from the centre of target pixel x.
+const int MIP_KAISER_TAPS = 6;
+
+inline double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+inline const float* kaiserWeights() {
+    static const std::vector<float> weights = []() {
+        const double alpha = 4.0, radius = MIP_KAISER_TAPS / 2.0, pi = 3.14159265358979323846;
+        std::vector<float> values(MIP_KAISER_TAPS);
+        double total = 0.0;
+        std::vector<double> raw(MIP_KAISER_TAPS);
+        for (int i = 0; i < MIP_KAISER_TAPS; ++i) {
+            double d = i - (MIP_KAISER_TAPS - 1) / 2.0;
+            double s = d / 2.0; // Source pixels are half a target pixel wide
+            double sinc = sin(pi * s) / (pi * s);
+            double t = d / radius;
+            raw[i] = sinc * besselI0(alpha * sqrt(1.0 - t * t)) / besselI0(alpha);
+            total += raw[i];
+        }
+        for (int i = 0; i < MIP_KAISER_TAPS; ++i) {
+            values[i] = (float)(raw[i] / total);
+        }
+        return values;
+    }();
+    return weights.data();
+}
+
+// Filters one source row horizontally into width target pixels, clamping at the edges
+inline void kaiserRow(const float* row, unsigned int sourceWidth, float* out, unsigned int width) {
+    const float* weights = kaiserWeights();
+    for (unsigned int x = 0; x < width; ++x) {
+        int first = (int)x * 2 - (MIP_KAISER_TAPS / 2 - 1);
+#ifdef __SSE2__
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < MIP_KAISER_TAPS; ++i) {
+            int sx = std::min(std::max(first + i, 0), (int)sourceWidth - 1);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + sx * 4), _mm_set1_ps(weights[i])));
+        }
+        _mm_storeu_ps(out + x * 4, sum);
+#else
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < MIP_KAISER_TAPS; ++i) {
+            const float* p = row + std::min(std::max(first + i, 0), (int)sourceWidth - 1) * 4;
+            for (int c = 0; c < 4; ++c) {
+                sum[c] += p[c] * weights[i];
+            }
+        }
+        memcpy(out + x * 4, sum, sizeof(sum));
+#endif
+    }
+}
+
+// Weighted sum of MIP_KAISER_TAPS rows of floatCount floats each
+inline void kaiserColumn(const float* const* rows, float* out, size_t floatCount) {
+    const float* weights = kaiserWeights();
+    size_t i = 0;
+#ifdef __AVX__
+    for (; i + 8 <= floatCount; i += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int t = 0; t < MIP_KAISER_TAPS; ++t) {
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[t] + i), _mm256_set1_ps(weights[t])));
+        }
+        _mm256_storeu_ps(out + i, sum);
+    }
+#endif
+#ifdef __SSE2__
+    for (; i + 4 <= floatCount; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int t = 0; t < MIP_KAISER_TAPS; ++t) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[t] + i), _mm_set1_ps(weights[t])));
+        }
+        _mm_storeu_ps(out + i, sum);
+    }
+#endif
+    for (; i < floatCount; ++i) {
+        float sum = 0.0f;
+        for (int t = 0; t < MIP_KAISER_TAPS; ++t) {
+            sum += rows[t][i] * weights[t];
+        }
+        out[i] = sum;
+    }
+}
+
+// Halves source into target with filter. The rows of the level are spread over
+// the cores; levels depend on each other, so they run one after another.
+inline void reduceLevel(const LinearLevel& source, MipFilter filter, LinearLevel& target) {
+    target.width = std::max(1u, source.width / 2);
+    target.height = std::max(1u, source.height / 2);
+    target.pixels.resize((size_t)target.width * target.height * 4);
+    size_t sourceStride = (size_t)source.width * 4;
+    size_t targetStride = (size_t)target.width * 4;
+    size_t blocks = (target.height + MIP_ROW_BLOCK - 1) / MIP_ROW_BLOCK;
+
+    if (filter == MIP_FILTER_BOX) {
+        parallelFor(blocks, [&](size_t block) {
+            unsigned int end = std::min(target.height, (unsigned int)(block + 1) * MIP_ROW_BLOCK);
+            for (unsigned int y = (unsigned int)block * MIP_ROW_BLOCK; y < end; ++y) {
+                const float* row0 = &source.pixels[std::min(y * 2, source.height - 1) * sourceStride];
+                const float* row1 = &source.pixels[std::min(y * 2 + 1, source.height - 1) * sourceStride];
+                boxRow(row0, row1, source.width, &target.pixels[y * targetStride], target.width);
+            }
+        });
+        return;
+    }
+
+    // Separable: every source row is filtered horizontally, then columns of those
+    std::vector<float> horizontal((size_t)source.height * targetStride);
+    size_t sourceBlocks = (source.height + MIP_ROW_BLOCK - 1) / MIP_ROW_BLOCK;
+    parallelFor(sourceBlocks, [&](size_t block) {
+        unsigned int end = std::min(source.height, (unsigned int)(block + 1) * MIP_ROW_BLOCK);
+        for (unsigned int y = (unsigned int)block * MIP_ROW_BLOCK; y < end; ++y) {
+            kaiserRow(&source.pixels[y * sourceStride], source.width, &horizontal[y * targetStride], target.width);
+        }
+    });
+    parallelFor(blocks, [&](size_t block) {
+        unsigned int end = std::min(target.height, (unsigned int)(block + 1) * MIP_ROW_BLOCK);
+        for (unsigned int y = (unsigned int)block * MIP_ROW_BLOCK; y < end; ++y) {
+            const float* rows[MIP_KAISER_TAPS];
+            int first = (int)y * 2 - (MIP_KAISER_TAPS / 2 - 1);
+            for (int i = 0; i < MIP_KAISER_TAPS; ++i) {
+                rows[i] = &horizontal[std::min(std::max(first + i, 0), (int)source.height - 1) * targetStride];
+            }
+            kaiserColumn(rows, &target.pixels[y * targetStride], targetStride);
+        }
+    });
+}
+
+// Bakes levels 1 and up of image's mip chain, down to 1x1. Colour (srgb) is
+// filtered in linear light so dark and bright texels average the way the eye sees
+// them; data such as height maps, and alpha, is filtered as stored.
+inline void bakeMipChain(const BMPImage& image, MipFilter filter, MipChain& chain, bool srgb = true) {
+    chain.levels.clear();
+    chain.storage.clear();
+
+    std::vector<MipLevel> levels;
+    size_t total = 0;
+    unsigned int width = image.width, height = image.height;
+    while (width > 1 || height > 1) {
+        MipLevel level;
+        level.width = width = std::max(1u, width / 2);
+        level.height = height = std::max(1u, height / 2);
+        level.size = (size_t)width * height * image.channels;
+        level.pixels = NULL;
+        levels.push_back(level);
+        total += level.size;
+    }
+    if (levels.empty()) {
+        return;
+    }
+    chain.storage.resize(total);
+
+    LinearLevel current, next;
+    decodeLinear(image, srgb, current);
+    size_t offset = 0;
+    for (MipLevel& level : levels) {
+        reduceLevel(current, filter, next);
+        encodeLevel(next, image.channels, srgb, &chain.storage[offset]);
+        level.pixels = &chain.storage[offset];
+        offset += level.size;
+        std::swap(current, next);
+    }
+    chain.levels.swap(levels);
+}
+
+#endif
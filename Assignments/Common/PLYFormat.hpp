@@ -0,0 +1,57 @@
+// PLYFormat.hpp PLY encodings and property types shared by the reader and writer
+#ifndef PLYFORMAT_HPP
+#define PLYFORMAT_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <string>
+
+enum PLYFormat {
+    PLY_ASCII,
+    PLY_BINARY_LITTLE_ENDIAN,
+    PLY_BINARY_BIG_ENDIAN
+};
+
+enum PLYType {
+    PLY_INVALID,
+    PLY_CHAR,
+    PLY_UCHAR,
+    PLY_SHORT,
+    PLY_USHORT,
+    PLY_INT,
+    PLY_UINT,
+    PLY_FLOAT,
+    PLY_DOUBLE
+};
+
+inline PLYType parsePLYType(const std::string& token) {
+    if (token == "char" || token == "int8") return PLY_CHAR;
+    if (token == "uchar" || token == "uint8") return PLY_UCHAR;
+    if (token == "short" || token == "int16") return PLY_SHORT;
+    if (token == "ushort" || token == "uint16") return PLY_USHORT;
+    if (token == "int" || token == "int32") return PLY_INT;
+    if (token == "uint" || token == "uint32") return PLY_UINT;
+    if (token == "float" || token == "float32") return PLY_FLOAT;
+    if (token == "double" || token == "float64") return PLY_DOUBLE;
+    return PLY_INVALID;
+}
+
+inline size_t plyTypeSize(PLYType type) {
+    switch (type) {
+        case PLY_CHAR: case PLY_UCHAR: return 1;
+        case PLY_SHORT: case PLY_USHORT: return 2;
+        case PLY_INT: case PLY_UINT: case PLY_FLOAT: return 4;
+        case PLY_DOUBLE: return 8;
+        default: return 0;
+    }
+}
+
+inline bool plyHostIsLittleEndian() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+#endif
@@ -0,0 +1,886 @@
+// PLYReader.hpp shared PLY parsing for the Assignment 4 and Assignment 6 mesh loaders
+#ifndef PLYREADER_HPP
+#define PLYREADER_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <charconv>
+#include <system_error>
+#include <algorithm>
+
+#include "PLYFormat.hpp"
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+
+// Vertex attributes a loader can receive, matched by property name in the header
+enum PLYAttrib {
+    PLY_UNUSED = -1,
+    PLY_X, PLY_Y, PLY_Z,
+    PLY_NX, PLY_NY, PLY_NZ,
+    PLY_RED, PLY_GREEN, PLY_BLUE,
+    PLY_U, PLY_V,
+    PLY_ATTRIB_COUNT
+};
+
+struct PLYProperty {
+    std::string name;
+    PLYType type;      // Value type, or the item type of a list
+    PLYType countType; // Length type of a list, PLY_INVALID for scalars
+    int attrib;        // PLYAttrib the property maps to
+};
+
+struct PLYElement {
+    std::string name;
+    size_t count;
+    std::vector<PLYProperty> properties;
+};
+
+struct PLYHeader {
+    PLYFormat format;
+    std::vector<PLYElement> elements;
+
+    const PLYElement* find(const std::string& name) const {
+        for (size_t i = 0; i < elements.size(); ++i) {
+            if (elements[i].name == name) {
+                return &elements[i];
+            }
+        }
+        return NULL;
+    }
+
+    // Number of vertices the file declares; every face index must be below it
+    size_t vertexCount() const {
+        const PLYElement* vertex = find("vertex");
+        return vertex ? vertex->count : 0;
+    }
+
+    // True if the vertex element has a property that maps to attrib
+    bool hasVertexAttrib(int attrib) const {
+        if (const PLYElement* vertex = find("vertex")) {
+            for (size_t p = 0; p < vertex->properties.size(); ++p) {
+                if (vertex->properties[p].attrib == attrib) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+};
+
+// Describes where each attribute lives inside the caller's vertex struct,
+// so decoded values are written straight into the destination array.
+struct PLYVertexLayout {
+    size_t stride;
+    int offset[PLY_ATTRIB_COUNT]; // Byte offset of the field, -1 if the struct has none
+    PLYType type[PLY_ATTRIB_COUNT]; // PLY_FLOAT or PLY_UCHAR
+};
+
+inline PLYVertexLayout makePLYVertexLayout(size_t stride) {
+    PLYVertexLayout layout;
+    layout.stride = stride;
+    for (int i = 0; i < PLY_ATTRIB_COUNT; ++i) {
+        layout.offset[i] = -1;
+        layout.type[i] = PLY_FLOAT;
+    }
+    return layout;
+}
+
+inline void setPLYAttrib(PLYVertexLayout& layout, int attrib, size_t offset, PLYType type = PLY_FLOAT) {
+    layout.offset[attrib] = (int)offset;
+    layout.type[attrib] = type;
+}
+
+inline int plyAttribFromName(const std::string& name) {
+    if (name == "x") return PLY_X;
+    if (name == "y") return PLY_Y;
+    if (name == "z") return PLY_Z;
+    if (name == "nx") return PLY_NX;
+    if (name == "ny") return PLY_NY;
+    if (name == "nz") return PLY_NZ;
+    if (name == "red") return PLY_RED;
+    if (name == "green") return PLY_GREEN;
+    if (name == "blue") return PLY_BLUE;
+    if (name == "u" || name == "s" || name == "texture_u") return PLY_U;
+    if (name == "v" || name == "t" || name == "texture_v") return PLY_V;
+    return PLY_UNUSED;
+}
+
+// Reads the header up to and including end_header, leaving the stream at the first data byte.
+inline PLYHeader readPLYHeader(std::istream& file, const std::string& filename) {
+    PLYHeader header;
+    header.format = PLY_ASCII;
+
+    std::string line;
+    if (!std::getline(file, line) || line.compare(0, 3, "ply") != 0) {
+        throw std::runtime_error("Not a PLY file: " + filename);
+    }
+
+    bool endHeader = false;
+    while (!endHeader && std::getline(file, line)) {
+        std::istringstream iss(line);
+        std::string token;
+        iss >> token;
+
+        if (token == "format") {
+            iss >> token;
+            if (token == "ascii") {
+                header.format = PLY_ASCII;
+            } else if (token == "binary_little_endian") {
+                header.format = PLY_BINARY_LITTLE_ENDIAN;
+            } else if (token == "binary_big_endian") {
+                header.format = PLY_BINARY_BIG_ENDIAN;
+            } else {
+                throw std::runtime_error("Unknown PLY format '" + token + "' in " + filename);
+            }
+        } else if (token == "element") {
+            PLYElement element;
+            element.count = 0;
+            iss >> element.name >> element.count;
+            header.elements.push_back(element);
+        } else if (token == "property") {
+            if (header.elements.empty()) {
+                throw std::runtime_error("PLY property declared before any element in " + filename);
+            }
+            PLYProperty property;
+            property.countType = PLY_INVALID;
+            iss >> token;
+            if (token == "list") {
+                std::string countType, itemType;
+                iss >> countType >> itemType;
+                property.countType = parsePLYType(countType);
+                property.type = parsePLYType(itemType);
+                if (property.countType == PLY_INVALID) {
+                    throw std::runtime_error("Unknown PLY type '" + countType + "' in " + filename);
+                }
+            } else {
+                property.type = parsePLYType(token);
+            }
+            if (property.type == PLY_INVALID) {
+                throw std::runtime_error("Unknown PLY property type in " + filename + ": " + line);
+            }
+            iss >> property.name;
+            property.attrib = property.countType == PLY_INVALID ? plyAttribFromName(property.name) : PLY_UNUSED;
+            header.elements.back().properties.push_back(property);
+        } else if (token == "end_header") {
+            endHeader = true;
+        }
+    }
+
+    if (!endHeader) {
+        throw std::runtime_error("PLY header not properly terminated in " + filename);
+    }
+    return header;
+}
+
+// Reads only the header of the PLY file at filename, without reading or mapping its body
+inline PLYHeader readPLYFileHeader(const std::string& filename) {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file: " + filename);
+    }
+    return readPLYHeader(file, filename);
+}
+
+// Writes one decoded value into its slot in the destination vertex.
+inline void storePLYAttrib(char* vertex, const PLYVertexLayout& layout, int attrib, PLYType sourceType, double value) {
+    if (attrib < 0 || layout.offset[attrib] < 0) {
+        return;
+    }
+    char* field = vertex + layout.offset[attrib];
+    if (layout.type[attrib] == PLY_UCHAR) {
+        // Float colours are stored in [0, 1]
+        if (sourceType == PLY_FLOAT || sourceType == PLY_DOUBLE) {
+            value *= 255.0;
+        }
+        value = value < 0.0 ? 0.0 : (value > 255.0 ? 255.0 : value);
+        *(unsigned char*)field = (unsigned char)(value + 0.5);
+    } else {
+        float f = (float)value;
+        memcpy(field, &f, sizeof(float));
+    }
+}
+
+// Cursor over the binary body of a PLY file
+class PLYBinaryCursor {
+    const unsigned char* cur;
+    const unsigned char* end;
+    bool swap;
+    const std::string& filename;
+
+    void need(size_t n) {
+        if ((size_t)(end - cur) < n) {
+            throw std::runtime_error("Unexpected end of binary PLY data in " + filename);
+        }
+    }
+
+    template <typename T>
+    T readRaw() {
+        need(sizeof(T));
+        unsigned char bytes[sizeof(T)];
+        if (swap) {
+            for (size_t i = 0; i < sizeof(T); ++i) {
+                bytes[i] = cur[sizeof(T) - 1 - i];
+            }
+        } else {
+            memcpy(bytes, cur, sizeof(T));
+        }
+        cur += sizeof(T);
+        T value;
+        memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+public:
+    PLYBinaryCursor(const char* data, size_t size, bool bigEndian, const std::string& filename)
+        : cur((const unsigned char*)data), end((const unsigned char*)data + size),
+          swap(bigEndian == plyHostIsLittleEndian()), filename(filename) {}
+
+    double read(PLYType type) {
+        switch (type) {
+            case PLY_CHAR: return readRaw<int8_t>();
+            case PLY_UCHAR: return readRaw<uint8_t>();
+            case PLY_SHORT: return readRaw<int16_t>();
+            case PLY_USHORT: return readRaw<uint16_t>();
+            case PLY_INT: return readRaw<int32_t>();
+            case PLY_UINT: return readRaw<uint32_t>();
+            case PLY_FLOAT: return readRaw<float>();
+            case PLY_DOUBLE: return readRaw<double>();
+            default: throw std::runtime_error("Invalid PLY property type in " + filename);
+        }
+    }
+
+    uint32_t readIndex(PLYType type) {
+        return (uint32_t)(int64_t)read(type);
+    }
+
+    void skip(PLYType type, size_t count = 1) {
+        size_t n = plyTypeSize(type) * count;
+        need(n);
+        cur += n;
+    }
+
+    bool swapsBytes() const { return swap; }
+
+    const std::string& getFilename() const { return filename; }
+
+    // Steps over n bytes and returns where they start, for decoders that read whole records
+    const unsigned char* take(size_t n) {
+        need(n);
+        const unsigned char* start = cur;
+        cur += n;
+        return start;
+    }
+};
+
+// Cursor over the body of an ASCII PLY file. Tokens are parsed in place with
+// std::from_chars, so decoding allocates nothing per line or per value.
+class PLYTextCursor {
+    const char* cur;
+    const char* end;
+    const std::string& filename;
+
+    void skipWhitespace() {
+        while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n')) {
+            ++cur;
+        }
+    }
+
+    void skipSpace() {
+        skipWhitespace();
+        if (cur < end && *cur == '+') {
+            ++cur;
+        }
+    }
+
+    template <typename T>
+    T parse() {
+        skipSpace();
+        T value = T();
+        std::from_chars_result result = std::from_chars(cur, end, value);
+        if (result.ec != std::errc()) {
+            throw std::runtime_error("Malformed ASCII PLY data in " + filename);
+        }
+        cur = result.ptr;
+        return value;
+    }
+
+public:
+    PLYTextCursor(const char* data, size_t size, const std::string& filename)
+        : cur(data), end(data + size), filename(filename) {}
+
+    double read(PLYType type) {
+        switch (type) {
+            case PLY_FLOAT: return parse<float>();
+            case PLY_DOUBLE: return parse<double>();
+            case PLY_UCHAR: case PLY_USHORT: case PLY_UINT: return parse<uint32_t>();
+            default: return parse<int32_t>();
+        }
+    }
+
+    uint32_t readIndex(PLYType) {
+        return parse<uint32_t>();
+    }
+
+    template <typename T>
+    T readAs() {
+        return parse<T>();
+    }
+
+    void skip(PLYType, size_t count = 1) {
+        for (size_t i = 0; i < count; ++i) {
+            skipSpace();
+            while (cur < end && *cur != ' ' && *cur != '\t' && *cur != '\r' && *cur != '\n') {
+                ++cur;
+            }
+        }
+    }
+
+    const std::string& getFilename() const { return filename; }
+
+    // True once nothing but whitespace is left
+    bool atEnd() {
+        skipWhitespace();
+        return cur == end;
+    }
+};
+
+inline bool isPLYFaceIndexList(const PLYProperty& property) {
+    return property.countType != PLY_INVALID &&
+           (property.name == "vertex_indices" || property.name == "vertex_index");
+}
+
+// Appends the fan triangulation of a polygon (v0 v1 v2, v0 v2 v3, ...) to a triangle list.
+// Degenerate faces with fewer than three vertices produce nothing.
+template <typename Index>
+void appendFanTriangles(std::vector<Index>& triangles, const uint32_t* polygon, uint32_t count) {
+    for (uint32_t j = 2; j < count; ++j) {
+        triangles.push_back((Index)polygon[0]);
+        triangles.push_back((Index)polygon[j - 1]);
+        triangles.push_back((Index)polygon[j]);
+    }
+}
+
+// Decodes one vertex record into the caller's struct through the layout.
+template <typename Cursor>
+void decodePLYVertex(Cursor& cursor, const PLYElement& element, const PLYVertexLayout& layout, char* vertex) {
+    for (size_t p = 0; p < element.properties.size(); ++p) {
+        const PLYProperty& property = element.properties[p];
+        if (property.countType != PLY_INVALID) {
+            cursor.skip(property.type, cursor.readIndex(property.countType));
+            continue;
+        }
+        storePLYAttrib(vertex, layout, property.attrib, property.type, cursor.read(property.type));
+    }
+}
+
+// Vertex records common enough to get a decoder of their own. Each names its
+// properties in file order; float for positions, normals and UVs, uchar for colours.
+enum PLYVertexSchema {
+    PLY_SCHEMA_GENERIC,
+    PLY_SCHEMA_XYZ,
+    PLY_SCHEMA_XYZ_N,
+    PLY_SCHEMA_XYZ_N_UV,
+    PLY_SCHEMA_XYZ_RGB
+};
+
+template <int Schema>
+struct PLYSchemaTraits;
+
+template <>
+struct PLYSchemaTraits<PLY_SCHEMA_XYZ> {
+    static constexpr int COUNT = 3;
+    static constexpr int attribs[COUNT] = {PLY_X, PLY_Y, PLY_Z};
+    static constexpr PLYType types[COUNT] = {PLY_FLOAT, PLY_FLOAT, PLY_FLOAT};
+};
+
+template <>
+struct PLYSchemaTraits<PLY_SCHEMA_XYZ_N> {
+    static constexpr int COUNT = 6;
+    static constexpr int attribs[COUNT] = {PLY_X, PLY_Y, PLY_Z, PLY_NX, PLY_NY, PLY_NZ};
+    static constexpr PLYType types[COUNT] = {PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_FLOAT};
+};
+
+template <>
+struct PLYSchemaTraits<PLY_SCHEMA_XYZ_N_UV> {
+    static constexpr int COUNT = 8;
+    static constexpr int attribs[COUNT] = {PLY_X, PLY_Y, PLY_Z, PLY_NX, PLY_NY, PLY_NZ, PLY_U, PLY_V};
+    static constexpr PLYType types[COUNT] = {PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_FLOAT};
+};
+
+template <>
+struct PLYSchemaTraits<PLY_SCHEMA_XYZ_RGB> {
+    static constexpr int COUNT = 6;
+    static constexpr int attribs[COUNT] = {PLY_X, PLY_Y, PLY_Z, PLY_RED, PLY_GREEN, PLY_BLUE};
+    static constexpr PLYType types[COUNT] = {PLY_FLOAT, PLY_FLOAT, PLY_FLOAT, PLY_UCHAR, PLY_UCHAR, PLY_UCHAR};
+};
+
+template <int Schema>
+bool matchesPLYSchema(const PLYElement& element, const PLYVertexLayout& layout) {
+    typedef PLYSchemaTraits<Schema> Traits;
+    if (element.properties.size() != (size_t)Traits::COUNT) {
+        return false;
+    }
+    for (int k = 0; k < Traits::COUNT; ++k) {
+        const PLYProperty& property = element.properties[k];
+        int attrib = Traits::attribs[k];
+        // The caller's field must hold the file's type as is, or the generic conversion is needed
+        if (property.countType != PLY_INVALID || property.attrib != attrib || property.type != Traits::types[k] ||
+            (layout.offset[attrib] >= 0 && layout.type[attrib] != property.type)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Picks the specialized decoder for a vertex element, if there is one
+inline PLYVertexSchema matchPLYVertexSchema(const PLYElement& element, const PLYVertexLayout& layout) {
+    if (matchesPLYSchema<PLY_SCHEMA_XYZ_N_UV>(element, layout)) return PLY_SCHEMA_XYZ_N_UV;
+    if (matchesPLYSchema<PLY_SCHEMA_XYZ_N>(element, layout)) return PLY_SCHEMA_XYZ_N;
+    if (matchesPLYSchema<PLY_SCHEMA_XYZ_RGB>(element, layout)) return PLY_SCHEMA_XYZ_RGB;
+    if (matchesPLYSchema<PLY_SCHEMA_XYZ>(element, layout)) return PLY_SCHEMA_XYZ;
+    return PLY_SCHEMA_GENERIC;
+}
+
+// Where each property of a schema goes. Properties the caller has no field for are
+// written to a scratch slot that does not move, so the decode loops need no branches.
+template <int Schema>
+struct PLYSchemaTargets {
+    char* field[PLYSchemaTraits<Schema>::COUNT];
+    size_t step[PLYSchemaTraits<Schema>::COUNT];
+    char scratch[4];
+
+    PLYSchemaTargets(const PLYVertexLayout& layout, char* vertices) {
+        for (int k = 0; k < PLYSchemaTraits<Schema>::COUNT; ++k) {
+            int offset = layout.offset[PLYSchemaTraits<Schema>::attribs[k]];
+            field[k] = offset >= 0 ? vertices + offset : scratch;
+            step[k] = offset >= 0 ? layout.stride : 0;
+        }
+    }
+};
+
+// Binary records of a known schema have a fixed size, so they are bounds checked once
+// and then copied field by field; the byte order is a template parameter.
+template <int Schema, bool Swap>
+void decodePLYRecords(const unsigned char* records, size_t count, PLYSchemaTargets<Schema>& targets) {
+    typedef PLYSchemaTraits<Schema> Traits;
+    size_t sourceOffset[Traits::COUNT], recordSize = 0;
+    for (int k = 0; k < Traits::COUNT; ++k) {
+        sourceOffset[k] = recordSize;
+        recordSize += Traits::types[k] == PLY_UCHAR ? 1 : 4;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char* record = records + i * recordSize;
+        for (int k = 0; k < Traits::COUNT; ++k) {
+            char* field = targets.field[k] + i * targets.step[k];
+            if (Traits::types[k] == PLY_UCHAR) {
+                *field = (char)record[sourceOffset[k]];
+            } else if (Swap) {
+                const unsigned char* value = record + sourceOffset[k];
+                unsigned char bytes[4] = {value[3], value[2], value[1], value[0]};
+                memcpy(field, bytes, 4);
+            } else {
+                memcpy(field, record + sourceOffset[k], 4);
+            }
+        }
+    }
+}
+
+template <int Schema>
+void decodePLYVerticesAs(PLYBinaryCursor& cursor, const PLYVertexLayout& layout, char* vertices, size_t count) {
+    typedef PLYSchemaTraits<Schema> Traits;
+    size_t recordSize = 0;
+    for (int k = 0; k < Traits::COUNT; ++k) {
+        recordSize += Traits::types[k] == PLY_UCHAR ? 1 : 4;
+    }
+    PLYSchemaTargets<Schema> targets(layout, vertices);
+    const unsigned char* records = cursor.take(recordSize * count);
+    if (cursor.swapsBytes()) {
+        decodePLYRecords<Schema, true>(records, count, targets);
+    } else {
+        decodePLYRecords<Schema, false>(records, count, targets);
+    }
+}
+
+// ASCII records still need every token parsed, but each one is parsed straight
+// into its known type instead of going through a double and a type switch.
+template <int Schema>
+void decodePLYVerticesAs(PLYTextCursor& cursor, const PLYVertexLayout& layout, char* vertices, size_t count) {
+    typedef PLYSchemaTraits<Schema> Traits;
+    PLYSchemaTargets<Schema> targets(layout, vertices);
+    for (size_t i = 0; i < count; ++i) {
+        for (int k = 0; k < Traits::COUNT; ++k) {
+            char* field = targets.field[k] + i * targets.step[k];
+            if (Traits::types[k] == PLY_UCHAR) {
+                uint32_t value = cursor.readAs<uint32_t>();
+                *field = (char)(value > 255 ? 255 : value);
+            } else {
+                float value = cursor.readAs<float>();
+                memcpy(field, &value, 4);
+            }
+        }
+    }
+}
+
+// Decodes count consecutive vertex records into vertices, stride layout.stride apart,
+// through the specialized decoder for the element's schema or property by property.
+template <typename Cursor>
+void decodePLYVertices(Cursor& cursor, const PLYElement& element, const PLYVertexLayout& layout,
+                       char* vertices, size_t count) {
+    switch (matchPLYVertexSchema(element, layout)) {
+        case PLY_SCHEMA_XYZ: decodePLYVerticesAs<PLY_SCHEMA_XYZ>(cursor, layout, vertices, count); return;
+        case PLY_SCHEMA_XYZ_N: decodePLYVerticesAs<PLY_SCHEMA_XYZ_N>(cursor, layout, vertices, count); return;
+        case PLY_SCHEMA_XYZ_N_UV: decodePLYVerticesAs<PLY_SCHEMA_XYZ_N_UV>(cursor, layout, vertices, count); return;
+        case PLY_SCHEMA_XYZ_RGB: decodePLYVerticesAs<PLY_SCHEMA_XYZ_RGB>(cursor, layout, vertices, count); return;
+        default: break;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        decodePLYVertex(cursor, element, layout, vertices + i * layout.stride);
+    }
+}
+
+// Decodes one face record, leaving its vertex list in indices.
+// Returns false if the record has no vertex index list. Throws if an index is not
+// below vertexCount, so every pass after loading can use the indices unchecked.
+template <typename Cursor>
+bool decodePLYFace(Cursor& cursor, const PLYElement& element, size_t vertexCount, std::vector<uint32_t>& indices) {
+    bool found = false;
+    for (size_t p = 0; p < element.properties.size(); ++p) {
+        const PLYProperty& property = element.properties[p];
+        if (property.countType == PLY_INVALID) {
+            cursor.skip(property.type);
+            continue;
+        }
+        uint32_t count = cursor.readIndex(property.countType);
+        if (found || !isPLYFaceIndexList(property)) {
+            cursor.skip(property.type, count);
+            continue;
+        }
+        indices.resize(count);
+        for (uint32_t j = 0; j < count; ++j) {
+            indices[j] = cursor.readIndex(property.type);
+            if (indices[j] >= vertexCount) {
+                throw std::runtime_error("PLY face refers to vertex " + std::to_string((int32_t)indices[j]) + " but there are only " +
+                                         std::to_string(vertexCount) + " in " + cursor.getFilename());
+            }
+        }
+        found = true;
+    }
+    return found;
+}
+
+// Steps over one record of an element we do not use (edges, materials, ...).
+template <typename Cursor>
+void skipPLYRecord(Cursor& cursor, const PLYElement& element) {
+    for (size_t p = 0; p < element.properties.size(); ++p) {
+        const PLYProperty& property = element.properties[p];
+        size_t count = 1;
+        if (property.countType != PLY_INVALID) {
+            count = cursor.readIndex(property.countType);
+        }
+        cursor.skip(property.type, count);
+    }
+}
+
+// Walks every element in header order. Vertices are decoded into the caller's
+// array through the layout, faces are handed to onFace(indices, count).
+template <typename Cursor, typename VertexT, typename FaceSink>
+void decodePLYElements(Cursor& cursor, const PLYHeader& header, const PLYVertexLayout& layout,
+                       std::vector<VertexT>& vertices, FaceSink& onFace) {
+    std::vector<uint32_t> faceIndices;
+    size_t vertexCount = header.vertexCount();
+
+    for (size_t e = 0; e < header.elements.size(); ++e) {
+        const PLYElement& element = header.elements[e];
+
+        if (element.name == "vertex") {
+            vertices.resize(element.count);
+            if (element.count > 0) {
+                decodePLYVertices(cursor, element, layout, (char*)&vertices[0], element.count);
+            }
+        } else if (element.name == "face") {
+            for (size_t i = 0; i < element.count; ++i) {
+                if (decodePLYFace(cursor, element, vertexCount, faceIndices)) {
+                    onFace(faceIndices.empty() ? NULL : &faceIndices[0], (uint32_t)faceIndices.size());
+                }
+            }
+        } else {
+            for (size_t i = 0; i < element.count; ++i) {
+                skipPLYRecord(cursor, element);
+            }
+        }
+    }
+}
+
+// ASCII bodies smaller than this are decoded on the calling thread
+const size_t PLY_PARALLEL_MIN_BYTES = 4 << 20;
+
+// Decodes an ASCII body on all cores. ASCII PLY stores one record per line, so the
+// body is cut into chunks at newlines, the lines in each chunk are counted in
+// parallel and a prefix sum tells every chunk which records it holds. Vertices are
+// then written straight to their final slot; faces are collected per chunk and
+// handed to onFace in file order, so the result matches the serial decoder.
+// Returns false, having decoded nothing, if a line does not hold exactly one record
+// (blank or whitespace-only lines, several records on a line, records split over
+// lines); the serial decoder reads those files token by token.
+template <typename VertexT, typename FaceSink>
+bool decodePLYTextParallel(const char* data, size_t size, const PLYHeader& header, const PLYVertexLayout& layout,
+                           std::vector<VertexT>& vertices, FaceSink& onFace, const std::string& filename) {
+    const size_t chunkCount = (size_t)hardwareThreads() * 4;
+
+    std::vector<size_t> bounds(chunkCount + 1, size);
+    bounds[0] = 0;
+    for (size_t c = 1; c < chunkCount; ++c) {
+        size_t pos = size * c / chunkCount;
+        if (pos < bounds[c - 1]) {
+            pos = bounds[c - 1];
+        }
+        const char* newline = pos < size ? (const char*)memchr(data + pos, '\n', size - pos) : NULL;
+        bounds[c] = newline ? (size_t)(newline - data) + 1 : size;
+    }
+
+    // Trailing blank lines are harmless, anything before the last token is not
+    size_t contentEnd = size;
+    while (contentEnd > 0 && (data[contentEnd - 1] == '\n' || data[contentEnd - 1] == '\r' ||
+                              data[contentEnd - 1] == ' ' || data[contentEnd - 1] == '\t')) {
+        --contentEnd;
+    }
+
+    // Pass 1: line starts per chunk, then a prefix sum gives each chunk its first record
+    std::vector<size_t> firstLine(chunkCount + 1, 0);
+    std::vector<char> blankLine(chunkCount, 0);
+    parallelFor(chunkCount, [&](size_t c) {
+        const char* cur = data + bounds[c];
+        const char* end = data + bounds[c + 1];
+        size_t lines = 0;
+        while (cur < end) {
+            const char* newline = (const char*)memchr(cur, '\n', end - cur);
+            const char* lineEnd = newline ? newline : end;
+            const char* token = cur;
+            while (token < lineEnd && (*token == ' ' || *token == '\t' || *token == '\r')) {
+                ++token;
+            }
+            if (token == lineEnd && (size_t)(cur - data) < contentEnd) {
+                blankLine[c] = 1;
+            }
+            ++lines;
+            cur = newline ? newline + 1 : end;
+        }
+        firstLine[c + 1] = lines;
+    });
+    for (size_t c = 0; c < chunkCount; ++c) {
+        if (blankLine[c]) {
+            return false;
+        }
+        firstLine[c + 1] += firstLine[c];
+    }
+
+    std::vector<size_t> elementStart(header.elements.size() + 1, 0);
+    for (size_t e = 0; e < header.elements.size(); ++e) {
+        elementStart[e + 1] = elementStart[e] + header.elements[e].count;
+    }
+    if (firstLine[chunkCount] < elementStart.back()) {
+        return false;
+    }
+
+    if (const PLYElement* vertexElement = header.find("vertex")) {
+        vertices.resize(vertexElement->count);
+    }
+
+    // Pass 2: decode every chunk. Face lists go to flat per-chunk arrays. A chunk
+    // whose records run out before its last line, or that has tokens left after its
+    // last record, is not one record per line.
+    std::vector<std::vector<uint32_t> > chunkIndices(chunkCount);
+    std::vector<std::vector<uint32_t> > chunkFaceSizes(chunkCount);
+    std::vector<char> misaligned(chunkCount, 0);
+    size_t vertexCount = header.vertexCount();
+    parallelFor(chunkCount, [&](size_t c) {
+        PLYTextCursor cursor(data + bounds[c], bounds[c + 1] - bounds[c], filename);
+        std::vector<uint32_t> face;
+        size_t line = firstLine[c];
+        size_t e = 0;
+        try {
+            while (line < firstLine[c + 1] && e < header.elements.size()) {
+                if (line >= elementStart[e + 1]) {
+                    ++e;
+                    continue;
+                }
+                const PLYElement& element = header.elements[e];
+                size_t stop = std::min(firstLine[c + 1], elementStart[e + 1]);
+                if (element.name == "vertex") {
+                    decodePLYVertices(cursor, element, layout, (char*)&vertices[line - elementStart[e]], stop - line);
+                    line = stop;
+                } else if (element.name == "face") {
+                    for (; line < stop; ++line) {
+                        if (decodePLYFace(cursor, element, vertexCount, face)) {
+                            chunkFaceSizes[c].push_back((uint32_t)face.size());
+                            chunkIndices[c].insert(chunkIndices[c].end(), face.begin(), face.end());
+                        }
+                    }
+                } else {
+                    for (; line < stop; ++line) {
+                        skipPLYRecord(cursor, element);
+                    }
+                }
+            }
+            misaligned[c] = !cursor.atEnd();
+        } catch (const std::runtime_error&) {
+            misaligned[c] = 1;
+        }
+    });
+    for (size_t c = 0; c < chunkCount; ++c) {
+        if (misaligned[c]) {
+            vertices.clear();
+            return false;
+        }
+    }
+
+    for (size_t c = 0; c < chunkCount; ++c) {
+        const uint32_t* indices = chunkIndices[c].empty() ? NULL : &chunkIndices[c][0];
+        for (size_t f = 0; f < chunkFaceSizes[c].size(); ++f) {
+            onFace(indices, chunkFaceSizes[c][f]);
+            indices += chunkFaceSizes[c][f];
+        }
+    }
+    return true;
+}
+
+// Finds the first byte after the end_header line.
+inline size_t findPLYDataOffset(const char* data, size_t size, const std::string& filename) {
+    static const char marker[] = "end_header";
+    const size_t markerLength = sizeof(marker) - 1;
+    for (size_t i = 0; i + markerLength <= size; ++i) {
+        if ((i == 0 || data[i - 1] == '\n') && memcmp(data + i, marker, markerLength) == 0) {
+            const char* newline = (const char*)memchr(data + i, '\n', size - i);
+            return newline ? (size_t)(newline - data) + 1 : size;
+        }
+    }
+    throw std::runtime_error("PLY header not properly terminated in " + filename);
+}
+
+// Decodes the body of a PLY file whose header has been read, ASCII on all cores
+// when it is large enough.
+template <typename VertexT, typename FaceSink>
+void decodePLYBody(const char* data, size_t size, const PLYHeader& header, const PLYVertexLayout& layout,
+                   std::vector<VertexT>& vertices, FaceSink& onFace, const std::string& filename) {
+    if (header.format == PLY_ASCII) {
+        if (size >= PLY_PARALLEL_MIN_BYTES && hardwareThreads() > 1 &&
+            decodePLYTextParallel(data, size, header, layout, vertices, onFace, filename)) {
+            return;
+        }
+        PLYTextCursor cursor(data, size, filename);
+        decodePLYElements(cursor, header, layout, vertices, onFace);
+    } else {
+        PLYBinaryCursor cursor(data, size, header.format == PLY_BINARY_BIG_ENDIAN, filename);
+        decodePLYElements(cursor, header, layout, vertices, onFace);
+    }
+}
+
+// Loads an ASCII or binary (either byte order) PLY file. The file is memory
+// mapped and decoded in place. Throws std::runtime_error on failure.
+template <typename VertexT, typename FaceSink>
+PLYHeader readPLY(const std::string& filename, const PLYVertexLayout& layout,
+                  std::vector<VertexT>& vertices, FaceSink onFace) {
+    MappedFile file(filename);
+    size_t dataOffset = findPLYDataOffset(file.data(), file.size(), filename);
+
+    std::istringstream headerStream(std::string(file.data(), dataOffset));
+    PLYHeader header = readPLYHeader(headerStream, filename);
+    decodePLYBody(file.data() + dataOffset, file.size() - dataOffset, header, layout, vertices, onFace, filename);
+    return header;
+}
+
+// Decodes a PLY file a fixed number of vertices at a time, so a mesh can be handed on
+// (packed, uploaded) piece by piece instead of being held whole. The header is read
+// up front, before any element data is touched, so callers can size their buffers
+// or decide how to load the mesh; it can also be decoded whole, as readPLY does,
+// from the same mapping.
+class PLYChunkedReader {
+    MappedFile file;
+    std::string filename;
+    size_t dataOffset;
+    PLYHeader header;
+
+public:
+    explicit PLYChunkedReader(const std::string& filename)
+        : file(filename), filename(filename), dataOffset(findPLYDataOffset(file.data(), file.size(), filename)) {
+        std::istringstream headerStream(std::string(file.data(), dataOffset));
+        header = readPLYHeader(headerStream, filename);
+    }
+
+    const PLYHeader& getHeader() const { return header; }
+
+    // The whole file, header included, as it was read
+    const MappedFile& getFile() const { return file; }
+
+    size_t elementCount(const std::string& name) const {
+        for (size_t e = 0; e < header.elements.size(); ++e) {
+            if (header.elements[e].name == name) {
+                return header.elements[e].count;
+            }
+        }
+        return 0;
+    }
+
+    // Decodes the whole file into vertices, handing faces to onFace(indices, count)
+    template <typename VertexT, typename FaceSink>
+    void read(const PLYVertexLayout& layout, std::vector<VertexT>& vertices, FaceSink onFace) {
+        decodePLYBody(file.data() + dataOffset, file.size() - dataOffset, header, layout, vertices, onFace, filename);
+    }
+
+    // Vertices are decoded into a staging array of chunkVertices records that is handed
+    // to onVertices(vertices, first, count) whenever it fills up (and once more for the
+    // tail) and then reused. Faces are handed to onFace(indices, count) as they are read.
+    template <typename VertexT, typename VertexSink, typename FaceSink>
+    void decode(const PLYVertexLayout& layout, size_t chunkVertices, VertexSink onVertices, FaceSink onFace) {
+        const char* data = file.data() + dataOffset;
+        size_t size = file.size() - dataOffset;
+        if (header.format == PLY_ASCII) {
+            PLYTextCursor cursor(data, size, filename);
+            decodeChunks<VertexT>(cursor, layout, chunkVertices, onVertices, onFace);
+        } else {
+            PLYBinaryCursor cursor(data, size, header.format == PLY_BINARY_BIG_ENDIAN, filename);
+            decodeChunks<VertexT>(cursor, layout, chunkVertices, onVertices, onFace);
+        }
+    }
+
+private:
+    template <typename VertexT, typename Cursor, typename VertexSink, typename FaceSink>
+    void decodeChunks(Cursor& cursor, const PLYVertexLayout& layout, size_t chunkVertices,
+                      VertexSink& onVertices, FaceSink& onFace) {
+        std::vector<VertexT> chunk(std::max<size_t>(chunkVertices, 1));
+        std::vector<uint32_t> faceIndices;
+        size_t vertexCount = header.vertexCount();
+
+        for (size_t e = 0; e < header.elements.size(); ++e) {
+            const PLYElement& element = header.elements[e];
+
+            if (element.name == "vertex") {
+                for (size_t first = 0; first < element.count; first += chunk.size()) {
+                    size_t count = std::min(chunk.size(), element.count - first);
+                    // Attributes missing from the file keep their defaults
+                    std::fill(chunk.begin(), chunk.begin() + count, VertexT());
+                    decodePLYVertices(cursor, element, layout, (char*)&chunk[0], count);
+                    onVertices(&chunk[0], first, count);
+                }
+            } else if (element.name == "face") {
+                for (size_t i = 0; i < element.count; ++i) {
+                    if (decodePLYFace(cursor, element, vertexCount, faceIndices)) {
+                        onFace(faceIndices.empty() ? NULL : &faceIndices[0], (uint32_t)faceIndices.size());
+                    }
+                }
+            } else {
+                for (size_t i = 0; i < element.count; ++i) {
+                    skipPLYRecord(cursor, element);
+                }
+            }
+        }
+    }
+};
+
+#endif
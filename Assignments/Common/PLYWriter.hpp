@@ -0,0 +1,143 @@
+// PLYWriter.hpp streaming PLY writer for triangle soups (positions + normals)
+#ifndef PLYWRITER_HPP
+#define PLYWRITER_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "PLYFormat.hpp"
+
+// Writes a PLY file whose faces are consecutive vertex triples (0 1 2, 3 4 5, ...).
+// Vertices are appended as they are produced and the face list is generated from
+// the final count on close(), so nothing but the current batch is held in memory.
+// The header is written up front with fixed-width counts that close() patches.
+class PLYStreamWriter {
+    FILE* file;
+    PLYFormat format;
+    size_t vertexCount;
+    long vertexCountPos, faceCountPos;
+    std::vector<char> staging;
+
+    // Width of the count fields reserved in the header
+    static const int COUNT_WIDTH = 12;
+
+    void putBinary(char*& out, const void* value, size_t size) {
+        bool swap = (format == PLY_BINARY_BIG_ENDIAN) == plyHostIsLittleEndian();
+        const char* bytes = (const char*)value;
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = swap ? bytes[size - 1 - i] : bytes[i];
+        }
+        out += size;
+    }
+
+    bool patchCount(long pos, size_t count) {
+        char field[COUNT_WIDTH + 1];
+        snprintf(field, sizeof(field), "%-*zu", COUNT_WIDTH, count);
+        return fseek(file, pos, SEEK_SET) == 0 && fwrite(field, 1, COUNT_WIDTH, file) == COUNT_WIDTH;
+    }
+
+    PLYStreamWriter(const PLYStreamWriter&);
+    PLYStreamWriter& operator=(const PLYStreamWriter&);
+
+public:
+    PLYStreamWriter() : file(NULL), format(PLY_ASCII), vertexCount(0), vertexCountPos(0), faceCountPos(0) {}
+
+    ~PLYStreamWriter() {
+        close();
+    }
+
+    bool isOpen() const { return file != NULL; }
+
+    bool open(const std::string& fileName, PLYFormat plyFormat) {
+        close();
+        file = fopen(fileName.c_str(), "wb");
+        if (!file) {
+            fprintf(stderr, "Failed to open file: %s\n", fileName.c_str());
+            return false;
+        }
+        setvbuf(file, NULL, _IOFBF, 1 << 20);
+        format = plyFormat;
+        vertexCount = 0;
+
+        const char* formatName = format == PLY_ASCII ? "ascii"
+                               : format == PLY_BINARY_LITTLE_ENDIAN ? "binary_little_endian"
+                               : "binary_big_endian";
+        fprintf(file, "ply\nformat %s 1.0\n", formatName);
+        fprintf(file, "element vertex ");
+        vertexCountPos = ftell(file);
+        fprintf(file, "%-*d\n", COUNT_WIDTH, 0);
+        fprintf(file, "property float x\nproperty float y\nproperty float z\n");
+        fprintf(file, "property float nx\nproperty float ny\nproperty float nz\n");
+        fprintf(file, "element face ");
+        faceCountPos = ftell(file);
+        fprintf(file, "%-*d\n", COUNT_WIDTH, 0);
+        fprintf(file, "property list uchar int vertex_indices\nend_header\n");
+        return true;
+    }
+
+    // Appends count vertices; positions and normals are tightly packed xyz triples.
+    void appendVertices(const float* positions, const float* normals, size_t count) {
+        if (!file || count == 0) {
+            return;
+        }
+        if (format == PLY_ASCII) {
+            for (size_t i = 0; i < count * 3; i += 3) {
+                fprintf(file, "%g %g %g %g %g %g\n", positions[i], positions[i + 1], positions[i + 2],
+                        normals[i], normals[i + 1], normals[i + 2]);
+            }
+        } else {
+            staging.resize(count * 6 * sizeof(float));
+            char* out = &staging[0];
+            for (size_t i = 0; i < count * 3; i += 3) {
+                putBinary(out, &positions[i], sizeof(float));
+                putBinary(out, &positions[i + 1], sizeof(float));
+                putBinary(out, &positions[i + 2], sizeof(float));
+                putBinary(out, &normals[i], sizeof(float));
+                putBinary(out, &normals[i + 1], sizeof(float));
+                putBinary(out, &normals[i + 2], sizeof(float));
+            }
+            fwrite(&staging[0], 1, staging.size(), file);
+        }
+        vertexCount += count;
+    }
+
+    // Writes the face list, patches the header counts and closes the file.
+    bool close() {
+        if (!file) {
+            return false;
+        }
+        size_t faceCount = vertexCount / 3;
+        const size_t batch = 1 << 16;
+        for (size_t first = 0; first < faceCount; first += batch) {
+            size_t last = first + batch < faceCount ? first + batch : faceCount;
+            if (format == PLY_ASCII) {
+                for (size_t i = first; i < last; ++i) {
+                    fprintf(file, "3 %zu %zu %zu\n", i * 3, i * 3 + 1, i * 3 + 2);
+                }
+            } else {
+                staging.resize((last - first) * (1 + 3 * sizeof(int32_t)));
+                char* out = &staging[0];
+                for (size_t i = first; i < last; ++i) {
+                    *out++ = 3;
+                    for (int32_t j = 0; j < 3; ++j) {
+                        int32_t index = (int32_t)(i * 3) + j;
+                        putBinary(out, &index, sizeof(index));
+                    }
+                }
+                fwrite(&staging[0], 1, staging.size(), file);
+            }
+        }
+
+        bool ok = patchCount(vertexCountPos, vertexCount) && patchCount(faceCountPos, faceCount);
+        ok = fclose(file) == 0 && ok;
+        file = NULL;
+        staging.clear();
+        staging.shrink_to_fit();
+        return ok;
+    }
+};
+
+#endif
@@ -0,0 +1,148 @@
+// Parallel.hpp small helpers for spreading loops over the available cores
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+
+inline unsigned hardwareThreads() {
+    unsigned count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+// One parallelFor loop as the pool sees it. It lives on the stack of the thread that
+// started it, which does not return until every pool thread that joined has left.
+struct ParallelLoop {
+    void (*call)(const void* body, size_t i);
+    const void* body;
+    size_t count;
+    std::atomic<size_t> next;
+    std::atomic<bool> failed;
+    std::exception_ptr error; // First exception thrown; guarded by the pool mutex
+    unsigned helpersWanted;   // Pool threads that may still join; guarded by the pool mutex
+    unsigned helpersActive;   // Pool threads running items; guarded by the pool mutex
+
+    ParallelLoop(void (*call)(const void*, size_t), const void* body, size_t count, unsigned helpers)
+        : call(call), body(body), count(count), next(0), failed(false), helpersWanted(helpers), helpersActive(0) {}
+};
+
+// Worker threads shared by every parallelFor. They start on first use and stay for the
+// rest of the run, so a loop costs no thread start-up, and loops started on several
+// threads at once (texture workers baking mips side by side) share these cores rather
+// than each bringing a thread per core.
+class ThreadPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable left;
+    std::deque<ParallelLoop*> loops; // Loops that still want helpers, oldest first
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    // Indices are handed out dynamically, so uneven items balance across threads
+    void runItems(ParallelLoop& loop) {
+        try {
+            for (size_t i = loop.next++; i < loop.count && !loop.failed; i = loop.next++) {
+                loop.call(loop.body, i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!loop.error) {
+                loop.error = std::current_exception();
+            }
+            loop.failed = true;
+        }
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this]() { return !loops.empty(); });
+            ParallelLoop* loop = loops.front();
+            if (--loop->helpersWanted == 0) {
+                loops.pop_front();
+            }
+            ++loop->helpersActive;
+            lock.unlock();
+            runItems(*loop);
+            lock.lock();
+            if (--loop->helpersActive == 0) {
+                left.notify_all();
+            }
+        }
+    }
+
+public:
+    ThreadPool() {
+        for (unsigned t = 1; t < hardwareThreads(); ++t) {
+            threads.push_back(std::thread(&ThreadPool::work, this));
+        }
+    }
+
+    // Never destroyed: static destructors elsewhere (the texture loader's) may still be
+    // waiting on loops at exit, and the idle threads end with the process
+    static ThreadPool& instance() {
+        static ThreadPool* pool = new ThreadPool();
+        return *pool;
+    }
+
+    unsigned size() const { return (unsigned)threads.size(); }
+
+    // Runs loop on the calling thread, with up to loop.helpersWanted pool threads
+    // joining in, and returns once all of them have left it
+    void run(ParallelLoop& loop) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loop.helpersWanted = std::min(loop.helpersWanted, size());
+            if (loop.helpersWanted > 0) {
+                loops.push_back(&loop);
+                wake.notify_all();
+            }
+        }
+        runItems(loop);
+
+        // Every index is taken; stop more helpers joining and wait out the ones still running
+        std::unique_lock<std::mutex> lock(mutex);
+        std::deque<ParallelLoop*>::iterator queued = std::find(loops.begin(), loops.end(), &loop);
+        if (queued != loops.end()) {
+            loops.erase(queued);
+        }
+        left.wait(lock, [&loop]() { return loop.helpersActive == 0; });
+    }
+};
+
+// Calls body(i) for every i in [0, count) on up to threads threads of the shared pool,
+// the calling thread included. Indices are handed out dynamically, so uneven items
+// balance across threads. The first exception thrown by any call is rethrown on the
+// calling thread once all workers have stopped.
+template <typename Body>
+void parallelFor(size_t count, const Body& body, unsigned threads = 0) {
+    if (threads == 0) {
+        threads = hardwareThreads();
+    }
+    if (threads > count) {
+        threads = (unsigned)count;
+    }
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            body(i);
+        }
+        return;
+    }
+
+    ParallelLoop loop([](const void* loopBody, size_t i) { (*(const Body*)loopBody)(i); }, &body, count, threads - 1);
+    ThreadPool::instance().run(loop);
+    if (loop.error) {
+        std::rethrow_exception(loop.error);
+    }
+}
+
+#endif
@@ -0,0 +1,289 @@
+// StreamingUpload.hpp chunked buffer uploads through a persistently mapped staging ring
+#ifndef STREAMINGUPLOAD_HPP
+#define STREAMINGUPLOAD_HPP
+
+#include <GL/glew.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <algorithm>
+
+// Default staging chunk size and count: one chunk is filled while the one before it is
+// copied on the GPU and the one before that is still waiting for its copy to retire
+const size_t STAGING_CHUNK_SIZE = 4 << 20;
+const size_t STAGING_CHUNK_COUNT = 3;
+
+// A ring of fixed-size staging chunks shared by a producer thread, which fills them, and
+// the GL thread, which copies each filled chunk into its destination buffer. With
+// ARB_buffer_storage the chunks live in one persistently mapped buffer and the copy is a
+// glCopyBufferSubData guarded by a fence, so the producer writes straight into memory
+// the GPU reads. Without it the chunks are plain memory handed to glBufferSubData.
+// The producer runs on a worker thread the ring starts once and keeps.
+class StagingRing {
+    struct Filled {
+        size_t slot;
+        int stream;
+        size_t offset;
+        size_t size;
+    };
+
+    size_t chunkBytes;
+    size_t chunkCount;
+    GLuint stagingBufferID;
+    unsigned char* mapped;
+    std::vector<unsigned char> fallback;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<size_t> freeSlots;
+    std::deque<Filled> filled;
+    bool closed;
+    std::exception_ptr error;
+
+    std::thread worker;
+    std::function<void()> producer; // Running or about to run on worker; empty when it is idle
+    bool stopping;
+
+    StagingRing(const StagingRing&);
+    StagingRing& operator=(const StagingRing&);
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            changed.wait(lock, [this]() { return producer || stopping; });
+            if (stopping) {
+                return;
+            }
+            std::function<void()> current = producer;
+            lock.unlock();
+            current();
+            lock.lock();
+            producer = nullptr;
+            changed.notify_all();
+        }
+    }
+
+public:
+    explicit StagingRing(size_t chunkSize = STAGING_CHUNK_SIZE, size_t chunkCount = STAGING_CHUNK_COUNT)
+        : chunkBytes(chunkSize), chunkCount(chunkCount < 2 ? 2 : chunkCount), stagingBufferID(0), mapped(NULL), closed(false),
+          stopping(false) {
+        if (GLEW_ARB_buffer_storage) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glGenBuffers(1, &stagingBufferID);
+            glBindBuffer(GL_COPY_READ_BUFFER, stagingBufferID);
+            glBufferStorage(GL_COPY_READ_BUFFER, chunkBytes * this->chunkCount, NULL, flags);
+            mapped = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, chunkBytes * this->chunkCount, flags);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        if (!mapped) {
+            if (stagingBufferID) {
+                glDeleteBuffers(1, &stagingBufferID);
+                stagingBufferID = 0;
+            }
+            fallback.resize(chunkBytes * this->chunkCount);
+        }
+        worker = std::thread(&StagingRing::work, this);
+    }
+
+    ~StagingRing() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            changed.notify_all();
+        }
+        worker.join();
+        if (stagingBufferID) {
+            glBindBuffer(GL_COPY_READ_BUFFER, stagingBufferID);
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &stagingBufferID);
+        }
+    }
+
+    // The ring every mesh streams through, so they share one staging buffer and worker.
+    // Created on first use, on the GL thread with a context current. Never destroyed: the
+    // context it belongs to is gone by the time static destructors run.
+    static StagingRing& shared() {
+        static StagingRing* ring = new StagingRing();
+        return *ring;
+    }
+
+    size_t chunkSize() const { return chunkBytes; }
+
+    // Marks every chunk free for a new stream; call before the producer starts.
+    void begin() {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlots.clear();
+        filled.clear();
+        closed = false;
+        error = std::exception_ptr();
+        for (size_t slot = 0; slot < chunkCount; ++slot) {
+            freeSlots.push_back(slot);
+        }
+    }
+
+    // Runs produce on the worker thread and returns without waiting for it
+    void startProducer(const std::function<void()>& produce) {
+        std::lock_guard<std::mutex> lock(mutex);
+        producer = produce;
+        changed.notify_all();
+    }
+
+    // Waits for the producer started last to return
+    void finishProducer() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return !producer; });
+    }
+
+    // Producer side. Returns a free chunk, waiting for the GPU to finish with one if needed.
+    unsigned char* acquire(size_t& slot) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return !freeSlots.empty(); });
+        slot = freeSlots.front();
+        freeSlots.pop_front();
+        return (mapped ? mapped : &fallback[0]) + slot * chunkBytes;
+    }
+
+    // Producer side. Queues size bytes of the chunk for copying to offset in stream's buffer.
+    void publish(size_t slot, int stream, size_t offset, size_t size) {
+        Filled chunk = {slot, stream, offset, size};
+        std::lock_guard<std::mutex> lock(mutex);
+        filled.push_back(chunk);
+        changed.notify_all();
+    }
+
+    // Producer side. No more chunks will come; error, if set, is rethrown by drain.
+    void close(std::exception_ptr failure = std::exception_ptr()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        error = failure;
+        changed.notify_all();
+    }
+
+    // GL thread. Copies chunks as they are published until the producer closes the ring.
+    // destination(stream, offset, size) returns the buffer a chunk goes to and may grow it.
+    template <typename Destination>
+    void drain(Destination destination) {
+        std::deque<std::pair<size_t, GLsync> > inFlight;
+        for (;;) {
+            Filled chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]() { return !filled.empty() || closed; });
+                if (filled.empty()) {
+                    break;
+                }
+                chunk = filled.front();
+                filled.pop_front();
+            }
+
+            GLuint buffer = destination(chunk.stream, chunk.offset, chunk.size);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            if (mapped) {
+                glBindBuffer(GL_COPY_READ_BUFFER, stagingBufferID);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, chunk.slot * chunkBytes, chunk.offset, chunk.size);
+                inFlight.push_back(std::make_pair(chunk.slot, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)));
+            } else {
+                // glBufferSubData has copied the data by the time it returns
+                glBufferSubData(GL_COPY_WRITE_BUFFER, chunk.offset, chunk.size, &fallback[chunk.slot * chunkBytes]);
+                release(chunk.slot);
+            }
+
+            // Hand back chunks whose copies are done. If the producer has none left, block
+            // on the oldest copy so it always has a chunk to fill while we wait for it.
+            while (!inFlight.empty()) {
+                bool starved;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    starved = freeSlots.empty();
+                }
+                GLuint64 timeout = starved ? 1000000000ull : 0;
+                GLenum status = glClientWaitSync(inFlight.front().second, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+                if (status == GL_TIMEOUT_EXPIRED && !starved) {
+                    break;
+                }
+                if (status == GL_TIMEOUT_EXPIRED) {
+                    continue;
+                }
+                glDeleteSync(inFlight.front().second);
+                release(inFlight.front().first);
+                inFlight.pop_front();
+            }
+        }
+
+        while (!inFlight.empty()) {
+            glDeleteSync(inFlight.front().second);
+            inFlight.pop_front();
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        std::exception_ptr failure;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failure = error;
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+private:
+    void release(size_t slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeSlots.push_back(slot);
+        changed.notify_all();
+    }
+};
+
+// Runs produce(ring) on the ring's worker thread while the calling thread, which must own
+// the GL context, copies what it publishes. The ring is closed when produce returns or
+// throws; an exception from produce is rethrown here once the producer has returned.
+template <typename Producer, typename Destination>
+void streamUpload(StagingRing& ring, Producer produce, Destination destination) {
+    ring.begin();
+    ring.startProducer([&ring, &produce]() {
+        try {
+            produce(ring);
+            ring.close();
+        } catch (...) {
+            ring.close(std::current_exception());
+        }
+    });
+    try {
+        ring.drain(destination);
+    } catch (...) {
+        ring.finishProducer();
+        throw;
+    }
+    ring.finishProducer();
+}
+
+// Copies size bytes from data into buffer, which must already hold at least that much,
+// one staging chunk at a time. Reading data (e.g. paging in a mapped file) overlaps
+// with the GPU copies of the chunks before it. Data that fits in one chunk has nothing
+// to overlap with, so it goes straight to glBufferSubData without the worker or fences.
+inline void uploadChunked(StagingRing& ring, GLuint buffer, const void* data, size_t size) {
+    if (size <= ring.chunkSize()) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return;
+    }
+    const unsigned char* source = (const unsigned char*)data;
+    streamUpload(ring, [source, size](StagingRing& ring) {
+        for (size_t offset = 0; offset < size; offset += ring.chunkSize()) {
+            size_t slot, bytes = std::min(ring.chunkSize(), size - offset);
+            memcpy(ring.acquire(slot), source + offset, bytes);
+            ring.publish(slot, 0, offset, bytes);
+        }
+    }, [buffer](int, size_t, size_t) { return buffer; });
+}
+
+#endif
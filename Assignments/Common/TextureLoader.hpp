@@ -0,0 +1,333 @@
+// TextureLoader.hpp cooked texture loading and uploads on worker threads
+#ifndef TEXTURELOADER_HPP
+#define TEXTURELOADER_HPP
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "BMPImage.hpp"
+#include "KTXTexture.hpp"
+#include "Parallel.hpp"
+
+// Texture bytes uploaded per update, so a burst of finished textures is spread over
+// a few frames instead of stalling one; a texture larger than this still goes whole
+const size_t TEXTURE_UPLOAD_BUDGET = 16 << 20;
+
+// How request() keeps a texture on the GPU. Compressed textures fall back to the
+// next format the driver supports, and to 8 bits per channel when it has none.
+enum TextureStorage {
+    TEXTURE_STORE_RAW,      // 8 bits per channel as decoded
+    TEXTURE_STORE_COLOR,    // BC7, else BC1 or BC3 by whether the image has alpha
+    TEXTURE_STORE_RED_GREEN // Data read from .r or .rg, such as height maps: BC7, else BC5
+};
+
+// The GL internal format of a block format
+inline GLenum blockTextureFormat(BlockFormat format) {
+    switch (format) {
+    case BLOCK_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BLOCK_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+    default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+}
+
+// The GL formats of a container format; format is unused when it is compressed. The
+// programs light in gamma space, so sRGB texels go to the plain formats and are
+// sampled as stored.
+inline void ktxTextureFormat(const KTXFormatInfo& info, GLenum& internalFormat, GLenum& format) {
+    if (info.compressed) {
+        internalFormat = blockTextureFormat(info.block);
+        format = 0;
+        return;
+    }
+    internalFormat = info.channels == 3 ? GL_RGB8 : GL_RGBA8;
+    format = info.channels == 3 ? (info.bgr ? GL_BGR : GL_RGB) : (info.bgr ? GL_BGRA : GL_RGBA);
+}
+
+// Loads textures in the background. start(), called once glewInit has run, checks
+// what the driver takes and starts the workers. request() takes the path of a source
+// image and returns a texture at once, holding a 1x1 grey placeholder. Worker threads
+// map the image's cooked KTX2 container (KTXTexture.hpp), or cook it when it is
+// missing or stale: the mip chain is baked (MipBaker.hpp), block compressed unless
+// raw storage was asked for (BlockCompress.hpp), and written beside the image for the
+// next run. A current container in a format this driver can't take is left as it is
+// for drivers that can, and the texture is cooked in memory for this one. update(),
+// called once per frame on the GL thread, uploads finished textures into the same
+// texture object: a mapped container of raw texels straight from the mapping, anything
+// else through a pixel unpack buffer. Callers keep the ID they were given and set its
+// sampling parameters as usual.
+class TextureLoader {
+    struct Job {
+        GLuint textureID;
+        std::string path;
+        TextureStorage storage;
+        BlockQuality quality;
+        KTXTexture texture; // Every level, mapped or just cooked
+        bool loaded;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::shared_ptr<Job> > queued;
+    std::deque<std::shared_ptr<Job> > finished;
+    size_t outstanding; // Requested and not yet uploaded; GL thread only
+    bool stopping;
+    BlockQuality quality;
+    // What the driver takes, checked by start() before the workers run
+    bool hasBPTC, hasS3TC, hasRGTC, hasTextureStorage;
+
+    TextureLoader(const TextureLoader&);
+    TextureLoader& operator=(const TextureLoader&);
+
+    void work() {
+        for (;;) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]() { return stopping || !queued.empty(); });
+                if (stopping) {
+                    return;
+                }
+                job = queued.front();
+                queued.pop_front();
+            }
+            job->loaded = load(*job);
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(job);
+        }
+    }
+
+    // Maps the job's container if it is current and uploadable, otherwise cooks it. Only a
+    // missing or stale container is replaced by what was cooked.
+    bool load(Job& job) const {
+        std::string cookedPath = cookedTexturePath(job.path);
+        bool current = loadKTX(cookedPath, job.texture) && cookedTextureCurrent(job.path, job.texture);
+        if (current && canUpload(job.storage, job.texture.vkFormat)) {
+            return true;
+        }
+        BMPImage image;
+        if (!loadBMP(job.path, image) ||
+            !cookTexture(job.path, image, pickFormat(job.storage, image), job.quality, MIP_FILTER_KAISER, job.texture)) {
+            return false;
+        }
+        if (!current && !writeKTX(cookedPath, job.texture)) {
+            printf("Could not write %s; the texture will be cooked again next run\n", cookedPath.c_str());
+        }
+        return true;
+    }
+
+    // The format to cook a decoded image to for this driver
+    uint32_t pickFormat(TextureStorage storage, const BMPImage& image) const {
+        bool srgb = storage != TEXTURE_STORE_RED_GREEN;
+        if (storage != TEXTURE_STORE_RAW && hasBPTC) {
+            return ktxFindFormat(true, BLOCK_BC7, 0, false, srgb);
+        }
+        if (storage == TEXTURE_STORE_RED_GREEN && hasRGTC) {
+            return KTX_BC5_UNORM;
+        }
+        if (storage == TEXTURE_STORE_COLOR && hasS3TC) {
+            return ktxFindFormat(true, image.hasAlpha ? BLOCK_BC3 : BLOCK_BC1, 0, false, srgb);
+        }
+        return ktxFindFormat(false, BLOCK_BC1, image.channels, image.bgr, srgb);
+    }
+
+    // Whether a container in vkFormat can be used for storage as it is. Whatever
+    // format a cooking tool picked is kept as long as the driver takes it.
+    bool canUpload(TextureStorage storage, uint32_t vkFormat) const {
+        const KTXFormatInfo* info = ktxFormatInfo(vkFormat);
+        if (!info->compressed) {
+            return true;
+        }
+        if (storage == TEXTURE_STORE_RAW) {
+            return false;
+        }
+        switch (info->block) {
+        case BLOCK_BC7: return hasBPTC;
+        case BLOCK_BC5: return hasRGTC;
+        default: return hasS3TC;
+        }
+    }
+
+    // Every level into the job's texture, which is bound. With immutable storage the
+    // whole chain is allocated at once and the levels are filled in. Raw levels in a
+    // mapped container are handed to GL where they lie in the file, so there is no copy
+    // in between; block compressed and freshly cooked levels go through a pixel unpack
+    // buffer, which lets the driver return before the transfer completes.
+    void uploadLevels(const KTXTexture& texture) const {
+        const KTXFormatInfo& info = *ktxFormatInfo(texture.vkFormat);
+        GLenum internalFormat, format;
+        ktxTextureFormat(info, internalFormat, format);
+        size_t size = 0;
+        for (const KTXLevel& level : texture.levels) {
+            size += level.size;
+        }
+
+        bool fromMapping = texture.file && !info.compressed;
+        GLuint pixelBufferID = 0;
+        unsigned char* mapped = NULL;
+        if (!fromMapping) {
+            glGenBuffers(1, &pixelBufferID);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBufferID);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        }
+        if (mapped) {
+            size_t offset = 0;
+            for (const KTXLevel& level : texture.levels) {
+                memcpy(mapped + offset, level.data, level.size);
+                offset += level.size;
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        } else {
+            // Mapped raw levels, and every level when the buffer can't be mapped, go from memory
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+
+        GLint previousAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (hasTextureStorage) {
+            glTexStorage2D(GL_TEXTURE_2D, (GLsizei)texture.levels.size(), internalFormat, texture.width, texture.height);
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < texture.levels.size(); ++i) {
+            const KTXLevel& level = texture.levels[i];
+            const void* pixels = mapped ? (const void*)offset : (const void*)level.data;
+            offset += level.size;
+            if (hasTextureStorage && info.compressed) {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, (GLint)i, 0, 0, level.width, level.height, internalFormat,
+                                          (GLsizei)level.size, pixels);
+            } else if (hasTextureStorage) {
+                glTexSubImage2D(GL_TEXTURE_2D, (GLint)i, 0, 0, level.width, level.height, format, GL_UNSIGNED_BYTE, pixels);
+            } else if (info.compressed) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, level.width, level.height, 0,
+                                       (GLsizei)level.size, pixels);
+            } else {
+                glTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, level.width, level.height, 0, format, GL_UNSIGNED_BYTE,
+                             pixels);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+        if (pixelBufferID) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &pixelBufferID);
+        }
+    }
+
+public:
+    TextureLoader() : outstanding(0), stopping(false), quality(BLOCK_QUALITY_NORMAL),
+                      hasBPTC(false), hasS3TC(false), hasRGTC(false), hasTextureStorage(false) {}
+
+    ~TextureLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            changed.notify_all();
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // The loader the programs share; its update() belongs in the render loop
+    static TextureLoader& instance() {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    // Encoder quality for textures cooked at load from now on. Containers that are
+    // already current are used as they are, whatever quality they were cooked at.
+    void setCompressionQuality(BlockQuality value) { quality = value; }
+
+    // Checks which texture formats the driver takes and starts the workers. Call on the
+    // GL thread after glewInit; until then the extension flags all read false. Textures
+    // requested earlier wait in the queue, and update() starts the loader if no one did.
+    void start() {
+        if (!workers.empty()) {
+            return;
+        }
+        hasBPTC = GLEW_ARB_texture_compression_bptc || GLEW_VERSION_4_2;
+        hasS3TC = GLEW_EXT_texture_compression_s3tc;
+        hasRGTC = GLEW_ARB_texture_compression_rgtc || GLEW_VERSION_3_0;
+        hasTextureStorage = GLEW_ARB_texture_storage || GLEW_VERSION_4_2;
+        unsigned count = std::max(1u, std::min(4u, hardwareThreads()));
+        for (unsigned i = 0; i < count; ++i) {
+            workers.push_back(std::thread(&TextureLoader::work, this));
+        }
+    }
+
+    // Creates a texture holding the placeholder and queues path to be loaded into it
+    GLuint request(const std::string& path, TextureStorage storage = TEXTURE_STORE_COLOR) {
+        GLint previous;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        const unsigned char grey[4] = {128, 128, 128, 255};
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glBindTexture(GL_TEXTURE_2D, previous);
+
+        std::shared_ptr<Job> job(new Job());
+        job->textureID = textureID;
+        job->path = path;
+        job->storage = storage;
+        job->quality = quality;
+        job->loaded = false;
+        ++outstanding;
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.push_back(job);
+        changed.notify_one();
+        return textureID;
+    }
+
+    // True while requested textures are still showing their placeholder
+    bool busy() const { return outstanding > 0; }
+
+    // Uploads the textures finished since the last call, up to TEXTURE_UPLOAD_BUDGET bytes
+    void update() {
+        if (outstanding == 0) {
+            return;
+        }
+        start();
+        GLint previous;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+        size_t uploaded = 0;
+        while (uploaded < TEXTURE_UPLOAD_BUDGET) {
+            std::shared_ptr<Job> job;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (finished.empty()) {
+                    break;
+                }
+                job = finished.front();
+                finished.pop_front();
+            }
+            --outstanding;
+            // A texture deleted while it was loading is dropped
+            if (!job->loaded || !glIsTexture(job->textureID)) {
+                continue;
+            }
+            glBindTexture(GL_TEXTURE_2D, job->textureID);
+            uploadLevels(job->texture);
+            for (const KTXLevel& level : job->texture.levels) {
+                uploaded += level.size;
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, previous);
+    }
+};
+
+#endif
@@ -0,0 +1,248 @@
+// VertexPacking.hpp compact quantized vertex layouts for upload to the GPU
+#ifndef VERTEXPACKING_HPP
+#define VERTEXPACKING_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+enum PackedPositionFormat {
+    POSITION_FLOAT32, // 12 bytes, stored as is
+    POSITION_HALF,    // 6 bytes, half floats relative to the centre of the bounding box
+    POSITION_UNORM16  // 6 bytes, 16-bit fixed point across the bounding box
+};
+
+// Which attributes go into the packed vertex and where. Only the attributes the
+// shader consumes should be requested; each vertex is padded to 4 bytes.
+struct PackedVertexLayout {
+    PackedPositionFormat positionFormat;
+    bool hasUV;       // 2 x unorm16 across the UV bounds (2 x float32 with POSITION_FLOAT32)
+    bool hasNormal;   // Octahedral, 2 x snorm16
+    uint32_t stride;
+    uint32_t positionOffset, uvOffset, normalOffset;
+};
+
+// Uniforms that undo the quantization in the vertex shader:
+// position = attribute * positionScale + positionOffset, same for uv.
+struct VertexDequantize {
+    float positionScale[3];
+    float positionOffset[3];
+    float uvScale[2];
+    float uvOffset[2];
+};
+
+inline PackedVertexLayout makePackedVertexLayout(PackedPositionFormat positionFormat, bool hasUV, bool hasNormal) {
+    PackedVertexLayout layout;
+    layout.positionFormat = positionFormat;
+    layout.hasUV = hasUV;
+    layout.hasNormal = hasNormal;
+    uint32_t offset = 0;
+    layout.positionOffset = offset;
+    offset += positionFormat == POSITION_FLOAT32 ? 12 : 6;
+    layout.uvOffset = offset;
+    if (hasUV) {
+        offset += positionFormat == POSITION_FLOAT32 ? 8 : 4;
+    }
+    layout.normalOffset = offset;
+    if (hasNormal) {
+        offset += 4;
+    }
+    layout.stride = (offset + 3) & ~3u;
+    return layout;
+}
+
+// IEEE 754 binary16 with round to nearest even
+inline uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+
+    if (magnitude >= 0x7F800000) {
+        // Inf stays inf, NaN stays a quiet NaN
+        return (uint16_t)(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+    }
+    if (magnitude >= 0x477FF000) {
+        // Rounds past the largest half
+        return (uint16_t)(sign | 0x7C00);
+    }
+    if (magnitude < 0x38800000) {
+        // Subnormal half: shift the mantissa (with its implicit bit) into place
+        if (magnitude < 0x33000000) {
+            return (uint16_t)sign;
+        }
+        uint32_t exponent = magnitude >> 23;
+        uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1))) {
+            ++half;
+        }
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t remainder = magnitude & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        ++half;
+    }
+    return (uint16_t)(sign | half);
+}
+
+inline float halfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+    uint32_t bits;
+    if (exponent == 0x1F) {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal half becomes a normal float
+        exponent = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+inline uint16_t quantizeUnorm16(float value) {
+    value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+    return (uint16_t)(value * 65535.0f + 0.5f);
+}
+
+inline int16_t quantizeSnorm16(float value) {
+    value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+    return (int16_t)lrintf(value * 32767.0f);
+}
+
+// Octahedral normal encoding (Meyer et al. 2010): project onto the octahedron,
+// fold the lower hemisphere over the diagonals and store the two coordinates.
+inline void encodeOctahedral(float nx, float ny, float nz, int16_t out[2]) {
+    float sum = fabsf(nx) + fabsf(ny) + fabsf(nz);
+    if (sum == 0.0f) {
+        out[0] = out[1] = 0;
+        return;
+    }
+    float x = nx / sum, y = ny / sum;
+    if (nz < 0.0f) {
+        float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    out[0] = quantizeSnorm16(x);
+    out[1] = quantizeSnorm16(y);
+}
+
+// The inverse, matching what a shader does with the normalized attribute:
+// n = vec3(e, 1 - |e.x| - |e.y|); if (n.z < 0) n.xy = (1 - |n.yx|) * sign(n.xy); normalize(n)
+inline void decodeOctahedral(const int16_t in[2], float n[3]) {
+    float x = fmaxf(in[0] / 32767.0f, -1.0f), y = fmaxf(in[1] / 32767.0f, -1.0f);
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f) {
+        float unfoldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float unfoldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = unfoldedX;
+        y = unfoldedY;
+    }
+    float length = sqrtf(x * x + y * y + z * z);
+    n[0] = x / length;
+    n[1] = y / length;
+    n[2] = z / length;
+}
+
+// Packs count vertices into out. Each attribute is read through a pointer to its
+// first float and the source stride in bytes (e.g. &vertices[0].x, sizeof(VertexData)).
+// uv and normal may be NULL when the layout does not include them.
+inline void packVertices(const PackedVertexLayout& layout, size_t count, size_t sourceStride,
+                         const float* position, const float* uv, const float* normal,
+                         std::vector<unsigned char>& out, VertexDequantize& dequantize) {
+    const size_t step = sourceStride / sizeof(float);
+
+    // Bounding boxes of positions and UVs drive the quantization range
+    float lower[5] = {0, 0, 0, 0, 0}, upper[5] = {0, 0, 0, 0, 0};
+    for (size_t i = 0; i < count; ++i) {
+        for (int k = 0; k < 5; ++k) {
+            if (k >= 3 && !layout.hasUV) {
+                break;
+            }
+            float value = k < 3 ? position[i * step + k] : uv[i * step + k - 3];
+            if (i == 0 || value < lower[k]) lower[k] = value;
+            if (i == 0 || value > upper[k]) upper[k] = value;
+        }
+    }
+
+    for (int k = 0; k < 3; ++k) {
+        float extent = upper[k] - lower[k];
+        if (layout.positionFormat == POSITION_UNORM16) {
+            dequantize.positionScale[k] = extent;
+            dequantize.positionOffset[k] = lower[k];
+        } else if (layout.positionFormat == POSITION_HALF) {
+            dequantize.positionScale[k] = 1.0f;
+            dequantize.positionOffset[k] = 0.5f * (lower[k] + upper[k]);
+        } else {
+            dequantize.positionScale[k] = 1.0f;
+            dequantize.positionOffset[k] = 0.0f;
+        }
+    }
+    for (int k = 0; k < 2; ++k) {
+        bool quantized = layout.hasUV && layout.positionFormat != POSITION_FLOAT32;
+        dequantize.uvScale[k] = quantized ? upper[3 + k] - lower[3 + k] : 1.0f;
+        dequantize.uvOffset[k] = quantized ? lower[3 + k] : 0.0f;
+    }
+
+    out.assign(count * layout.stride, 0);
+    for (size_t i = 0; i < count; ++i) {
+        unsigned char* vertex = &out[i * layout.stride];
+        const float* p = position + i * step;
+
+        if (layout.positionFormat == POSITION_FLOAT32) {
+            memcpy(vertex + layout.positionOffset, p, 12);
+        } else {
+            uint16_t packed[3];
+            for (int k = 0; k < 3; ++k) {
+                if (layout.positionFormat == POSITION_HALF) {
+                    packed[k] = floatToHalf(p[k] - dequantize.positionOffset[k]);
+                } else {
+                    float scale = dequantize.positionScale[k];
+                    packed[k] = quantizeUnorm16(scale > 0.0f ? (p[k] - dequantize.positionOffset[k]) / scale : 0.0f);
+                }
+            }
+            memcpy(vertex + layout.positionOffset, packed, 6);
+        }
+
+        if (layout.hasUV) {
+            const float* t = uv + i * step;
+            if (layout.positionFormat == POSITION_FLOAT32) {
+                memcpy(vertex + layout.uvOffset, t, 8);
+            } else {
+                uint16_t packed[2];
+                for (int k = 0; k < 2; ++k) {
+                    float scale = dequantize.uvScale[k];
+                    packed[k] = quantizeUnorm16(scale > 0.0f ? (t[k] - dequantize.uvOffset[k]) / scale : 0.0f);
+                }
+                memcpy(vertex + layout.uvOffset, packed, 4);
+            }
+        }
+
+        if (layout.hasNormal) {
+            const float* n = normal + i * step;
+            int16_t packed[2];
+            encodeOctahedral(n[0], n[1], n[2], packed);
+            memcpy(vertex + layout.normalOffset, packed, 4);
+        }
+    }
+}
+
+#endif
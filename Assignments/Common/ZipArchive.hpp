@@ -0,0 +1,360 @@
+// ZipArchive.hpp reads files straight out of zip archives, without unpacking them
+#ifndef ZIPARCHIVE_HPP
+#define ZIPARCHIVE_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+
+// A file stored in an archive, as listed in its central directory
+struct ZipEntry {
+    std::string name;
+    uint16_t method;            // 0 stored, 8 deflated
+    uint32_t crc;
+    uint64_t compressedSize;
+    uint64_t size;
+    uint64_t localHeaderOffset;
+};
+
+// A zip archive mapped into memory. The central directory is parsed once up front;
+// entries are inflated on demand, and since each read has its own zlib stream,
+// any number of threads can read from one archive at once. Zip64 archives are
+// supported; encrypted entries and compression other than deflate are not.
+class ZipArchive {
+    MappedFile file;
+    std::string path;
+    std::vector<ZipEntry> entries;
+    std::unordered_map<std::string, size_t> lookup;
+
+    ZipArchive(const ZipArchive&);
+    ZipArchive& operator=(const ZipArchive&);
+
+    static uint16_t get16(const unsigned char* p) { return (uint16_t)(p[0] | p[1] << 8); }
+    static uint32_t get32(const unsigned char* p) { return (uint32_t)get16(p) | (uint32_t)get16(p + 2) << 16; }
+    static uint64_t get64(const unsigned char* p) { return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32; }
+
+    const unsigned char* at(uint64_t offset, uint64_t size) const {
+        if (offset > file.size() || size > file.size() - offset) {
+            throw std::runtime_error("Truncated zip archive: " + path);
+        }
+        return (const unsigned char*)file.data() + offset;
+    }
+
+    void readCentralDirectory() {
+        // The end of central directory record is in the last 64K + 22 bytes, after any comment
+        const size_t EOCD_SIZE = 22;
+        if (file.size() < EOCD_SIZE) {
+            throw std::runtime_error("Not a zip archive: " + path);
+        }
+        size_t eocd = file.size() - EOCD_SIZE;
+        size_t lowest = file.size() > EOCD_SIZE + 0xFFFF ? file.size() - EOCD_SIZE - 0xFFFF : 0;
+        while (get32(at(eocd, 4)) != 0x06054b50) {
+            if (eocd == lowest) {
+                throw std::runtime_error("Not a zip archive: " + path);
+            }
+            --eocd;
+        }
+        const unsigned char* record = at(eocd, EOCD_SIZE);
+        uint64_t count = get16(record + 10);
+        uint64_t directorySize = get32(record + 12);
+        uint64_t directoryOffset = get32(record + 16);
+
+        // Zip64: the real values are in a second record, found through a locator just before this one
+        if ((count == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) && eocd >= 20 &&
+            get32(at(eocd - 20, 4)) == 0x07064b50) {
+            const unsigned char* zip64 = at(get64(at(eocd - 20, 20) + 8), 56);
+            if (get32(zip64) != 0x06064b50) {
+                throw std::runtime_error("Corrupt zip64 directory in " + path);
+            }
+            count = get64(zip64 + 32);
+            directorySize = get64(zip64 + 40);
+            directoryOffset = get64(zip64 + 48);
+        }
+
+        const unsigned char* cursor = at(directoryOffset, directorySize);
+        const unsigned char* end = cursor + directorySize;
+        entries.reserve((size_t)std::min<uint64_t>(count, directorySize / 46));
+        for (uint64_t i = 0; i < count; ++i) {
+            if (end - cursor < 46 || get32(cursor) != 0x02014b50) {
+                throw std::runtime_error("Corrupt zip central directory in " + path);
+            }
+            uint16_t flags = get16(cursor + 8);
+            size_t nameLength = get16(cursor + 28), extraLength = get16(cursor + 30), commentLength = get16(cursor + 32);
+            if ((size_t)(end - cursor) < 46 + nameLength + extraLength + commentLength) {
+                throw std::runtime_error("Corrupt zip central directory in " + path);
+            }
+            ZipEntry entry;
+            entry.name.assign((const char*)cursor + 46, nameLength);
+            entry.method = get16(cursor + 10);
+            entry.crc = get32(cursor + 16);
+            entry.compressedSize = get32(cursor + 20);
+            entry.size = get32(cursor + 24);
+            entry.localHeaderOffset = get32(cursor + 42);
+
+            // Zip64 extra field: whichever of the three were saturated follow in this order
+            const unsigned char* extra = cursor + 46 + nameLength;
+            for (size_t e = 0; e + 4 <= extraLength;) {
+                size_t fieldSize = get16(extra + e + 2);
+                if (get16(extra + e) == 0x0001) {
+                    const unsigned char* value = extra + e + 4;
+                    const unsigned char* valueEnd = value + std::min(fieldSize, extraLength - e - 4);
+                    uint64_t* saturated[3] = {&entry.size, &entry.compressedSize, &entry.localHeaderOffset};
+                    for (int f = 0; f < 3; ++f) {
+                        if (*saturated[f] == 0xFFFFFFFF && value + 8 <= valueEnd) {
+                            *saturated[f] = get64(value);
+                            value += 8;
+                        }
+                    }
+                }
+                e += 4 + fieldSize;
+            }
+
+            if (!(flags & 1) && !entry.name.empty() && entry.name[entry.name.size() - 1] != '/') {
+                lookup[entry.name] = entries.size();
+                entries.push_back(entry);
+            }
+            cursor += 46 + nameLength + extraLength + commentLength;
+        }
+    }
+
+public:
+    // Throws std::runtime_error if the file can't be mapped or isn't a zip archive
+    explicit ZipArchive(const std::string& path) : file(path), path(path) {
+        readCentralDirectory();
+    }
+
+    const std::string& getPath() const { return path; }
+
+    const std::vector<ZipEntry>& getEntries() const { return entries; }
+
+    // NULL if there is no such file in the archive
+    const ZipEntry* find(const std::string& name) const {
+        std::unordered_map<std::string, size_t>::const_iterator found = lookup.find(name);
+        return found == lookup.end() ? NULL : &entries[found->second];
+    }
+
+    // Inflates entry into out and checks its CRC. Throws std::runtime_error on failure.
+    void read(const ZipEntry& entry, std::vector<char>& out) const {
+        const unsigned char* local = at(entry.localHeaderOffset, 30);
+        if (get32(local) != 0x04034b50) {
+            throw std::runtime_error("Corrupt zip entry " + entry.name + " in " + path);
+        }
+        uint64_t dataOffset = entry.localHeaderOffset + 30 + get16(local + 26) + get16(local + 28);
+        const unsigned char* data = at(dataOffset, entry.compressedSize);
+        out.resize((size_t)entry.size);
+
+        if (entry.method == 0) {
+            if (entry.compressedSize != entry.size) {
+                throw std::runtime_error("Corrupt zip entry " + entry.name + " in " + path);
+            }
+            if (entry.size > 0) {
+                memcpy(&out[0], data, (size_t)entry.size);
+            }
+        } else if (entry.method == 8) {
+            // Raw deflate, no zlib header; fed in pieces since zlib counts in 32 bits
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+                throw std::runtime_error("Could not start inflating " + entry.name);
+            }
+            uint64_t consumed = 0, produced = 0;
+            int status = Z_OK;
+            while (status == Z_OK) {
+                const uint64_t PIECE = 1u << 30;
+                stream.next_in = (Bytef*)(data + consumed);
+                stream.avail_in = (uInt)std::min(PIECE, entry.compressedSize - consumed);
+                stream.next_out = (Bytef*)(out.empty() ? NULL : &out[0] + produced);
+                stream.avail_out = (uInt)std::min(PIECE, entry.size - produced);
+                uInt inBefore = stream.avail_in, outBefore = stream.avail_out;
+                status = inflate(&stream, Z_NO_FLUSH);
+                consumed += inBefore - stream.avail_in;
+                produced += outBefore - stream.avail_out;
+                if (status == Z_OK && inBefore == stream.avail_in && outBefore == stream.avail_out) {
+                    break;
+                }
+            }
+            inflateEnd(&stream);
+            if (status != Z_STREAM_END || produced != entry.size) {
+                throw std::runtime_error("Could not inflate " + entry.name + " in " + path);
+            }
+        } else {
+            throw std::runtime_error("Unsupported compression for " + entry.name + " in " + path);
+        }
+
+        uLong crc = crc32(0L, Z_NULL, 0);
+        for (uint64_t offset = 0; offset < entry.size; offset += 1u << 30) {
+            crc = crc32(crc, (const Bytef*)&out[(size_t)offset], (uInt)std::min<uint64_t>(1u << 30, entry.size - offset));
+        }
+        if ((uint32_t)crc != entry.crc) {
+            throw std::runtime_error("CRC mismatch for " + entry.name + " in " + path);
+        }
+    }
+
+    // Inflates several entries at once, one per worker thread
+    void readAll(const std::vector<const ZipEntry*>& wanted, std::vector<std::vector<char> >& out) const {
+        out.resize(wanted.size());
+        parallelFor(wanted.size(), [&](size_t i) {
+            read(*wanted[i], out[i]);
+        });
+    }
+};
+
+// Splits "Assets.zip/dir/file.ply" into the archive and the entry name. Only paths
+// that go through an existing .zip file count, so a directory named x.zip still works.
+inline bool splitArchivePath(const std::string& path, std::string& archive, std::string& entry) {
+    for (size_t pos = path.find(".zip/"); pos != std::string::npos; pos = path.find(".zip/", pos + 1)) {
+        std::string candidate = path.substr(0, pos + 4);
+        struct stat info;
+        if (stat(candidate.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            archive = candidate;
+            entry = path.substr(pos + 5);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Archives opened through archive paths stay open for the rest of the run, so each
+// central directory is parsed once.
+struct ArchiveRegistry {
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<ZipArchive> > archives;
+
+    static ArchiveRegistry& instance() {
+        static ArchiveRegistry registry;
+        return registry;
+    }
+};
+
+// Throws std::runtime_error if the archive can't be opened
+inline std::shared_ptr<ZipArchive> openZipArchive(const std::string& path) {
+    ArchiveRegistry& registry = ArchiveRegistry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    std::shared_ptr<ZipArchive>& archive = registry.archives[path];
+    if (!archive) {
+        archive.reset(new ZipArchive(path));
+    }
+    return archive;
+}
+
+// Size of the file an archive path names, and the archive's mtime
+inline bool statArchivePath(const std::string& path, uint64_t& size, int64_t& mtime) {
+    std::string archivePath, name;
+    struct stat info;
+    if (!splitArchivePath(path, archivePath, name) || stat(archivePath.c_str(), &info) != 0) {
+        return false;
+    }
+    try {
+        const ZipEntry* entry = openZipArchive(archivePath)->find(name);
+        if (!entry) {
+            return false;
+        }
+        size = entry->size;
+        mtime = (int64_t)info.st_mtime;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// CRC-32 and size of the file an archive path names, as its central directory lists
+// them, so the file can be told apart from an edited copy without inflating it
+inline bool checksumArchivePath(const std::string& path, uint32_t& crc, uint64_t& size) {
+    std::string archivePath, name;
+    if (!splitArchivePath(path, archivePath, name)) {
+        return false;
+    }
+    try {
+        const ZipEntry* entry = openZipArchive(archivePath)->find(name);
+        if (!entry) {
+            return false;
+        }
+        crc = entry->crc;
+        size = entry->size;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// Reads the file an archive path names into out. Returns false for paths that are not
+// inside an archive; throws std::runtime_error if the archive or the entry is bad.
+inline bool readArchivePath(const std::string& path, std::vector<char>& out) {
+    std::string archivePath, name;
+    if (!splitArchivePath(path, archivePath, name)) {
+        return false;
+    }
+    std::shared_ptr<ZipArchive> archive = openZipArchive(archivePath);
+    const ZipEntry* entry = archive->find(name);
+    if (!entry) {
+        throw std::runtime_error("No " + name + " in " + archivePath);
+    }
+    archive->read(*entry, out);
+    return true;
+}
+
+// Has every MappedFile open archive paths through readArchivePath. Call it once, before
+// any loads start; programs that do must link zlib.
+inline void enableArchivePaths() {
+    pathReader() = readArchivePath;
+}
+
+// Inflates the files of every archive path in paths at once, into the prefetched
+// files (MappedFile.hpp), so the loads that follow find them ready. The archives are
+// opened here; the entries are inflated in the background and each is handed over as
+// soon as it is done, so the first loads can start while the rest inflate. Other
+// paths, and entries that fail, are skipped; the load itself will report them.
+inline void prefetchArchivePaths(const std::vector<std::string>& paths) {
+    std::vector<std::string> names;
+    std::vector<std::shared_ptr<ZipArchive> > archives;
+    std::vector<const ZipEntry*> entries;
+    for (const std::string& path : paths) {
+        std::string archivePath, name;
+        if (!splitArchivePath(path, archivePath, name)) {
+            continue;
+        }
+        try {
+            std::shared_ptr<ZipArchive> archive = openZipArchive(archivePath);
+            if (const ZipEntry* entry = archive->find(name)) {
+                names.push_back(path);
+                archives.push_back(archive);
+                entries.push_back(entry);
+            }
+        } catch (const std::exception&) {
+        }
+    }
+
+    if (entries.empty()) {
+        return;
+    }
+
+    // The thread only touches the archives it holds and the prefetched files, which
+    // outlive it, so it can be left to finish on its own
+    expectPrefetchedFiles(names);
+    std::thread([names, archives, entries]() {
+        parallelFor(entries.size(), [&](size_t i) {
+            std::vector<char> data;
+            try {
+                archives[i]->read(*entries[i], data);
+            } catch (const std::exception&) {
+                dropPrefetchedFile(names[i]);
+                return;
+            }
+            storePrefetchedFile(names[i], data);
+        });
+    }).detach();
+}
+
+#endif
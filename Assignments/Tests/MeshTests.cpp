@@ -0,0 +1,220 @@
+// MeshTests.cpp checks vertex welding and the bounds meshlets are culled with
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+#include "TestCheck.hpp"
+#include "../Common/MeshWeld.hpp"
+#include "../Common/Meshlets.hpp"
+
+struct WeldVertex {
+    float x, y, z;
+    float u, v;
+    int tag; // Not welded on; kept from the first vertex of each group
+};
+
+static const std::vector<WeldAttribute>& weldAttributes() {
+    static const std::vector<WeldAttribute> attributes = {{offsetof(WeldVertex, x), 3}, {offsetof(WeldVertex, u), 2}};
+    return attributes;
+}
+
+static bool within(const WeldVertex& a, const WeldVertex& b, float epsilon) {
+    return fabsf(a.x - b.x) <= epsilon && fabsf(a.y - b.y) <= epsilon && fabsf(a.z - b.z) <= epsilon &&
+           fabsf(a.u - b.u) <= epsilon && fabsf(a.v - b.v) <= epsilon;
+}
+
+// Exact copies collapse into the first, in first-seen order; -0 matches 0; a UV
+// seam keeps both sides; indices follow the vertices
+static void testWeldExact() {
+    std::vector<WeldVertex> vertices = {
+        {0, 0, 0, 0, 0, 0},
+        {1, 0, 0, 1, 0, 1},
+        {0, 0, 0, 0, 0, 2},  // Copy of 0
+        {1, 0, 0, 0.5f, 0, 3}, // Same position as 1, other UV
+        {-0.0f, 0, 0, 0, 0, 4}, // -0 is 0
+        {1, 0, 0, 1, 0, 5},  // Copy of 1
+        {1, 1e-6f, 0, 1, 0, 6}, // Close to 1, but only exact copies weld
+    };
+    std::vector<uint32_t> indices = {0, 1, 2, 3, 4, 5, 6, 2, 5};
+    size_t count = weldVertices(vertices.data(), vertices.size(), sizeof(WeldVertex), weldAttributes(), 0.0f,
+                                indices.data(), indices.size());
+    CHECK(count == 4);
+    CHECK((indices == std::vector<uint32_t>{0, 1, 0, 2, 0, 1, 3, 0, 1}));
+    CHECK(vertices[0].tag == 0 && vertices[1].tag == 1 && vertices[2].tag == 3 && vertices[3].tag == 6);
+}
+
+// With an epsilon, every corner ends up on a vertex within epsilon of where it was, and
+// vertices further apart than epsilon on any attribute are never merged
+static void testWeldEpsilon() {
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> jitter(-0.4f, 0.4f);
+    const float EPSILON = 0.01f;
+    std::vector<WeldVertex> original;
+    for (int i = 0; i < 20000; ++i) {
+        // Lattice points 0.1 apart, each repeated with up to 0.4 epsilon of noise
+        int cell = i / 4;
+        WeldVertex v = {(cell % 30) * 0.1f, (cell / 30 % 30) * 0.1f, (cell / 900) * 0.1f, (cell % 7) * 0.25f, 0.5f, i};
+        v.x += jitter(random) * EPSILON;
+        v.y += jitter(random) * EPSILON;
+        v.u += jitter(random) * EPSILON;
+        original.push_back(v);
+    }
+    std::vector<uint32_t> indices(original.size() * 2);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        indices[i] = (uint32_t)((i * 7919) % original.size());
+    }
+    std::vector<uint32_t> originalIndices = indices;
+    std::vector<WeldVertex> vertices = original;
+    size_t count = weldVertices(vertices.data(), vertices.size(), sizeof(WeldVertex), weldAttributes(), EPSILON,
+                                indices.data(), indices.size());
+    CHECK(count == original.size() / 4);
+
+    bool close = true, inRange = true;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        inRange = inRange && indices[i] < count;
+        close = close && indices[i] < count && within(original[originalIndices[i]], vertices[indices[i]], EPSILON);
+    }
+    CHECK(inRange);
+    CHECK(close);
+
+    // Points one lattice step apart are far outside epsilon and stay separate
+    std::vector<WeldVertex> apart = {{0, 0, 0, 0, 0, 0}, {EPSILON * 1.5f, 0, 0, 0, 0, 1}, {0, 0, 0, EPSILON * 1.5f, 0, 2}};
+    std::vector<uint32_t> apartIndices = {0, 1, 2};
+    CHECK(weldVertices(apart.data(), apart.size(), sizeof(WeldVertex), weldAttributes(), EPSILON, apartIndices.data(),
+                       apartIndices.size()) == 3);
+}
+
+static void testWeldRejectsBadPositions() {
+    for (float bad : {NAN, INFINITY}) {
+        std::vector<WeldVertex> vertices = {{0, 0, 0, 0, 0, 0}, {bad, 0, 0, 0, 0, 1}};
+        std::vector<uint32_t> indices = {0, 1};
+        bool threw = false;
+        try {
+            weldVertices(vertices.data(), vertices.size(), sizeof(WeldVertex), weldAttributes(), 0.001f, indices.data(),
+                         indices.size());
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+}
+
+// A bumpy height field over a grid, one position per vertex
+struct TestMesh {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+};
+
+static TestMesh bumpyGrid(unsigned int size, float bumpiness) {
+    TestMesh mesh;
+    for (unsigned int y = 0; y < size; ++y) {
+        for (unsigned int x = 0; x < size; ++x) {
+            mesh.positions.push_back((float)x);
+            mesh.positions.push_back((float)y);
+            mesh.positions.push_back(bumpiness * sinf(x * 0.7f) * cosf(y * 0.4f));
+        }
+    }
+    for (unsigned int y = 0; y + 1 < size; ++y) {
+        for (unsigned int x = 0; x + 1 < size; ++x) {
+            uint32_t a = y * size + x;
+            mesh.indices.insert(mesh.indices.end(), {a, a + 1, a + size + 1, a, a + size + 1, a + size});
+        }
+    }
+    return mesh;
+}
+
+// Every meshlet stays within the limits and the meshlets cover the index range in order
+static bool coversInOrder(const std::vector<Meshlet>& meshlets, const std::vector<uint32_t>& indices, size_t maxVertices,
+                          size_t maxTriangles) {
+    size_t next = 0;
+    for (const Meshlet& meshlet : meshlets) {
+        if (meshlet.firstIndex != next || meshlet.indexCount == 0 || meshlet.indexCount % 3 != 0 ||
+            meshlet.indexCount / 3 > maxTriangles) {
+            return false;
+        }
+        std::vector<uint32_t> used(indices.begin() + meshlet.firstIndex, indices.begin() + meshlet.firstIndex + meshlet.indexCount);
+        std::sort(used.begin(), used.end());
+        if ((size_t)(std::unique(used.begin(), used.end()) - used.begin()) > maxVertices) {
+            return false;
+        }
+        next += meshlet.indexCount;
+    }
+    return next == indices.size();
+}
+
+// The bounding sphere holds every vertex of its meshlet, and whenever the cone test
+// culls a meshlet from a camera position, every one of its triangles faces away
+static void testMeshletBounds() {
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> around(-40.0f, 40.0f);
+    for (float bumpiness : {0.0f, 0.3f, 20.0f}) {
+        TestMesh mesh = bumpyGrid(40, bumpiness);
+        size_t vertexCount = mesh.positions.size() / 3;
+        std::vector<Meshlet> meshlets;
+        buildMeshlets(mesh.positions.data(), 3 * sizeof(float), vertexCount, mesh.indices.data(), 0, mesh.indices.size(),
+                      meshlets);
+        CHECK(coversInOrder(meshlets, mesh.indices, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES));
+
+        bool enclosed = true, culledCorrectly = true;
+        size_t culled = 0, conesThatCull = 0;
+        for (const Meshlet& meshlet : meshlets) {
+            const float* sphere = meshlet.boundingSphere;
+            for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; ++i) {
+                const float* p = &mesh.positions[mesh.indices[i] * 3];
+                float dx = p[0] - sphere[0], dy = p[1] - sphere[1], dz = p[2] - sphere[2];
+                enclosed = enclosed && sqrtf(dx * dx + dy * dy + dz * dz) <= sphere[3] * 1.0001f + 1e-6f;
+            }
+            conesThatCull += meshlet.coneCutoff <= 1.0f;
+
+            for (int c = 0; c < 200; ++c) {
+                float camera[3] = {around(random), around(random), around(random)};
+                float toApex[3] = {meshlet.coneApex[0] - camera[0], meshlet.coneApex[1] - camera[1], meshlet.coneApex[2] - camera[2]};
+                float length = sqrtf(toApex[0] * toApex[0] + toApex[1] * toApex[1] + toApex[2] * toApex[2]);
+                float along = (toApex[0] * meshlet.coneAxis[0] + toApex[1] * meshlet.coneAxis[1] + toApex[2] * meshlet.coneAxis[2]) / length;
+                if (along < meshlet.coneCutoff) {
+                    continue;
+                }
+                ++culled;
+                for (uint32_t t = meshlet.firstIndex; t < meshlet.firstIndex + meshlet.indexCount; t += 3) {
+                    const float* p0 = &mesh.positions[mesh.indices[t] * 3];
+                    const float* p1 = &mesh.positions[mesh.indices[t + 1] * 3];
+                    const float* p2 = &mesh.positions[mesh.indices[t + 2] * 3];
+                    float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+                    float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+                    float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+                    float facing = n[0] * (p0[0] - camera[0]) + n[1] * (p0[1] - camera[1]) + n[2] * (p0[2] - camera[2]);
+                    culledCorrectly = culledCorrectly && facing >= -1e-3f;
+                }
+            }
+        }
+        CHECK(enclosed);
+        CHECK(culledCorrectly);
+        // Flat and gently curved meshlets can be culled from behind; folded ones never are
+        if (bumpiness < 1.0f) {
+            CHECK(conesThatCull == meshlets.size() && culled > 0);
+        } else {
+            CHECK(conesThatCull < meshlets.size());
+        }
+    }
+
+    // Smaller limits cut more meshlets but keep the same guarantees
+    TestMesh mesh = bumpyGrid(20, 0.3f);
+    std::vector<Meshlet> small;
+    buildMeshlets(mesh.positions.data(), 3 * sizeof(float), mesh.positions.size() / 3, mesh.indices.data(), 0,
+                  mesh.indices.size(), small, 16, 20);
+    CHECK(coversInOrder(small, mesh.indices, 16, 20));
+}
+
+int main() {
+    runTest("testWeldExact", testWeldExact);
+    runTest("testWeldEpsilon", testWeldEpsilon);
+    runTest("testWeldRejectsBadPositions", testWeldRejectsBadPositions);
+    runTest("testMeshletBounds", testMeshletBounds);
+    return finishTests("MeshTests");
+}
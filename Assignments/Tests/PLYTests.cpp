@@ -0,0 +1,474 @@
+// PLYTests.cpp checks the PLY readers on every body format and the staleness checks of the cooked mesh sidecars
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "TestCheck.hpp"
+#include "../Assignment4/MeshData.hpp"
+#include "../Assignment6/LoadPLY.hpp"
+#include "../Common/MeshCache.hpp"
+#include "../Common/MeshPack.hpp"
+
+enum BodyFormat {
+    BODY_ASCII,
+    BODY_LITTLE_ENDIAN,
+    BODY_BIG_ENDIAN
+};
+
+static const char* formatName(BodyFormat format) {
+    switch (format) {
+    case BODY_ASCII: return "ascii";
+    case BODY_LITTLE_ENDIAN: return "binary_little_endian";
+    default: return "binary_big_endian";
+    }
+}
+
+// Builds a PLY body value by value in any of the three formats
+struct BodyWriter {
+    BodyFormat format;
+    std::string text;
+
+    explicit BodyWriter(BodyFormat format) : format(format) {}
+
+    void bytes(const void* value, size_t size) {
+        const char* p = (const char*)value;
+        for (size_t i = 0; i < size; ++i) {
+            text += p[format == BODY_BIG_ENDIAN ? size - 1 - i : i];
+        }
+    }
+
+    void number(const char* printed, const void* value, size_t size) {
+        if (format == BODY_ASCII) {
+            text += printed;
+            text += ' ';
+        } else {
+            bytes(value, size);
+        }
+    }
+
+    void f32(float value) {
+        char printed[32];
+        snprintf(printed, sizeof(printed), "%.9g", value);
+        number(printed, &value, sizeof(value));
+    }
+
+    void f64(double value) {
+        char printed[32];
+        snprintf(printed, sizeof(printed), "%.17g", value);
+        number(printed, &value, sizeof(value));
+    }
+
+    void u8(unsigned char value) {
+        number(std::to_string(value).c_str(), &value, sizeof(value));
+    }
+
+    void i32(int32_t value) {
+        number(std::to_string(value).c_str(), &value, sizeof(value));
+    }
+
+    void endRecord() {
+        if (format == BODY_ASCII) {
+            text.back() = '\n';
+        }
+    }
+};
+
+// A 4 x 3 grid of vertices whose attributes all differ and are exact in float, with
+// its six cells as quads and one extra triangle
+const unsigned int GRID_WIDTH = 4, GRID_HEIGHT = 3;
+
+static VertexData gridVertex(unsigned int i) {
+    VertexData v;
+    v.x = i * 0.5f;
+    v.y = -(float)(i % 3) * 1.25f;
+    v.z = i * i * 0.125f;
+    v.nx = (float)(i % 2);
+    v.ny = i / 16.0f;
+    v.nz = -1.0f;
+    v.r = (unsigned char)(i * 20);
+    v.g = (unsigned char)(255 - i * 20);
+    v.b = (unsigned char)i;
+    v.u = i / 32.0f;
+    v.v = 1.0f - i / 64.0f;
+    return v;
+}
+
+static std::vector<std::vector<uint32_t> > gridFaces() {
+    std::vector<std::vector<uint32_t> > faces;
+    for (unsigned int y = 0; y + 1 < GRID_HEIGHT; ++y) {
+        for (unsigned int x = 0; x + 1 < GRID_WIDTH; ++x) {
+            uint32_t a = y * GRID_WIDTH + x;
+            faces.push_back({a, a + 1, a + GRID_WIDTH + 1, a + GRID_WIDTH});
+        }
+    }
+    faces.push_back({0, 1, GRID_WIDTH});
+    return faces;
+}
+
+// The triangles readers should produce: every face fanned from its first corner
+static std::vector<uint32_t> gridTriangles() {
+    std::vector<uint32_t> triangles;
+    for (const std::vector<uint32_t>& face : gridFaces()) {
+        for (size_t j = 2; j < face.size(); ++j) {
+            triangles.push_back(face[0]);
+            triangles.push_back(face[j - 1]);
+            triangles.push_back(face[j]);
+        }
+    }
+    return triangles;
+}
+
+// The grid with every attribute A4 reads, z stored as a double, an unknown vertex
+// property and an element no loader knows, so the generic decoder and skipping run.
+// lastIndex replaces the last index of the last face, to make it refer to a missing vertex.
+static std::string gridPLY(BodyFormat format, int32_t lastIndex = -1) {
+    unsigned int vertexCount = GRID_WIDTH * GRID_HEIGHT;
+    std::vector<std::vector<uint32_t> > faces = gridFaces();
+    std::string header = std::string("ply\nformat ") + formatName(format) + " 1.0\ncomment test grid\n" +
+                         "element vertex " + std::to_string(vertexCount) + "\n" +
+                         "property float x\nproperty float y\nproperty double z\nproperty float confidence\n"
+                         "property float nx\nproperty float ny\nproperty float nz\n"
+                         "property uchar red\nproperty uchar green\nproperty uchar blue\n"
+                         "property float u\nproperty float v\n"
+                         "element face " + std::to_string(faces.size()) + "\n"
+                         "property list uchar int vertex_indices\n"
+                         "element edge 2\nproperty int vertex1\nproperty int vertex2\n"
+                         "end_header\n";
+    BodyWriter body(format);
+    for (unsigned int i = 0; i < vertexCount; ++i) {
+        VertexData v = gridVertex(i);
+        body.f32(v.x);
+        body.f32(v.y);
+        body.f64(v.z);
+        body.f32(0.75f);
+        body.f32(v.nx);
+        body.f32(v.ny);
+        body.f32(v.nz);
+        body.u8(v.r);
+        body.u8(v.g);
+        body.u8(v.b);
+        body.f32(v.u);
+        body.f32(v.v);
+        body.endRecord();
+    }
+    for (size_t f = 0; f < faces.size(); ++f) {
+        body.u8((unsigned char)faces[f].size());
+        for (size_t j = 0; j < faces[f].size(); ++j) {
+            bool replaced = lastIndex >= 0 && f + 1 == faces.size() && j + 1 == faces[f].size();
+            body.i32(replaced ? lastIndex : (int32_t)faces[f][j]);
+        }
+        body.endRecord();
+    }
+    for (int e = 0; e < 2; ++e) {
+        body.i32(e);
+        body.i32(e + 1);
+        body.endRecord();
+    }
+    return header + body.text;
+}
+
+// The same grid as plain float x, y, z, nx, ny, nz, u, v: the layout A6 reads with its specialized decoder
+static std::string gridPLYPositionNormalUV(BodyFormat format) {
+    unsigned int vertexCount = GRID_WIDTH * GRID_HEIGHT;
+    std::vector<std::vector<uint32_t> > faces = gridFaces();
+    std::string header = std::string("ply\nformat ") + formatName(format) + " 1.0\n" +
+                         "element vertex " + std::to_string(vertexCount) + "\n" +
+                         "property float x\nproperty float y\nproperty float z\n"
+                         "property float nx\nproperty float ny\nproperty float nz\n"
+                         "property float u\nproperty float v\n"
+                         "element face " + std::to_string(faces.size()) + "\n"
+                         "property list uchar int vertex_indices\n"
+                         "end_header\n";
+    BodyWriter body(format);
+    for (unsigned int i = 0; i < vertexCount; ++i) {
+        VertexData v = gridVertex(i);
+        float values[8] = {v.x, v.y, v.z, v.nx, v.ny, v.nz, v.u, v.v};
+        for (float value : values) {
+            body.f32(value);
+        }
+        body.endRecord();
+    }
+    for (const std::vector<uint32_t>& face : faces) {
+        body.u8((unsigned char)face.size());
+        for (uint32_t index : face) {
+            body.i32((int32_t)index);
+        }
+        body.endRecord();
+    }
+    return header + body.text;
+}
+
+static bool sameVertex(const VertexData& a, const VertexData& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z && a.nx == b.nx && a.ny == b.ny && a.nz == b.nz &&
+           a.r == b.r && a.g == b.g && a.b == b.b && a.u == b.u && a.v == b.v;
+}
+
+static bool matchesGrid(const std::vector<VertexData>& vertices) {
+    if (vertices.size() != GRID_WIDTH * GRID_HEIGHT) {
+        return false;
+    }
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        if (!sameVertex(vertices[i], gridVertex((unsigned int)i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// readPLYFile, the chunked decoder and A6's loadPLY on every body format
+static void testFormats() {
+    for (BodyFormat format : {BODY_ASCII, BODY_LITTLE_ENDIAN, BODY_BIG_ENDIAN}) {
+        std::string path = scratchPath(std::string("grid_") + formatName(format) + ".ply");
+        CHECK(writeFile(path, gridPLY(format)));
+
+        PLYChunkedReader reader(path);
+        CHECK(reader.getHeader().vertexCount() == GRID_WIDTH * GRID_HEIGHT);
+        CHECK(reader.elementCount("edge") == 2);
+        std::vector<VertexData> vertices;
+        std::vector<uint32_t> indices;
+        readPLYFile(reader, vertices, indices);
+        CHECK(matchesGrid(vertices));
+        CHECK(indices == gridTriangles());
+
+        // Chunks smaller than the vertex count, so the tail chunk is partly filled
+        std::vector<VertexData> chunked(GRID_WIDTH * GRID_HEIGHT);
+        std::vector<uint32_t> chunkedIndices;
+        size_t calls = 0;
+        reader.decode<VertexData>(vertexDataLayout(), 5, [&](const VertexData* chunk, size_t first, size_t count) {
+            std::copy(chunk, chunk + count, chunked.begin() + first);
+            ++calls;
+        }, [&](const uint32_t* polygon, uint32_t count) {
+            appendFanTriangles(chunkedIndices, polygon, count);
+        });
+        CHECK(calls == 3);
+        CHECK(matchesGrid(chunked));
+        CHECK(chunkedIndices == indices);
+        remove(path.c_str());
+
+        path = scratchPath(std::string("grid_pnuv_") + formatName(format) + ".ply");
+        CHECK(writeFile(path, gridPLYPositionNormalUV(format)));
+        std::vector<Vertex> a6Vertices;
+        FaceList faces;
+        loadPLY(path.c_str(), a6Vertices, faces, true);
+        bool same = a6Vertices.size() == GRID_WIDTH * GRID_HEIGHT;
+        for (size_t i = 0; same && i < a6Vertices.size(); ++i) {
+            VertexData expected = gridVertex((unsigned int)i);
+            const Vertex& v = a6Vertices[i];
+            same = v.x == expected.x && v.y == expected.y && v.z == expected.z && v.nx == expected.nx &&
+                   v.ny == expected.ny && v.nz == expected.nz && v.u == expected.u && v.v == expected.v;
+        }
+        CHECK(same);
+        CHECK(faces.indices == gridTriangles());
+        CHECK(faces.offsets.size() == gridFaces().size() + 1);
+        CHECK(faces.offsets.back() == faces.indices.size());
+        remove(path.c_str());
+    }
+}
+
+// Out of range face indices and truncated bodies are reported, not read past
+static void testDamagedFiles() {
+    for (BodyFormat format : {BODY_ASCII, BODY_LITTLE_ENDIAN, BODY_BIG_ENDIAN}) {
+        std::string path = scratchPath(std::string("bad_") + formatName(format) + ".ply");
+        CHECK(writeFile(path, gridPLY(format, (int32_t)(GRID_WIDTH * GRID_HEIGHT))));
+        bool threw = false;
+        try {
+            PLYChunkedReader reader(path);
+            std::vector<VertexData> vertices;
+            std::vector<uint32_t> indices;
+            readPLYFile(reader, vertices, indices);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+
+        std::string whole = gridPLY(format);
+        CHECK(writeFile(path, whole.substr(0, whole.size() - 30)));
+        threw = false;
+        try {
+            PLYChunkedReader reader(path);
+            std::vector<VertexData> vertices;
+            std::vector<uint32_t> indices;
+            readPLYFile(reader, vertices, indices);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+        remove(path.c_str());
+    }
+
+    std::string path = scratchPath("not_ply.ply");
+    CHECK(writeFile(path, std::string("mesh\nformat ascii 1.0\nend_header\n")));
+    bool threw = false;
+    try {
+        PLYChunkedReader reader(path);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    remove(path.c_str());
+}
+
+// An ASCII body large enough for the parallel decoder must read the same as the serial
+// chunked decoder, and a body the parallel decoder turns down (a blank line) as well
+static void testParallelASCII() {
+    const unsigned int VERTICES = 200000;
+    std::string body;
+    char line[160];
+    for (unsigned int i = 0; i < VERTICES; ++i) {
+        snprintf(line, sizeof(line), "%.9g %.9g %.9g 0 0 1 %.9g %.9g\n", i * 0.25f, (float)(i % 1000), -(float)i / 7.0f,
+                 (i % 256) / 256.0f, (i % 512) / 512.0f);
+        body += line;
+    }
+    for (unsigned int i = 0; i + 2 < VERTICES; i += 3) {
+        snprintf(line, sizeof(line), "3 %u %u %u\n", i, i + 1, i + 2);
+        body += line;
+    }
+    std::string header = "ply\nformat ascii 1.0\nelement vertex " + std::to_string(VERTICES) +
+                         "\nproperty float x\nproperty float y\nproperty float z\n"
+                         "property float nx\nproperty float ny\nproperty float nz\n"
+                         "property float u\nproperty float v\n"
+                         "element face " + std::to_string(VERTICES / 3) + "\nproperty list uchar int vertex_indices\nend_header\n";
+    CHECK(body.size() >= PLY_PARALLEL_MIN_BYTES);
+
+    std::string path = scratchPath("large_ascii.ply");
+    std::vector<Vertex> serial;
+    std::vector<uint32_t> serialIndices;
+    for (int variant = 0; variant < 2; ++variant) {
+        std::string text = header + body;
+        if (variant == 1) {
+            size_t middle = text.find('\n', header.size() + body.size() / 2);
+            text.insert(middle + 1, "\n");
+        }
+        CHECK(writeFile(path, text));
+
+        PLYVertexLayout layout = makePLYVertexLayout(sizeof(Vertex));
+        setPLYAttrib(layout, PLY_X, offsetof(Vertex, x));
+        setPLYAttrib(layout, PLY_Y, offsetof(Vertex, y));
+        setPLYAttrib(layout, PLY_Z, offsetof(Vertex, z));
+        setPLYAttrib(layout, PLY_NX, offsetof(Vertex, nx));
+        setPLYAttrib(layout, PLY_NY, offsetof(Vertex, ny));
+        setPLYAttrib(layout, PLY_NZ, offsetof(Vertex, nz));
+        setPLYAttrib(layout, PLY_U, offsetof(Vertex, u));
+        setPLYAttrib(layout, PLY_V, offsetof(Vertex, v));
+
+        if (variant == 0) {
+            PLYChunkedReader reader(path);
+            serial.resize(VERTICES);
+            reader.decode<Vertex>(layout, 4096, [&](const Vertex* chunk, size_t first, size_t count) {
+                std::copy(chunk, chunk + count, serial.begin() + first);
+            }, [&](const uint32_t* polygon, uint32_t count) {
+                appendFanTriangles(serialIndices, polygon, count);
+            });
+        }
+
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        readPLY(path, layout, vertices, [&](const uint32_t* polygon, uint32_t count) {
+            appendFanTriangles(indices, polygon, count);
+        });
+        CHECK(vertices.size() == serial.size());
+        CHECK(!vertices.empty() && memcmp(vertices.data(), serial.data(), vertices.size() * sizeof(Vertex)) == 0);
+        CHECK(indices == serialIndices);
+    }
+    remove(path.c_str());
+}
+
+// Cooked sidecars are used while their source is unchanged, survive a touch (and
+// refresh their stamp), and are turned down once the source's contents change
+static void testSidecarStaleness() {
+    std::string source = scratchPath("cooked.ply");
+    CHECK(writeFile(source, gridPLY(BODY_ASCII)));
+    CHECK(setModifiedTime(source, 1000000000));
+
+    std::vector<float> vertices;
+    for (unsigned int i = 0; i < GRID_WIDTH * GRID_HEIGHT; ++i) {
+        VertexData v = gridVertex(i);
+        vertices.insert(vertices.end(), {v.x, v.y, v.z, v.u, v.v});
+    }
+    std::vector<uint32_t> triangles = gridTriangles();
+    std::vector<uint16_t> indices(triangles.begin(), triangles.end());
+    MeshBuffers mesh;
+    mesh.vertexData = vertices.data();
+    mesh.vertexCount = GRID_WIDTH * GRID_HEIGHT;
+    mesh.vertexStride = 5 * sizeof(float);
+    mesh.indexData = indices.data();
+    mesh.indexCount = indices.size();
+    mesh.indexSize = sizeof(uint16_t);
+    const uint32_t TAG = 0x1234;
+
+    CHECK(writeMeshCache(source, TAG, mesh));
+    CHECK(writeMeshPack(source, TAG, mesh));
+    {
+        CookedMesh cooked;
+        CHECK(loadMeshCache(source, TAG, mesh.vertexStride, cooked));
+        CHECK(cooked.vertexCount == mesh.vertexCount && cooked.indexCount == mesh.indexCount);
+        CHECK(memcmp(cooked.vertexData, vertices.data(), vertices.size() * sizeof(float)) == 0);
+        CHECK(memcmp(cooked.indexData, indices.data(), indices.size() * sizeof(uint16_t)) == 0);
+        CookedMesh otherLayout;
+        CHECK(!loadMeshCache(source, TAG + 1, mesh.vertexStride, otherLayout));
+        CHECK(!loadMeshCache(source, TAG, mesh.vertexStride + 4, otherLayout));
+        MeshPack pack;
+        CHECK(openMeshPack(source, TAG, mesh.vertexStride, pack));
+        CHECK(pack.vertexCount == mesh.vertexCount && pack.indexCount == mesh.indexCount && pack.indexSize == 2);
+        MeshPack otherPack;
+        CHECK(!openMeshPack(source, TAG + 1, mesh.vertexStride, otherPack));
+    }
+
+    // Touched: same contents, new mtime. Both are kept, and their stamps take the new time.
+    CHECK(setModifiedTime(source, 1100000000));
+    {
+        CookedMesh cooked;
+        CHECK(loadMeshCache(source, TAG, mesh.vertexStride, cooked));
+        MeshPack pack;
+        CHECK(openMeshPack(source, TAG, mesh.vertexStride, pack));
+    }
+    {
+        MappedFile cache(meshCachePath(source));
+        MeshBinHeader header;
+        memcpy(&header, cache.data(), sizeof(header));
+        CHECK(header.sourceMtime == 1100000000);
+        MappedFile pack(meshPackPath(source));
+        MeshPackHeader packHeader;
+        memcpy(&packHeader, pack.data(), sizeof(packHeader));
+        CHECK(packHeader.sourceMtime == 1100000000);
+    }
+
+    // Edited in place to the same size: only the hash tells the difference
+    std::string edited = gridPLY(BODY_ASCII);
+    edited.replace(edited.find("test grid"), 9, "test GRID");
+    CHECK(writeFile(source, edited));
+    CHECK(setModifiedTime(source, 1200000000));
+    {
+        CookedMesh cooked;
+        CHECK(!loadMeshCache(source, TAG, mesh.vertexStride, cooked));
+        MeshPack pack;
+        CHECK(!openMeshPack(source, TAG, mesh.vertexStride, pack));
+    }
+
+    // A different size is stale without hashing; a .meshz shipped without its source still opens
+    CHECK(writeFile(source, edited + "\n"));
+    {
+        CookedMesh cooked;
+        CHECK(!loadMeshCache(source, TAG, mesh.vertexStride, cooked));
+    }
+    remove(source.c_str());
+    {
+        CookedMesh cooked;
+        CHECK(!loadMeshCache(source, TAG, mesh.vertexStride, cooked));
+        MeshPack pack;
+        CHECK(openMeshPack(source, TAG, mesh.vertexStride, pack));
+    }
+    remove(meshCachePath(source).c_str());
+    remove(meshPackPath(source).c_str());
+}
+
+int main() {
+    runTest("testFormats", testFormats);
+    runTest("testDamagedFiles", testDamagedFiles);
+    runTest("testParallelASCII", testParallelASCII);
+    runTest("testSidecarStaleness", testSidecarStaleness);
+    return finishTests("PLYTests");
+}
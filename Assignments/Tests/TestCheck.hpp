@@ -0,0 +1,95 @@
+// TestCheck.hpp the checks and scratch files the GL-free tests share
+#ifndef TESTCHECK_HPP
+#define TESTCHECK_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <utime.h>
+
+// Checks that fail are printed with their line and counted, and finishTests gives
+// the program a non-zero exit status if any did.
+#define CHECK(condition) checkThat((condition), #condition, __FILE__, __LINE__)
+
+inline int& failedChecks() {
+    static int count = 0;
+    return count;
+}
+
+inline bool checkThat(bool ok, const char* what, const char* file, int line) {
+    if (!ok) {
+        printf("%s:%d: check failed: %s\n", file, line, what);
+        ++failedChecks();
+    }
+    return ok;
+}
+
+// Runs one test function; an exception it lets out counts as a failed check
+template <typename Test>
+void runTest(const char* name, Test test) {
+    try {
+        test();
+    } catch (const std::exception& e) {
+        printf("%s threw: %s\n", name, e.what());
+        ++failedChecks();
+    }
+}
+
+// Prints the result of a test program and returns its exit status
+inline int finishTests(const char* name) {
+    if (failedChecks() > 0) {
+        printf("%s: %d checks failed\n", name, failedChecks());
+        return 1;
+    }
+    printf("%s: all checks passed\n", name);
+    return 0;
+}
+
+// Scratch files are written to the working directory under this prefix and
+// removed by the test that wrote them
+inline std::string scratchPath(const std::string& name) {
+    return "test_scratch_" + name;
+}
+
+inline bool writeFile(const std::string& path, const void* data, size_t size) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    bool ok = size == 0 || fwrite(data, 1, size, out) == size;
+    return fclose(out) == 0 && ok;
+}
+
+inline bool writeFile(const std::string& path, const std::string& contents) {
+    return writeFile(path, contents.data(), contents.size());
+}
+
+// Sets the access and modification times of path, as a fresh checkout or a touch would
+inline bool setModifiedTime(const std::string& path, time_t when) {
+    struct utimbuf times;
+    times.actime = when;
+    times.modtime = when;
+    return utime(path.c_str(), &times) == 0;
+}
+
+// Little-endian fields for hand-built binary files
+inline void put16(std::vector<unsigned char>& out, uint16_t value) {
+    out.push_back((unsigned char)value);
+    out.push_back((unsigned char)(value >> 8));
+}
+
+inline void put32(std::vector<unsigned char>& out, uint32_t value) {
+    put16(out, (uint16_t)value);
+    put16(out, (uint16_t)(value >> 16));
+}
+
+inline void put64(std::vector<unsigned char>& out, uint64_t value) {
+    put32(out, (uint32_t)value);
+    put32(out, (uint32_t)(value >> 32));
+}
+
+#endif
@@ -0,0 +1,366 @@
+// TextureTests.cpp checks the BC encoders against reference decoders and the KTX2 container round trip
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "TestCheck.hpp"
+#include "../Common/KTXTexture.hpp"
+
+// Reference decoders, written from the format specifications rather than from the
+// encoder's own palette code, so a shared mistake can't hide
+
+static uint32_t expand565(uint16_t color) {
+    int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+    return packRGBA(r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2, 255);
+}
+
+// BC1 colours of one block, in RGBA order as packRGBA packs them
+static void decodeBC1Block(const uint8_t* block, uint32_t* pixels) {
+    uint16_t c0 = (uint16_t)(block[0] | block[1] << 8), c1 = (uint16_t)(block[2] | block[3] << 8);
+    uint32_t palette[4] = {expand565(c0), expand565(c1), 0, 0};
+    int mix[2][3];
+    for (int c = 0; c < 3; ++c) {
+        int a = channelOf(palette[0], c), b = channelOf(palette[1], c);
+        mix[0][c] = c0 > c1 ? (2 * a + b) / 3 : (a + b) / 2;
+        mix[1][c] = c0 > c1 ? (a + 2 * b) / 3 : 0;
+    }
+    palette[2] = packRGBA(mix[0][0], mix[0][1], mix[0][2], 255);
+    palette[3] = packRGBA(mix[1][0], mix[1][1], mix[1][2], c0 > c1 ? 255 : 0);
+    for (int i = 0; i < 16; ++i) {
+        pixels[i] = palette[block[4 + i / 4] >> (2 * (i % 4)) & 3];
+    }
+}
+
+static void decodeBC4Block(const uint8_t* block, uint8_t* values) {
+    int a0 = block[0], a1 = block[1];
+    int palette[8] = {a0, a1};
+    for (int i = 1; i < 7; ++i) {
+        palette[i + 1] = a0 > a1 ? ((7 - i) * a0 + i * a1) / 7 : i < 5 ? ((5 - i) * a0 + i * a1) / 5 : 0;
+    }
+    if (a0 <= a1) {
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; ++i) {
+        bits |= (uint64_t)block[2 + i] << (8 * i);
+    }
+    for (int i = 0; i < 16; ++i) {
+        values[i] = (uint8_t)palette[bits >> (3 * i) & 7];
+    }
+}
+
+static uint32_t readBits(const uint8_t* block, int& position, int count) {
+    uint32_t value = 0;
+    for (int i = 0; i < count; ++i, ++position) {
+        value |= (uint32_t)(block[position >> 3] >> (position & 7) & 1) << i;
+    }
+    return value;
+}
+
+// BC7 mode 6, the only mode the encoder writes; false for any other mode
+static bool decodeBC7Block(const uint8_t* block, uint32_t* pixels) {
+    static const int WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    int position = 0;
+    if (readBits(block, position, 7) != 1 << 6) {
+        return false;
+    }
+    int endpoints[2][4];
+    for (int c = 0; c < 4; ++c) {
+        endpoints[0][c] = (int)readBits(block, position, 7) << 1;
+        endpoints[1][c] = (int)readBits(block, position, 7) << 1;
+    }
+    int p0 = (int)readBits(block, position, 1), p1 = (int)readBits(block, position, 1);
+    for (int c = 0; c < 4; ++c) {
+        endpoints[0][c] |= p0;
+        endpoints[1][c] |= p1;
+    }
+    for (int i = 0; i < 16; ++i) {
+        int w = WEIGHTS[readBits(block, position, i == 0 ? 3 : 4)];
+        int channel[4];
+        for (int c = 0; c < 4; ++c) {
+            channel[c] = (endpoints[0][c] * (64 - w) + endpoints[1][c] * w + 32) >> 6;
+        }
+        pixels[i] = packRGBA(channel[0], channel[1], channel[2], channel[3]);
+    }
+    return position == 128;
+}
+
+// An RGBA test image, rows bottom first, as compressLevel reads them
+struct TestImage {
+    unsigned int width, height;
+    std::vector<unsigned char> pixels;
+
+    const unsigned char* row(unsigned int y) const { return &pixels[(size_t)y * width * 4]; }
+};
+
+static TestImage makeImage(unsigned int width, unsigned int height, int kind) {
+    TestImage image = {width, height, std::vector<unsigned char>((size_t)width * height * 4)};
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            unsigned char* p = &image.pixels[((size_t)y * width + x) * 4];
+            if (kind == 0) {
+                // Smooth gradients on every channel, the common case for photos
+                p[0] = (unsigned char)(x * 3);
+                p[1] = (unsigned char)(y * 2);
+                p[2] = (unsigned char)(128 + 100 * sinf(x * 0.1f + y * 0.05f));
+                p[3] = (unsigned char)(255 - (x + y));
+            } else {
+                // Two colours per 4x4 block, which every format can hold nearly exactly
+                bool odd = ((x ^ y) & 1) != 0;
+                unsigned int block = (x / 4) * 31 + (y / 4) * 17;
+                p[0] = (unsigned char)(odd ? block * 7 : 255 - block * 3);
+                p[1] = (unsigned char)(odd ? 40 : 200);
+                p[2] = (unsigned char)(odd ? block * 11 : 30);
+                p[3] = (unsigned char)(odd ? 255 : 96);
+            }
+        }
+    }
+    return image;
+}
+
+// Root mean square error per channel in use, after decoding every block of the level
+static double blockError(const TestImage& image, BlockFormat format, BlockQuality quality) {
+    std::vector<uint8_t> blocks(compressedLevelSize(format, image.width, image.height));
+    compressLevel([&image](unsigned int y) { return image.row(y); }, image.width, image.height, 4, false, true, format,
+                  quality, blocks.data());
+
+    unsigned int blocksWide = (image.width + 3) / 4;
+    double squared = 0;
+    size_t samples = 0;
+    for (unsigned int y = 0; y < image.height; ++y) {
+        for (unsigned int x = 0; x < image.width; ++x) {
+            const uint8_t* block = &blocks[((size_t)(y / 4) * blocksWide + x / 4) * blockBytes(format)];
+            int i = (y % 4) * 4 + x % 4;
+            const unsigned char* source = image.row(y) + (size_t)x * 4;
+            int decoded[4] = {0, 0, 0, 0}, channels = 0;
+            uint32_t colors[16];
+            uint8_t values[16];
+            if (format == BLOCK_BC1 || format == BLOCK_BC3) {
+                decodeBC1Block(format == BLOCK_BC3 ? block + 8 : block, colors);
+                for (int c = 0; c < 3; ++c) {
+                    decoded[c] = channelOf(colors[i], c);
+                }
+                channels = 3;
+                if (format == BLOCK_BC3) {
+                    decodeBC4Block(block, values);
+                    decoded[3] = values[i];
+                    channels = 4;
+                }
+            } else if (format == BLOCK_BC5) {
+                decodeBC4Block(block, values);
+                decoded[0] = values[i];
+                decodeBC4Block(block + 8, values);
+                decoded[1] = values[i];
+                channels = 2;
+            } else {
+                if (!decodeBC7Block(block, colors)) {
+                    return 1e9;
+                }
+                for (int c = 0; c < 4; ++c) {
+                    decoded[c] = channelOf(colors[i], c);
+                }
+                channels = 4;
+            }
+            for (int c = 0; c < channels; ++c) {
+                double difference = decoded[c] - source[c];
+                squared += difference * difference;
+                ++samples;
+            }
+        }
+    }
+    return sqrt(squared / samples);
+}
+
+// Each format stays within the error its bit budget allows, on a gradient and on
+// two-colour blocks, at sizes that are and aren't whole blocks
+static void testBlockEncoders() {
+    const BlockFormat formats[] = {BLOCK_BC1, BLOCK_BC3, BLOCK_BC5, BLOCK_BC7};
+    const char* names[] = {"BC1", "BC3", "BC5", "BC7"};
+    // BC1 has 5:6:5 endpoints and four colours per block; the others interpolate 8-bit values
+    const double gradientLimit[] = {4.0, 3.5, 1.0, 2.0};
+    const double twoColourLimit[] = {3.0, 2.5, 0.5, 1.0};
+    for (int f = 0; f < 4; ++f) {
+        for (unsigned int size : {64u, 13u}) {
+            TestImage gradient = makeImage(size, size + 3, 0), twoColour = makeImage(size, size + 3, 1);
+            double fast = blockError(gradient, formats[f], BLOCK_QUALITY_FAST);
+            double high = blockError(gradient, formats[f], BLOCK_QUALITY_HIGH);
+            double sharp = blockError(twoColour, formats[f], BLOCK_QUALITY_NORMAL);
+            if (!CHECK(fast < gradientLimit[f] && high < gradientLimit[f] && sharp < twoColourLimit[f])) {
+                printf("  %s at %u: fast %.2f, high %.2f, two colours %.2f\n", names[f], size, fast, high, sharp);
+            }
+        }
+    }
+
+    // A solid block comes back exactly from BC4, to within the shared p-bit from BC7, and
+    // to 5:6:5 precision from BC1
+    uint32_t solid[16];
+    uint8_t values[16];
+    std::fill(solid, solid + 16, packRGBA(201, 77, 13, 140));
+    std::fill(values, values + 16, (uint8_t)77);
+    uint8_t block[16];
+    uint32_t decoded[16];
+    uint8_t decodedValues[16];
+    encodeBC7(solid, BLOCK_QUALITY_NORMAL, block);
+    bool close = decodeBC7Block(block, decoded);
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            close = close && abs(channelOf(decoded[i], c) - channelOf(solid[0], c)) <= 1;
+        }
+    }
+    CHECK(close);
+    encodeBC4(values, BLOCK_QUALITY_NORMAL, block);
+    decodeBC4Block(block, decodedValues);
+    CHECK(std::count(decodedValues, decodedValues + 16, (uint8_t)77) == 16);
+    encodeBC1(solid, BLOCK_QUALITY_NORMAL, block);
+    decodeBC1Block(block, decoded);
+    close = true;
+    for (int c = 0; c < 3; ++c) {
+        close = close && abs(channelOf(decoded[5], c) - channelOf(solid[0], c)) <= (c == 1 ? 2 : 4);
+    }
+    CHECK(close);
+}
+
+// A 24-bit bottom-up BMP of image's colour channels, in the BGR order BMP stores
+static std::string bmpFile(const TestImage& image) {
+    size_t rowBytes = ((size_t)image.width * 3 + 3) & ~(size_t)3;
+    std::vector<unsigned char> out;
+    out.push_back('B');
+    out.push_back('M');
+    put32(out, (uint32_t)(54 + rowBytes * image.height));
+    put32(out, 0);
+    put32(out, 54);
+    put32(out, 40);
+    put32(out, image.width);
+    put32(out, image.height);
+    put16(out, 1);
+    put16(out, 24);
+    put32(out, 0);
+    put32(out, (uint32_t)(rowBytes * image.height));
+    put32(out, 2835);
+    put32(out, 2835);
+    put32(out, 0);
+    put32(out, 0);
+    for (unsigned int y = 0; y < image.height; ++y) {
+        size_t start = out.size();
+        for (unsigned int x = 0; x < image.width; ++x) {
+            const unsigned char* p = image.row(y) + (size_t)x * 4;
+            out.push_back(p[2]);
+            out.push_back(p[1]);
+            out.push_back(p[0]);
+        }
+        out.resize(start + rowBytes, 0);
+    }
+    return std::string(out.begin(), out.end());
+}
+
+static bool sameLevels(const KTXTexture& a, const KTXTexture& b) {
+    if (a.vkFormat != b.vkFormat || a.width != b.width || a.height != b.height || a.levels.size() != b.levels.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.levels.size(); ++i) {
+        if (a.levels[i].width != b.levels[i].width || a.levels[i].height != b.levels[i].height ||
+            a.levels[i].size != b.levels[i].size || memcmp(a.levels[i].data, b.levels[i].data, a.levels[i].size) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Cooked containers map back level for level, are current for their source until it
+// changes, survive a touch, and damaged files are turned down
+static void testKTXRoundTrip() {
+    std::string source = scratchPath("texture.bmp");
+    TestImage pixels = makeImage(20, 12, 0);
+    CHECK(writeFile(source, bmpFile(pixels)));
+    CHECK(setModifiedTime(source, 1000000000));
+    BMPImage image;
+    CHECK(loadBMP(source, image) && image.channels == 3 && image.bgr);
+
+    const uint32_t formats[] = {ktxFindFormat(false, BLOCK_BC1, 3, true, true), ktxFindFormat(true, BLOCK_BC7, 0, false, true),
+                                ktxFindFormat(true, BLOCK_BC1, 0, false, true), KTX_BC5_UNORM};
+    for (uint32_t vkFormat : formats) {
+        KTXTexture cooked;
+        CHECK(cookTexture(source, image, vkFormat, BLOCK_QUALITY_FAST, MIP_FILTER_KAISER, cooked));
+        // 20 x 12 halves down to 1 x 1 in four steps
+        CHECK(cooked.levels.size() == 5);
+        CHECK(cooked.levels.back().width == 1 && cooked.levels.back().height == 1);
+        std::string path = cookedTexturePath(source);
+        CHECK(writeKTX(path, cooked));
+
+        KTXTexture loaded;
+        if (!CHECK(loadKTX(path, loaded))) {
+            continue;
+        }
+        CHECK(loaded.file != NULL);
+        CHECK(sameLevels(cooked, loaded));
+        CHECK(loaded.stamped && loaded.stamp.sourceMtime == 1000000000);
+        CHECK(cookedTextureCurrent(source, loaded));
+
+        MappedFile file(path);
+        KTX2Header header;
+        memcpy(&header, file.data(), sizeof(header));
+        CHECK(memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0);
+        CHECK(header.vkFormat == vkFormat && header.levelCount == 5 && header.supercompressionScheme == 0);
+    }
+
+    // The raw level 0 is the BMP's pixels, rows bottom first and without padding
+    KTXTexture raw;
+    CHECK(cookTexture(source, image, formats[0], BLOCK_QUALITY_FAST, MIP_FILTER_BOX, raw));
+    bool samePixels = raw.levels[0].size == (size_t)pixels.width * pixels.height * 3;
+    for (unsigned int y = 0; samePixels && y < pixels.height; ++y) {
+        for (unsigned int x = 0; x < pixels.width; ++x) {
+            const unsigned char* p = pixels.row(y) + (size_t)x * 4;
+            const unsigned char* q = raw.levels[0].data + ((size_t)y * pixels.width + x) * 3;
+            samePixels = samePixels && q[0] == p[2] && q[1] == p[1] && q[2] == p[0];
+        }
+    }
+    CHECK(samePixels);
+
+    // Touched, the container stays current and its stamp takes the new time
+    std::string path = cookedTexturePath(source);
+    CHECK(setModifiedTime(source, 1100000000));
+    {
+        KTXTexture loaded;
+        CHECK(loadKTX(path, loaded) && cookedTextureCurrent(source, loaded));
+    }
+    {
+        KTXTexture loaded;
+        CHECK(loadKTX(path, loaded) && loaded.stamp.sourceMtime == 1100000000);
+    }
+
+    // Edited to the same size, it is stale
+    pixels.pixels[100] ^= 0x40;
+    CHECK(writeFile(source, bmpFile(pixels)));
+    CHECK(setModifiedTime(source, 1200000000));
+    {
+        KTXTexture loaded;
+        CHECK(loadKTX(path, loaded) && !cookedTextureCurrent(source, loaded));
+    }
+
+    // Truncated or not KTX2 at all, it does not load
+    {
+        MappedFile whole(path);
+        std::string bytes(whole.data(), whole.size());
+        std::string damaged = scratchPath("damaged.ktx2");
+        CHECK(writeFile(damaged, bytes.substr(0, bytes.size() - 7)));
+        KTXTexture loaded;
+        CHECK(!loadKTX(damaged, loaded));
+        bytes[1] = 'X';
+        CHECK(writeFile(damaged, bytes));
+        CHECK(!loadKTX(damaged, loaded));
+        remove(damaged.c_str());
+    }
+    remove(path.c_str());
+    remove(source.c_str());
+}
+
+int main() {
+    runTest("testBlockEncoders", testBlockEncoders);
+    runTest("testKTXRoundTrip", testKTXRoundTrip);
+    return finishTests("TextureTests");
+}
@@ -0,0 +1,282 @@
+// ZipTests.cpp checks the zip and zip64 reader and the archive paths built on it
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "TestCheck.hpp"
+#include "../Common/ZipArchive.hpp"
+
+// A file to put in a hand-built archive
+struct TestEntry {
+    std::string name;
+    std::string contents;
+    uint16_t method; // 0 stored, 8 deflated
+};
+
+static std::string deflateRaw(const std::string& contents) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&stream, (uLong)contents.size()), '\0');
+    stream.next_in = (Bytef*)contents.data();
+    stream.avail_in = (uInt)contents.size();
+    stream.next_out = (Bytef*)&out[0];
+    stream.avail_out = (uInt)out.size();
+    deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+// Writes entries as a zip archive. With zip64 every size and offset in the central
+// directory is saturated and the real values go in zip64 extra fields and a zip64
+// end of central directory record, as archivers do for files over 4 GB.
+static std::vector<unsigned char> buildZip(const std::vector<TestEntry>& entries, bool zip64, const std::string& comment = "") {
+    std::vector<unsigned char> out, directory;
+    for (const TestEntry& entry : entries) {
+        std::string data = entry.method == 8 ? deflateRaw(entry.contents) : entry.contents;
+        uint32_t crc = (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef*)entry.contents.data(), (uInt)entry.contents.size());
+        uint64_t localOffset = out.size();
+
+        put32(out, 0x04034b50);
+        put16(out, 20);
+        put16(out, 0);
+        put16(out, entry.method);
+        put32(out, 0);
+        put32(out, crc);
+        put32(out, (uint32_t)data.size());
+        put32(out, (uint32_t)entry.contents.size());
+        put16(out, (uint16_t)entry.name.size());
+        put16(out, 0);
+        out.insert(out.end(), entry.name.begin(), entry.name.end());
+        out.insert(out.end(), data.begin(), data.end());
+
+        put32(directory, 0x02014b50);
+        put16(directory, zip64 ? 45 : 20);
+        put16(directory, zip64 ? 45 : 20);
+        put16(directory, 0);
+        put16(directory, entry.method);
+        put32(directory, 0);
+        put32(directory, crc);
+        put32(directory, zip64 ? 0xFFFFFFFF : (uint32_t)data.size());
+        put32(directory, zip64 ? 0xFFFFFFFF : (uint32_t)entry.contents.size());
+        put16(directory, (uint16_t)entry.name.size());
+        put16(directory, zip64 ? 28 : 0);
+        put16(directory, 0);
+        put16(directory, 0);
+        put16(directory, 0);
+        put32(directory, 0);
+        put32(directory, zip64 ? 0xFFFFFFFF : (uint32_t)localOffset);
+        directory.insert(directory.end(), entry.name.begin(), entry.name.end());
+        if (zip64) {
+            put16(directory, 0x0001);
+            put16(directory, 24);
+            put64(directory, entry.contents.size());
+            put64(directory, data.size());
+            put64(directory, localOffset);
+        }
+    }
+
+    uint64_t directoryOffset = out.size();
+    out.insert(out.end(), directory.begin(), directory.end());
+    if (zip64) {
+        uint64_t recordOffset = out.size();
+        put32(out, 0x06064b50);
+        put64(out, 44);
+        put16(out, 45);
+        put16(out, 45);
+        put32(out, 0);
+        put32(out, 0);
+        put64(out, entries.size());
+        put64(out, entries.size());
+        put64(out, directory.size());
+        put64(out, directoryOffset);
+        put32(out, 0x07064b50);
+        put32(out, 0);
+        put64(out, recordOffset);
+        put32(out, 1);
+    }
+    put32(out, 0x06054b50);
+    put16(out, 0);
+    put16(out, 0);
+    put16(out, zip64 ? 0xFFFF : (uint16_t)entries.size());
+    put16(out, zip64 ? 0xFFFF : (uint16_t)entries.size());
+    put32(out, zip64 ? 0xFFFFFFFF : (uint32_t)directory.size());
+    put32(out, zip64 ? 0xFFFFFFFF : (uint32_t)directoryOffset);
+    put16(out, (uint16_t)comment.size());
+    out.insert(out.end(), comment.begin(), comment.end());
+    return out;
+}
+
+static std::vector<TestEntry> testEntries() {
+    std::string repetitive, empty;
+    for (int i = 0; i < 5000; ++i) {
+        repetitive += "vertex " + std::to_string(i % 97) + "\n";
+    }
+    return {
+        {"readme.txt", "stored as is", 0},
+        {"assets/", "", 0},
+        {"assets/mesh.ply", repetitive, 8},
+        {"assets/empty.bin", empty, 0},
+        {"assets/deep/tiny.txt", "x", 8},
+    };
+}
+
+static bool sameContents(const std::vector<char>& read, const std::string& expected) {
+    return read.size() == expected.size() && std::string(read.begin(), read.end()) == expected;
+}
+
+// Every file reads back through both directory formats; directories are not listed
+static void testReadEntries() {
+    std::vector<TestEntry> entries = testEntries();
+    for (bool zip64 : {false, true}) {
+        std::string path = scratchPath(zip64 ? "entries64.zip" : "entries.zip");
+        std::vector<unsigned char> zip = buildZip(entries, zip64, "an archive comment");
+        CHECK(writeFile(path, zip.data(), zip.size()));
+
+        ZipArchive archive(path);
+        CHECK(archive.getEntries().size() == entries.size() - 1);
+        CHECK(archive.find("assets/") == NULL);
+        CHECK(archive.find("missing.txt") == NULL);
+        for (const TestEntry& entry : entries) {
+            if (entry.name.back() == '/') {
+                continue;
+            }
+            const ZipEntry* found = archive.find(entry.name);
+            if (!CHECK(found != NULL)) {
+                continue;
+            }
+            CHECK(found->method == entry.method);
+            CHECK(found->size == entry.contents.size());
+            std::vector<char> read;
+            archive.read(*found, read);
+            CHECK(sameContents(read, entry.contents));
+        }
+
+        std::vector<const ZipEntry*> wanted;
+        for (const ZipEntry& entry : archive.getEntries()) {
+            wanted.push_back(&entry);
+        }
+        std::vector<std::vector<char> > all;
+        archive.readAll(wanted, all);
+        bool allSame = all.size() == wanted.size();
+        for (size_t i = 0; allSame && i < all.size(); ++i) {
+            for (const TestEntry& entry : entries) {
+                if (entry.name == wanted[i]->name) {
+                    allSame = sameContents(all[i], entry.contents);
+                }
+            }
+        }
+        CHECK(allSame);
+        remove(path.c_str());
+    }
+}
+
+// Damaged archives and entries throw instead of returning bad data
+static void testDamagedArchives() {
+    std::vector<TestEntry> entries = testEntries();
+    std::string path = scratchPath("damaged.zip");
+    std::vector<unsigned char> zip = buildZip(entries, false);
+
+    // A flipped byte in the stored readme fails its CRC
+    std::vector<unsigned char> flipped = zip;
+    flipped[30 + strlen("readme.txt") + 2] ^= 1;
+    CHECK(writeFile(path, flipped.data(), flipped.size()));
+    {
+        ZipArchive archive(path);
+        bool threw = false;
+        try {
+            std::vector<char> read;
+            archive.read(*archive.find("readme.txt"), read);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+
+    // Cut short, the end of central directory record is gone
+    CHECK(writeFile(path, zip.data(), zip.size() - 10));
+    bool threw = false;
+    try {
+        ZipArchive archive(path);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // A central directory pointing past the end of the file
+    std::vector<unsigned char> pastEnd = zip;
+    size_t eocd = pastEnd.size() - 22;
+    pastEnd[eocd + 16] = 0xFF;
+    pastEnd[eocd + 17] = 0xFF;
+    CHECK(writeFile(path, pastEnd.data(), pastEnd.size()));
+    threw = false;
+    try {
+        ZipArchive archive(path);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    remove(path.c_str());
+}
+
+// Once enabled, MappedFile opens "archive.zip/entry" paths; a directory whose name
+// ends in .zip is still an ordinary directory
+static void testArchivePaths() {
+    std::vector<TestEntry> entries = testEntries();
+    std::string archivePath = scratchPath("paths.zip");
+    std::vector<unsigned char> zip = buildZip(entries, true);
+    CHECK(writeFile(archivePath, zip.data(), zip.size()));
+    enableArchivePaths();
+
+    std::string archive, entry;
+    CHECK(splitArchivePath(archivePath + "/assets/mesh.ply", archive, entry));
+    CHECK(archive == archivePath && entry == "assets/mesh.ply");
+    CHECK(!splitArchivePath(scratchPath("nothing.zip/assets/mesh.ply"), archive, entry));
+
+    MappedFile mesh(archivePath + "/assets/mesh.ply");
+    CHECK(mesh.size() == entries[2].contents.size() && memcmp(mesh.data(), entries[2].contents.data(), mesh.size()) == 0);
+    bool threw = false;
+    try {
+        MappedFile missing(archivePath + "/assets/missing.ply");
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    CHECK(statArchivePath(archivePath + "/assets/mesh.ply", size, mtime) && size == entries[2].contents.size());
+    uint32_t crc = 0;
+    CHECK(checksumArchivePath(archivePath + "/assets/mesh.ply", crc, size));
+    CHECK(crc == (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef*)entries[2].contents.data(), (uInt)size));
+
+    // Prefetched entries are handed to the MappedFile that asks for them
+    std::vector<std::string> paths = {archivePath + "/readme.txt", archivePath + "/assets/deep/tiny.txt"};
+    prefetchArchivePaths(paths);
+    MappedFile readme(paths[0]), tiny(paths[1]);
+    CHECK(std::string(readme.data(), readme.size()) == entries[0].contents);
+    CHECK(std::string(tiny.data(), tiny.size()) == entries[4].contents);
+
+    std::string directory = scratchPath("folder.zip");
+    CHECK(mkdir(directory.c_str(), 0755) == 0);
+    CHECK(writeFile(directory + "/plain.txt", std::string("not archived")));
+    MappedFile plain(directory + "/plain.txt");
+    CHECK(std::string(plain.data(), plain.size()) == "not archived");
+    remove((directory + "/plain.txt").c_str());
+    rmdir(directory.c_str());
+    remove(archivePath.c_str());
+}
+
+int main() {
+    runTest("testReadEntries", testReadEntries);
+    runTest("testDamagedArchives", testDamagedArchives);
+    runTest("testArchivePaths", testArchivePaths);
+    return finishTests("ZipTests");
+}
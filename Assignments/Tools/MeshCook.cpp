@@ -0,0 +1,73 @@
+// MeshCook.cpp partitions large PLY meshes into the spatial chunks the programs page in
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "../Assignment4/MeshData.hpp"
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--triangles N] mesh.ply...\n"
+            "Partitions each mesh into a .chunks directory beside it (beside the archive for\n"
+            "archive paths such as LinksHouse.zip/Floor.ply), about N triangles per chunk\n"
+            "(default %zu). The PLY is never held in memory whole.\n",
+            program, MESH_CHUNK_TRIANGLES);
+}
+
+int main(int argc, char** argv) {
+    size_t chunkTriangles = MESH_CHUNK_TRIANGLES;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (i + 1 < argc && option == "--triangles") {
+            chunkTriangles = (size_t)std::max(atol(argv[++i]), 1L);
+        } else if (option[0] != '-') {
+            paths.push_back(option);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (paths.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+    enableArchivePaths();
+
+    printf("%-40s %12s %8s %10s %10s %9s\n", "mesh", "vertices", "chunks", "source MB", "chunks MB", "ms");
+    int failures = 0;
+    for (const std::string& path : paths) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<MeshChunkInfo> chunks;
+        float boundingSphere[4];
+        size_t stride = chunkVertexLayout().stride;
+        size_t vertexCount = 0, sourceBytes = 0;
+        try {
+            PLYChunkedReader reader(path);
+            vertexCount = reader.elementCount("vertex");
+            sourceBytes = reader.getFile().size();
+            if (!partitionVertexData(path, reader, chunkTriangles) ||
+                !loadMeshChunks(path, CHUNK_LAYOUT_TAG, stride, chunks, boundingSphere)) {
+                fprintf(stderr, "Could not partition %s into %s\n", path.c_str(), meshChunksDirectory(path).c_str());
+                ++failures;
+                continue;
+            }
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            ++failures;
+            continue;
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        size_t chunkBytes = 0;
+        for (const MeshChunkInfo& chunk : chunks) {
+            chunkBytes += chunk.vertexCount * stride + chunk.indexCount * chunk.indexSize;
+        }
+        printf("%-40s %12zu %8zu %10.1f %10.1f %9.1f\n", path.c_str(), vertexCount, chunks.size(), sourceBytes / 1e6,
+               chunkBytes / 1e6, milliseconds);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+// TextureCook.cpp cooks BMP textures into KTX2 containers the programs load directly
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "../Common/KTXTexture.hpp"
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--format bc7|bc3|bc1|bc5|raw] [--quality fast|normal|high] [--filter kaiser|box] [--data] image.bmp...\n"
+            "Writes each image's full mip chain to a .ktx2 container beside it (beside the archive for\n"
+            "archive paths such as LinksHouse.zip/floor.bmp). --data marks images that hold\n"
+            "data rather than colour, such as height maps: they are filtered and tagged as linear.\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    std::string formatName = "bc7";
+    BlockQuality quality = BLOCK_QUALITY_NORMAL;
+    MipFilter filter = MIP_FILTER_KAISER;
+    bool data = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (i + 1 < argc && option == "--format") {
+            formatName = argv[++i];
+        } else if (i + 1 < argc && option == "--quality") {
+            std::string name = argv[++i];
+            quality = name == "fast" ? BLOCK_QUALITY_FAST : name == "high" ? BLOCK_QUALITY_HIGH : BLOCK_QUALITY_NORMAL;
+        } else if (i + 1 < argc && option == "--filter") {
+            filter = std::string(argv[++i]) == "box" ? MIP_FILTER_BOX : MIP_FILTER_KAISER;
+        } else if (option == "--data") {
+            data = true;
+        } else if (option[0] != '-') {
+            paths.push_back(option);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (paths.empty() || (formatName != "bc7" && formatName != "bc3" && formatName != "bc1" && formatName != "bc5" &&
+                          formatName != "raw")) {
+        usage(argv[0]);
+        return 2;
+    }
+    enableArchivePaths();
+
+    printf("%-40s %11s %6s %-8s %10s %10s %9s\n", "image", "size", "levels", "format", "source KB", "cooked KB", "ms");
+    int failures = 0;
+    for (const std::string& path : paths) {
+        auto start = std::chrono::steady_clock::now();
+        BMPImage image;
+        if (!loadBMP(path, image)) {
+            ++failures;
+            continue;
+        }
+        uint32_t vkFormat;
+        if (formatName == "raw") {
+            vkFormat = ktxFindFormat(false, BLOCK_BC1, image.channels, image.bgr, !data);
+        } else {
+            BlockFormat block = formatName == "bc1" ? BLOCK_BC1 : formatName == "bc3" ? BLOCK_BC3 : formatName == "bc5" ? BLOCK_BC5 : BLOCK_BC7;
+            vkFormat = ktxFindFormat(true, block, 0, false, !data);
+        }
+
+        KTXTexture texture;
+        std::string cookedPath = cookedTexturePath(path);
+        if (!cookTexture(path, image, vkFormat, quality, filter, texture) || !writeKTX(cookedPath, texture)) {
+            fprintf(stderr, "Could not cook %s into %s\n", path.c_str(), cookedPath.c_str());
+            ++failures;
+            continue;
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        size_t cookedBytes = 0;
+        for (const KTXLevel& level : texture.levels) {
+            cookedBytes += level.size;
+        }
+        std::string size = std::to_string(image.width) + "x" + std::to_string(image.height);
+        printf("%-40s %11s %6zu %-8s %10.1f %10.1f %9.1f\n", path.c_str(), size.c_str(), texture.levels.size(),
+               formatName.c_str(), image.file->size() / 1024.0, cookedBytes / 1024.0, milliseconds);
+    }
+    return failures == 0 ? 0 : 1;
+}